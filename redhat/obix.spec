@@ -15,6 +15,7 @@ Source0:        https://github.com/ONEDC/obix/archive/%{version}.tar.gz#/obix-%{
 BuildRequires:  fcgi-devel
 BuildRequires:  kernel-devel
 BuildRequires:  libxml2-devel
+BuildRequires:  zlib-devel
 BuildRequires:  cmake >= 2.6
 
 
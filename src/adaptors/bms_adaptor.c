@@ -2252,6 +2252,12 @@ static int bms_update_fdr(bms_sb_t *sb, const char *name,
 		return OBIX_ERR_NO_MEMORY;
 	}
 
+	/* Results of write commands are never checked */
+	if ((ret = obix_batch_set_readback(batch,
+									   OBIX_BATCH_READBACK_NONE)) < 0) {
+		goto failed;
+	}
+
 	sprintf(buf, FORMAT_FLOAT, kw);
 	ret = obix_batch_write_value(batch, history_name, KW, buf, OBIX_T_REAL);
 
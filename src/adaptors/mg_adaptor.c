@@ -1881,6 +1881,12 @@ static int obix_update_aux(mg_bcm_t *bcm)
 		return OBIX_ERR_NO_MEMORY;
 	}
 
+	/* Results of write commands are never checked */
+	if ((error = obix_batch_set_readback(batch,
+										 OBIX_BATCH_READBACK_NONE)) < 0) {
+		goto failed;
+	}
+
 	/* Add batch commands for float attributes */
 	for (i = 0; i < OBIX_BCM_ATTR_MAX; i++) {
 		sprintf(buf, "%f", bcm->attr[i]);
@@ -1936,6 +1942,12 @@ static int obix_update_aux_static(mg_bcm_t *bcm)
 		return OBIX_ERR_NO_MEMORY;
 	}
 
+	/* Results of write commands are never checked */
+	if ((error = obix_batch_set_readback(batch,
+										 OBIX_BATCH_READBACK_NONE)) < 0) {
+		goto failed;
+	}
+
 	sprintf(buf, "0x%x", bcm->sn);
 	error = obix_batch_write_value(batch, bcm->history_name,
 								   MG_BCM_SN, buf, OBIX_T_INT);
@@ -2009,6 +2021,12 @@ static int obix_update_bm_contract(mg_bm_t *bm)
 		return OBIX_ERR_NO_MEMORY;
 	}
 
+	/* Results of write commands are never checked */
+	if ((error = obix_batch_set_readback(batch,
+										 OBIX_BATCH_READBACK_NONE)) < 0) {
+		goto failed;
+	}
+
 	for (j = 0; j < OBIX_BM_ATTR_MAX; j++) {
 		sprintf(buf, "%f", bm->attr[j]);
 		error = obix_batch_write_value(batch, bm->history_name,
@@ -21,6 +21,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>		/* strncasecmp */
 #include <unistd.h>			/* sysconf */
 #include <errno.h>
 #include "log_utils.h"
@@ -41,10 +42,20 @@
 #define REQUEST_HTTP_POST 1
 
 static struct curl_slist* _header;
+static struct curl_slist* _binary_header;
 
 static const char *HTTP_CONTENT_LENGTH_HEADER =
 "Content-Length:";
 
+static const char *HTTP_CONTENT_TYPE_HEADER =
+"Content-Type:";
+
+static const char *HTTP_CONTENT_ENCODING_HEADER =
+"Content-Encoding:";
+
+/* The content encodings that oBIX server may apply to responses */
+static const char *HTTP_ACCEPT_ENCODING = "gzip";
+
 /*
  * Decide quantum size, which should be mulitple of system's page
  * size.
@@ -193,7 +204,8 @@ int curl_get_data(CURL_EXT *h, char **data, int *size)
 
 	*(h->inputBuffer + h->input_pos) = '\0';
 
-	if (strlen(h->inputBuffer) != h->input_pos) {
+	/* The binary encoding has NULL terminators of strings in it */
+	if (h->input_binary == 0 && strlen(h->inputBuffer) != h->input_pos) {
 		log_warning("CURL Handle inputBuffer strlen differs from input_pos!"
 					"%d vs %d", strlen(h->inputBuffer), h->input_pos);
 	}
@@ -243,17 +255,20 @@ int curl_save_data(CURL_EXT *h, int fd)
 }
 
 /*
- * Get the value of the Content-Length header, if it exists.
+ * Get the value of the Content-Length header, if it exists, whether
+ * the response is in the binary encoding according to the Content-Type
+ * header, and whether it has been compressed according to the
+ * Content-Encoding header.
  *
  * Note,
  * 1. Do not assume inputData passed in by libcurl is NULL
  * terminated, therefore a separate memory buffer would have
  * to be used.
  */
-static size_t get_cl(char *inputData,
-					 size_t size,
-					 size_t nmemb,
-					 void *arg)
+static size_t get_headers(char *inputData,
+						  size_t size,
+						  size_t nmemb,
+						  void *arg)
 {
 	char *buf, *s, *endptr;
 	CURL_EXT *h = (CURL_EXT *)arg;
@@ -267,6 +282,18 @@ static size_t get_cl(char *inputData,
 	memcpy(buf, inputData, dsize);
 	buf[dsize] = '\0';
 
+	if (strncasecmp(buf, HTTP_CONTENT_TYPE_HEADER,
+					strlen(HTTP_CONTENT_TYPE_HEADER)) == 0) {
+		h->input_binary = (strstr(buf, XML_BINARY_MIME) != NULL) ? 1 : 0;
+		goto out;
+	}
+
+	if (strncasecmp(buf, HTTP_CONTENT_ENCODING_HEADER,
+					strlen(HTTP_CONTENT_ENCODING_HEADER)) == 0) {
+		h->input_encoded = 1;
+		goto out;
+	}
+
 	/* Ignore other HTTP header than Content-Length */
 	if (!(s = strstr(buf, HTTP_CONTENT_LENGTH_HEADER)))
 		goto out;
@@ -427,7 +454,7 @@ static size_t outputReader(char *outputData,
 		bytesToSend = size;
 	}
 
-	memcpy(outputData, (handle->outputBuffer + handle->outputPos),
+	memcpy(outputData, (handle->outputData + handle->outputPos),
 		   bytesToSend);
 
 	handle->outputPos += bytesToSend;
@@ -453,6 +480,8 @@ void curl_ext_free(CURL_EXT *h)
 		free(h->inputBuffer);
 	}
 
+	xml_binary_dispose(&h->bin);
+
 	qset_trim(h);
 
 	free(h);
@@ -483,9 +512,15 @@ static CURL_EXT *curl_ext_allocateMemory(int bulky, int timeout, int nosignal)
 
 	handle->curl = NULL;
 	handle->outputBuffer = NULL;
+	handle->outputData = NULL;
 	handle->outputPos = 0;
 	handle->outputSize = 0;
 
+	handle->binary = 0;
+	handle->input_binary = 0;
+	handle->input_encoded = 0;
+	xml_binary_init(&handle->bin);
+
 	INIT_LIST_HEAD(&handle->data);
 	handle->input_pos = 0;
 	handle->quantum = quantum_size(bulky);
@@ -499,7 +534,7 @@ static CURL_EXT *curl_ext_allocateMemory(int bulky, int timeout, int nosignal)
 
 	handle->write = inputWriter;
 	handle->read = outputReader;
-	handle->header = get_cl;
+	handle->header = get_headers;
 
 	log_debug("Bulky is %s, quantum size: %d, qset_t size: %d, timeout: %d",
 			  bulky, handle->quantum, handle->qset_size, handle->timeout);
@@ -519,6 +554,12 @@ int curl_ext_init(void)
 	_header = curl_slist_append(_header, "Content-Type: text/xml");
 	_header = curl_slist_append(_header, "Expect:");
 
+	_binary_header = curl_slist_append(_binary_header,
+									   "Content-Type: " XML_BINARY_MIME);
+	_binary_header = curl_slist_append(_binary_header,
+									   "Accept: " XML_BINARY_MIME);
+	_binary_header = curl_slist_append(_binary_header, "Expect:");
+
 	return 0;
 }
 
@@ -527,6 +568,8 @@ void curl_ext_dispose()
 	curl_global_cleanup();
 	curl_slist_free_all(_header);
 	_header = NULL;
+	curl_slist_free_all(_binary_header);
+	_binary_header = NULL;
 }
 
 int curl_ext_create(CURL_EXT **handle, const int bulky,
@@ -620,6 +663,18 @@ int curl_ext_create(CURL_EXT **handle, const int bulky,
 		goto failed;
 	}
 
+	/*
+	 * Have libcurl send the Accept-Encoding header and decompress
+	 * responses compressed by oBIX server before they are passed
+	 * to the write callback
+	 */
+	if ((code = curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING,
+								 HTTP_ACCEPT_ENCODING)) != CURLE_OK) {
+		log_error("Unable to initialize CURL handle: Failed to set "
+				  "accepted encodings (%d).", code);
+		goto failed;
+	}
+
 	h->curl = curl;
 	*handle = h;
 
@@ -632,6 +687,81 @@ failed:
 	return -1;
 }
 
+/*
+ * Switch the given handle between XML and the compact binary encoding
+ * for both requests and responses
+ *
+ * Return 0 on success, -1 on error
+ */
+int curl_ext_set_binary(CURL_EXT *h, const int binary)
+{
+	CURLcode code;
+
+	if (!h || !h->curl) {
+		log_error("Illegal parameter provided");
+		return -1;
+	}
+
+	if ((code = curl_easy_setopt(h->curl, CURLOPT_HTTPHEADER,
+								 (binary == 1) ? _binary_header :
+												 _header)) != CURLE_OK) {
+		log_error("Failed to set custom header (%d).", code);
+		return -1;
+	}
+
+	h->binary = binary;
+
+	return 0;
+}
+
+/*
+ * Setup the data to be sent from the outputBuffer, which is encoded
+ * in the binary encoding if enabled
+ *
+ * Return 0 on success, -1 on error
+ */
+static int prepareOutput(CURL_EXT *h)
+{
+	xmlDoc *doc;
+	int ret;
+
+	h->outputPos = 0;
+	h->outputData = h->outputBuffer;
+
+	if (!h->outputBuffer) {
+		h->outputSize = 0;
+		return 0;
+	}
+
+	h->outputSize = strlen(h->outputBuffer);
+
+	if (h->binary == 0) {
+		return 0;
+	}
+
+	if (!(doc = xmlReadMemory(h->outputBuffer, h->outputSize, NULL, NULL,
+							  XML_PARSE_OPTIONS_COMMON))) {
+		log_error("Request body is not an XML document:\n%s",
+				  h->outputBuffer);
+		return -1;
+	}
+
+	xml_binary_reset(&h->bin);
+
+	ret = xml_binary_encode(&h->bin, xmlDocGetRootElement(doc));
+	xmlFreeDoc(doc);
+
+	if (ret < 0) {
+		log_error("Failed to encode request body in binary encoding");
+		return -1;
+	}
+
+	h->outputData = h->bin.data;
+	h->outputSize = h->bin.len;
+
+	return 0;
+}
+
 /**
  * Helper function which performs actual HTTP request
  * assumes that type of request was already set by a caller.
@@ -651,6 +781,8 @@ static int sendRequest(CURL_EXT* handle, const char* uri)
 	 * the new requests.
 	 */
 	handle->cl = handle->input_pos = 0;
+	handle->input_binary = 0;
+	handle->input_encoded = 0;
 
 	code = curl_easy_perform(handle->curl);
 
@@ -664,9 +796,11 @@ static int sendRequest(CURL_EXT* handle, const char* uri)
 	/*
 	 * Not care about the amount of data received if no
 	 * Content-Length header available or failed to get
-	 * its value for whatever reason.
+	 * its value for whatever reason, or the response has
+	 * been decompressed.
 	 */
-	if (handle->cl > 0 && handle->cl != handle->input_pos) {
+	if (handle->input_encoded == 0 &&
+		handle->cl > 0 && handle->cl != handle->input_pos) {
 		log_error("HTTP Content-Length header: %ld whereas %ld bytes received",
 					handle->cl, handle->input_pos);
 		return -1;
@@ -708,12 +842,14 @@ int curl_ext_put(CURL_EXT* handle, const char* uri)
 		return -1;
 	}
 
-	handle->outputPos = 0;
 	if (handle->outputBuffer == NULL) {
 		log_error("Trying to perform PUT request with empty body.");
 		return -1;
 	}
-	handle->outputSize = strlen(handle->outputBuffer);
+
+	if (prepareOutput(handle) < 0) {
+		return -1;
+	}
 
 	if ((code = curl_easy_setopt(handle->curl, CURLOPT_INFILESIZE,
 								 handle->outputSize)) != CURLE_OK) {
@@ -746,12 +882,8 @@ int curl_ext_post(CURL_EXT *handle, const char *uri)
 		return -1;
 	}
 
-	handle->outputPos = 0;
-
-	if (!handle->outputBuffer) {
-		handle->outputSize = 0;
-	} else {
-		handle->outputSize = strlen(handle->outputBuffer);
+	if (prepareOutput(handle) < 0) {
+		return -1;
 	}
 
 	if ((code = curl_easy_setopt(handle->curl, CURLOPT_POSTFIELDSIZE,
@@ -764,6 +896,32 @@ int curl_ext_post(CURL_EXT *handle, const char *uri)
 	return sendRequest(handle, uri);
 }
 
+/*
+ * Turn the received response in the binary encoding into a document
+ *
+ * Return 0 on success, -1 on error
+ */
+static int parseBinaryInput(const char *data, int size, xmlDoc **doc)
+{
+	xmlNode *node;
+
+	if (!(node = xml_binary_decode(data, size))) {
+		log_error("Server response of %d bytes is not a valid binary "
+				  "encoded object", size);
+		return -1;
+	}
+
+	if (!(*doc = xmlNewDoc(BAD_CAST XML_VERSION))) {
+		log_error("Failed to allocate a document for server response");
+		xmlFreeNode(node);
+		return -1;
+	}
+
+	xmlDocSetRootElement(*doc, node);
+
+	return 0;
+}
+
 /**
  * Helper function for parsing received response at input buffer of provided
  * handle.
@@ -786,6 +944,10 @@ static int parseXmlInput(CURL_EXT *h, xmlDoc **doc)
 		return -1;
 	}
 
+	if (h->input_binary == 1) {
+		return parseBinaryInput(data, size, doc);
+	}
+
 	if (!(*doc = xmlReadMemory(data, size, NULL, NULL,
 							   XML_PARSE_OPTIONS_COMMON))) {
 		log_error("Server response is not an XML document:\n%s",
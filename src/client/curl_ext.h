@@ -25,6 +25,7 @@
 #include <libxml/tree.h>
 #include <curl/curl.h>
 #include "list.h"
+#include "xml_binary.h"
 
 /*
  * A set of quantums that store scattered chunk of data received by libcurl.
@@ -96,6 +97,12 @@ typedef struct
 	/* Buffer for storing sending data.*/
 	const char *outputBuffer;
 
+	/*
+	 * The data actually sent, either the outputBuffer or its
+	 * encoding in the binary buffer below
+	 */
+	const char *outputData;
+
 	/* size of output data */
 	int outputSize;
 
@@ -129,6 +136,31 @@ typedef struct
 	 * Callback to receive HTTP headers
 	 */
 	curl_cb_t header;
+
+	/*
+	 * Raised to send requests and accept responses in the compact
+	 * binary encoding instead of XML, see xml_binary.h. The XML
+	 * documents in the outputBuffer are encoded into the binary
+	 * buffer before sent
+	 */
+	int binary;
+	xml_binary_t bin;
+
+	/*
+	 * Raised if the response of the current request is actually in
+	 * the binary encoding, as indicated by its Content-Type header,
+	 * since oBIX server sends some responses such as history query
+	 * results in XML regardless
+	 */
+	int input_binary;
+
+	/*
+	 * Raised if the response of the current request has been compressed
+	 * by gzip, as indicated by its Content-Encoding header, in which case
+	 * libcurl decodes it on the fly and the Content-Length header, if
+	 * any, no longer matches the amount of data received
+	 */
+	int input_encoded;
 } CURL_EXT;
 
 int curl_ext_init(void);
@@ -136,6 +168,7 @@ void curl_ext_dispose(void);
 
 int curl_ext_create(CURL_EXT **, const int, const int, const int);
 void curl_ext_free(CURL_EXT *);
+int curl_ext_set_binary(CURL_EXT *, const int);
 
 int curl_ext_get(CURL_EXT *, const char *);
 int curl_ext_put(CURL_EXT *, const char *);
@@ -945,6 +945,31 @@ Batch *obix_batch_create(const int conn_id)
 	return batch;
 }
 
+/*
+ * Specify the responses expected for successful write commands in
+ * the given batch object, one of "full", "compact" or "none". The
+ * latter is preferred by applications which never check results of
+ * their write commands, so as to save the oBIX server from reading
+ * back the written nodes
+ */
+int obix_batch_set_readback(Batch *batch, const char *readback)
+{
+	xmlNode *root;
+
+	if (!batch->in || !(root = xmlDocGetRootElement(batch->in))) {
+		log_error("Illegal batchIn document for batch object on Connection %d",
+				  batch->conn->id);
+		return OBIX_ERR_INVALID_STATE;
+	}
+
+	if (!xmlSetProp(root, BAD_CAST OBIX_BATCH_ATTR_READBACK,
+					BAD_CAST readback)) {
+		return OBIX_ERR_NO_MEMORY;
+	}
+
+	return OBIX_SUCCESS;
+}
+
 int obix_batch_remove_command(Batch *batch, const char *name, const char *param)
 {
 	Connection *conn = batch->conn;
@@ -349,6 +349,7 @@ int obix_batch_write_value(Batch *, const char *, const char *, const char *, OB
 int obix_batch_get_result(Batch *, const char *, xmlNode **);
 int obix_batch_send(CURL_EXT *, Batch *);
 int obix_batch_remove_command(Batch *, const char *, const char *);
+int obix_batch_set_readback(Batch *, const char *);
 
 int obix_get_history(CURL_EXT *, const int, const char *);
 int obix_get_history_ts(CURL_EXT *, const int, const char *, char **, char **);
@@ -295,7 +295,13 @@ int http_setup_connection(xmlNode *node, Connection *conn)
 		goto failed;
 	}
 
-	if (curl_ext_create(&hc->handle, hc->bulky, hc->timeout, hc->nosignal) < 0) {
+	/* Optional, XML is used by default */
+	if ((hc->binary = xml_get_child_long(node, CT_CURL_BINARY, NULL)) < 0) {
+		hc->binary = 0;
+	}
+
+	if (curl_ext_create(&hc->handle, hc->bulky, hc->timeout, hc->nosignal) < 0 ||
+		(hc->binary == 1 && curl_ext_set_binary(hc->handle, 1) < 0)) {
 		log_error("Failed to setup CURL handle for connection %d", conn->id);
 		goto failed;
 	}
@@ -979,7 +985,10 @@ static int _http_create_watch(Device *dev)
 	 * but blocking to receive notifications from the oBIX server
 	 */
 	if (curl_ext_create(&hd->watch_handle, 0, 0, 1) < 0 ||
-		curl_ext_create(&hd->poll_handle, 0, 0, 1) < 0) {
+		curl_ext_create(&hd->poll_handle, 0, 0, 1) < 0 ||
+		(hc->binary == 1 &&
+		 (curl_ext_set_binary(hd->watch_handle, 1) < 0 ||
+		  curl_ext_set_binary(hd->poll_handle, 1) < 0))) {
 		log_error("Failed to setup watch CURL handles for device %s",
 				  dev->name);
 		goto failed;
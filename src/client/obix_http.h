@@ -47,6 +47,9 @@ typedef struct
 	int bulky;
 	int nosignal;
 
+	/* Whether to talk with the oBIX server in the binary encoding */
+	int binary;
+
 	/* Polling intervals, and attributes for the long-poll intervals */
 	long poll_int;
 	long poll_min;
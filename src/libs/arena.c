@@ -0,0 +1,126 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ROUND_UP(n)	(((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/*
+ * Initialise an arena with the given initial buffer, which should be
+ * aligned by ARENA_ALIGN and can be NULL, and the minimal size of the
+ * chunks to allocate once it is used up
+ */
+void arena_init(arena_t *arena, void *buf, size_t size, size_t chunk_size)
+{
+	arena->buf = arena->pos = (char *)buf;
+	arena->size = (buf) ? size : 0;
+	arena->end = arena->pos + arena->size;
+	arena->chunks = NULL;
+	arena->chunk_size = chunk_size;
+}
+
+/*
+ * Release all blocks ever allocated from the arena in one go, and
+ * release all chunks so that the arena can be reused from scratch
+ */
+void arena_reset(arena_t *arena)
+{
+	arena_chunk_t *chunk;
+
+	while ((chunk = arena->chunks) != NULL) {
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+
+	arena->pos = arena->buf;
+	arena->end = arena->buf + arena->size;
+}
+
+/*
+ * Allocate a block of the given size from the arena
+ *
+ * Return its address on success, NULL on failure
+ */
+void *arena_alloc(arena_t *arena, size_t size)
+{
+	arena_chunk_t *chunk;
+	char *pos;
+	size_t len;
+
+	size = ARENA_ROUND_UP((size > 0) ? size : 1);
+
+	pos = (char *)ARENA_ROUND_UP((uintptr_t)arena->pos);
+
+	if (!arena->pos || pos > arena->end || (size_t)(arena->end - pos) < size) {
+		len = (size > arena->chunk_size) ? size : arena->chunk_size;
+
+		if (!(chunk = (arena_chunk_t *)malloc(sizeof(arena_chunk_t) + len))) {
+			return NULL;
+		}
+
+		chunk->next = arena->chunks;
+		chunk->size = len;
+		arena->chunks = chunk;
+
+		pos = chunk->data;
+		arena->end = pos + len;
+	}
+
+	arena->pos = pos + size;
+
+	return pos;
+}
+
+/*
+ * Return 1 if the given address belongs to a block allocated from the
+ * arena, 0 otherwise
+ */
+int arena_owns(const arena_t *arena, const void *ptr)
+{
+	const char *p = (const char *)ptr;
+	arena_chunk_t *chunk;
+
+	if (arena->buf && p >= arena->buf && p < arena->buf + arena->size) {
+		return 1;
+	}
+
+	for (chunk = arena->chunks; chunk; chunk = chunk->next) {
+		if (p >= chunk->data && p < chunk->data + chunk->size) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+char *arena_strdup(arena_t *arena, const char *str)
+{
+	char *copy;
+	size_t len = strlen(str) + 1;
+
+	if ((copy = (char *)arena_alloc(arena, len)) != NULL) {
+		memcpy(copy, str, len);
+	}
+
+	return copy;
+}
@@ -0,0 +1,71 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+/*
+ * A region allocator for short-lived memory blocks which are released
+ * all together, such as those needed by an oBIX request until it has
+ * been answered. Blocks are carved out of an initial buffer provided by
+ * the user, and then out of chunks allocated on demand, so that a small
+ * region takes no malloc() at all and a large one takes only a few.
+ *
+ * Blocks can't be released individually. An arena is not thread safe
+ * and should be used by one thread at a time.
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+/* All blocks are aligned as malloc() does */
+#define ARENA_ALIGN			(2 * sizeof(void *))
+
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+
+	/* The size of the data area */
+	size_t size;
+
+	/* Keep the data area aligned */
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+} arena_chunk_t;
+
+typedef struct arena {
+	/* The free space of the buffer or chunk in use */
+	char *pos, *end;
+
+	/* The initial buffer provided by the user and its size */
+	char *buf;
+	size_t size;
+
+	/* Chunks allocated, the latest one first */
+	arena_chunk_t *chunks;
+
+	/* The minimal size of chunks */
+	size_t chunk_size;
+} arena_t;
+
+void arena_init(arena_t *arena, void *buf, size_t size, size_t chunk_size);
+void arena_reset(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+char *arena_strdup(arena_t *arena, const char *str);
+int arena_owns(const arena_t *arena, const void *ptr);
+
+#endif
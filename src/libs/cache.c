@@ -20,213 +20,345 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include "xml_utils.h"
 #include "cache.h"
 
 /*
- * NOTE: to make the most sense, the size of the cache should be
- * less than the average length of "conflict queues" of the accompanied
- * hash table
+ * Calculate the hash value of the given href, also return its
+ * length without the trailing slash
  *
- * Therefore the more number of structures recorded in the hash
- * table, the longer the conflict queues, the larger the cache
+ * The FNV-1a algorithm is adopted so that both the shard and the
+ * set could be decided by different bits of the same hash value
+ */
+static unsigned int cache_hash(const unsigned char *href, int *len)
+{
+	unsigned int hash = 2166136261U;
+	int i, n = strlen((const char *)href);
+
+	if (n > 0 && href[n - 1] == '/') {
+		n--;
+	}
+
+	for (i = 0; i < n; i++) {
+		hash ^= href[i];
+		hash *= 16777619U;
+	}
+
+	*len = n;
+	return hash;
+}
+
+static cache_shard_t *cache_get_shard(cache_t *c, unsigned int hash)
+{
+	return &c->shards[hash % CACHE_SHARDS];
+}
+
+static int cache_get_set(cache_t *c, unsigned int hash)
+{
+	return (hash / CACHE_SHARDS) % c->sets;
+}
+
+static int __cache_is_valid(const cache_item_t *slot, unsigned long gen)
+{
+	return (slot->item && slot->gen == gen) ? 1 : 0;
+}
+
+static int __cache_is_matched(const cache_item_t *slot, const unsigned char *href,
+							  int len, unsigned int hash)
+{
+	return (slot->hash == hash && slot->len == len &&
+			memcmp(slot->href, href, len) == 0) ? 1 : 0;
+}
+
+/*
+ * The size of the cache is rounded up to a multiple of the number of
+ * slots in a set of every shard
  */
 cache_t *cache_init(const int len)
 {
 	cache_t *cache = NULL;
+	cache_shard_t *shard;
+	int i;
 
 	if (len <= 0) {
 		return NULL;
 	}
 
-	if (!(cache = (cache_t *)malloc(sizeof(cache_t))) ||
-		!(cache->items = (cache_item_t *)malloc(sizeof(cache_item_t) * len))) {
-		goto failed;
+	if (!(cache = (cache_t *)malloc(sizeof(cache_t)))) {
+		return NULL;
 	}
-	memset(cache->items, 0, sizeof(cache_item_t) * len);
+	memset(cache, 0, sizeof(cache_t));
 
-	cache->len = len;
-	pthread_mutex_init(&cache->mutex, NULL);
+	cache->sets = (len + CACHE_SHARDS * CACHE_WAYS - 1) /
+				  (CACHE_SHARDS * CACHE_WAYS);
 
-#ifdef DEBUG
-	cache->hit = cache->miss = 0;
-#endif
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+
+		if (!(shard->items = (cache_item_t *)calloc(cache->sets * CACHE_WAYS,
+													sizeof(cache_item_t))) ||
+			!(shard->hands = (unsigned char *)calloc(cache->sets, 1))) {
+			goto failed;
+		}
+
+		pthread_mutex_init(&shard->mutex, NULL);
+	}
 
 	return cache;
 
 failed:
-	if (cache) {
-		free(cache);
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+
+		if (shard->items) {
+			free(shard->items);
+		}
+
+		if (shard->hands) {
+			free(shard->hands);
+		}
 	}
 
+	free(cache);
 	return NULL;
 }
 
-static void __cache_dispose_slot(cache_t *c, int i)
-{
-	/* Sanity checks on arguments already done by internal callers */
-	c->items[i].href = c->items[i].item = NULL;
-}
-
 void cache_dispose(cache_t *c)
 {
+	cache_shard_t *shard;
 	int i;
 
 	if (!c) {
 		return;
 	}
 
-	pthread_mutex_lock(&c->mutex);
-	for (i = 0; i < c->len; i++) {
-		__cache_dispose_slot(c, i);
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		shard = &c->shards[i];
+
+		pthread_mutex_destroy(&shard->mutex);
+		free(shard->items);
+		free(shard->hands);
 	}
-	pthread_mutex_unlock(&c->mutex);
 
-	pthread_mutex_destroy(&c->mutex);
-	free(c->items);
 	free(c);
 }
 
+long cache_get_hit(cache_t *c)
+{
+	long hit = 0;
+	int i;
+
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		pthread_mutex_lock(&c->shards[i].mutex);
+		hit += c->shards[i].hit;
+		pthread_mutex_unlock(&c->shards[i].mutex);
+	}
+
+	return hit;
+}
+
+long cache_get_miss(cache_t *c)
+{
+	long miss = 0;
+	int i;
+
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		pthread_mutex_lock(&c->shards[i].mutex);
+		miss += c->shards[i].miss;
+		pthread_mutex_unlock(&c->shards[i].mutex);
+	}
+
+	return miss;
+}
+
+int cache_get_size(cache_t *c)
+{
+	return CACHE_SHARDS * c->sets * CACHE_WAYS;
+}
+
 /*
- * Make room for the latest search result by shuffling existing
- * cache slots forward/downard by one offset thus getting rid of
- * the recently least accessed one
+ * Get the current generation of the cache, which should be read
+ * before searching for the item that is going to be cached
+ */
+unsigned long cache_get_gen(cache_t *c)
+{
+	return __atomic_load_n(&c->gen, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Fill a slot in relevant set with the latest search result, an empty
+ * or stale slot is preferred, otherwise the first slot not referenced
+ * since the CLOCK hand passed it last time is replaced
  *
- * NOTE: since "cache_search + hash_search + cache_update" are
- * not in an atomic manner, multi-thread may add duplicate entries
- * into the cache. However, it would be too costy to fully prevent
- * this by checking the entire cache for potential duplicate before
- * pushing in a new one, especially considering that such scenario
- * is very rare
+ * The gen parameter is the generation read before the search on the
+ * underlying data structure, if the cache has been flushed since then
+ * the result may have become stale and is simply discarded
  *
- * NOTE: given that the cache slot won't duplicate href strings, the
- * href passed in must have the same life cycle as the item parameter
+ * NOTE: the href is copied into the slot, therefore it could be any
+ * href hosted by the item, not necessarily the item's own href
  */
-static void __cache_update(cache_t *c, const unsigned char *href,
-						   const void *item)
+void cache_update(cache_t *c, const unsigned char *href, const void *item,
+				  unsigned long gen)
 {
-	int loc;
+	cache_shard_t *shard;
+	cache_item_t *set, *slot = NULL;
+	unsigned char *hand;
+	unsigned int hash;
+	int len, i, n;
 
-	/* Try to minimise duplicate but not traverse the entire cache */
-	if (is_str_identical(c->items[0].href, href, 1) == 1) {
-		pthread_mutex_unlock(&c->mutex);
+	if (!c || !href || !item) {
 		return;
 	}
 
-	loc = c->len - 1;	/* the last slot */
+	hash = cache_hash(href, &len);
+	if (len >= CACHE_HREF_MAX) {
+		return;
+	}
+
+	shard = cache_get_shard(c, hash);
+	n = cache_get_set(c, hash);
+	set = shard->items + n * CACHE_WAYS;
+	hand = shard->hands + n;
+
+	pthread_mutex_lock(&shard->mutex);
 
-	while (loc > 0) {
-		c->items[loc].href = c->items[loc - 1].href;
-		c->items[loc].item = c->items[loc - 1].item;
-		loc--;
+	if (gen != cache_get_gen(c)) {
+		goto out;
 	}
 
-	c->items[0].href = href;
-	c->items[0].item = item;
-}
+	for (i = 0; i < CACHE_WAYS; i++) {
+		if (__cache_is_valid(set + i, gen) == 0) {
+			if (!slot) {
+				slot = set + i;
+			}
+		} else if (__cache_is_matched(set + i, href, len, hash) == 1) {
+			/* Already cached by another thread */
+			slot = set + i;
+			break;
+		}
+	}
 
-void cache_update(cache_t *c, const unsigned char *href, const void *item)
-{
-	if (!c || !href || !item) {
-		return;
+	while (!slot) {
+		if (set[*hand].ref == 1) {
+			set[*hand].ref = 0;
+		} else {
+			slot = set + *hand;
+		}
+
+		*hand = (*hand + 1) % CACHE_WAYS;
 	}
 
-	pthread_mutex_lock(&c->mutex);
-	__cache_update(c, href, item);
-	pthread_mutex_unlock(&c->mutex);
+	memcpy(slot->href, href, len);
+	slot->href[len] = '\0';
+	slot->len = len;
+	slot->hash = hash;
+	slot->item = item;
+	slot->gen = gen;
+	slot->ref = 1;
+
+out:
+	pthread_mutex_unlock(&shard->mutex);
 }
 
 const void *cache_search(cache_t *c, const unsigned char *href,
 						 void (*get)(void *))
 {
-	const void *item;
-	int i;
+	cache_shard_t *shard;
+	cache_item_t *set;
+	const void *item = NULL;
+	unsigned long gen;
+	unsigned int hash;
+	int len, i;
 
 	if (!c || !href) {
 		return NULL;
 	}
 
-	pthread_mutex_lock(&c->mutex);
+	hash = cache_hash(href, &len);
+	shard = cache_get_shard(c, hash);
+	set = shard->items + cache_get_set(c, hash) * CACHE_WAYS;
 
-	for (i = 0; i < c->len; i++) {
-		if (!(item = c->items[i].item) || !c->items[i].href) {
-			/*
-			 * Keep searching the rest of cache instead of break
-			 * since the current reference may have been nullified
-			 *
-			 * NOTE: since the entire cache is iterated, the cache
-			 * size must remain small when oBIX clients are quickly
-			 * accessing different URIs, as a result, the locality
-			 * principle won't work
-			 */
-			continue;
-		}
+	pthread_mutex_lock(&shard->mutex);
 
-		if (is_str_identical(c->items[i].href, href, 1) == 1) {
-#ifdef DEBUG
-			c->hit++;
-#endif
-			/*
-			 * NOTE: invoke cache_update to ensure the recently most
-			 * accessed on always on top, although this will incur
-			 * duplication in the cache
-			 */
-			if (i > 0) {
-				__cache_update(c, c->items[i].href, c->items[i].item);
-			}
+	gen = cache_get_gen(c);
+
+	for (i = 0; i < CACHE_WAYS; i++) {
+		if (__cache_is_valid(set + i, gen) == 1 &&
+			__cache_is_matched(set + i, href, len, hash) == 1) {
+			set[i].ref = 1;
+			item = set[i].item;
 
 			/*
 			 * Atomically increase the reference count for relevant
 			 * structure before returning its address
 			 */
 			get((void *)item);
-
-			pthread_mutex_unlock(&c->mutex);
-			return item;
+			break;
 		}
 	}
 
-#ifdef DEBUG
-	c->miss++;
-#endif
-	pthread_mutex_unlock(&c->mutex);
-	return NULL;
+	if (item) {
+		shard->hit++;
+	} else {
+		shard->miss++;
+	}
+
+	pthread_mutex_unlock(&shard->mutex);
+	return item;
 }
 
+/*
+ * Invalidate the given href and any hrefs prefixed with it, which
+ * has to traverse the entire cache
+ */
 void cache_invalidate(cache_t *c, const unsigned char *href)
 {
-	const void *item;
-	int i, len;
+	cache_shard_t *shard;
+	cache_item_t *slot;
+	int len, i, j;
 
 	if (!c || !href) {
 		return;
 	}
 
-	len = strlen((const char *)href);
-	if (href[len - 1] == '/') {
-		len--;
-	}
+	cache_hash(href, &len);
 
-	pthread_mutex_lock(&c->mutex);
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		shard = &c->shards[i];
 
-	for (i = 0; i < c->len; i++) {
-		if (!(item = c->items[i].item) || !c->items[i].href) {
-			continue;
-		}
+		pthread_mutex_lock(&shard->mutex);
 
-		/*
-		 * NOTE: the entire cache should be traversed due to duplicated slots
-		 *
-		 * Note: although the oBIX server can help ensure the device won't be
-		 * deleted if it has any children, for sake of consisitency any hrefs
-		 * in the cache that are prefixed with that of the deleted device need
-		 * to be invalidated as well
-		 */
-		if (strncmp((const char *)c->items[i].href, (const char *)href,
-					len) == 0) {
-			__cache_dispose_slot(c, i);
+		for (j = 0; j < c->sets * CACHE_WAYS; j++) {
+			slot = shard->items + j;
+
+			if (slot->item && slot->len >= len &&
+				memcmp(slot->href, href, len) == 0) {
+				slot->item = NULL;
+			}
 		}
+
+		pthread_mutex_unlock(&shard->mutex);
 	}
+}
+
+/*
+ * Invalidate the entire cache by starting a new generation
+ *
+ * Once returned, no thread would ever get an item from previous
+ * generations, since any search in progress has been waited for
+ * by grabbing the lock of each shard
+ */
+void cache_flush(cache_t *c)
+{
+	int i;
 
-	pthread_mutex_unlock(&c->mutex);
+	if (!c) {
+		return;
+	}
+
+	__atomic_add_fetch(&c->gen, 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		pthread_mutex_lock(&c->shards[i].mutex);
+		pthread_mutex_unlock(&c->shards[i].mutex);
+	}
 }
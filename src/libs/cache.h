@@ -21,6 +21,12 @@
 /*
  * Cache to take advantage of the "locality principle" when finding a core
  * data structure with a specified href.
+ *
+ * The cache is split into a number of shards, each protected by its own
+ * lock, and every shard is organised as a set-associative array so that
+ * one href can only reside in one small set of slots. A probe therefore
+ * takes constant time regardless of the cache size, and a victim in the
+ * set is chosen by the CLOCK algorithm when the set is full.
  */
 
 #ifndef _CACHE_H
@@ -28,41 +34,73 @@
 
 #include <pthread.h>
 
+/* The number of shards, each of which has its own lock */
+#define CACHE_SHARDS		16
+
+/* The number of slots in one set */
+#define CACHE_WAYS			4
+
+/* The maximal length of hrefs to be cached */
+#define CACHE_HREF_MAX		128
+
 typedef struct cache_item {
 	/* reference to a data structure */
 	const void *item;
 
 	/*
-	 * reference to the data structure's unique absolute href
-	 *
-	 * NOTE: for sake of performance and efficiency, strings
-	 * shouldn't be copied
+	 * a copy of the href, without the trailing slash, so that it
+	 * could be any href hosted by the data structure
 	 */
-	const unsigned char *href;
+	unsigned char href[CACHE_HREF_MAX];
+	int len;
+
+	/* the hash value of the href */
+	unsigned int hash;
+
+	/* the generation of the cache when the slot is filled */
+	unsigned long gen;
+
+	/* the "referenced" bit of the CLOCK algorithm */
+	int ref;
 } cache_item_t;
 
-typedef struct cache {
-	/* cache slots */
+typedef struct cache_shard {
+	/* cache slots, CACHE_WAYS per set */
 	cache_item_t *items;
 
-	/* cache size */
-	int len;
+	/* the CLOCK hand of each set */
+	unsigned char *hands;
 
-#ifdef DEBUG
 	/* statistics variables */
 	long hit, miss;
-#endif
 
-	/* lock to protect the whole structure */
+	/* lock to protect the shard */
 	pthread_mutex_t mutex;
+} cache_shard_t;
+
+typedef struct cache {
+	cache_shard_t shards[CACHE_SHARDS];
+
+	/* the number of sets in each shard */
+	int sets;
+
+	/*
+	 * the current generation of the cache, slots filled in previous
+	 * generations are regarded as empty
+	 */
+	unsigned long gen;
 } cache_t;
 
 long cache_get_hit(cache_t *c);
 long cache_get_miss(cache_t *c);
+int cache_get_size(cache_t *c);
 cache_t *cache_init(const int len);
 void cache_dispose(cache_t *c);
-void cache_update(cache_t *c, const unsigned char *href, const void *item);
+unsigned long cache_get_gen(cache_t *c);
+void cache_update(cache_t *c, const unsigned char *href, const void *item,
+				  unsigned long gen);
 const void *cache_search(cache_t *c, const unsigned char *href, void (*get)(void *));
 void cache_invalidate(cache_t *c, const unsigned char *href);
+void cache_flush(cache_t *c);
 
 #endif
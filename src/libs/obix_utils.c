@@ -48,6 +48,9 @@ const char *OBIX_ATTR_NULL = "null";
 const char *OBIX_ATTR_DISPLAY = "display";
 const char *OBIX_ATTR_DISPLAY_NAME = "displayName";
 const char *OBIX_ATTR_HIDDEN = "hidden";
+const char *OBIX_ATTR_STATUS = "status";
+
+const char *OBIX_STATUS_OK = "ok";
 
 const char *OBIX_META_ATTR_OP = "op";
 const char *OBIX_META_ATTR_WATCH_ID = "watch_id";
@@ -82,6 +85,17 @@ const char *OBIX_CONTRACT_HIST_FILE_ABS = "obix:HistoryFileAbstract";
 const char *OBIX_CONTRACT_HIST_AIN = "obix:HistoryAppendIn";
 const char *OBIX_CONTRACT_HIST_FLT = "obix:HistoryFilter";
 const char *OBIX_CONTRACT_BATCH_IN = "obix:BatchIn";
+
+/*
+ * The optional attribute of a batchIn contract deciding the response
+ * to each successful write in it, which is a full copy of the written
+ * node, a compact object with only its href and new value, or a bare
+ * status object
+ */
+const char *OBIX_BATCH_ATTR_READBACK = "readback";
+const char *OBIX_BATCH_READBACK_FULL = "full";
+const char *OBIX_BATCH_READBACK_COMPACT = "compact";
+const char *OBIX_BATCH_READBACK_NONE = "none";
 const char *OBIX_CONTRACT_WATCH_IN = "obix:WatchIn";
 
 const char *OBIX_RELTIME_ZERO = "PT0S";
@@ -162,11 +176,19 @@ int str_token_count_helper(const char *tok, void *arg1, void *arg2)
 int for_each_str_token(const char *delimiter, const char *str,
 					   token_cb_t cb, void *arg1, void *arg2)
 {
+	char buf[STR_TOKEN_BUF_SIZE];
 	char *copy;
 	char *tok, *saveptr;
+	size_t len = strlen(str) + 1;
 	int ret = -1;
 
-	if (!(copy = strdup(str))) {
+	/*
+	 * Strings such as hrefs are mostly short enough to be tokenised
+	 * in a buffer on the stack without any malloc()
+	 */
+	if (len <= STR_TOKEN_BUF_SIZE) {
+		copy = memcpy(buf, str, len);
+	} else if (!(copy = strdup(str))) {
 		log_error("Failed to duplicate string %s", str);
 		return -1;
 	}
@@ -180,7 +202,10 @@ int for_each_str_token(const char *delimiter, const char *str,
 		} while ((tok = strtok_r(NULL, delimiter, &saveptr)) != NULL);
 	}
 
-	free(copy);
+	if (copy != buf) {
+		free(copy);
+	}
+
 	return ret;
 }
 
@@ -81,6 +81,9 @@ extern const char *OBIX_ATTR_NULL;
 extern const char *OBIX_ATTR_DISPLAY;
 extern const char *OBIX_ATTR_DISPLAY_NAME;
 extern const char *OBIX_ATTR_HIDDEN;
+extern const char *OBIX_ATTR_STATUS;
+
+extern const char *OBIX_STATUS_OK;
 
 extern const char *OBIX_META_ATTR_OP;
 extern const char *OBIX_META_ATTR_WATCH_ID;
@@ -96,6 +99,10 @@ extern const char *OBIX_CONTRACT_HIST_AIN;
 extern const char *OBIX_CONTRACT_HIST_FLT;
 extern const char *OBIX_CONTRACT_HIST_FILE_ABS;
 extern const char *OBIX_CONTRACT_BATCH_IN;
+extern const char *OBIX_BATCH_ATTR_READBACK;
+extern const char *OBIX_BATCH_READBACK_FULL;
+extern const char *OBIX_BATCH_READBACK_COMPACT;
+extern const char *OBIX_BATCH_READBACK_NONE;
 extern const char *OBIX_CONTRACT_WATCH_IN;
 
 extern const char *HIST_OP_APPEND;
@@ -175,6 +182,9 @@ int for_each_file_name(const char *dir, const char *prefix,
 int slash_preceded(const char *s);
 int slash_followed(const char *s);
 
+/* Strings no longer than this are tokenised without malloc() */
+#define STR_TOKEN_BUF_SIZE		256
+
 typedef int (*token_cb_t)(const char *token, void *arg1, void *arg2);
 
 int for_each_str_token(const char *delimiter, const char *str,
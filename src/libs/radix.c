@@ -0,0 +1,394 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "radix.h"
+
+/* The initial capacity of the children array of a node */
+#define RADIX_CHILDREN_MIN		4
+
+/*
+ * Get the next segment from the given href and have the href
+ * pointer moved over it
+ *
+ * Return the start of the segment with its length returned in
+ * the len parameter, or NULL if no more segment
+ */
+static const char *radix_next_seg(const char **href, int *len)
+{
+	const char *p = *href, *seg;
+
+	while (*p == '/') {
+		p++;
+	}
+
+	if (*p == '\0') {
+		*href = p;
+		return NULL;
+	}
+
+	for (seg = p; *p != '\0' && *p != '/'; p++);	/* do nothing */
+
+	*len = p - seg;
+	*href = p;
+
+	return seg;
+}
+
+static int radix_compare_seg(const radix_node_t *node, const char *seg, int len)
+{
+	int ret;
+
+	if ((ret = strncmp(node->seg, seg, len)) != 0) {
+		return ret;
+	}
+
+	return (node->seg[len] == '\0') ? 0 : 1;
+}
+
+/*
+ * Search for the child with the given segment by binary search
+ *
+ * Return its index in the children array if found, otherwise the
+ * negative of (the index where it should be inserted + 1)
+ */
+static int radix_find_child(const radix_node_t *node, const char *seg, int len)
+{
+	int low = 0, high = node->count - 1, mid, ret;
+
+	while (low <= high) {
+		mid = (low + high) / 2;
+
+		if ((ret = radix_compare_seg(node->children[mid], seg, len)) == 0) {
+			return mid;
+		}
+
+		if (ret < 0) {
+			low = mid + 1;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	return -(low + 1);
+}
+
+/*
+ * Create a child with the given segment at the specified position
+ * of the children array of the parent node
+ */
+static radix_node_t *radix_add_child(radix_node_t *parent, int pos,
+									 const char *seg, int len)
+{
+	radix_node_t *node, **children;
+	int size;
+
+	if (parent->count == parent->size) {
+		size = (parent->size == 0) ? RADIX_CHILDREN_MIN : parent->size * 2;
+		if (!(children = (radix_node_t **)realloc(parent->children,
+											sizeof(radix_node_t *) * size))) {
+			return NULL;
+		}
+
+		parent->children = children;
+		parent->size = size;
+	}
+
+	if (!(node = (radix_node_t *)malloc(sizeof(radix_node_t)))) {
+		return NULL;
+	}
+	memset(node, 0, sizeof(radix_node_t));
+
+	if (!(node->seg = strndup(seg, len))) {
+		free(node);
+		return NULL;
+	}
+
+	node->parent = parent;
+
+	memmove(parent->children + pos + 1, parent->children + pos,
+			sizeof(radix_node_t *) * (parent->count - pos));
+	parent->children[pos] = node;
+	parent->count++;
+
+	return node;
+}
+
+/*
+ * Release the given node along with its entire subtree
+ */
+static void radix_free_node(radix_node_t *node)
+{
+	int i;
+
+	for (i = 0; i < node->count; i++) {
+		radix_free_node(node->children[i]);
+	}
+
+	if (node->children) {
+		free(node->children);
+	}
+
+	if (node->seg) {
+		free(node->seg);
+		free(node);		/* the root is embedded in the tree */
+	}
+}
+
+/*
+ * Remove the given node from its parent and release it, then
+ * move upward to release any ancestor that becomes useless
+ */
+static void radix_prune(radix_node_t *node)
+{
+	radix_node_t *parent;
+	int pos;
+
+	while ((parent = node->parent) != NULL &&
+		   !node->item && node->count == 0) {
+		pos = radix_find_child(parent, node->seg, strlen(node->seg));
+
+		memmove(parent->children + pos, parent->children + pos + 1,
+				sizeof(radix_node_t *) * (parent->count - pos - 1));
+		parent->count--;
+
+		radix_free_node(node);
+		node = parent;
+	}
+}
+
+radix_tree_t *radix_init(void (*get)(void *))
+{
+	radix_tree_t *tree;
+
+	if (!get) {
+		return NULL;
+	}
+
+	if (!(tree = (radix_tree_t *)malloc(sizeof(radix_tree_t)))) {
+		return NULL;
+	}
+	memset(tree, 0, sizeof(radix_tree_t));
+
+	tree->get = get;
+	tsync_init(&tree->sync);
+
+	return tree;
+}
+
+void radix_dispose(radix_tree_t *tree)
+{
+	if (!tree) {
+		return;
+	}
+
+	if (tsync_shutdown_entry(&tree->sync) == 0) {
+		radix_free_node(&tree->root);
+		tsync_cleanup(&tree->sync);
+	}
+
+	free(tree);
+}
+
+/*
+ * Register an item at the given href
+ *
+ * Return 0 on success, < 0 for error code
+ */
+int radix_add(radix_tree_t *tree, const unsigned char *href, const void *item)
+{
+	radix_node_t *node;
+	const char *p = (const char *)href, *seg;
+	int len, pos, ret = 0;
+
+	if (!tree || !href || !item) {
+		return -1;
+	}
+
+	if (tsync_writer_entry(&tree->sync) < 0) {
+		return -1;
+	}
+
+	node = &tree->root;
+
+	while ((seg = radix_next_seg(&p, &len)) != NULL) {
+		if ((pos = radix_find_child(node, seg, len)) >= 0) {
+			node = node->children[pos];
+		} else if (!(node = radix_add_child(node, -pos - 1, seg, len))) {
+			ret = -1;
+			goto out;
+		}
+	}
+
+	if (!node->item) {
+		node->item = item;
+		tree->count++;
+	} else if (node->item != item) {
+		ret = -1;		/* occupied by another item */
+	}
+
+	/* Already added, return success */
+
+out:
+	tsync_writer_exit(&tree->sync);
+	return ret;
+}
+
+void radix_del(radix_tree_t *tree, const unsigned char *href)
+{
+	radix_node_t *node;
+	const char *p = (const char *)href, *seg;
+	int len, pos;
+
+	if (!tree || !href) {
+		return;
+	}
+
+	if (tsync_writer_entry(&tree->sync) < 0) {
+		return;
+	}
+
+	node = &tree->root;
+
+	while ((seg = radix_next_seg(&p, &len)) != NULL) {
+		if ((pos = radix_find_child(node, seg, len)) < 0) {
+			goto out;	/* not registered */
+		}
+
+		node = node->children[pos];
+	}
+
+	if (node->item) {
+		node->item = NULL;
+		tree->count--;
+		radix_prune(node);
+	}
+
+out:
+	tsync_writer_exit(&tree->sync);
+}
+
+/*
+ * Search for the item registered at the given href or its closest
+ * ancestor, as specified by the how parameter, in one single walk
+ *
+ * NOTE: The reference count of the item is increased before
+ * returned so as to synchronise with deletion threads
+ */
+void *radix_match(radix_tree_t *tree, const unsigned char *href,
+				  radix_match_t how)
+{
+	radix_node_t *node;
+	const void *last, *prev = NULL, *item = NULL;
+	const char *p = (const char *)href, *seg;
+	int len, pos, full = 1;
+
+	if (!tree || !href) {
+		return NULL;
+	}
+
+	if (tsync_reader_entry(&tree->sync) < 0) {
+		return NULL;
+	}
+
+	node = &tree->root;
+	last = node->item;
+
+	while ((seg = radix_next_seg(&p, &len)) != NULL) {
+		if ((pos = radix_find_child(node, seg, len)) < 0) {
+			full = 0;
+			break;
+		}
+
+		node = node->children[pos];
+
+		if (node->item) {
+			prev = last;
+			last = node->item;
+		}
+	}
+
+	switch (how) {
+	case RADIX_MATCH_EXACT:
+		item = (full == 1) ? node->item : NULL;
+		break;
+	case RADIX_MATCH_LONGEST:
+		item = last;
+		break;
+	case RADIX_MATCH_PARENT:
+		item = (full == 1 && node->item) ? prev : last;
+		break;
+	}
+
+	if (item) {
+		tree->get((void *)item);
+	}
+
+	tsync_reader_exit(&tree->sync);
+
+	return (void *)item;
+}
+
+static int radix_for_each_helper(radix_node_t *node, radix_item_cb_t cb,
+								 void *arg)
+{
+	int i;
+
+	if (node->item && cb(node->item, arg) < 0) {
+		return -1;
+	}
+
+	for (i = 0; i < node->count; i++) {
+		if (radix_for_each_helper(node->children[i], cb, arg) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Apply the given callback on each registered item, parents before
+ * children, until the callback returns < 0
+ *
+ * NOTE: the callback is invoked within the "read region" of the tree
+ * and must not manipulate the tree at all
+ *
+ * Return 0 on success, < 0 if the traversal is terminated
+ */
+int radix_for_each(radix_tree_t *tree, radix_item_cb_t cb, void *arg)
+{
+	int ret;
+
+	if (!tree || !cb) {
+		return -1;
+	}
+
+	if (tsync_reader_entry(&tree->sync) < 0) {
+		return -1;
+	}
+
+	ret = radix_for_each_helper(&tree->root, cb, arg);
+
+	tsync_reader_exit(&tree->sync);
+
+	return ret;
+}
@@ -0,0 +1,82 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+/*
+ * A prefix tree keyed by the slash-separated segments of hrefs, so that
+ * the data structure registered at a href, or at its closest ancestor,
+ * can be found by one single walk from the root.
+ *
+ * Like hrefs compared in lenient mode, leading, trailing and repeated
+ * slashes are insignificant.
+ */
+
+#ifndef _RADIX_H
+#define _RADIX_H
+
+#include "tsync.h"
+
+typedef struct radix_node {
+	/* The segment of href represented by this node, NULL for the root */
+	char *seg;
+
+	/* Reference to the data structure registered, or NULL */
+	const void *item;
+
+	/* Children nodes sorted by their segments for binary search */
+	struct radix_node **children;
+
+	/* The number of children and the capacity of the children array */
+	int count, size;
+
+	struct radix_node *parent;
+} radix_node_t;
+
+typedef enum {
+	RADIX_MATCH_EXACT = 0,		/* registered at the given href */
+	RADIX_MATCH_LONGEST = 1,	/* at the given href or its closest ancestor */
+	RADIX_MATCH_PARENT = 2		/* at the closest ancestor of the given href */
+} radix_match_t;
+
+typedef struct radix_tree {
+	radix_node_t root;
+
+	/* The number of data structures registered */
+	int count;
+
+	/*
+	 * Increase the reference count of relevant hosting structure before
+	 * returning its pointer to users
+	 */
+	void (*get)(void *);
+
+	tsync_t sync;
+} radix_tree_t;
+
+typedef int (*radix_item_cb_t)(const void *item, void *arg);
+
+radix_tree_t *radix_init(void (*get)(void *));
+void radix_dispose(radix_tree_t *tree);
+int radix_add(radix_tree_t *tree, const unsigned char *href, const void *item);
+void radix_del(radix_tree_t *tree, const unsigned char *href);
+void *radix_match(radix_tree_t *tree, const unsigned char *href,
+				  radix_match_t how);
+int radix_for_each(radix_tree_t *tree, radix_item_cb_t cb, void *arg);
+
+#endif
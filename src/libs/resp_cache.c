@@ -0,0 +1,266 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "resp_cache.h"
+
+/*
+ * Calculate the FNV-1a hash value of the given href and flags,
+ * also return the length of the href
+ */
+static unsigned int resp_cache_hash(const unsigned char *href, int flags,
+									int *len)
+{
+	unsigned int hash = 2166136261U;
+	int i, n = strlen((const char *)href);
+
+	for (i = 0; i < n; i++) {
+		hash ^= href[i];
+		hash *= 16777619U;
+	}
+
+	hash ^= (unsigned int)flags;
+	hash *= 16777619U;
+
+	*len = n;
+	return hash;
+}
+
+static resp_cache_shard_t *resp_cache_get_shard(resp_cache_t *c,
+												unsigned int hash)
+{
+	return &c->shards[hash % RESP_CACHE_SHARDS];
+}
+
+static resp_cache_item_t *resp_cache_get_slot(resp_cache_t *c,
+											  resp_cache_shard_t *shard,
+											  unsigned int hash)
+{
+	return &shard->items[(hash / RESP_CACHE_SHARDS) % c->slots];
+}
+
+/*
+ * The size of the cache is rounded up to a multiple of the number
+ * of shards
+ */
+resp_cache_t *resp_cache_init(const int len)
+{
+	resp_cache_t *cache;
+	int i;
+
+	if (len <= 0) {
+		return NULL;
+	}
+
+	if (!(cache = (resp_cache_t *)malloc(sizeof(resp_cache_t)))) {
+		return NULL;
+	}
+	memset(cache, 0, sizeof(resp_cache_t));
+
+	cache->slots = (len + RESP_CACHE_SHARDS - 1) / RESP_CACHE_SHARDS;
+
+	for (i = 0; i < RESP_CACHE_SHARDS; i++) {
+		if (!(cache->shards[i].items =
+				(resp_cache_item_t *)calloc(cache->slots,
+											sizeof(resp_cache_item_t)))) {
+			goto failed;
+		}
+
+		pthread_mutex_init(&cache->shards[i].mutex, NULL);
+	}
+
+	return cache;
+
+failed:
+	for (i = 0; i < RESP_CACHE_SHARDS; i++) {
+		if (cache->shards[i].items) {
+			free(cache->shards[i].items);
+		}
+	}
+
+	free(cache);
+	return NULL;
+}
+
+void resp_cache_dispose(resp_cache_t *c)
+{
+	resp_cache_shard_t *shard;
+	int i, j;
+
+	if (!c) {
+		return;
+	}
+
+	for (i = 0; i < RESP_CACHE_SHARDS; i++) {
+		shard = &c->shards[i];
+
+		for (j = 0; j < c->slots; j++) {
+			if (shard->items[j].data) {
+				free(shard->items[j].data);
+			}
+		}
+
+		pthread_mutex_destroy(&shard->mutex);
+		free(shard->items);
+	}
+
+	free(c);
+}
+
+/*
+ * Search for the response generated from the given version of the
+ * data structure at the href with the given flags
+ *
+ * Return 0 on success with a copy of the response returned in the
+ * data parameter, which should be released by callers, < 0 otherwise
+ */
+int resp_cache_search(resp_cache_t *c, const unsigned char *href, int flags,
+					  unsigned long version, char **data, int *size)
+{
+	resp_cache_shard_t *shard;
+	resp_cache_item_t *slot;
+	unsigned int hash;
+	int len, ret = -1;
+
+	if (!c || !href || version == 0) {
+		return -1;
+	}
+
+	hash = resp_cache_hash(href, flags, &len);
+	shard = resp_cache_get_shard(c, hash);
+
+	pthread_mutex_lock(&shard->mutex);
+
+	slot = resp_cache_get_slot(c, shard, hash);
+
+	if (slot->version == version && slot->flags == flags &&
+		slot->hash == hash && slot->len == len &&
+		memcmp(slot->href, href, len) == 0 &&
+		(*data = (char *)malloc(slot->size + 1)) != NULL) {
+		memcpy(*data, slot->data, slot->size + 1);
+		*size = slot->size;
+		shard->hit++;
+		ret = 0;
+	} else {
+		shard->miss++;
+	}
+
+	pthread_mutex_unlock(&shard->mutex);
+
+	return ret;
+}
+
+/*
+ * Save a copy of the response generated from the given version of
+ * the data structure at the href with the given flags, replacing
+ * whatever occupies relevant slot
+ *
+ * Responses with too long hrefs or too big sizes are not cached
+ */
+void resp_cache_update(resp_cache_t *c, const unsigned char *href, int flags,
+					   unsigned long version, const char *data, int size)
+{
+	resp_cache_shard_t *shard;
+	resp_cache_item_t *slot;
+	unsigned int hash;
+	char *copy;
+	int len;
+
+	if (!c || !href || !data || version == 0 ||
+		size <= 0 || size > RESP_CACHE_DATA_MAX) {
+		return;
+	}
+
+	hash = resp_cache_hash(href, flags, &len);
+	if (len >= RESP_CACHE_HREF_MAX) {
+		return;
+	}
+
+	/* Allocate outside of the lock, with the terminating NULL */
+	if (!(copy = (char *)malloc(size + 1))) {
+		return;
+	}
+	memcpy(copy, data, size);
+	copy[size] = '\0';
+
+	shard = resp_cache_get_shard(c, hash);
+
+	pthread_mutex_lock(&shard->mutex);
+
+	slot = resp_cache_get_slot(c, shard, hash);
+
+	/* Never replace a newer response of the same href */
+	if (slot->hash == hash && slot->len == len && slot->flags == flags &&
+		slot->version > version &&
+		memcmp(slot->href, href, len) == 0) {
+		pthread_mutex_unlock(&shard->mutex);
+		free(copy);
+		return;
+	}
+
+	if (slot->data) {
+		free(slot->data);
+	}
+
+	memcpy(slot->href, href, len);
+	slot->href[len] = '\0';
+	slot->len = len;
+	slot->hash = hash;
+	slot->flags = flags;
+	slot->version = version;
+	slot->data = copy;
+	slot->size = size;
+
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+long resp_cache_get_hit(resp_cache_t *c)
+{
+	long hit = 0;
+	int i;
+
+	for (i = 0; i < RESP_CACHE_SHARDS; i++) {
+		pthread_mutex_lock(&c->shards[i].mutex);
+		hit += c->shards[i].hit;
+		pthread_mutex_unlock(&c->shards[i].mutex);
+	}
+
+	return hit;
+}
+
+long resp_cache_get_miss(resp_cache_t *c)
+{
+	long miss = 0;
+	int i;
+
+	for (i = 0; i < RESP_CACHE_SHARDS; i++) {
+		pthread_mutex_lock(&c->shards[i].mutex);
+		miss += c->shards[i].miss;
+		pthread_mutex_unlock(&c->shards[i].mutex);
+	}
+
+	return miss;
+}
+
+int resp_cache_get_size(resp_cache_t *c)
+{
+	return RESP_CACHE_SHARDS * c->slots;
+}
@@ -0,0 +1,95 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+/*
+ * Cache of serialised responses keyed by the href, the flags used to
+ * generate the response and the version of the data structure at the
+ * href when the response was generated.
+ *
+ * Owners of the data structure are supposed to assign a new version to
+ * it whenever it is changed, so that stale responses simply stop being
+ * matched and no explicit invalidation is ever needed. They are replaced
+ * by newer responses in the same slots later.
+ *
+ * The cache is split into a number of shards, each protected by its own
+ * lock, and every href can only reside in one slot of one shard.
+ */
+
+#ifndef _RESP_CACHE_H
+#define _RESP_CACHE_H
+
+#include <pthread.h>
+
+/* The number of shards, each of which has its own lock */
+#define RESP_CACHE_SHARDS		16
+
+/* The maximal length of hrefs to be cached */
+#define RESP_CACHE_HREF_MAX		128
+
+/* The maximal size of responses to be cached */
+#define RESP_CACHE_DATA_MAX		4096
+
+typedef struct resp_cache_item {
+	/* a copy of the href */
+	unsigned char href[RESP_CACHE_HREF_MAX];
+	int len;
+
+	/* the hash value of the href and flags */
+	unsigned int hash;
+
+	/* the flags used to generate the response */
+	int flags;
+
+	/* the version of the data structure, 0 for an empty slot */
+	unsigned long version;
+
+	/* the serialised response */
+	char *data;
+	int size;
+} resp_cache_item_t;
+
+typedef struct resp_cache_shard {
+	resp_cache_item_t *items;
+
+	/* statistics variables */
+	long hit, miss;
+
+	/* lock to protect the shard */
+	pthread_mutex_t mutex;
+} resp_cache_shard_t;
+
+typedef struct resp_cache {
+	resp_cache_shard_t shards[RESP_CACHE_SHARDS];
+
+	/* the number of slots in every shard */
+	int slots;
+} resp_cache_t;
+
+resp_cache_t *resp_cache_init(const int len);
+void resp_cache_dispose(resp_cache_t *c);
+int resp_cache_search(resp_cache_t *c, const unsigned char *href, int flags,
+					  unsigned long version, char **data, int *size);
+void resp_cache_update(resp_cache_t *c, const unsigned char *href, int flags,
+					   unsigned long version, const char *data, int size);
+long resp_cache_get_hit(resp_cache_t *c);
+long resp_cache_get_miss(resp_cache_t *c);
+int resp_cache_get_size(resp_cache_t *c);
+
+#endif
@@ -0,0 +1,447 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+#include <string.h>
+#include <libxml/tree.h>
+#include <libxml/parserInternals.h>	/* xmlStringText */
+#include "xml_arena.h"
+#include "obix_utils.h"
+
+static void *xml_arena_zalloc(arena_t *arena, size_t size)
+{
+	void *p;
+
+	if ((p = arena_alloc(arena, size)) != NULL) {
+		memset(p, 0, size);
+	}
+
+	return p;
+}
+
+/*
+ * Duplicate the given string in the arena, a NULL string is duplicated
+ * as NULL
+ *
+ * Return 0 on success, -1 on failure
+ */
+static int xml_arena_strdup(arena_t *arena, const xmlChar *str,
+							const xmlChar **copy)
+{
+	if (!str) {
+		*copy = NULL;
+		return 0;
+	}
+
+	return ((*copy = (xmlChar *)arena_strdup(arena, (const char *)str)) !=
+				NULL) ? 0 : -1;
+}
+
+/*
+ * Get the namespace declared on the given copy with the same prefix
+ * as the given one, declaring it first if not yet
+ *
+ * NOTE: namespaces used by a node but declared on its ancestors are
+ * declared again on its copy, since the copy may be made before its
+ * parent. oBIX contracts hardly have any namespace anyway
+ *
+ * Return the namespace on success, NULL on failure
+ */
+static xmlNs *xml_arena_get_ns(arena_t *arena, xmlNode *copy,
+							   const xmlNs *ns)
+{
+	xmlNs *n, *last = NULL;
+
+	for (n = copy->nsDef; n; last = n, n = n->next) {
+		if (xmlStrEqual(n->prefix, ns->prefix) == 1) {
+			return n;
+		}
+	}
+
+	if (!(n = (xmlNs *)xml_arena_zalloc(arena, sizeof(xmlNs))) ||
+		xml_arena_strdup(arena, ns->href, &n->href) < 0 ||
+		xml_arena_strdup(arena, ns->prefix, &n->prefix) < 0) {
+		return NULL;
+	}
+
+	n->type = XML_NAMESPACE_DECL;
+
+	if (last) {
+		last->next = n;
+	} else {
+		copy->nsDef = n;
+	}
+
+	return n;
+}
+
+/*
+ * Create a text node with the given content
+ *
+ * Return the text node on success, NULL on failure
+ */
+static xmlNode *xml_arena_new_text(arena_t *arena, const xmlChar *content)
+{
+	xmlNode *text;
+
+	if (!(text = (xmlNode *)xml_arena_zalloc(arena, sizeof(xmlNode))) ||
+		xml_arena_strdup(arena, content, (const xmlChar **)&text->content) < 0) {
+		return NULL;
+	}
+
+	text->type = XML_TEXT_NODE;
+	text->name = xmlStringText;
+
+	return text;
+}
+
+/*
+ * Append an attribute with the given name and value to the given node
+ *
+ * Return the attribute on success, NULL on failure
+ */
+static xmlAttr *xml_arena_new_prop(arena_t *arena, xmlNode *node,
+								   const xmlChar *name, const xmlChar *val,
+								   xmlNs *ns)
+{
+	xmlAttr *attr, *last;
+
+	if (!(attr = (xmlAttr *)xml_arena_zalloc(arena, sizeof(xmlAttr))) ||
+		xml_arena_strdup(arena, name, &attr->name) < 0) {
+		return NULL;
+	}
+
+	attr->type = XML_ATTRIBUTE_NODE;
+	attr->parent = node;
+	attr->doc = node->doc;
+	attr->ns = ns;
+
+	if (val) {
+		if (!(attr->children = xml_arena_new_text(arena, val))) {
+			return NULL;
+		}
+
+		attr->children->parent = (xmlNode *)attr;
+		attr->children->doc = node->doc;
+		attr->last = attr->children;
+	}
+
+	if (!(last = node->properties)) {
+		node->properties = attr;
+	} else {
+		while (last->next) {
+			last = last->next;
+		}
+
+		last->next = attr;
+		attr->prev = last;
+	}
+
+	return attr;
+}
+
+/*
+ * Copy the attributes of the given element into its copy
+ *
+ * Return 0 on success, -1 on failure
+ */
+static int xml_arena_copy_props(arena_t *arena, const xmlNode *src,
+								xmlNode *copy)
+{
+	const xmlAttr *attr;
+	const xmlNode *child;
+	xmlChar *val;
+	xmlNs *ns;
+	int ret;
+
+	for (attr = src->properties; attr; attr = attr->next) {
+		ns = NULL;
+
+		if (attr->ns && !(ns = xml_arena_get_ns(arena, copy, attr->ns))) {
+			return -1;
+		}
+
+		child = attr->children;
+
+		/* The value of an attribute is nearly always one text node */
+		if (!child || (!child->next && child->type == XML_TEXT_NODE)) {
+			if (!xml_arena_new_prop(arena, copy, attr->name,
+									(child) ? child->content : NULL, ns)) {
+				return -1;
+			}
+
+			continue;
+		}
+
+		if (!(val = xmlNodeListGetString(src->doc, child, 1))) {
+			return -1;
+		}
+
+		ret = (xml_arena_new_prop(arena, copy, attr->name, val, ns) != NULL) ?
+					0 : -1;
+		xmlFree(val);
+
+		if (ret < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Copy the given node along with its attributes but not children,
+ * the same as xmlCopyNode(src, 2)
+ *
+ * Only elements, text, CDATA and comment nodes can be copied, which
+ * are all that oBIX contracts consist of
+ *
+ * Return the copy on success, NULL on failure
+ */
+xmlNode *xml_arena_copy_node(arena_t *arena, const xmlNode *src)
+{
+	xmlNode *copy;
+	xmlNs *ns;
+
+	if (src->type != XML_ELEMENT_NODE && src->type != XML_TEXT_NODE &&
+		src->type != XML_CDATA_SECTION_NODE &&
+		src->type != XML_COMMENT_NODE) {
+		return NULL;
+	}
+
+	if (!(copy = (xmlNode *)xml_arena_zalloc(arena, sizeof(xmlNode)))) {
+		return NULL;
+	}
+
+	copy->type = src->type;
+
+	if (src->type != XML_ELEMENT_NODE) {
+		/*
+		 * Names of such nodes are static strings of libxml2, such as
+		 * xmlStringText, xmlStringTextNoenc or xmlStringComment, which
+		 * are told apart by their addresses when serialised
+		 */
+		copy->name = src->name;
+
+		return (xml_arena_strdup(arena, src->content,
+								 (const xmlChar **)&copy->content) == 0) ?
+					copy : NULL;
+	}
+
+	if (xml_arena_strdup(arena, src->name, &copy->name) < 0) {
+		return NULL;
+	}
+
+	for (ns = src->nsDef; ns; ns = ns->next) {
+		if (!xml_arena_get_ns(arena, copy, ns)) {
+			return NULL;
+		}
+	}
+
+	if (src->ns && !(copy->ns = xml_arena_get_ns(arena, copy, src->ns))) {
+		return NULL;
+	}
+
+	return (xml_arena_copy_props(arena, src, copy) == 0) ? copy : NULL;
+}
+
+/*
+ * Append the given copy as the last child of the given node, without
+ * merging adjacent text nodes as xmlAddChild() does
+ */
+void xml_arena_add_child(xmlNode *parent, xmlNode *child)
+{
+	child->parent = parent;
+	child->doc = parent->doc;
+
+	if (!parent->last) {
+		parent->children = child;
+	} else {
+		parent->last->next = child;
+		child->prev = parent->last;
+	}
+
+	parent->last = child;
+}
+
+/*
+ * Re-enterant version of xml_arena_copy(), see xml_copy_r()
+ */
+static xmlNode *xml_arena_copy_r(arena_t *arena, const xmlNode *src,
+								 xml_copy_flags_t flags, int depth)
+{
+	xmlNode *child, *copyRoot, *copyChild;
+
+	if (depth > 0) {
+		if (((flags & EXCLUDE_HIDDEN) > 0 && xml_is_hidden(src) == 1) ||
+			((flags & EXCLUDE_META) > 0 &&
+			 xmlStrcmp(src->name, BAD_CAST OBIX_OBJ_META) == 0) ||
+			((flags & EXCLUDE_COMMENTS) > 0 && src->type == XML_COMMENT_NODE)) {
+			return NULL;
+		}
+	}
+
+	if (!(copyRoot = xml_arena_copy_node(arena, src))) {
+		return NULL;
+	}
+
+	for (child = src->children; child; child = child->next) {
+		/* Excluded children are simply skipped */
+		if ((copyChild = xml_arena_copy_r(arena, child, flags,
+										  depth + 1)) != NULL) {
+			xml_arena_add_child(copyRoot, copyChild);
+		}
+	}
+
+	return copyRoot;
+}
+
+/*
+ * Copy the given subtree from the arena, skipping descendants as
+ * specified by the flags in the same way as xml_copy()
+ *
+ * Return the copy on success, NULL on failure
+ */
+xmlNode *xml_arena_copy(arena_t *arena, const xmlNode *src,
+						xml_copy_flags_t flags)
+{
+	return (src) ? xml_arena_copy_r(arena, src, flags, 0) : NULL;
+}
+
+/*
+ * Set the value of the attribute of the given name of a copy, adding
+ * the attribute if not yet. The old value is simply left in the arena
+ *
+ * Return 0 on success, -1 on failure
+ */
+int xml_arena_set_prop(arena_t *arena, xmlNode *node, const xmlChar *name,
+					   const xmlChar *val)
+{
+	xmlAttr *attr;
+	xmlNode *text;
+
+	for (attr = node->properties; attr; attr = attr->next) {
+		if (!attr->ns && xmlStrcmp(attr->name, name) == 0) {
+			break;
+		}
+	}
+
+	if (!attr) {
+		return (xml_arena_new_prop(arena, node, name, val, NULL) != NULL) ?
+					0 : -1;
+	}
+
+	if (!val) {
+		attr->children = attr->last = NULL;
+		return 0;
+	}
+
+	if (!(text = xml_arena_new_text(arena, val))) {
+		return -1;
+	}
+
+	text->parent = (xmlNode *)attr;
+	text->doc = node->doc;
+	attr->children = attr->last = text;
+
+	return 0;
+}
+
+/*
+ * Remove the attribute of the given name from a copy, which is simply
+ * left in the arena
+ */
+void xml_arena_unset_prop(xmlNode *node, const xmlChar *name)
+{
+	xmlAttr *attr;
+
+	for (attr = node->properties; attr; attr = attr->next) {
+		if (!attr->ns && xmlStrcmp(attr->name, name) == 0) {
+			break;
+		}
+	}
+
+	if (!attr) {
+		return;
+	}
+
+	if (attr->prev) {
+		attr->prev->next = attr->next;
+	} else {
+		node->properties = attr->next;
+	}
+
+	if (attr->next) {
+		attr->next->prev = attr->prev;
+	}
+
+	attr->parent = NULL;
+	attr->prev = attr->next = NULL;
+}
+
+static void xml_arena_set_doc(xmlNode *node, xmlDoc *doc)
+{
+	xmlAttr *attr;
+	xmlNode *child;
+
+	node->doc = doc;
+
+	for (attr = node->properties; attr; attr = attr->next) {
+		attr->doc = doc;
+
+		for (child = attr->children; child; child = child->next) {
+			child->doc = doc;
+		}
+	}
+
+	for (child = node->children; child; child = child->next) {
+		xml_arena_set_doc(child, doc);
+	}
+}
+
+/*
+ * Make the given copy the root of a new document allocated from the
+ * arena as well, the same as xmlNewDoc() plus xmlDocSetRootElement()
+ *
+ * Return the document on success, NULL on failure
+ */
+xmlDoc *xml_arena_wrap(arena_t *arena, xmlNode *root)
+{
+	xmlDoc *doc;
+
+	if (!(doc = (xmlDoc *)xml_arena_zalloc(arena, sizeof(xmlDoc))) ||
+		xml_arena_strdup(arena, BAD_CAST XML_VERSION, &doc->version) < 0) {
+		return NULL;
+	}
+
+	doc->type = XML_DOCUMENT_NODE;
+	doc->doc = doc;
+	doc->standalone = -1;
+	doc->compression = -1;
+	doc->charset = XML_CHAR_ENCODING_UTF8;
+	doc->properties = XML_DOC_USERBUILT;
+
+	root->parent = (xmlNode *)doc;
+	root->prev = root->next = NULL;
+	doc->children = doc->last = root;
+
+	xml_arena_set_doc(root, doc);
+
+	return doc;
+}
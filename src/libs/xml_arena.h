@@ -0,0 +1,51 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+/*
+ * Copies of DOM subtrees carved out of an arena, such as those of an
+ * oBIX request that are serialised as its response and then dropped.
+ * A copy takes a handful of malloc() calls for its chunks instead of
+ * several ones for each node, attribute and string, and is released
+ * along with the arena in one go.
+ *
+ * Copies are as good as any other tree to be read or serialised by
+ * libxml2, however, they must never be released or modified by libxml2
+ * since none of their memory comes from xmlMalloc(). Use xml_arena_*()
+ * to change them instead, and xml_arena_wrap() to make a document out
+ * of them, which must never be passed to xmlFreeDoc() either.
+ */
+
+#ifndef _XML_ARENA_H
+#define _XML_ARENA_H
+
+#include <libxml/tree.h>
+#include "arena.h"
+#include "xml_utils.h"
+
+xmlNode *xml_arena_copy_node(arena_t *arena, const xmlNode *src);
+xmlNode *xml_arena_copy(arena_t *arena, const xmlNode *src,
+						xml_copy_flags_t flags);
+void xml_arena_add_child(xmlNode *parent, xmlNode *child);
+int xml_arena_set_prop(arena_t *arena, xmlNode *node, const xmlChar *name,
+					   const xmlChar *val);
+void xml_arena_unset_prop(xmlNode *node, const xmlChar *name);
+xmlDoc *xml_arena_wrap(arena_t *arena, xmlNode *root);
+
+#endif
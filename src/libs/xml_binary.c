@@ -0,0 +1,343 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "xml_binary.h"
+
+/* The initial capacity of a buffer */
+#define XML_BINARY_SIZE_MIN		1024
+
+/* The maximal depth of subtrees, to protect the stack from corrupted data */
+#define XML_BINARY_DEPTH_MAX	256
+
+/* Types of nodes in the encoded data */
+#define XML_BINARY_ELEMENT		1
+#define XML_BINARY_TEXT			2
+#define XML_BINARY_COMMENT		3
+
+void xml_binary_init(xml_binary_t *buf)
+{
+	memset(buf, 0, sizeof(xml_binary_t));
+}
+
+/*
+ * Discard the encoded data but keep the buffer for reuse
+ */
+void xml_binary_reset(xml_binary_t *buf)
+{
+	buf->len = 0;
+}
+
+void xml_binary_dispose(xml_binary_t *buf)
+{
+	if (buf->data) {
+		free(buf->data);
+	}
+
+	memset(buf, 0, sizeof(xml_binary_t));
+}
+
+/*
+ * Append the given data to the buffer, which is enlarged if needed
+ *
+ * Return 0 on success, < 0 on error
+ */
+int xml_binary_put(xml_binary_t *buf, const void *data, uint32_t len)
+{
+	char *p;
+	uint32_t size;
+
+	if (buf->len + len < buf->len) {
+		return -1;		/* overflow */
+	}
+
+	if (buf->len + len > buf->size) {
+		for (size = (buf->size > 0) ? buf->size : XML_BINARY_SIZE_MIN;
+			 size < buf->len + len; size *= 2) {
+			if (size * 2 < size) {
+				return -1;
+			}
+		}
+
+		if (!(p = (char *)realloc(buf->data, size))) {
+			return -1;
+		}
+
+		buf->data = p;
+		buf->size = size;
+	}
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+
+	return 0;
+}
+
+int xml_binary_put_u32(xml_binary_t *buf, uint32_t val)
+{
+	unsigned char b[4];
+
+	b[0] = val & 0xff;
+	b[1] = (val >> 8) & 0xff;
+	b[2] = (val >> 16) & 0xff;
+	b[3] = (val >> 24) & 0xff;
+
+	return xml_binary_put(buf, b, 4);
+}
+
+int xml_binary_put_str(xml_binary_t *buf, const char *str)
+{
+	uint32_t len = strlen(str);
+
+	return (xml_binary_put_u32(buf, len) < 0 ||
+			xml_binary_put(buf, str, len + 1) < 0) ? -1 : 0;
+}
+
+static int xml_binary_put_type(xml_binary_t *buf, unsigned char type)
+{
+	return xml_binary_put(buf, &type, 1);
+}
+
+static int xml_binary_is_encodable(const xmlNode *node)
+{
+	return (node->type == XML_ELEMENT_NODE || node->type == XML_TEXT_NODE ||
+			node->type == XML_COMMENT_NODE) ? 1 : 0;
+}
+
+/*
+ * Append the encoded subtree of the given node to the buffer
+ *
+ * Return 0 on success, < 0 on error or if the subtree contains
+ * namespaces
+ */
+int xml_binary_encode(xml_binary_t *buf, const xmlNode *node)
+{
+	const xmlNode *child;
+	const xmlAttr *attr;
+	xmlChar *val;
+	uint32_t count;
+	int ret;
+
+	switch (node->type) {
+	case XML_TEXT_NODE:
+		return (xml_binary_put_type(buf, XML_BINARY_TEXT) < 0 ||
+				xml_binary_put_str(buf, (node->content) ?
+								   (const char *)node->content : "") < 0) ? -1 : 0;
+	case XML_COMMENT_NODE:
+		return (xml_binary_put_type(buf, XML_BINARY_COMMENT) < 0 ||
+				xml_binary_put_str(buf, (node->content) ?
+								   (const char *)node->content : "") < 0) ? -1 : 0;
+	case XML_ELEMENT_NODE:
+		break;
+	default:
+		return -1;
+	}
+
+	if (node->ns) {
+		return -1;
+	}
+
+	if (xml_binary_put_type(buf, XML_BINARY_ELEMENT) < 0 ||
+		xml_binary_put_str(buf, (const char *)node->name) < 0) {
+		return -1;
+	}
+
+	for (count = 0, attr = node->properties; attr; attr = attr->next) {
+		if (attr->ns) {
+			return -1;
+		}
+
+		count++;
+	}
+
+	if (xml_binary_put_u32(buf, count) < 0) {
+		return -1;
+	}
+
+	for (attr = node->properties; attr; attr = attr->next) {
+		if (!(val = xmlNodeListGetString(node->doc, attr->children, 1))) {
+			val = xmlStrdup(BAD_CAST "");
+		}
+
+		ret = (!val || xml_binary_put_str(buf, (const char *)attr->name) < 0 ||
+			   xml_binary_put_str(buf, (const char *)val) < 0) ? -1 : 0;
+
+		if (val) {
+			xmlFree(val);
+		}
+
+		if (ret < 0) {
+			return -1;
+		}
+	}
+
+	for (count = 0, child = node->children; child; child = child->next) {
+		if (xml_binary_is_encodable(child) == 1) {
+			count++;
+		}
+	}
+
+	if (xml_binary_put_u32(buf, count) < 0) {
+		return -1;
+	}
+
+	for (child = node->children; child; child = child->next) {
+		if (xml_binary_is_encodable(child) == 1 &&
+			xml_binary_encode(buf, child) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Read a 32bit integer from the given position of the data, which
+ * is moved over it
+ *
+ * Return 0 on success, < 0 if the data is truncated
+ */
+int xml_binary_get_u32(const char *data, uint32_t size, uint32_t *pos,
+					   uint32_t *val)
+{
+	const unsigned char *b;
+
+	if (*pos > size || size - *pos < 4) {
+		return -1;
+	}
+
+	b = (const unsigned char *)data + *pos;
+	*val = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+	*pos += 4;
+
+	return 0;
+}
+
+/*
+ * Get a string from the given position of the data, which is moved
+ * over it
+ *
+ * Return the string in place, or NULL if the data is corrupted
+ */
+const char *xml_binary_get_str(const char *data, uint32_t size, uint32_t *pos)
+{
+	const char *str;
+	uint32_t len;
+
+	if (xml_binary_get_u32(data, size, pos, &len) < 0 ||
+		size - *pos < len || size - *pos - len < 1 ||
+		data[*pos + len] != '\0') {
+		return NULL;
+	}
+
+	str = data + *pos;
+	*pos += len + 1;
+
+	return str;
+}
+
+static xmlNode *xml_binary_decode_node(const char *data, uint32_t size,
+									   uint32_t *pos, int depth)
+{
+	xmlNode *node, *child;
+	const char *name, *val;
+	uint32_t count, i;
+	unsigned char type;
+
+	if (depth > XML_BINARY_DEPTH_MAX || *pos >= size) {
+		return NULL;
+	}
+
+	type = (unsigned char)data[(*pos)++];
+
+	switch (type) {
+	case XML_BINARY_TEXT:
+		return (val = xml_binary_get_str(data, size, pos)) ?
+					xmlNewText(BAD_CAST val) : NULL;
+	case XML_BINARY_COMMENT:
+		return (val = xml_binary_get_str(data, size, pos)) ?
+					xmlNewComment(BAD_CAST val) : NULL;
+	case XML_BINARY_ELEMENT:
+		break;
+	default:
+		return NULL;
+	}
+
+	if (!(name = xml_binary_get_str(data, size, pos)) ||
+		xml_binary_get_u32(data, size, pos, &count) < 0 ||
+		!(node = xmlNewNode(NULL, BAD_CAST name))) {
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!(name = xml_binary_get_str(data, size, pos)) ||
+			!(val = xml_binary_get_str(data, size, pos)) ||
+			!xmlNewProp(node, BAD_CAST name, BAD_CAST val)) {
+			goto failed;
+		}
+	}
+
+	if (xml_binary_get_u32(data, size, pos, &count) < 0) {
+		goto failed;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!(child = xml_binary_decode_node(data, size, pos, depth + 1))) {
+			goto failed;
+		}
+
+		if (!xmlAddChild(node, child)) {
+			xmlFreeNode(child);
+			goto failed;
+		}
+	}
+
+	return node;
+
+failed:
+	xmlFreeNode(node);
+	return NULL;
+}
+
+/*
+ * Turn the encoded data back into a subtree, which doesn't belong
+ * to any document
+ *
+ * Return the root node of the subtree, or NULL if the data is
+ * corrupted or on error
+ */
+xmlNode *xml_binary_decode(const char *data, uint32_t size)
+{
+	xmlNode *node;
+	uint32_t pos = 0;
+
+	if (!data || size == 0) {
+		return NULL;
+	}
+
+	if ((node = xml_binary_decode_node(data, size, &pos, 0)) != NULL &&
+		pos != size) {
+		xmlFreeNode(node);
+		node = NULL;
+	}
+
+	return node;
+}
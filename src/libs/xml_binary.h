@@ -0,0 +1,77 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+/*
+ * A compact binary encoding of XML subtrees, which can be turned back
+ * into DOM nodes without any tokenising or parsing, e.g. to restore
+ * a large number of device contracts from one snapshot file quickly,
+ * or to exchange oBIX objects between the oBIX server and clients
+ * as the XML_BINARY_MIME content type.
+ *
+ * Every node is encoded as one byte of its type followed by:
+ *	element:	name, number of attributes, name and value of each
+ *				attribute, number of children, each child node
+ *	text:		content
+ *	comment:	content
+ *
+ * where numbers are 32bit integers in little-endian byte order regardless
+ * of the platform and strings are
+ * preceded by their lengths and followed by NULL terminators, so that
+ * they can be referenced in place. Other types of nodes are skipped,
+ * and elements or attributes with namespaces are not supported at all.
+ */
+
+#ifndef _XML_BINARY_H
+#define _XML_BINARY_H
+
+#include <stdint.h>
+#include <libxml/tree.h>
+
+/*
+ * The content type of the encoding. It is not the binary encoding
+ * defined by the oBIX 1.1 specification, but a plain encoding of the
+ * same object model as the XML one
+ */
+#define XML_BINARY_MIME		"application/x-obix-compact"
+
+/* A growable buffer to hold the encoded data */
+typedef struct xml_binary {
+	char *data;
+
+	/* The length of the encoded data and the capacity of the buffer */
+	uint32_t len, size;
+} xml_binary_t;
+
+void xml_binary_init(xml_binary_t *buf);
+void xml_binary_reset(xml_binary_t *buf);
+void xml_binary_dispose(xml_binary_t *buf);
+int xml_binary_put(xml_binary_t *buf, const void *data, uint32_t len);
+int xml_binary_put_u32(xml_binary_t *buf, uint32_t val);
+int xml_binary_put_str(xml_binary_t *buf, const char *str);
+
+int xml_binary_encode(xml_binary_t *buf, const xmlNode *node);
+
+int xml_binary_get_u32(const char *data, uint32_t size, uint32_t *pos,
+					   uint32_t *val);
+const char *xml_binary_get_str(const char *data, uint32_t size, uint32_t *pos);
+
+xmlNode *xml_binary_decode(const char *data, uint32_t size);
+
+#endif
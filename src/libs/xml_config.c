@@ -35,10 +35,28 @@ static const char *XP_LOG_FACILITY = "/config/log/facility";
 const char *XP_LISTEN_SOCKET = "/config/listen_socket";
 const char *XP_LISTEN_BACKLOG = "/config/listen_backlog";
 const char *XP_MULTI_THREADS = "/config/multi_threads";
+const char *XP_FAST_THREADS = "/config/fast_threads";
+const char *XP_SLOW_THREADS = "/config/slow_threads";
+const char *XP_FAST_THREADS_MAX = "/config/fast_threads_max";
+const char *XP_SLOW_THREADS_MAX = "/config/slow_threads_max";
+const char *XP_THREAD_IDLE_TIMEOUT = "/config/thread_idle_timeout";
+const char *XP_THREAD_GROW_LATENCY = "/config/thread_grow_latency";
+const char *XP_QUEUE_MAX = "/config/queue_max";
+const char *XP_DEVICE_LIMIT = "/config/device_limit";
+const char *XP_HISTORY_LIMIT = "/config/history_limit";
+const char *XP_WATCH_LIMIT = "/config/watch_limit";
+const char *XP_RETRY_AFTER = "/config/retry_after";
 const char *XP_POLL_THREADS = "/config/poll_threads";
-const char *XP_DEV_TABLE_SIZE = "/config/dev_table_size";
+const char *XP_POLL_THREADS_MAX = "/config/poll_threads_max";
 const char *XP_DEV_CACHE_SIZE = "/config/dev_cache_size";
+const char *XP_DEV_RESP_CACHE_SIZE = "/config/dev_resp_cache_size";
 const char *XP_DEV_BACKUP_PERIOD = "/config/dev_backup_period";
+const char *XP_DEV_SNAPSHOT_PERIOD = "/config/dev_snapshot_period";
+const char *XP_DEV_LOAD_THREADS = "/config/dev_load_threads";
+const char *XP_BATCH_THREADS = "/config/batch_threads";
+const char *XP_GZIP_MIN_SIZE = "/config/gzip_min_size";
+const char *XP_GZIP_LEVEL = "/config/gzip_level";
+const char *XP_BODY_MAX_SIZE = "/config/body_max_size";
 
 /*
  * XPath predicates used by the client side
@@ -54,6 +72,7 @@ const char *CT_LP_MAX = "long_poll_max";
 const char *CT_CURL_TIMEOUT = "curl_timeout";
 const char *CT_CURL_BULKY = "curl_bulky";
 const char *CT_CURL_NOSIGNAL = "curl_nosignal";
+const char *CT_CURL_BINARY = "curl_binary";
 
 #define ARRAY_LEN(a) (size_t) (sizeof(a) / sizeof(a[0]))
 
@@ -30,10 +30,28 @@
 extern const char *XP_LISTEN_SOCKET;
 extern const char *XP_LISTEN_BACKLOG;
 extern const char *XP_POLL_THREADS;
+extern const char *XP_POLL_THREADS_MAX;
 extern const char *XP_MULTI_THREADS;
-extern const char *XP_DEV_TABLE_SIZE;
+extern const char *XP_FAST_THREADS;
+extern const char *XP_SLOW_THREADS;
+extern const char *XP_FAST_THREADS_MAX;
+extern const char *XP_SLOW_THREADS_MAX;
+extern const char *XP_THREAD_IDLE_TIMEOUT;
+extern const char *XP_THREAD_GROW_LATENCY;
+extern const char *XP_QUEUE_MAX;
+extern const char *XP_DEVICE_LIMIT;
+extern const char *XP_HISTORY_LIMIT;
+extern const char *XP_WATCH_LIMIT;
+extern const char *XP_RETRY_AFTER;
 extern const char *XP_DEV_CACHE_SIZE;
+extern const char *XP_DEV_RESP_CACHE_SIZE;
 extern const char *XP_DEV_BACKUP_PERIOD;
+extern const char *XP_DEV_SNAPSHOT_PERIOD;
+extern const char *XP_DEV_LOAD_THREADS;
+extern const char *XP_BATCH_THREADS;
+extern const char *XP_GZIP_MIN_SIZE;
+extern const char *XP_GZIP_LEVEL;
+extern const char *XP_BODY_MAX_SIZE;
 
 extern const char *XP_CT;
 
@@ -47,6 +65,7 @@ extern const char *CT_LP_MAX;
 extern const char *CT_CURL_TIMEOUT;
 extern const char *CT_CURL_BULKY;
 extern const char *CT_CURL_NOSIGNAL;
+extern const char *CT_CURL_BINARY;
 
 typedef struct xml_config {
 	char *resdir;
@@ -0,0 +1,640 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "obix_utils.h"
+#include "xml_json.h"
+
+/* The longest entity reference decoded, e.g. "&#x10FFFF;" */
+#define XML_JSON_REF_MAX		10
+
+static void xml_json_write(xmlOutputBuffer *out, const char *data, int len)
+{
+	if (len > 0) {
+		xmlOutputBufferWrite(out, len, data);
+	}
+}
+
+static void xml_json_puts(xmlOutputBuffer *out, const char *str)
+{
+	xmlOutputBufferWrite(out, strlen(str), str);
+}
+
+static int xml_json_is_blank(const char *data, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (data[i] != ' ' && data[i] != '\t' &&
+			data[i] != '\n' && data[i] != '\r') {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int xml_json_is_equal(const char *data, int len, const char *str)
+{
+	return ((int)strlen(str) == len && strncmp(data, str, len) == 0) ? 1 : 0;
+}
+
+/*
+ * Return 1 if the given string follows the grammar of JSON numbers,
+ * 0 otherwise
+ */
+static int xml_json_is_number(const char *p, int len)
+{
+	const char *end = p + len;
+
+	if (p < end && *p == '-') {
+		p++;
+	}
+
+	if (p == end || *p < '0' || *p > '9') {
+		return 0;
+	}
+
+	if (*p++ == '0' && p < end && *p >= '0' && *p <= '9') {
+		return 0;		/* no leading zeros */
+	}
+
+	while (p < end && *p >= '0' && *p <= '9') {
+		p++;
+	}
+
+	if (p < end && *p == '.') {
+		if (++p == end || *p < '0' || *p > '9') {
+			return 0;
+		}
+
+		while (p < end && *p >= '0' && *p <= '9') {
+			p++;
+		}
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		if (++p < end && (*p == '+' || *p == '-')) {
+			p++;
+		}
+
+		if (p == end || *p < '0' || *p > '9') {
+			return 0;
+		}
+
+		while (p < end && *p >= '0' && *p <= '9') {
+			p++;
+		}
+	}
+
+	return (p == end) ? 1 : 0;
+}
+
+/*
+ * Return 1 if the given attribute of an element of the given tag
+ * can be emitted as a JSON literal as is, 0 otherwise
+ */
+static int xml_json_is_literal(const char *tag, int tag_len,
+							   const char *name, int name_len,
+							   const char *val, int len)
+{
+	if (xml_json_is_equal(name, name_len, OBIX_ATTR_VAL) == 0) {
+		return 0;
+	}
+
+	if (xml_json_is_equal(tag, tag_len, OBIX_OBJ_BOOL) == 1) {
+		return (xml_json_is_equal(val, len, XML_TRUE) == 1 ||
+				xml_json_is_equal(val, len, XML_FALSE) == 1) ? 1 : 0;
+	}
+
+	if (xml_json_is_equal(tag, tag_len, OBIX_OBJ_INT) == 1 ||
+		xml_json_is_equal(tag, tag_len, OBIX_OBJ_REAL) == 1) {
+		return xml_json_is_number(val, len);
+	}
+
+	return 0;
+}
+
+static void xml_json_put_esc(xmlOutputBuffer *out, unsigned char c)
+{
+	char esc[8];
+
+	switch (c) {
+	case '"':
+		xml_json_puts(out, "\\\"");
+		break;
+	case '\\':
+		xml_json_puts(out, "\\\\");
+		break;
+	case '\n':
+		xml_json_puts(out, "\\n");
+		break;
+	case '\r':
+		xml_json_puts(out, "\\r");
+		break;
+	case '\t':
+		xml_json_puts(out, "\\t");
+		break;
+	default:
+		sprintf(esc, "\\u%04x", c);
+		xml_json_puts(out, esc);
+		break;
+	}
+}
+
+static int xml_json_need_esc(unsigned char c)
+{
+	return (c < 0x20 || c == '"' || c == '\\') ? 1 : 0;
+}
+
+/*
+ * Emit the given string as a JSON string, with runs of characters
+ * that need no escape written in place
+ */
+static void xml_json_put_str(xmlOutputBuffer *out, const char *str, int len)
+{
+	const char *p, *end = str + len;
+
+	xml_json_puts(out, "\"");
+
+	for (p = str; p < end; p++) {
+		if (xml_json_need_esc(*p) == 1) {
+			xml_json_write(out, str, p - str);
+			xml_json_put_esc(out, *p);
+			str = p + 1;
+		}
+	}
+
+	xml_json_write(out, str, p - str);
+
+	xml_json_puts(out, "\"");
+}
+
+/*
+ * Decode the entity reference at the start of the given data into
+ * UTF-8 bytes
+ *
+ * Return the length of the reference, or 0 if it is not recognised
+ */
+static int xml_json_decode_ref(const char *data, int len, char *utf8,
+							   int *utf8_len)
+{
+	const char *end;
+	unsigned long c;
+	char *endptr;
+	int n;
+
+	for (n = 1; n < len && n <= XML_JSON_REF_MAX && data[n] != ';'; n++);
+
+	if (n == len || data[n] != ';') {
+		return 0;
+	}
+
+	end = data + n++;
+
+	if (data[1] != '#') {
+		if (xml_json_is_equal(data + 1, n - 2, "lt") == 1) {
+			c = '<';
+		} else if (xml_json_is_equal(data + 1, n - 2, "gt") == 1) {
+			c = '>';
+		} else if (xml_json_is_equal(data + 1, n - 2, "amp") == 1) {
+			c = '&';
+		} else if (xml_json_is_equal(data + 1, n - 2, "quot") == 1) {
+			c = '"';
+		} else if (xml_json_is_equal(data + 1, n - 2, "apos") == 1) {
+			c = '\'';
+		} else {
+			return 0;
+		}
+	} else {
+		if (data[2] == 'x') {
+			c = strtoul(data + 3, &endptr, 16);
+		} else {
+			c = strtoul(data + 2, &endptr, 10);
+		}
+
+		if (endptr != end || c == 0 || c > 0x10ffff) {
+			return 0;
+		}
+	}
+
+	if (c < 0x80) {
+		utf8[0] = c;
+		*utf8_len = 1;
+	} else if (c < 0x800) {
+		utf8[0] = 0xc0 | (c >> 6);
+		utf8[1] = 0x80 | (c & 0x3f);
+		*utf8_len = 2;
+	} else if (c < 0x10000) {
+		utf8[0] = 0xe0 | (c >> 12);
+		utf8[1] = 0x80 | ((c >> 6) & 0x3f);
+		utf8[2] = 0x80 | (c & 0x3f);
+		*utf8_len = 3;
+	} else {
+		utf8[0] = 0xf0 | (c >> 18);
+		utf8[1] = 0x80 | ((c >> 12) & 0x3f);
+		utf8[2] = 0x80 | ((c >> 6) & 0x3f);
+		utf8[3] = 0x80 | (c & 0x3f);
+		*utf8_len = 4;
+	}
+
+	return n;
+}
+
+/*
+ * Emit the given piece of serialised XML text as a JSON string, with
+ * entity references decoded. Unrecognised references are kept as is
+ */
+static void xml_json_put_xml_str(xmlOutputBuffer *out, const char *str,
+								 int len)
+{
+	const char *p, *end = str + len;
+	char utf8[4];
+	int n, utf8_len, i;
+
+	xml_json_puts(out, "\"");
+
+	for (p = str; p < end; p++) {
+		if (*p == '&' &&
+			(n = xml_json_decode_ref(p, end - p, utf8, &utf8_len)) > 0) {
+			xml_json_write(out, str, p - str);
+
+			for (i = 0; i < utf8_len; i++) {
+				if (xml_json_need_esc(utf8[i]) == 1) {
+					xml_json_put_esc(out, utf8[i]);
+				} else {
+					xml_json_write(out, utf8 + i, 1);
+				}
+			}
+
+			p += n - 1;
+			str = p + 1;
+		} else if (xml_json_need_esc(*p) == 1) {
+			xml_json_write(out, str, p - str);
+			xml_json_put_esc(out, *p);
+			str = p + 1;
+		}
+	}
+
+	xml_json_write(out, str, p - str);
+
+	xml_json_puts(out, "\"");
+}
+
+/*
+ * Start the next child of an element, the first one of which opens
+ * the nodes array of the element
+ */
+static void xml_json_start_child(xmlOutputBuffer *out, unsigned char *nodes)
+{
+	if (*nodes == 0) {
+		xml_json_puts(out, ",\"nodes\":[");
+		*nodes = 1;
+	} else {
+		xml_json_puts(out, ",");
+	}
+}
+
+static void xml_json_start_element(xmlOutputBuffer *out, const char *tag,
+								   int len)
+{
+	xml_json_puts(out, "{\"tag\":");
+	xml_json_put_str(out, tag, len);
+}
+
+static void xml_json_end_element(xmlOutputBuffer *out, unsigned char nodes)
+{
+	xml_json_puts(out, (nodes == 1) ? "]}" : "}");
+}
+
+static int xml_json_dump_node(xmlOutputBuffer *out, const xmlNode *node,
+							  int depth)
+{
+	const xmlNode *child;
+	const xmlAttr *attr;
+	const char *tag = (const char *)node->name;
+	xmlChar *val;
+	unsigned char nodes = 0;
+	int tag_len = strlen(tag), len, copied;
+
+	if (depth > XML_JSON_DEPTH_MAX) {
+		return -1;
+	}
+
+	xml_json_start_element(out, tag, tag_len);
+
+	for (attr = node->properties; attr; attr = attr->next) {
+		xml_json_puts(out, ",");
+		xml_json_put_str(out, (const char *)attr->name,
+						 strlen((const char *)attr->name));
+		xml_json_puts(out, ":");
+
+		/* Attribute values are normally one single text node */
+		copied = 0;
+
+		if (attr->children && !attr->children->next &&
+			attr->children->type == XML_TEXT_NODE) {
+			val = attr->children->content;
+		} else if (!(val = xmlNodeListGetString(node->doc,
+												attr->children, 1))) {
+			xml_json_puts(out, "\"\"");
+			continue;
+		} else {
+			copied = 1;
+		}
+
+		len = xmlStrlen(val);
+
+		if (xml_json_is_literal(tag, tag_len, (const char *)attr->name,
+								xmlStrlen(attr->name),
+								(const char *)val, len) == 1) {
+			xml_json_write(out, (const char *)val, len);
+		} else {
+			xml_json_put_str(out, (const char *)val, len);
+		}
+
+		if (copied == 1) {
+			xmlFree(val);
+		}
+	}
+
+	for (child = node->children; child; child = child->next) {
+		if (child->type == XML_ELEMENT_NODE) {
+			xml_json_start_child(out, &nodes);
+
+			if (xml_json_dump_node(out, child, depth + 1) < 0) {
+				return -1;
+			}
+		} else if ((child->type == XML_TEXT_NODE ||
+					child->type == XML_CDATA_SECTION_NODE) &&
+				   child->content &&
+				   xml_json_is_blank((const char *)child->content,
+									 xmlStrlen(child->content)) == 0) {
+			xml_json_start_child(out, &nodes);
+			xml_json_put_str(out, (const char *)child->content,
+							 xmlStrlen(child->content));
+		}
+	}
+
+	xml_json_end_element(out, nodes);
+
+	return 0;
+}
+
+/*
+ * Emit the JSON encoding of the given subtree into the output buffer
+ *
+ * Return 0 on success, < 0 on error
+ */
+int xml_json_dump(xmlOutputBuffer *out, const xmlNode *node)
+{
+	if (!out || !node || node->type != XML_ELEMENT_NODE) {
+		return -1;
+	}
+
+	if (xml_json_dump_node(out, node, 0) < 0) {
+		return -1;
+	}
+
+	return (out->error == 0) ? 0 : -1;
+}
+
+void xml_json_conv_init(xml_json_conv_t *conv)
+{
+	conv->depth = 0;
+	conv->roots = 0;
+}
+
+/*
+ * Search for the given pattern in [p, end)
+ *
+ * Return the start of the pattern, or NULL if not found
+ */
+static const char *xml_json_find(const char *p, const char *end,
+								 const char *pattern)
+{
+	int len = strlen(pattern);
+
+	for (; end - p >= len; p++) {
+		if (*p == *pattern && strncmp(p, pattern, len) == 0) {
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+static const char *xml_json_skip_blank(const char *p, const char *end)
+{
+	while (p < end && xml_json_is_blank(p, 1) == 1) {
+		p++;
+	}
+
+	return p;
+}
+
+static const char *xml_json_skip_name(const char *p, const char *end)
+{
+	while (p < end && xml_json_is_blank(p, 1) == 0 &&
+		   *p != '/' && *p != '>' && *p != '=') {
+		p++;
+	}
+
+	return p;
+}
+
+/*
+ * Emit a text node or CDATA section as the next child of the current
+ * element, or skip it if blank
+ *
+ * Return 0 on success, -1 if it is outside of any element
+ */
+static int xml_json_conv_text(xml_json_conv_t *conv, xmlOutputBuffer *out,
+							  const char *data, int len, int is_cdata)
+{
+	if (xml_json_is_blank(data, len) == 1) {
+		return 0;
+	}
+
+	if (conv->depth == 0) {
+		return -1;
+	}
+
+	xml_json_start_child(out, &conv->nodes[conv->depth - 1]);
+
+	if (is_cdata == 1) {
+		xml_json_put_str(out, data, len);
+	} else {
+		xml_json_put_xml_str(out, data, len);
+	}
+
+	return 0;
+}
+
+/*
+ * Convert the start tag at the given position, which is moved over it
+ *
+ * Return 0 on success, -1 if the tag is malformed or nested too deep
+ */
+static int xml_json_conv_start_tag(xml_json_conv_t *conv, xmlOutputBuffer *out,
+								   const char **pos, const char *end)
+{
+	const char *p = *pos + 1, *tag, *name, *val;
+	int tag_len, name_len;
+	char quote;
+
+	tag = p;
+	p = xml_json_skip_name(p, end);
+
+	if ((tag_len = p - tag) == 0) {
+		return -1;
+	}
+
+	if (conv->depth > 0) {
+		xml_json_start_child(out, &conv->nodes[conv->depth - 1]);
+	} else if (conv->roots++ > 0) {
+		xml_json_puts(out, ",");
+	}
+
+	xml_json_start_element(out, tag, tag_len);
+
+	while (1) {
+		if ((p = xml_json_skip_blank(p, end)) == end) {
+			return -1;
+		}
+
+		if (*p == '/') {
+			if (++p == end || *p != '>') {
+				return -1;
+			}
+
+			xml_json_end_element(out, 0);
+			break;
+		}
+
+		if (*p == '>') {
+			if (conv->depth == XML_JSON_DEPTH_MAX) {
+				return -1;
+			}
+
+			conv->nodes[conv->depth++] = 0;
+			break;
+		}
+
+		name = p;
+		p = xml_json_skip_name(p, end);
+
+		if ((name_len = p - name) == 0 ||
+			(p = xml_json_skip_blank(p, end)) == end || *p != '=' ||
+			(p = xml_json_skip_blank(p + 1, end)) == end ||
+			(*p != '"' && *p != '\'')) {
+			return -1;
+		}
+
+		quote = *p++;
+
+		for (val = p; p < end && *p != quote; p++);	/* do nothing */
+
+		if (p++ == end) {
+			return -1;
+		}
+
+		xml_json_puts(out, ",");
+		xml_json_put_str(out, name, name_len);
+		xml_json_puts(out, ":");
+
+		if (xml_json_is_literal(tag, tag_len, name, name_len,
+								val, p - 1 - val) == 1) {
+			xml_json_write(out, val, p - 1 - val);
+		} else {
+			xml_json_put_xml_str(out, val, p - 1 - val);
+		}
+	}
+
+	*pos = p + 1;
+
+	return 0;
+}
+
+/*
+ * Convert the given piece of XML text serialised by libxml2, which
+ * must consist of complete tags, into JSON in the output buffer.
+ * XML declarations, comments and processing instructions are skipped
+ *
+ * Return 0 on success, < 0 if the text is malformed or on error
+ */
+int xml_json_conv(xml_json_conv_t *conv, xmlOutputBuffer *out,
+				  const char *data, int len)
+{
+	const char *p = data, *end = data + len, *q;
+
+	while (p < end) {
+		if (*p != '<') {
+			for (q = p; q < end && *q != '<'; q++);	/* do nothing */
+
+			if (xml_json_conv_text(conv, out, p, q - p, 0) < 0) {
+				return -1;
+			}
+
+			p = q;
+		} else if (end - p >= 4 && strncmp(p, "<!--", 4) == 0) {
+			if (!(q = xml_json_find(p + 4, end, "-->"))) {
+				return -1;
+			}
+
+			p = q + 3;
+		} else if (end - p >= 9 && strncmp(p, "<![CDATA[", 9) == 0) {
+			if (!(q = xml_json_find(p + 9, end, "]]>")) ||
+				xml_json_conv_text(conv, out, p + 9, q - p - 9, 1) < 0) {
+				return -1;
+			}
+
+			p = q + 3;
+		} else if (end - p >= 2 && strncmp(p, "<?", 2) == 0) {
+			if (!(q = xml_json_find(p + 2, end, "?>"))) {
+				return -1;
+			}
+
+			p = q + 2;
+		} else if (end - p >= 2 && strncmp(p, "</", 2) == 0) {
+			if (!(q = xml_json_find(p + 2, end, ">")) || conv->depth == 0) {
+				return -1;
+			}
+
+			conv->depth--;
+			xml_json_end_element(out, conv->nodes[conv->depth]);
+			p = q + 1;
+		} else if (xml_json_conv_start_tag(conv, out, &p, end) < 0) {
+			return -1;
+		}
+	}
+
+	return (out->error == 0) ? 0 : -1;
+}
+
+/*
+ * Return 0 if all elements have been closed, -1 otherwise
+ */
+int xml_json_conv_end(xml_json_conv_t *conv)
+{
+	return (conv->depth == 0 && conv->roots > 0) ? 0 : -1;
+}
@@ -0,0 +1,72 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+/*
+ * Streaming emitters of the JSON encoding of oBIX objects, which write
+ * straight into libxml2 output buffers. Every element becomes a JSON
+ * object as below:
+ *
+ *	{"tag": name, attribute: value, ..., "nodes": [child, ...]}
+ *
+ * where the val attribute of bool, int and real objects is a JSON
+ * literal if it is a valid one and all other attribute values are
+ * strings. Non-blank text nodes are strings in the nodes array, while
+ * comments and processing instructions are dropped.
+ *
+ * Objects can be emitted either from DOM subtrees, or from XML text
+ * serialised by libxml2 such as history records and cached responses,
+ * without building any DOM tree from it at all.
+ */
+
+#ifndef _XML_JSON_H
+#define _XML_JSON_H
+
+#include <libxml/tree.h>
+#include <libxml/xmlIO.h>
+
+#define XML_JSON_MIME			"application/json"
+
+/* The maximal depth of elements converted from XML text */
+#define XML_JSON_DEPTH_MAX		256
+
+/*
+ * The state of converting XML text into JSON, which may be fed in
+ * a number of pieces, as long as each one of them consists of
+ * complete tags only
+ */
+typedef struct xml_json_conv {
+	/* The number of open elements */
+	int depth;
+
+	/* The number of top-level elements */
+	int roots;
+
+	/* Whether the nodes array of each open element has been started */
+	unsigned char nodes[XML_JSON_DEPTH_MAX];
+} xml_json_conv_t;
+
+int xml_json_dump(xmlOutputBuffer *out, const xmlNode *node);
+
+void xml_json_conv_init(xml_json_conv_t *conv);
+int xml_json_conv(xml_json_conv_t *conv, xmlOutputBuffer *out,
+				  const char *data, int len);
+int xml_json_conv_end(xml_json_conv_t *conv);
+
+#endif
@@ -27,6 +27,9 @@
 #include <string.h>		/* strlen */
 #include <sys/uio.h>	/* writev */
 #include <errno.h>
+#include <stdio.h>		/* rename */
+#include <stdlib.h>
+#include <unistd.h>		/* fsync */
 #include "xml_utils.h"
 #include "obix_utils.h"
 #include "log_utils.h"
@@ -760,6 +763,77 @@ failed:
 	return ret;
 }
 
+/*
+ * Replace the specified file with the given vector of data, by writing
+ * into a temporary file first and renaming it over the original one,
+ * so that the file is always intact even if the server crashes in the
+ * middle
+ *
+ * Return 0 on success, < 0 otherwise
+ */
+int file_writev_atomic(const char *path, const struct iovec *iov, int count)
+{
+	char *tmp;
+	int fd, ret = -1;
+
+	if (!(tmp = (char *)malloc(strlen(path) + 5))) {
+		log_error("Failed to allocate temporary file name for %s", path);
+		return -1;
+	}
+	sprintf(tmp, "%s.tmp", path);
+
+	errno = 0;
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, OBIX_FILE_PERM)) < 0) {
+		log_error("Failed to open %s because of %s", tmp, strerror(errno));
+		goto out;
+	}
+
+	errno = 0;
+	if (writev(fd, iov, count) < 0 || fsync(fd) < 0) {
+		log_error("Failed to write into %s because of %s", tmp,
+				  strerror(errno));
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+
+	close(fd);
+
+	errno = 0;
+	if (rename(tmp, path) < 0) {
+		log_error("Failed to rename %s to %s because of %s", tmp, path,
+				  strerror(errno));
+		unlink(tmp);
+	} else {
+		ret = 0;
+	}
+
+	/* Fall through */
+
+out:
+	free(tmp);
+	return ret;
+}
+
+/*
+ * Replace the specified file with the given data provisioning it with
+ * a XML header, so that the file is always well-formed even if the
+ * server crashes in the middle
+ *
+ * Return 0 on success, < 0 otherwise
+ */
+int xml_write_file_atomic(const char *path, const char *data, int size)
+{
+	struct iovec iov[2];
+
+	iov[0].iov_base = (char *)XML_HEADER;
+	iov[0].iov_len = XML_HEADER_LEN;
+	iov[1].iov_base = (char *)data;
+	iov[1].iov_len = size;
+
+	return file_writev_atomic(path, iov, 2);
+}
+
 static int xml_setup_private_helper(xmlNode **element, void *arg1, void *arg2)
 {
 	if (!*element) {
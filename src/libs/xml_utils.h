@@ -22,6 +22,7 @@
 #ifndef _XML_UTILS_H_
 #define _XML_UTILS_H_
 
+#include <sys/uio.h>
 #include <libxml/tree.h>
 #include <libxml/parser.h>
 
@@ -121,6 +122,8 @@ int xml_is_valid_href(const xmlChar *);
 xmlNode *xml_create_ref_node(xmlNode *src, const xmlChar *href);
 
 int xml_write_file(const char *path, int flags, const char *data, int size);
+int file_writev_atomic(const char *path, const struct iovec *iov, int count);
+int xml_write_file_atomic(const char *path, const char *data, int size);
 
 void xml_setup_private(xmlNode *node, void *arg);
 
@@ -19,6 +19,9 @@
  *
  * *****************************************************************************/
 
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "log_utils.h"
 #include "obix_utils.h"
 #include "xml_utils.h"
@@ -26,9 +29,20 @@
 #include "server.h"
 #include "errmsg.h"
 #include "device.h"
+#include "list.h"
 
 static const char *OBIX_WATCH_POLLCHANGES = "pollChanges";
 
+/*
+ * Responses to successful writes in a batch, as specified by the
+ * readback attribute of the batchIn contract
+ */
+typedef enum {
+	BATCH_READBACK_COMPACT = 0,	/* compact objects for writes on devices */
+	BATCH_READBACK_FULL = 1,	/* full copies of written nodes */
+	BATCH_READBACK_NONE = 2		/* bare status objects */
+} BATCH_READBACK;
+
 static void obix_batch_add_item(xmlNode *batchOut, xmlNode *item)
 {
 	xmlNode *copy = NULL;
@@ -72,8 +86,19 @@ static void obix_batch_add_item(xmlNode *batchOut, xmlNode *item)
 	}
 }
 
-static void obix_batch_process_item(obix_request_t *request, xmlNode *batchItem,
-									xmlNode *batch_out, xmlChar **uri)
+static xmlNode *obix_batch_write_status(const xmlChar *name,
+										const xmlChar *href,
+										const xmlChar *val);
+
+/*
+ * Handle one batch item and return the response to it
+ *
+ * NOTE: the uri parameter could be NULL for read requests which never
+ * need to cache up any device's URI
+ */
+static xmlNode *obix_batch_process_item(obix_request_t *request,
+										xmlNode *batchItem, xmlChar **uri,
+										BATCH_READBACK readback)
 {
 	xmlNode *node = NULL;
 	xmlChar *is_attr = NULL, *href = NULL;
@@ -102,7 +127,13 @@ static void obix_batch_process_item(obix_request_t *request, xmlNode *batchItem,
 	if (xmlStrcasecmp(is_attr, BAD_CAST OBIX_CONTRACT_OP_READ) == 0) {
 		node = obix_server_read(request, href);
 	} else if (xmlStrcasecmp(is_attr, BAD_CAST OBIX_CONTRACT_OP_WRITE) == 0) {
-		node = obix_server_write(request, href, batchItem->children);
+		if (readback != BATCH_READBACK_NONE) {
+			node = obix_server_write(request, href, batchItem->children);
+		} else if ((ret = obix_server_update(href, batchItem->children)) == 0) {
+			node = obix_batch_write_status(BAD_CAST OBIX_OBJ, href, NULL);
+		} else {
+			goto failed;
+		}
 
 		/*
 		 * If writing a subnode of a device contract succeeds and it is
@@ -110,7 +141,8 @@ static void obix_batch_process_item(obix_request_t *request, xmlNode *batchItem,
 		 * relevant persistent file of the parent device updated when
 		 * the entire batch has been handled
 		 */
-		if (!*uri && xmlStrcmp(node->name, BAD_CAST OBIX_OBJ_ERR) != 0) {
+		if (uri && !*uri && node &&
+			xmlStrcmp(node->name, BAD_CAST OBIX_OBJ_ERR) != 0) {
 			*uri = xmlStrdup(href);
 		}
 	} else if (xmlStrcasecmp(is_attr, BAD_CAST OBIX_CONTRACT_OP_INVOKE) == 0) {
@@ -164,7 +196,506 @@ failed:
 		xmlFree(href);
 	}
 
-	obix_batch_add_item(batch_out, node);
+	return node;
+}
+
+/*
+ * Check if the given node is a batch command, that is, an uri element.
+ * Any other nodes in the batchIn contract are skipped altogether
+ *
+ * Return 1 if so, 0 otherwise
+ */
+static int obix_batch_is_command(const xmlNode *node)
+{
+	return (node->type == XML_ELEMENT_NODE &&
+			xmlStrcmp(node->name, BAD_CAST OBIX_OBJ_URI) == 0) ? 1 : 0;
+}
+
+/*
+ * Check if the given batch item is a write request on a device
+ *
+ * Return 1 if so, 0 otherwise
+ */
+static int obix_batch_is_device_write(xmlNode *batchItem)
+{
+	xmlChar *is_attr, *href;
+	int ret = 0;
+
+	if (obix_batch_is_command(batchItem) == 0) {
+		return 0;
+	}
+
+	if ((is_attr = xmlGetProp(batchItem, BAD_CAST OBIX_ATTR_IS)) != NULL) {
+		if (xmlStrcasecmp(is_attr, BAD_CAST OBIX_CONTRACT_OP_WRITE) == 0 &&
+			(href = xmlGetProp(batchItem, BAD_CAST OBIX_ATTR_VAL)) != NULL) {
+			ret = (xml_is_valid_href(href) == 1 &&
+				   is_given_type(href, OBIX_DEVICE) == 1) ? 1 : 0;
+			xmlFree(href);
+		}
+
+		xmlFree(is_attr);
+	}
+
+	return ret;
+}
+
+/*
+ * Generate a compact response to a successful write, which has only
+ * the href and the new value of the written node if available, or
+ * otherwise the status of the write
+ */
+static xmlNode *obix_batch_write_status(const xmlChar *name,
+										const xmlChar *href,
+										const xmlChar *val)
+{
+	xmlNode *node;
+
+	if (!(node = xmlNewNode(NULL, name))) {
+		return NULL;
+	}
+
+	if (!xmlSetProp(node, BAD_CAST OBIX_ATTR_HREF, href) ||
+		(val && !xmlSetProp(node, BAD_CAST OBIX_ATTR_VAL, val)) ||
+		(!val && !xmlSetProp(node, BAD_CAST OBIX_ATTR_STATUS,
+							 BAD_CAST OBIX_STATUS_OK))) {
+		xmlFreeNode(node);
+		return NULL;
+	}
+
+	return node;
+}
+
+/*
+ * Handle the run of consecutive write requests on devices starting
+ * from the given batch item in one bulk, so that each device is
+ * locked and notified only once
+ *
+ * Return the first batch item after the run
+ */
+static xmlNode *obix_batch_write_devices(obix_request_t *request,
+										 xmlNode *first, xmlNode *batch_out,
+										 xmlChar **uri, BATCH_READBACK readback)
+{
+	device_write_t *writes = NULL;
+	xmlNode **inputs = NULL, *item, *next, *node;
+	xmlChar *href, *val;
+	int i, count = 0;
+
+	for (next = first; next; next = next->next) {
+		if (obix_batch_is_command(next) == 1) {
+			if (obix_batch_is_device_write(next) == 0) {
+				break;
+			}
+			count++;
+		}
+	}
+
+	if (!(writes = (device_write_t *)calloc(count, sizeof(device_write_t))) ||
+		!(inputs = (xmlNode **)calloc(count, sizeof(xmlNode *)))) {
+		log_error("%s", server_err_msg[ERR_NO_MEM].msgs);
+		for (item = first; item != next; item = item->next) {
+			if (obix_batch_is_command(item) == 1) {
+				obix_batch_add_item(batch_out,
+									obix_server_generate_error(NULL,
+											server_err_msg[ERR_NO_MEM].type,
+											"obix:Batch",
+											server_err_msg[ERR_NO_MEM].msgs));
+			}
+		}
+		goto out;
+	}
+
+	for (i = 0, item = first; item != next; item = item->next) {
+		if (obix_batch_is_command(item) == 0) {
+			continue;
+		}
+
+		/* Verified as a valid href already */
+		href = xmlGetProp(item, BAD_CAST OBIX_ATTR_VAL);
+
+		inputs[i] = item->children;
+		writes[i].href = href;
+
+		if (!href) {
+			writes[i].ret = ERR_NO_MEM;
+		} else if ((writes[i].ret = obix_server_write_check(href,
+											item->children, &val)) == 0) {
+			writes[i].val = val;
+		}
+
+		i++;
+	}
+
+	device_update_uris(writes, count);
+
+	for (i = 0; i < count; i++) {
+		if (writes[i].ret == 0) {
+			switch (readback) {
+			case BATCH_READBACK_FULL:
+				node = obix_server_read(request, writes[i].href);
+				break;
+			case BATCH_READBACK_NONE:
+				node = obix_batch_write_status(BAD_CAST OBIX_OBJ,
+											   writes[i].href, NULL);
+				break;
+			case BATCH_READBACK_COMPACT:
+			default:
+				node = obix_batch_write_status(inputs[i]->name,
+											   writes[i].href,
+											   writes[i].val);
+				break;
+			}
+
+			/* Have the first written device saved, see handlerBatch() */
+			if (!*uri) {
+				*uri = xmlStrdup(writes[i].href);
+			}
+		} else {
+			log_error("%s : %s", writes[i].href,
+					  server_err_msg[writes[i].ret].msgs);
+			node = obix_server_generate_error(writes[i].href,
+											  server_err_msg[writes[i].ret].type,
+											  "Write",
+											  server_err_msg[writes[i].ret].msgs);
+		}
+
+		obix_batch_add_item(batch_out, node);
+	}
+
+	/* Fall through */
+
+out:
+	if (writes) {
+		for (i = 0; i < count; i++) {
+			if (writes[i].href) {
+				xmlFree((xmlChar *)writes[i].href);
+			}
+
+			if (writes[i].val) {
+				xmlFree((xmlChar *)writes[i].val);
+			}
+		}
+
+		free(writes);
+	}
+
+	if (inputs) {
+		free(inputs);
+	}
+
+	return next;
+}
+
+/*
+ * A read request in a run of consecutive ones in a batch, which
+ * are handled in parallel
+ */
+typedef struct batch_slot {
+	xmlNode *item;
+
+	/* The response to the read request */
+	xmlNode *result;
+
+	/* The identity of the device hosting the href, or NULL */
+	const void *key;
+
+	/* The next read request on the same device */
+	struct batch_slot *next;
+} batch_slot_t;
+
+/* The context of a run of read requests being handled in parallel */
+typedef struct batch_run {
+	obix_request_t *request;
+
+	BATCH_READBACK readback;
+
+	/* The number of chains not yet handled, protected by the pool mutex */
+	int pending;
+} batch_run_t;
+
+/*
+ * A chain of read requests on the same device, which are handled
+ * one after another in their original order by one thread
+ */
+typedef struct batch_chain {
+	batch_slot_t *head, *tail;
+
+	batch_run_t *run;
+
+	/* Joining the queue of the worker pool */
+	struct list_head list;
+} batch_chain_t;
+
+/*
+ * The pool of worker threads shared by all batch requests, so that
+ * the number of threads handling batch items is bounded no matter
+ * how many batch requests are handled at the same time
+ */
+typedef struct obix_batch_pool {
+	pthread_t *threads;
+	int count;
+
+	/* The queue of chains waiting to be handled */
+	struct list_head queue;
+
+	pthread_mutex_t mutex;
+
+	/* Signalled when chains are queued or the pool is shutting down */
+	pthread_cond_t wq;
+
+	/* Signalled when all chains of a run have been handled */
+	pthread_cond_t done;
+
+	int shutdown;
+} obix_batch_pool_t;
+
+static obix_batch_pool_t *_pool;
+
+static void obix_batch_run_chain(batch_chain_t *chain)
+{
+	batch_slot_t *slot;
+
+	for (slot = chain->head; slot; slot = slot->next) {
+		slot->result = obix_batch_process_item(chain->run->request,
+											   slot->item, NULL,
+											   chain->run->readback);
+	}
+}
+
+/*
+ * NOTE: callers must have held the mutex of the pool
+ */
+static void __obix_batch_finish_chain(batch_chain_t *chain)
+{
+	if (--chain->run->pending == 0) {
+		pthread_cond_broadcast(&_pool->done);
+	}
+}
+
+static void *obix_batch_worker(void *arg)
+{
+	batch_chain_t *chain;
+
+	pthread_mutex_lock(&_pool->mutex);
+
+	for (;;) {
+		while (_pool->shutdown == 0 && list_empty(&_pool->queue) == 1) {
+			pthread_cond_wait(&_pool->wq, &_pool->mutex);
+		}
+
+		if (list_empty(&_pool->queue) == 1) {
+			break;		/* shutting down */
+		}
+
+		chain = list_first_entry(&_pool->queue, batch_chain_t, list);
+		list_del_init(&chain->list);
+
+		pthread_mutex_unlock(&_pool->mutex);
+
+		obix_batch_run_chain(chain);
+
+		pthread_mutex_lock(&_pool->mutex);
+		__obix_batch_finish_chain(chain);
+	}
+
+	pthread_mutex_unlock(&_pool->mutex);
+
+	return NULL;
+}
+
+/*
+ * Check if the given batch item is a read request
+ *
+ * Return 1 if so, 0 otherwise
+ */
+static int obix_batch_is_read(xmlNode *batchItem)
+{
+	xmlChar *is_attr;
+	int ret = 0;
+
+	if ((is_attr = xmlGetProp(batchItem, BAD_CAST OBIX_ATTR_IS)) != NULL) {
+		ret = (xmlStrcasecmp(is_attr, BAD_CAST OBIX_CONTRACT_OP_READ) == 0) ?
+					1 : 0;
+		xmlFree(is_attr);
+	}
+
+	return ret;
+}
+
+/*
+ * Get the identity of the device that the given read request is on,
+ * or NULL if it is not on any device
+ */
+static const void *obix_batch_read_key(xmlNode *batchItem)
+{
+	xmlChar *href;
+	const void *key = NULL;
+
+	if ((href = xmlGetProp(batchItem, BAD_CAST OBIX_ATTR_VAL)) != NULL) {
+		if (xml_is_valid_href(href) == 1 &&
+			is_given_type(href, OBIX_DEVICE) == 1) {
+			key = device_host_key(href);
+		}
+
+		xmlFree(href);
+	}
+
+	return key;
+}
+
+/*
+ * Handle the run of consecutive read requests starting from the given
+ * batch item in parallel, with requests on the same device handled by
+ * one thread in their original order. Responses are added into the
+ * batchOut contract in the order of requests
+ *
+ * Return the first batch item after the run
+ */
+static xmlNode *obix_batch_read_parallel(obix_request_t *request,
+										 xmlNode *first, xmlNode *batch_out,
+										 BATCH_READBACK readback)
+{
+	batch_run_t run;
+	batch_slot_t *slots = NULL;
+	batch_chain_t *chains = NULL, *chain;
+	xmlNode *item, *next;
+	int i, j, count = 0, num = 0;
+
+	for (next = first; next; next = next->next) {
+		if (obix_batch_is_command(next) == 1) {
+			if (obix_batch_is_read(next) == 0) {
+				break;
+			}
+			count++;
+		}
+	}
+
+	/* Handle them one by one if not worthwhile or no pool available */
+	if (count < 2 || !_pool || _pool->count == 0 ||
+		!(slots = (batch_slot_t *)calloc(count, sizeof(batch_slot_t))) ||
+		!(chains = (batch_chain_t *)calloc(count, sizeof(batch_chain_t)))) {
+		for (item = first; item != next; item = item->next) {
+			if (obix_batch_is_command(item) == 1) {
+				obix_batch_add_item(batch_out,
+									obix_batch_process_item(request, item,
+															NULL, readback));
+			}
+		}
+		goto out;
+	}
+
+	run.request = request;
+	run.readback = readback;
+
+	for (i = 0, item = first; item != next; item = item->next) {
+		if (obix_batch_is_command(item) == 0) {
+			continue;
+		}
+
+		slots[i].item = item;
+		slots[i].key = obix_batch_read_key(item);
+
+		for (j = 0; j < num && chains[j].head->key != slots[i].key; j++);	/* do nothing */
+
+		if (j == num) {
+			chains[num].run = &run;
+			INIT_LIST_HEAD(&chains[num].list);
+			chains[num].head = chains[num].tail = &slots[i];
+			num++;
+		} else {
+			chains[j].tail->next = &slots[i];
+			chains[j].tail = &slots[i];
+		}
+
+		i++;
+	}
+
+	run.pending = num;
+
+	/*
+	 * Queue all chains but the first one which is handled by the
+	 * current thread, which then takes over any of the rest that
+	 * have not been picked up by worker threads yet instead of
+	 * waiting idly
+	 */
+	pthread_mutex_lock(&_pool->mutex);
+
+	for (j = 1; j < num; j++) {
+		list_add_tail(&chains[j].list, &_pool->queue);
+	}
+
+	if (num > 1) {
+		pthread_cond_broadcast(&_pool->wq);
+	}
+
+	chain = &chains[0];
+
+	do {
+		pthread_mutex_unlock(&_pool->mutex);
+
+		obix_batch_run_chain(chain);
+
+		pthread_mutex_lock(&_pool->mutex);
+		__obix_batch_finish_chain(chain);
+
+		for (j = 1, chain = NULL; j < num; j++) {
+			if (list_empty(&chains[j].list) == 0) {
+				chain = &chains[j];
+				list_del_init(&chain->list);
+				break;
+			}
+		}
+	} while (chain);
+
+	while (run.pending > 0) {
+		pthread_cond_wait(&_pool->done, &_pool->mutex);
+	}
+
+	pthread_mutex_unlock(&_pool->mutex);
+
+	for (i = 0; i < count; i++) {
+		obix_batch_add_item(batch_out, slots[i].result);
+	}
+
+	/* Fall through */
+
+out:
+	if (slots) {
+		free(slots);
+	}
+
+	if (chains) {
+		free(chains);
+	}
+
+	return next;
+}
+
+/*
+ * Get the responses expected for successful writes in the given
+ * batchIn contract, compact ones by default
+ *
+ * Return the readback option, or < 0 if it is illegal
+ */
+static int obix_batch_get_readback(xmlNode *input)
+{
+	xmlChar *attr;
+	int ret = -1;
+
+	if (!(attr = xmlGetProp(input, BAD_CAST OBIX_BATCH_ATTR_READBACK))) {
+		return BATCH_READBACK_COMPACT;
+	}
+
+	if (xmlStrcmp(attr, BAD_CAST OBIX_BATCH_READBACK_COMPACT) == 0) {
+		ret = BATCH_READBACK_COMPACT;
+	} else if (xmlStrcmp(attr, BAD_CAST OBIX_BATCH_READBACK_FULL) == 0) {
+		ret = BATCH_READBACK_FULL;
+	} else if (xmlStrcmp(attr, BAD_CAST OBIX_BATCH_READBACK_NONE) == 0) {
+		ret = BATCH_READBACK_NONE;
+	}
+
+	xmlFree(attr);
+	return ret;
 }
 
 /**
@@ -178,6 +709,7 @@ xmlNode *handlerBatch(obix_request_t *request, const xmlChar *uri,
 {
 	xmlNode *batch_out = NULL, *item;
 	xmlChar *is_attr = NULL, *dev_uri = NULL;
+	int readback;
 	int ret = 0;
 
 	if (!input) {
@@ -192,7 +724,8 @@ xmlNode *handlerBatch(obix_request_t *request, const xmlChar *uri,
 
 	if (xmlStrcmp(input->name, BAD_CAST OBIX_OBJ_LIST) != 0 ||
 		!(is_attr = xmlGetProp(input, BAD_CAST OBIX_ATTR_IS)) ||
-		xmlStrcmp(is_attr, BAD_CAST OBIX_CONTRACT_BATCH_IN) != 0) {
+		xmlStrcmp(is_attr, BAD_CAST OBIX_CONTRACT_BATCH_IN) != 0 ||
+		(readback = obix_batch_get_readback(input)) < 0) {
 		ret = ERR_INVALID_INPUT;
 		goto failed;
 	}
@@ -201,9 +734,29 @@ xmlNode *handlerBatch(obix_request_t *request, const xmlChar *uri,
 	 * If the batchIn contract is malformed, then not all of its commands
 	 * may have a chance to be processed
 	 */
-	for (item = input->children; item; item = item->next) {
-		if (item->type != XML_ELEMENT_NODE ||
-			xmlStrcmp(item->name, BAD_CAST OBIX_OBJ_URI) != 0) {
+	for (item = input->children; item; ) {
+		if (obix_batch_is_command(item) == 0) {
+			item = item->next;
+			continue;
+		}
+
+		/*
+		 * Consecutive writes on devices are applied in one bulk, with
+		 * responses to them decided by the readback attribute
+		 */
+		if (obix_batch_is_device_write(item) == 1) {
+			item = obix_batch_write_devices(request, item, batch_out,
+											&dev_uri, readback);
+			continue;
+		}
+
+		/*
+		 * Consecutive reads are handled in parallel by the worker pool,
+		 * with responses added in their original order
+		 */
+		if (obix_batch_is_read(item) == 1) {
+			item = obix_batch_read_parallel(request, item, batch_out,
+											readback);
 			continue;
 		}
 
@@ -219,7 +772,10 @@ xmlNode *handlerBatch(obix_request_t *request, const xmlChar *uri,
 		 * and then back it up to persistent files on the hard drive
 		 * if needed
 		 */
-		obix_batch_process_item(request, item, batch_out, &dev_uri);
+		obix_batch_add_item(batch_out,
+							obix_batch_process_item(request, item, &dev_uri,
+													readback));
+		item = item->next;
 	}
 
 	if (dev_uri) {
@@ -249,3 +805,75 @@ failed:
 
 	return batch_out;
 }
+
+void obix_batch_dispose(void)
+{
+	int i;
+
+	if (!_pool) {
+		return;
+	}
+
+	pthread_mutex_lock(&_pool->mutex);
+	_pool->shutdown = 1;
+	pthread_cond_broadcast(&_pool->wq);
+	pthread_mutex_unlock(&_pool->mutex);
+
+	for (i = 0; i < _pool->count; i++) {
+		if (pthread_join(_pool->threads[i], NULL) != 0) {
+			log_error("Failed to join batch worker thread %d", i);
+		}
+	}
+
+	if (_pool->threads) {
+		free(_pool->threads);
+	}
+
+	pthread_mutex_destroy(&_pool->mutex);
+	pthread_cond_destroy(&_pool->wq);
+	pthread_cond_destroy(&_pool->done);
+
+	free(_pool);
+	_pool = NULL;
+
+	log_debug("The batch worker pool disposed");
+}
+
+/*
+ * Start the pool of worker threads to handle read requests in
+ * batches in parallel, 0 to handle them on request threads only
+ *
+ * Return 0 on success, > 0 for error code
+ */
+int obix_batch_init(const int threads)
+{
+	if (!(_pool = (obix_batch_pool_t *)malloc(sizeof(obix_batch_pool_t)))) {
+		log_error("Failed to allocate the batch worker pool");
+		return ERR_NO_MEM;
+	}
+	memset(_pool, 0, sizeof(obix_batch_pool_t));
+
+	INIT_LIST_HEAD(&_pool->queue);
+	pthread_mutex_init(&_pool->mutex, NULL);
+	pthread_cond_init(&_pool->wq, NULL);
+	pthread_cond_init(&_pool->done, NULL);
+
+	if (threads > 0 &&
+		!(_pool->threads = (pthread_t *)malloc(sizeof(pthread_t) * threads))) {
+		log_error("Failed to allocate the batch worker pool");
+		obix_batch_dispose();
+		return ERR_NO_MEM;
+	}
+
+	for (_pool->count = 0; _pool->count < threads; _pool->count++) {
+		if (pthread_create(_pool->threads + _pool->count, NULL,
+						   obix_batch_worker, NULL) != 0) {
+			log_error("Failed to start batch worker thread %d", _pool->count);
+			obix_batch_dispose();
+			return ERR_NO_MEM;
+		}
+	}
+
+	log_debug("The batch worker pool initialised with %d threads", threads);
+	return 0;
+}
@@ -27,4 +27,7 @@
 
 xmlNode *handlerBatch(obix_request_t *request, const xmlChar *uri, xmlNode *input);
 
+int obix_batch_init(const int threads);
+void obix_batch_dispose(void);
+
 #endif
@@ -19,23 +19,33 @@
  * *****************************************************************************/
 
 #include <libgen.h>			/* dirname */
+#include <stdio.h>			/* snprintf */
 #include <string.h>			/* memset */
 #include <stdlib.h>			/* malloc */
 #include <errno.h>
+#include <math.h>			/* isfinite */
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include "xml_storage.h"
 #include "obix_utils.h"
 #include "list.h"
 #include "tsync.h"
 #include "refcnt.h"
 #include "hash.h"
+#include "radix.h"
 #include "cache.h"
+#include "resp_cache.h"
+#include "ptask.h"
 #include "watch.h"
+#include "device.h"
 #include "xml_utils.h"
+#include "xml_arena.h"
+#include "xml_binary.h"
 #include "log_utils.h"
 #include "security.h"
 #include "errmsg.h"
@@ -52,8 +62,100 @@ static const char *DEVICE_META_CONTRACT =
 
 static const char *DEVICE_OWNER_ID = "owner_id";
 
+static const char *SERVER_DB_DEVICE_SNAPSHOT = "devices.snapshot";
+
+/*
+ * The magic number and format version at the start of the snapshot
+ * file of the device database
+ */
+static const char DEVICE_SNAPSHOT_MAGIC[8] = { 'o', 'B', 'I', 'X', 'S', 'N', 'A', 'P' };
+#define DEVICE_SNAPSHOT_VERSION		1
+
 const xmlChar *OBIX_DEVICES = (xmlChar *)"/obix/devices/";
 
+/*
+ * The maximal length of values of abstime nodes kept in value slots,
+ * e.g. "2015-01-01T00:00:00.000+10:00"
+ */
+#define DEV_VAL_ABSTIME_MAX		40
+
+/* The maximal length of values rendered from value slots */
+#define DEV_VAL_STR_MAX			48
+
+typedef enum {
+	DEV_VAL_NONE = 0,		/* the val attribute is authoritative */
+	DEV_VAL_REAL,
+	DEV_VAL_INT,
+	DEV_VAL_BOOL,
+	DEV_VAL_ABSTIME
+} dev_val_type_t;
+
+/*
+ * The typed value of a leaf node, which is updated in place by
+ * writes without any memory allocation and only rendered into
+ * the val attribute of copies of the node when it is read or
+ * saved onto the hard drive
+ */
+typedef struct dev_val {
+	dev_val_type_t type;
+
+	/* Raised when the val attribute of the node is out of date */
+	int stale;
+
+	union {
+		double r;
+		long i;
+		int b;
+		char t[DEV_VAL_ABSTIME_MAX];
+	} u;
+} dev_val_t;
+
+/*
+ * Entry of the index of a device, mapping a href relative to the
+ * root node of the device contract to relevant node
+ *
+ * NOTE: the psvi pointer of relevant node points back to the entry,
+ * since its _private pointer has been occupied by the device
+ */
+typedef struct dev_index_item {
+	/* The relative href, not preceded or followed by any slash */
+	xmlChar *href;
+
+	/* Pointing to relevant node in the device contract */
+	xmlNode *node;
+
+	/*
+	 * The version of the node, renewed whenever any node in its
+	 * subtree belonging to the same device is changed
+	 */
+	unsigned long version;
+
+	/* The value slot of the node */
+	dev_val_t val;
+
+	/* Next entry in the same collision list */
+	struct dev_index_item *next;
+} dev_index_item_t;
+
+/*
+ * The index of all nodes in a device contract which have their
+ * relative hrefs hashed into collision lists, so that the subnode
+ * with the given href can be found by one hash computation instead
+ * of a tokenised walk on the device subtree
+ *
+ * NOTE: the index is protected by the synchronisation facility
+ * of the hosting device
+ */
+typedef struct dev_index {
+	/* The number of collision lists */
+	unsigned int size;
+
+	/* The number of entries in all collision lists */
+	unsigned int count;
+
+	dev_index_item_t **table;
+} dev_index_t;
+
 /*
  * Descriptor of a device registered on to the oBIX server, acting
  * as a wrapper or extension of relevant xmlNode in the global DOM
@@ -85,6 +187,12 @@ typedef struct obix_dev {
 	/* Pointing to a copy of ref node of the device */
 	xmlNode *ref;
 
+	/* The index of subnodes in the device contract */
+	dev_index_t index;
+
+	/* The version of the root node of the device contract */
+	unsigned long version;
+
 	/*
 	 * Synchronisation facility to manage the life-cycle of
 	 * the device descriptor itself
@@ -113,8 +221,18 @@ typedef struct obix_dev {
 	/* Joining the parent device's children list */
 	struct list_head siblings;
 
-	/* Last updated timestamp of the persistent file */
-	time_t mtime;
+	/*
+	 * Joining the queue of devices whose contracts have changed since
+	 * last saved onto the hard drive, protected by the dirty_mutex of
+	 * the Device subsystem
+	 */
+	struct list_head dirty;
+
+	/*
+	 * Indicator of whether persistent files of the device have been
+	 * removed, protected by the persist_mutex of the Device subsystem
+	 */
+	int removed;
 } obix_dev_t;
 
 /*
@@ -128,14 +246,62 @@ typedef struct obix_devices {
 	int backup_period;
 
 	/*
-	 * The hash table of all devices registered, which are
+	 * The queue of dirty devices and the mutex to protect it. A device
+	 * is queued at most once no matter how many times it is changed
+	 * before saved onto the hard drive
+	 */
+	struct list_head dirty;
+	pthread_mutex_t dirty_mutex;
+
+	/*
+	 * The mutex to serialise the saving of device contracts with the
+	 * removal of their persistent files when devices are signed off
+	 */
+	pthread_mutex_t persist_mutex;
+
+	/* The worker thread to save dirty devices periodically */
+	obix_task_t persister;
+
+	/*
+	 * The period to save a snapshot of the whole device database,
+	 * 0 if it's only saved when the server is shutting down, and
+	 * when the last one was saved
+	 */
+	int snapshot_period;
+	time_t snapshot_ts;
+
+	/* The absolute pathname of the snapshot file */
+	char *snapshot_file;
+
+	/* The snapshot mapped into memory during start-up, or NULL */
+	struct dev_snapshot *snapshot;
+
+	/*
+	 * The prefix tree of all devices registered, which are
 	 * recognisable by their unique hrefs
 	 */
-	hash_table_t *tab;
+	radix_tree_t *tree;
 
-	/* The cache used along with the hash table */
+	/*
+	 * The cache of the hosting devices of recently accessed hrefs,
+	 * which must be flushed whenever any device is registered or
+	 * removed since the closest device of some hrefs may change
+	 */
 	cache_t *cache;
 
+	/*
+	 * The cache of serialised responses of recently read hrefs, which
+	 * are matched against the current versions of relevant nodes
+	 */
+	resp_cache_t *resp_cache;
+
+	/*
+	 * The source of versions of nodes in all device contracts, so that
+	 * a node has never had the same version as any of its predecessors
+	 * at the same href
+	 */
+	unsigned long version;
+
 	/* Pointing to the device descriptor of the device root */
 	obix_dev_t *device_root;
 } obix_devices_t;
@@ -157,30 +323,11 @@ int is_device_root_href(const xmlChar *href)
 }
 
 /*
- * Application specific methods to calculate a hash value
- * from the given href. If it starts with the common part of
- * "/obix/deviceRoot/" and longer than it, then skip it over.
+ * Get a brand-new version for a node, 0 is never used
  */
-static unsigned int device_compute_hash(const xmlChar *href,
-										const unsigned int tab_size)
-{
-	int len = xmlStrlen(href);
-	const xmlChar *root = obix_roots[OBIX_DEVICE].root;
-	int root_len = obix_roots[OBIX_DEVICE].len;
-
-	if (xmlStrncmp(href, root, root_len) == 0 && len > root_len) {
-		href += root_len;
-		len -= root_len;
-	}
-
-	return hash_bkdr(href, len, tab_size);
-}
-
-static int device_compare_str(const xmlChar *href, hash_node_t *node)
+static unsigned long device_version_next(void)
 {
-	obix_dev_t *dev = (obix_dev_t *)(node->item);
-
-	return is_str_identical(href, dev->href, 1);
+	return __atomic_add_fetch(&_devices->version, 1, __ATOMIC_RELAXED);
 }
 
 static void device_get(obix_dev_t *dev)
@@ -198,18 +345,276 @@ static void device_get_wrapper(void *dev)
 	device_get((obix_dev_t *)dev);
 }
 
-static hash_table_ops_t device_hash_ops = {
-	.compute = device_compute_hash,
-	.compare = device_compare_str,
-	.get = device_get_wrapper
-};
-
 /* The meta information of a device */
 typedef struct meta_info {
 	char *owner_id;
 	char *href;
 } meta_info_t;
 
+/*
+ * The identity of a persistent file, which changes whenever the file
+ * is re-written
+ */
+typedef struct dev_stamp {
+	int64_t sec;
+	int64_t nsec;
+	int64_t size;
+} dev_stamp_t;
+
+/*
+ * A record in the snapshot of the device database, whose strings and
+ * encoded device contract are referenced in place in the mapped file
+ */
+typedef struct dev_snapshot_record {
+	/* The absolute pathname of the device's contract file */
+	const char *file;
+
+	const char *href;
+	const char *owner_id;
+
+	/* Identities of the meta and contract files when snapshot was taken */
+	dev_stamp_t meta_stamp;
+	dev_stamp_t file_stamp;
+
+	/* The device contract in binary encoding */
+	const char *tree;
+	uint32_t len;
+} dev_snapshot_record_t;
+
+/*
+ * The snapshot of the device database mapped into memory, consulted
+ * at start-up instead of parsing persistent files of devices which
+ * have not changed since the snapshot was taken
+ */
+typedef struct dev_snapshot {
+	void *map;
+	size_t size;
+
+	/* Records sorted by the pathnames of contract files */
+	dev_snapshot_record_t *records;
+	uint32_t count;
+
+	/* The number of devices restored from the snapshot */
+	int restored;
+} dev_snapshot_t;
+
+/*
+ * Get the identity of the given file
+ *
+ * Return 0 on success, < 0 if it can't be accessed
+ */
+static int device_get_stamp(const char *path, dev_stamp_t *stamp)
+{
+	struct stat statbuf;
+
+	if (lstat(path, &statbuf) < 0) {
+		return -1;
+	}
+
+	stamp->sec = statbuf.st_mtim.tv_sec;
+	stamp->nsec = statbuf.st_mtim.tv_nsec;
+	stamp->size = statbuf.st_size;
+
+	return 0;
+}
+
+static int device_compare_stamp(const dev_stamp_t *a, const dev_stamp_t *b)
+{
+	return (a->sec == b->sec && a->nsec == b->nsec &&
+			a->size == b->size) ? 0 : -1;
+}
+
+static int device_snapshot_get_stamp(const char *data, uint32_t size,
+									 uint32_t *pos, dev_stamp_t *stamp)
+{
+	if (*pos > size || size - *pos < sizeof(dev_stamp_t)) {
+		return -1;
+	}
+
+	memcpy(stamp, data + *pos, sizeof(dev_stamp_t));
+	*pos += sizeof(dev_stamp_t);
+
+	return 0;
+}
+
+static int device_snapshot_compare(const void *a, const void *b)
+{
+	return strcmp(((const dev_snapshot_record_t *)a)->file,
+				  ((const dev_snapshot_record_t *)b)->file);
+}
+
+static void device_snapshot_unload(dev_snapshot_t *snap)
+{
+	if (!snap) {
+		return;
+	}
+
+	if (snap->records) {
+		free(snap->records);
+	}
+
+	if (snap->map) {
+		munmap(snap->map, snap->size);
+	}
+
+	free(snap);
+}
+
+/*
+ * Map the snapshot file of the device database into memory and
+ * validate all its records
+ *
+ * Return the snapshot descriptor, or NULL if the snapshot file
+ * doesn't exist or is corrupted
+ */
+static dev_snapshot_t *device_snapshot_load(const char *path)
+{
+	dev_snapshot_t *snap;
+	dev_snapshot_record_t *rec;
+	struct stat statbuf;
+	const char *data;
+	uint32_t pos, size, version, i;
+	int fd;
+
+	errno = 0;
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		if (errno != ENOENT) {
+			log_warning("Failed to open %s because of %s", path,
+						strerror(errno));
+		}
+		return NULL;
+	}
+
+	if (fstat(fd, &statbuf) < 0 || statbuf.st_size <= 0 ||
+		statbuf.st_size > UINT32_MAX) {
+		close(fd);
+		return NULL;
+	}
+
+	if (!(snap = (dev_snapshot_t *)malloc(sizeof(dev_snapshot_t)))) {
+		close(fd);
+		return NULL;
+	}
+	memset(snap, 0, sizeof(dev_snapshot_t));
+
+	snap->size = statbuf.st_size;
+	snap->map = mmap(NULL, snap->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (snap->map == MAP_FAILED) {
+		snap->map = NULL;
+		goto failed;
+	}
+
+	data = (const char *)snap->map;
+	size = snap->size;
+
+	if (size < sizeof(DEVICE_SNAPSHOT_MAGIC) ||
+		memcmp(data, DEVICE_SNAPSHOT_MAGIC, sizeof(DEVICE_SNAPSHOT_MAGIC)) != 0) {
+		goto failed;
+	}
+
+	pos = sizeof(DEVICE_SNAPSHOT_MAGIC);
+
+	if (xml_binary_get_u32(data, size, &pos, &version) < 0 ||
+		version != DEVICE_SNAPSHOT_VERSION ||
+		xml_binary_get_u32(data, size, &pos, &snap->count) < 0 ||
+		snap->count > size / sizeof(dev_snapshot_record_t) + 1) {
+		goto failed;
+	}
+
+	if (snap->count > 0 &&
+		!(snap->records = (dev_snapshot_record_t *)
+				malloc(sizeof(dev_snapshot_record_t) * snap->count))) {
+		goto failed;
+	}
+
+	for (i = 0; i < snap->count; i++) {
+		rec = &snap->records[i];
+
+		if (!(rec->file = xml_binary_get_str(data, size, &pos)) ||
+			!(rec->href = xml_binary_get_str(data, size, &pos)) ||
+			!(rec->owner_id = xml_binary_get_str(data, size, &pos)) ||
+			device_snapshot_get_stamp(data, size, &pos, &rec->meta_stamp) < 0 ||
+			device_snapshot_get_stamp(data, size, &pos, &rec->file_stamp) < 0 ||
+			xml_binary_get_u32(data, size, &pos, &rec->len) < 0 ||
+			size - pos < rec->len) {
+			goto failed;
+		}
+
+		rec->tree = data + pos;
+		pos += rec->len;
+	}
+
+	if (pos != size) {
+		goto failed;
+	}
+
+	if (snap->count > 0) {
+		qsort(snap->records, snap->count, sizeof(dev_snapshot_record_t),
+			  device_snapshot_compare);
+	}
+
+	return snap;
+
+failed:
+	log_warning("Ignored corrupted snapshot of device database at %s", path);
+	device_snapshot_unload(snap);
+	return NULL;
+}
+
+/*
+ * A device to be loaded from its persistent files or the snapshot
+ *
+ * Loading takes two steps. Device contracts are prepared by loader
+ * threads in parallel, which is where parsing or decoding takes place.
+ * Then they are added into the global DOM tree one by one in the order
+ * of the walk on the folders of the device database, so that a parent
+ * device is always added before any of its children
+ */
+typedef struct dev_load_job {
+	/* The absolute pathnames of the meta and contract files */
+	char *meta;
+	char *file;
+
+	/* The owner ID and href of the device */
+	meta_info_t info;
+
+	/* The device contract prepared, or NULL if nothing to load */
+	xmlNode *node;
+
+	/* The document of the contract if parsed from file, or NULL */
+	xmlDoc *doc;
+
+	/* Whether the contract has been decoded from the snapshot */
+	int from_snapshot;
+
+	/* Error code of the preparation */
+	int ret;
+
+	/* Whether the preparation has completed */
+	int done;
+} dev_load_job_t;
+
+typedef struct dev_loader {
+	/* Jobs in the order of the walk on folders */
+	dev_load_job_t *jobs;
+	int count, size;
+
+	/* The next job to be prepared */
+	int next;
+
+	/* Raised to stop loader threads on any error */
+	int abort;
+
+	/* Protecting all fields above but the content of jobs */
+	pthread_mutex_t mutex;
+
+	/* Signalled whenever a job has been prepared */
+	pthread_cond_t cond;
+} dev_loader_t;
+
 /*
  * Read the owner ID and href information of a device from
  * its meta file
@@ -246,135 +651,429 @@ static int device_load_meta(const char *path, meta_info_t *info)
 	return ret;
 }
 
-static int device_load_contract(const char *path, meta_info_t *info);
-static int device_load_files(const char *resdir);
-
 /*
- * Load a child device contract from the given folder
+ * Decode the device contract of the given job from the snapshot,
+ * if neither of its persistent files has changed since the snapshot
+ * was taken
  *
- * Return 0 on success, < 0 on error so as to break from
- * the for_each_file_name loop
+ * NOTE: the snapshot is read-only while devices are being loaded
+ * and therefore accessed by loader threads without locking
+ *
+ * Return 0 on success, < 0 if the device has to be loaded from its
+ * persistent files instead
  */
-static int device_load_child(const char *dir, const char *file, void *arg)
+static int device_prepare_snapshot(dev_load_job_t *job)
 {
-	struct stat statbuf;
-	char *path;
-	int ret = 0;
+	dev_snapshot_t *snap = _devices->snapshot;
+	dev_snapshot_record_t key, *rec;
+	dev_stamp_t meta_stamp, file_stamp;
 
-	if (link_pathname(&path, dir, NULL, file, NULL) < 0) {
-		log_error("Failed to assemble absolute path name for %s/%s", dir, file);
+	if (!snap || snap->count == 0) {
 		return -1;
 	}
 
-	/*
-	 * Skip over meta or contract files of the parent device,
-	 * return 0 so as to move on to the next children device
-	 */
-	if (lstat(path, &statbuf) < 0 || S_ISDIR(statbuf.st_mode) == 0) {
-		free(path);
-		return 0;
+	key.file = job->file;
+
+	if (!(rec = (dev_snapshot_record_t *)bsearch(&key, snap->records,
+											snap->count,
+											sizeof(dev_snapshot_record_t),
+											device_snapshot_compare)) ||
+		device_get_stamp(job->meta, &meta_stamp) < 0 ||
+		device_get_stamp(job->file, &file_stamp) < 0 ||
+		device_compare_stamp(&rec->meta_stamp, &meta_stamp) < 0 ||
+		device_compare_stamp(&rec->file_stamp, &file_stamp) < 0) {
+		return -1;
 	}
 
-	if (device_load_files(path) != 0) {
-		log_error("Failed to load child device %s", path);
-		ret = -1;
+	if (!(job->info.href = strdup(rec->href)) ||
+		!(job->info.owner_id = strdup(rec->owner_id))) {
+		return -1;
 	}
 
-	free(path);
-	return ret;
+	if (!(job->node = xml_binary_decode(rec->tree, rec->len))) {
+		log_warning("Failed to decode device of %s from snapshot", rec->href);
+		return -1;
+	}
+
+	job->from_snapshot = 1;
+
+	return 0;
 }
 
 /*
- * Load all device persistent files from the hard drive
+ * Parse the meta and contract files of the given job
  *
  * Return 0 on success, > 0 for error code
  */
-static int device_load_files(const char *resdir)
+static int device_prepare_files(dev_load_job_t *job)
 {
-	meta_info_t info = { NULL, NULL };
-	char *meta = NULL, *file = NULL;
-	int ret = 0;
+	struct stat statbuf;
+	int ret;
 
-	/*
-	 * Load the meta and contract files in the current directory first,
-	 * then move on to its children to ensure the parent device is setup
-	 * before any of its children devices.
-	 *
-	 * It doesn't matter if the meta or contract file is missing, e.g.
-	 * in the top directory of the Device Root where the helper function
-	 * doesn't need to load anything
-	 */
-	if (link_pathname(&meta, resdir, NULL, SERVER_DB_DEVICE_META,
-					  XML_FILENAME_SUFFIX) < 0 ||
-		link_pathname(&file, resdir, NULL, SERVER_DB_DEVICE_CONTRACT,
-					  XML_FILENAME_SUFFIX) < 0) {
-		log_error("Failed to assemble pathname for persistent files under %s",
-				  resdir);
-		ret = ERR_NO_MEM;
-		goto failed;
+	if ((ret = device_load_meta(job->meta, &job->info)) != 0) {
+		log_error("Failed to load device meta at %s", job->meta);
+		return ret;
 	}
 
-	if ((ret = device_load_meta(meta, &info)) != 0) {
-		log_error("Failed to load device meta at %s", meta);
-		goto failed;
+	/*
+	 * It doesn't matter if the contract file is missing, e.g. in the
+	 * top directory of the Device Root where nothing is to be loaded
+	 */
+	errno = 0;
+	if (lstat(job->file, &statbuf) < 0) {
+		return (errno == ENOENT) ? 0 : ERR_DISK_IO;
 	}
 
-	if ((ret = device_load_contract(file, &info)) != 0) {
-		log_error("Failed to load device contract at %s", file);
-		goto failed;
+	if (!job->info.href) {
+		log_error("No meta file for device contract at %s", job->file);
+		return ERR_NO_MEM;
 	}
 
-	if (for_each_file_name(resdir, NULL, NULL,
-						   device_load_child, NULL) < 0) {
-		ret = ERR_DISK_IO;
+	if (!(job->doc = xmlReadFile(job->file, NULL,
+								 XML_PARSE_OPTIONS_COMMON | XML_PARSE_NODICT)) ||
+		!(job->node = xmlDocGetRootElement(job->doc))) {
+		log_error("Unable to parse XML document %s", job->file);
+		return ERR_NO_MEM;
 	}
 
-	/* Fall through */
-
-failed:
-	if (info.owner_id) {
-		free(info.owner_id);
-	}
+	return 0;
+}
 
-	if (info.href) {
-		free(info.href);
+static void device_reset_job(dev_load_job_t *job)
+{
+	if (job->info.owner_id) {
+		free(job->info.owner_id);
+		job->info.owner_id = NULL;
 	}
 
-	if (meta) {
-		free(meta);
+	if (job->info.href) {
+		free(job->info.href);
+		job->info.href = NULL;
 	}
 
-	if (file) {
-		free(file);
+	if (job->doc) {
+		xmlFreeDoc(job->doc);		/* along with its root node */
+	} else if (job->node) {
+		xmlFreeNode(job->node);
 	}
 
-	return ret;
+	job->doc = NULL;
+	job->node = NULL;
+	job->from_snapshot = 0;
 }
 
 /*
- * Remove the given device's persistent files on the hard drive
+ * Prepare the device contract of the given job, restoring it from the
+ * snapshot if possible, otherwise parsing its persistent files
  */
-static void __device_remove_files(obix_dev_t *dev)
+static void device_prepare_job(dev_load_job_t *job)
 {
-	if (dev->meta) {
-		unlink(dev->meta);
-	}
-
-	if (dev->file) {
-		unlink(dev->file);
-	}
-
-	if (dev->dir) {
-		rmdir(dev->dir);
+	if (device_prepare_snapshot(job) < 0) {
+		device_reset_job(job);
+		job->ret = device_prepare_files(job);
 	}
 }
 
 /*
- * Create persistent device files on the hard drive for the given device
+ * Add the device contract prepared by the given job into the global
+ * DOM tree
  *
  * Return 0 on success, > 0 for error code
  */
-static int __device_create_files(obix_dev_t *dev)
+static int device_add_job(dev_load_job_t *job)
+{
+	int ret;
+
+	if (job->ret != 0 || !job->node) {
+		return job->ret;
+	}
+
+	ret = device_add(job->node, BAD_CAST job->info.href,
+					 job->info.owner_id, 0);
+
+	/*
+	 * The contract is now part of the global DOM tree, or has been
+	 * released as a duplicate of an existing device
+	 */
+	if (ret == 0) {
+		job->node = NULL;
+		if (job->from_snapshot == 1) {
+			_devices->snapshot->restored++;
+		}
+		return 0;
+	}
+
+	/* Fall back to the persistent files if the snapshot is rejected */
+	if (job->from_snapshot == 1) {
+		log_warning("Failed to restore device of %s from snapshot",
+					job->info.href);
+		device_reset_job(job);
+		if ((job->ret = device_prepare_files(job)) == 0) {
+			return device_add_job(job);
+		}
+		return job->ret;
+	}
+
+	return ret;
+}
+
+/*
+ * Claim the next job to be prepared
+ *
+ * NOTE: callers must have held the mutex of the loader
+ *
+ * Return the index of the job, or < 0 if no more jobs
+ */
+static int __device_loader_claim(dev_loader_t *loader)
+{
+	return (loader->abort == 1 || loader->next >= loader->count) ?
+				-1 : loader->next++;
+}
+
+static void *device_loader_thread(void *arg)
+{
+	dev_loader_t *loader = (dev_loader_t *)arg;
+	int i;
+
+	pthread_mutex_lock(&loader->mutex);
+
+	while ((i = __device_loader_claim(loader)) >= 0) {
+		pthread_mutex_unlock(&loader->mutex);
+
+		device_prepare_job(&loader->jobs[i]);
+
+		pthread_mutex_lock(&loader->mutex);
+		loader->jobs[i].done = 1;
+		pthread_cond_broadcast(&loader->cond);
+	}
+
+	pthread_mutex_unlock(&loader->mutex);
+
+	return NULL;
+}
+
+/*
+ * Append a job for the device folder of the given pathname
+ *
+ * Return 0 on success, < 0 on error
+ */
+static int device_loader_push(dev_loader_t *loader, const char *dir)
+{
+	dev_load_job_t *jobs, *job;
+	int size;
+
+	if (loader->count == loader->size) {
+		size = (loader->size == 0) ? 64 : loader->size * 2;
+		if (!(jobs = (dev_load_job_t *)realloc(loader->jobs,
+										sizeof(dev_load_job_t) * size))) {
+			return -1;
+		}
+
+		loader->jobs = jobs;
+		loader->size = size;
+	}
+
+	job = &loader->jobs[loader->count];
+	memset(job, 0, sizeof(dev_load_job_t));
+
+	if (link_pathname(&job->meta, dir, NULL, SERVER_DB_DEVICE_META,
+					  XML_FILENAME_SUFFIX) < 0 ||
+		link_pathname(&job->file, dir, NULL, SERVER_DB_DEVICE_CONTRACT,
+					  XML_FILENAME_SUFFIX) < 0) {
+		if (job->meta) {
+			free(job->meta);
+		}
+		return -1;
+	}
+
+	loader->count++;
+
+	return 0;
+}
+
+static int device_loader_scan(dev_loader_t *loader, const char *dir);
+
+/*
+ * Scan a child device folder
+ *
+ * Return 0 on success, < 0 on error so as to break from
+ * the for_each_file_name loop
+ */
+static int device_loader_scan_child(const char *dir, const char *file,
+									void *arg)
+{
+	struct stat statbuf;
+	char *path;
+	int ret = 0;
+
+	if (link_pathname(&path, dir, NULL, file, NULL) < 0) {
+		log_error("Failed to assemble absolute path name for %s/%s", dir, file);
+		return -1;
+	}
+
+	/*
+	 * Skip over meta or contract files of the parent device,
+	 * return 0 so as to move on to the next children device
+	 */
+	if (lstat(path, &statbuf) < 0 || S_ISDIR(statbuf.st_mode) == 0) {
+		free(path);
+		return 0;
+	}
+
+	if (device_loader_scan((dev_loader_t *)arg, path) < 0) {
+		log_error("Failed to scan child device %s", path);
+		ret = -1;
+	}
+
+	free(path);
+	return ret;
+}
+
+/*
+ * Walk the given folder and all its sub-folders, appending jobs for
+ * the current folder first to ensure a parent device is setup before
+ * any of its children devices
+ *
+ * Return 0 on success, < 0 on error
+ */
+static int device_loader_scan(dev_loader_t *loader, const char *dir)
+{
+	if (device_loader_push(loader, dir) < 0) {
+		log_error("Failed to assemble pathname for persistent files under %s",
+				  dir);
+		return -1;
+	}
+
+	return for_each_file_name(dir, NULL, NULL, device_loader_scan_child,
+							  loader);
+}
+
+/*
+ * Load all device persistent files from the hard drive, with the help
+ * of the given number of loader threads
+ *
+ * Return 0 on success, > 0 for error code
+ */
+static int device_load_files(const char *resdir, int threads)
+{
+	dev_loader_t loader;
+	pthread_t *id = NULL;
+	dev_load_job_t *job;
+	int i, j, started = 0, ret = 0;
+
+	memset(&loader, 0, sizeof(dev_loader_t));
+	pthread_mutex_init(&loader.mutex, NULL);
+	pthread_cond_init(&loader.cond, NULL);
+
+	if (device_loader_scan(&loader, resdir) < 0) {
+		log_error("Failed to walk the device database at %s", resdir);
+		ret = ERR_DISK_IO;
+		goto out;
+	}
+
+	/* No point having more threads than jobs */
+	if (threads > loader.count) {
+		threads = loader.count;
+	}
+
+	if (threads > 0 &&
+		!(id = (pthread_t *)malloc(sizeof(pthread_t) * threads))) {
+		threads = 0;
+	}
+
+	for (started = 0; started < threads; started++) {
+		if (pthread_create(id + started, NULL, device_loader_thread,
+						   &loader) != 0) {
+			log_warning("Failed to start device loader thread %d", started);
+			break;
+		}
+	}
+
+	/*
+	 * Add devices strictly in the order of jobs. The current thread
+	 * prepares jobs as well instead of waiting idly, and prepares all
+	 * of them if no loader threads are available
+	 */
+	for (i = 0; i < loader.count; i++) {
+		job = &loader.jobs[i];
+
+		pthread_mutex_lock(&loader.mutex);
+
+		while (job->done == 0) {
+			if ((j = __device_loader_claim(&loader)) >= 0) {
+				pthread_mutex_unlock(&loader.mutex);
+				device_prepare_job(&loader.jobs[j]);
+				pthread_mutex_lock(&loader.mutex);
+				loader.jobs[j].done = 1;
+				continue;
+			}
+
+			pthread_cond_wait(&loader.cond, &loader.mutex);
+		}
+
+		pthread_mutex_unlock(&loader.mutex);
+
+		if ((ret = device_add_job(job)) != 0) {
+			log_error("Failed to load device contract at %s", job->file);
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&loader.mutex);
+	loader.abort = 1;
+	pthread_mutex_unlock(&loader.mutex);
+
+	for (i = 0; i < started; i++) {
+		pthread_join(id[i], NULL);
+	}
+
+	/* Fall through */
+
+out:
+	for (i = 0; i < loader.count; i++) {
+		device_reset_job(&loader.jobs[i]);
+		free(loader.jobs[i].meta);
+		free(loader.jobs[i].file);
+	}
+
+	if (loader.jobs) {
+		free(loader.jobs);
+	}
+
+	if (id) {
+		free(id);
+	}
+
+	pthread_mutex_destroy(&loader.mutex);
+	pthread_cond_destroy(&loader.cond);
+
+	return ret;
+}
+
+/*
+ * Remove the given device's persistent files on the hard drive
+ */
+static void __device_remove_files(obix_dev_t *dev)
+{
+	if (dev->meta) {
+		unlink(dev->meta);
+	}
+
+	if (dev->file) {
+		unlink(dev->file);
+	}
+
+	if (dev->dir) {
+		rmdir(dev->dir);
+	}
+}
+
+/*
+ * Create persistent device files on the hard drive for the given device
+ *
+ * Return 0 on success, > 0 for error code
+ */
+static int __device_create_files(obix_dev_t *dev)
 {
 	int fd, ret = ERR_DISK_IO, errno_saved = 0;
 
@@ -449,136 +1148,1069 @@ static int __device_write_meta(obix_dev_t *dev)
 	return ret;
 }
 
-static time_t __device_get_file_ts(obix_dev_t *dev)
+/*
+ * The initial number of collision lists in the index of a device,
+ * which will be doubled whenever they become too long on average
+ */
+#define DEV_INDEX_SIZE			61
+
+/*
+ * The maximal length of relative hrefs that could be looked up in
+ * the index of a device, longer ones are resolved by a DOM walk
+ */
+#define DEV_INDEX_HREF_MAX		256
+
+static dev_val_type_t device_val_type(const xmlNode *node)
 {
-	struct stat statbuf;
+	if (xmlStrcmp(node->name, BAD_CAST OBIX_OBJ_REAL) == 0) {
+		return DEV_VAL_REAL;
+	} else if (xmlStrcmp(node->name, BAD_CAST OBIX_OBJ_INT) == 0) {
+		return DEV_VAL_INT;
+	} else if (xmlStrcmp(node->name, BAD_CAST OBIX_OBJ_BOOL) == 0) {
+		return DEV_VAL_BOOL;
+	} else if (xmlStrcmp(node->name, BAD_CAST OBIX_OBJ_ABSTIME) == 0) {
+		return DEV_VAL_ABSTIME;
+	}
 
-	return (lstat(dev->file, &statbuf) == 0) ? statbuf.st_mtime : 0;
+	return DEV_VAL_NONE;
 }
 
 /*
- * Copy the subtree of a device, EXCLUDING any of its
- * children devices
+ * Convert the given string into a typed value as specified by the
+ * type of the node
+ *
+ * Return 0 on success, < 0 if the node is not typed or the string
+ * can't be represented by the value slot losslessly
  */
-static xmlNode *__device_copy_no_child(obix_dev_t *parent, const xmlNode *src)
+static int device_val_parse(const xmlNode *node, const xmlChar *str,
+							dev_val_t *val)
 {
-	xmlNode *copy_src, *copy_node, *node;
+	char *end;
+	int ret = -1;
+
+	memset(val, 0, sizeof(dev_val_t));
+
+	if (!str || *str == '\0') {
+		return -1;
+	}
+
+	switch ((val->type = device_val_type(node))) {
+	case DEV_VAL_REAL:
+		val->u.r = strtod((const char *)str, &end);
+		if (*end == '\0' && isfinite(val->u.r)) {
+			ret = 0;
+		}
+		break;
+	case DEV_VAL_INT:
+		errno = 0;
+		val->u.i = strtol((const char *)str, &end, 10);
+		if (*end == '\0' && errno == 0) {
+			ret = 0;
+		}
+		break;
+	case DEV_VAL_BOOL:
+		if (xmlStrcmp(str, BAD_CAST XML_TRUE) == 0) {
+			val->u.b = 1;
+			ret = 0;
+		} else if (xmlStrcmp(str, BAD_CAST XML_FALSE) == 0) {
+			val->u.b = 0;
+			ret = 0;
+		}
+		break;
+	case DEV_VAL_ABSTIME:
+		if (xmlStrlen(str) < DEV_VAL_ABSTIME_MAX) {
+			strcpy(val->u.t, (const char *)str);
+			ret = 0;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (ret < 0) {
+		val->type = DEV_VAL_NONE;
+	}
+
+	return ret;
+}
+
+/*
+ * Return 1 if the given typed values are the same, numerically
+ * for numbers, 0 otherwise
+ */
+static int device_val_equal(const dev_val_t *a, const dev_val_t *b)
+{
+	if (a->type != b->type) {
+		return 0;
+	}
+
+	switch (a->type) {
+	case DEV_VAL_REAL:
+		return (a->u.r == b->u.r) ? 1 : 0;
+	case DEV_VAL_INT:
+		return (a->u.i == b->u.i) ? 1 : 0;
+	case DEV_VAL_BOOL:
+		return (a->u.b == b->u.b) ? 1 : 0;
+	case DEV_VAL_ABSTIME:
+		return (strcmp(a->u.t, b->u.t) == 0) ? 1 : 0;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Render the given typed value into the given buffer of DEV_VAL_STR_MAX
+ * bytes, unless it is a string already
+ *
+ * Reals are rendered in 15 significant digits, which is good enough for
+ * most of them, and in 17 digits if that doesn't parse back into the
+ * very same double
+ */
+static const xmlChar *device_val_render(const dev_val_t *val, char *buf)
+{
+	switch (val->type) {
+	case DEV_VAL_REAL:
+		snprintf(buf, DEV_VAL_STR_MAX, "%.15g", val->u.r);
+		if (strtod(buf, NULL) != val->u.r) {
+			snprintf(buf, DEV_VAL_STR_MAX, "%.17g", val->u.r);
+		}
+		break;
+	case DEV_VAL_INT:
+		snprintf(buf, DEV_VAL_STR_MAX, "%ld", val->u.i);
+		break;
+	case DEV_VAL_BOOL:
+		return BAD_CAST ((val->u.b == 1) ? XML_TRUE : XML_FALSE);
+	case DEV_VAL_ABSTIME:
+		return BAD_CAST val->u.t;
+	default:
+		buf[0] = '\0';
+		break;
+	}
+
+	return BAD_CAST buf;
+}
+
+/*
+ * Render the value slot of the given node, if any, into the val
+ * attribute of a copy of the node, which is allocated from the given
+ * arena if not NULL
+ *
+ * Return 0 on success, < 0 on error
+ */
+static int __device_val_apply(const xmlNode *src, xmlNode *copy,
+							  arena_t *arena)
+{
+	dev_index_item_t *item;
+	char buf[DEV_VAL_STR_MAX];
+
+	if (src->type != XML_ELEMENT_NODE ||
+		!(item = (dev_index_item_t *)src->psvi) || item->val.stale == 0) {
+		return 0;
+	}
+
+	if (arena) {
+		return xml_arena_set_prop(arena, copy, BAD_CAST OBIX_ATTR_VAL,
+								  device_val_render(&item->val, buf));
+	}
+
+	return (xmlSetProp(copy, BAD_CAST OBIX_ATTR_VAL,
+					   device_val_render(&item->val, buf)) != NULL) ? 0 : -1;
+}
+
+/*
+ * Bring the val attribute of the node up to date with its value slot
+ * and have the slot discarded, so that the node can be accessed
+ * without the help of the index
+ *
+ * Return 0 on success, < 0 on error
+ *
+ * NOTE: callers must have entered the "write region" of the device
+ */
+static int __device_val_flush(dev_index_item_t *item)
+{
+	char buf[DEV_VAL_STR_MAX];
+
+	if (item->val.stale == 1 &&
+		!xmlSetProp(item->node, BAD_CAST OBIX_ATTR_VAL,
+					device_val_render(&item->val, buf))) {
+		return -1;
+	}
+
+	memset(&item->val, 0, sizeof(dev_val_t));
+	return 0;
+}
+
+/*
+ * Update the value of the given node and tell whether it has really
+ * changed. Typed leaf nodes in the index have their value slots
+ * updated in place, others have the val attribute replaced
+ *
+ * Return 0 on success, > 0 for error code
+ *
+ * NOTE: callers must have entered the "write region" of the device
+ */
+static int __device_val_update(xmlNode *node, const xmlChar *new, int *changed)
+{
+	dev_index_item_t *item = (dev_index_item_t *)node->psvi;
+	dev_val_t val;
+	xmlChar *old;
+	int ret = 0;
+
+	*changed = 0;
+
+	if (item && device_val_parse(node, new, &val) == 0) {
+		/* Load the current value into the slot on the first write */
+		if (item->val.type == DEV_VAL_NONE &&
+			(old = xmlGetProp(node, BAD_CAST OBIX_ATTR_VAL)) != NULL) {
+			device_val_parse(node, old, &item->val);
+			xmlFree(old);
+		}
+
+		if (device_val_equal(&item->val, &val) == 0) {
+			val.stale = 1;
+			item->val = val;
+			*changed = 1;
+		}
+
+		return 0;
+	}
+
+	/*
+	 * Otherwise fall back on the val attribute which should be
+	 * brought up to date first
+	 */
+	if (item && __device_val_flush(item) < 0) {
+		return ERR_NO_MEM;
+	}
+
+	if (!(old = xmlGetProp(node, BAD_CAST OBIX_ATTR_VAL)) ||
+		xmlStrcmp(old, new) != 0) {
+		if (!xmlSetProp(node, BAD_CAST OBIX_ATTR_VAL, new)) {
+			ret = ERR_NO_MEM;
+		} else {
+			*changed = 1;
+		}
+	}
+
+	if (old) {
+		xmlFree(old);
+	}
+
+	return ret;
+}
+
+/*
+ * Release all entries in the index. If nodes in the device contract
+ * are still alive, their values are flushed from value slots into
+ * their val attributes
+ */
+static void __device_index_dispose(dev_index_t *index, int live)
+{
+	dev_index_item_t *item, *n;
+	int i;
+
+	if (!index->table) {
+		return;
+	}
+
+	for (i = 0; i < index->size; i++) {
+		for (item = index->table[i]; item; item = n) {
+			n = item->next;
+
+			if (live == 1) {
+				if (__device_val_flush(item) < 0) {
+					log_error("Failed to flush the value of %s", item->href);
+				}
+
+				item->node->psvi = NULL;
+			}
+
+			xmlFree(item->href);
+			free(item);
+		}
+	}
+
+	free(index->table);
+	memset(index, 0, sizeof(dev_index_t));
+}
+
+/*
+ * Re-hash all entries into twice as many collision lists. Simply
+ * keep using the current ones if failed to allocate the new table
+ */
+static void __device_index_grow(dev_index_t *index)
+{
+	dev_index_item_t **table, *item, *n;
+	unsigned int size = index->size * 2 + 1, h;
+	int i;
+
+	if (!(table = (dev_index_item_t **)calloc(size,
+											  sizeof(dev_index_item_t *)))) {
+		return;
+	}
+
+	for (i = 0; i < index->size; i++) {
+		for (item = index->table[i]; item; item = n) {
+			n = item->next;
+			h = hash_bkdr(item->href, xmlStrlen(item->href), size);
+			item->next = table[h];
+			table[h] = item;
+		}
+	}
+
+	free(index->table);
+	index->table = table;
+	index->size = size;
+}
+
+/*
+ * Add an entry for the given node with the given relative href.
+ * The first node with the same href prevails, in line with the
+ * DOM walk which returns the first matching child
+ *
+ * Return 0 on success, < 0 on error
+ */
+static int __device_index_add(dev_index_t *index, const xmlChar *href,
+							  xmlNode *node)
+{
+	dev_index_item_t *item;
+	unsigned int h;
+
+	h = hash_bkdr(href, xmlStrlen(href), index->size);
+
+	for (item = index->table[h]; item; item = item->next) {
+		if (xmlStrcmp(item->href, href) == 0) {
+			return 0;
+		}
+	}
+
+	if (!(item = (dev_index_item_t *)malloc(sizeof(dev_index_item_t)))) {
+		return -1;
+	}
+
+	if (!(item->href = xmlStrdup(href))) {
+		free(item);
+		return -1;
+	}
+
+	item->node = node;
+	item->version = device_version_next();
+	memset(&item->val, 0, sizeof(dev_val_t));
+	item->next = index->table[h];
+
+	node->psvi = item;
+	index->table[h] = item;
+
+	if (++index->count > index->size * 2) {
+		__device_index_grow(index);
+	}
+
+	return 0;
+}
+
+static void __device_index_del(dev_index_t *index, const xmlChar *href,
+							   xmlNode *node)
+{
+	dev_index_item_t *item, **pprev;
+
+	pprev = &index->table[hash_bkdr(href, xmlStrlen(href), index->size)];
+
+	for (item = *pprev; item; pprev = &item->next, item = item->next) {
+		if (item->node == node && xmlStrcmp(item->href, href) == 0) {
+			*pprev = item->next;
+
+			if (__device_val_flush(item) < 0) {
+				log_error("Failed to flush the value of %s", href);
+			}
+
+			node->psvi = NULL;
+
+			xmlFree(item->href);
+			free(item);
+			index->count--;
+			break;
+		}
+	}
+}
+
+static dev_index_item_t *__device_index_lookup(dev_index_t *index,
+												const xmlChar *href, int len)
+{
+	dev_index_item_t *item;
+
+	for (item = index->table[hash_bkdr(href, len, index->size)]; item;
+		 item = item->next) {
+		if (xmlStrncmp(item->href, href, len) == 0 && item->href[len] == '\0') {
+			return item;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Look up the given relative href in the index of a device. Like
+ * the tokenised DOM walk, leading, trailing and repeated slashes
+ * are insignificant
+ *
+ * Return 0 on success with the entry pointer set accordingly, which
+ * is NULL if not found, < 0 if the index is not usable
+ */
+static int __device_index_search_item(dev_index_t *index, const xmlChar *href,
+									  dev_index_item_t **item)
+{
+	xmlChar buf[DEV_INDEX_HREF_MAX];
+	int len = 0;
+
+	if (!index->table) {
+		return -1;
+	}
+
+	for (; *href; href++) {
+		if (*href == '/' && (len == 0 || buf[len - 1] == '/')) {
+			continue;
+		}
+
+		if (len == DEV_INDEX_HREF_MAX - 1) {
+			return -1;
+		}
+
+		buf[len++] = *href;
+	}
+
+	if (len > 0 && buf[len - 1] == '/') {
+		len--;
+	}
+	buf[len] = '\0';
+
+	*item = __device_index_lookup(index, buf, len);
+	return 0;
+}
+
+static int __device_index_search(dev_index_t *index, const xmlChar *href,
+								 xmlNode **node)
+{
+	dev_index_item_t *item;
+
+	if (__device_index_search_item(index, href, &item) < 0) {
+		return -1;
+	}
+
+	*node = (item) ? item->node : NULL;
+	return 0;
+}
+
+/*
+ * Renew the versions of the node with the given relative href and
+ * all its ancestors in the device contract, including the root node
+ *
+ * NOTE: callers must have entered the "write region" of the device
+ */
+static void __device_index_touch(obix_dev_t *dev, const xmlChar *href)
+{
+	dev_index_t *index = &dev->index;
+	dev_index_item_t *item;
+	xmlChar buf[DEV_INDEX_HREF_MAX];
+	unsigned long version = device_version_next();
+	int len = 0;
+
+	dev->version = version;
+
+	if (!index->table) {
+		return;		/* responses not cached at all */
+	}
+
+	/*
+	 * An overlong href is truncated, in which case the versions of
+	 * some irrelevant nodes may be renewed as well, which is harmless
+	 */
+	for (; *href && len < DEV_INDEX_HREF_MAX - 1; href++) {
+		if (*href == '/') {
+			if (len == 0 || buf[len - 1] == '/') {
+				continue;
+			}
+
+			if ((item = __device_index_lookup(index, buf, len)) != NULL) {
+				item->version = version;
+			}
+		}
+
+		buf[len++] = *href;
+	}
+
+	if (len > 0 && buf[len - 1] != '/' &&
+		(item = __device_index_lookup(index, buf, len)) != NULL) {
+		item->version = version;
+	}
+}
+
+/*
+ * Renew the versions of all nodes in the device contract, which is
+ * necessary when a child device is linked or unlinked since it's not
+ * easy to tell which nodes contain it
+ *
+ * NOTE: callers must have entered the "write region" of the device
+ */
+static void __device_index_touch_all(obix_dev_t *dev)
+{
+	dev_index_t *index = &dev->index;
+	dev_index_item_t *item;
+	unsigned long version = device_version_next();
+	int i;
+
+	dev->version = version;
+
+	if (!index->table) {
+		return;
+	}
+
+	for (i = 0; i < index->size; i++) {
+		for (item = index->table[i]; item; item = item->next) {
+			item->version = version;
+		}
+	}
+}
+
+/*
+ * Assemble the relative href of a node from that of its parent
+ */
+static xmlChar *device_index_href(const xmlChar *prefix, const xmlChar *name)
+{
+	xmlChar *href;
+
+	if (!prefix) {
+		return xmlStrdup(name);
+	}
+
+	if ((href = (xmlChar *)xmlMalloc(xmlStrlen(prefix) +
+									 xmlStrlen(name) + 2)) != NULL) {
+		sprintf((char *)href, "%s/%s", prefix, name);
+	}
+
+	return href;
+}
+
+/*
+ * Get the relative href of the given node in the device contract,
+ * which is NULL for the root node of the device contract
+ *
+ * Return 0 on success, < 0 if the node is unreachable by its href
+ */
+static int __device_index_node_href(obix_dev_t *dev, xmlNode *node,
+									xmlChar **href)
+{
+	xmlChar *prefix = NULL, *name;
+	int ret;
+
+	*href = NULL;
+
+	if (node == dev->node) {
+		return 0;
+	}
+
+	if (!node->parent ||
+		!(name = xmlGetProp(node, BAD_CAST OBIX_ATTR_HREF))) {
+		return -1;
+	}
+
+	if ((ret = __device_index_node_href(dev, node->parent, &prefix)) == 0 &&
+		!(*href = device_index_href(prefix, name))) {
+		ret = -1;
+	}
+
+	if (prefix) {
+		xmlFree(prefix);
+	}
+
+	xmlFree(name);
+	return ret;
+}
+
+/*
+ * Add or delete index entries for all nodes belonging to the given
+ * device in the subtree of the given node, whose relative href is
+ * specified by prefix
+ *
+ * Nodes without a href can't be reached by the DOM walk, neither
+ * can their descendants, therefore they are not indexed
+ *
+ * Return 0 on success, < 0 on error
+ */
+static int __device_index_subtree(obix_dev_t *dev, xmlNode *node,
+								  const xmlChar *prefix, int add)
+{
+	xmlNode *n;
+	xmlChar *name, *href;
+	int ret = 0;
+
+	for (n = node->children; n && ret == 0; n = n->next) {
+		if (n->type != XML_ELEMENT_NODE || (obix_dev_t *)n->_private != dev ||
+			!(name = xmlGetProp(n, BAD_CAST OBIX_ATTR_HREF))) {
+			continue;
+		}
+
+		if (!(href = device_index_href(prefix, name))) {
+			ret = -1;
+		} else {
+			if (add == 1) {
+				ret = __device_index_add(&dev->index, href, n);
+			} else {
+				__device_index_del(&dev->index, href, n);
+			}
+
+			if (ret == 0) {
+				ret = __device_index_subtree(dev, n, href, add);
+			}
+
+			xmlFree(href);
+		}
+
+		xmlFree(name);
+	}
+
+	return ret;
+}
+
+/*
+ * Index the entire device contract, which is not fatal on failure
+ * since hrefs can be resolved by the DOM walk anyway
+ *
+ * NOTE: callers must have entered the "write region" of the device
+ * or have the device not yet accessible to others
+ */
+static void __device_index_build(obix_dev_t *dev)
+{
+	dev_index_t *index = &dev->index;
+
+	if (!(index->table = (dev_index_item_t **)calloc(DEV_INDEX_SIZE,
+											sizeof(dev_index_item_t *)))) {
+		log_warning("Failed to allocate index for device %s", dev->href);
+		return;
+	}
+
+	index->size = DEV_INDEX_SIZE;
+	index->count = 0;
+
+	if (__device_index_subtree(dev, dev->node, NULL, 1) < 0) {
+		log_warning("Failed to index device %s", dev->href);
+		__device_index_dispose(index, 1);
+	}
+}
+
+/*
+ * Add or delete index entries for the given node and its subtree
+ * when it is linked into or about to be unlinked from the device
+ * contract. The index is dropped if failed to be kept up to date.
+ *
+ * NOTE: callers must have entered the "write region" of the device
+ */
+static void __device_index_update(obix_dev_t *dev, xmlNode *node, int add)
+{
+	xmlChar *href;
+
+	if (!dev->index.table ||
+		__device_index_node_href(dev, node, &href) < 0 || !href) {
+		return;		/* not reachable by hrefs */
+	}
+
+	if (add == 1) {
+		if (__device_index_add(&dev->index, href, node) < 0 ||
+			__device_index_subtree(dev, node, href, 1) < 0) {
+			log_warning("Failed to index new node at %s in device %s, "
+						"fall back on DOM walk", href, dev->href);
+			__device_index_dispose(&dev->index, 1);
+		}
+	} else {
+		__device_index_subtree(dev, node, href, 0);
+		__device_index_del(&dev->index, href, node);
+	}
+
+	xmlFree(href);
+}
+
+/*
+ * Copy the subtree of a device, EXCLUDING any of its
+ * children devices
+ */
+static xmlNode *__device_copy_no_child(obix_dev_t *parent, const xmlNode *src)
+{
+	xmlNode *copy_src, *copy_node, *node;
+
+	if (!(copy_src = xmlCopyNode((xmlNode *)src, 2))) {
+		return NULL;
+	}
+
+	if (__device_val_apply(src, copy_src, NULL) < 0) {
+		xmlFreeNode(copy_src);
+		return NULL;
+	}
+
+	for (node = src->children; node; node = node->next) {
+		if ((obix_dev_t *)node->_private != parent ||
+			!(copy_node = __device_copy_no_child(parent, node))) {
+			continue;
+		}
+
+		if (!xmlAddChild(copy_src, copy_node)) {
+			xmlFreeNode(copy_node);
+			xmlFreeNode(copy_src);
+			return NULL;
+		}
+	}
+
+	return copy_src;
+}
+
+/*
+ * Dump the content of a device into a buffer, EXCLUDING any of
+ * its children devices
+ *
+ * NOTE: this is NOT a recursive function, since any child device
+ * contracts should not be saved into parent's persistent file
+ */
+static char *__device_dump_device(obix_dev_t *dev)
+{
+	xmlNode *copy;
+	char *buf = NULL;
+
+	/*
+	 * Always make another copy of it to exclude all its children
+	 * devices and to render values of value slots, if any
+	 */
+	if ((copy = __device_copy_no_child(dev, dev->node)) != NULL) {
+		buf = xml_dump_node(copy);
+		xmlFreeNode(copy);
+	}
+
+	return buf;
+}
+
+/*
+ * Backup the device contract onto its persistent file on the
+ * hard-drive
+ *
+ * NOTE: callers must have entered either the "read region" or the
+ * "write region" of the device
+ *
+ * Return 0 on success, > 0 for error code
+ */
+static int __device_write_file(obix_dev_t *dev)
+{
+	char *buf;
+	int ret = 0;
+
+	if (!(buf = __device_dump_device(dev))) {
+		log_error("Failed to dump content from device of %s", dev->href);
+		return ERR_NO_MEM;
+	}
+
+	if (xml_write_file_atomic(dev->file, buf, strlen(buf)) < 0) {
+		log_error("Failed to write device file at %s", dev->file);
+		ret = ERR_DISK_IO;
+	}
+
+	free(buf);
+	return ret;
+}
+
+/*
+ * Remove the given device's persistent files and prevent the persister
+ * from re-creating them afterwards
+ */
+static void device_remove_files(obix_dev_t *dev)
+{
+	pthread_mutex_lock(&_devices->persist_mutex);
+	dev->removed = 1;
+	__device_remove_files(dev);
+	pthread_mutex_unlock(&_devices->persist_mutex);
+}
+
+/*
+ * Queue the given device to have its contract saved onto the hard
+ * drive by the persister later
+ */
+static void device_mark_dirty(obix_dev_t *dev)
+{
+	/* The Device Root has no persistent files at all */
+	if (dev == _devices->device_root) {
+		return;
+	}
+
+	pthread_mutex_lock(&_devices->dirty_mutex);
+	if (list_empty(&dev->dirty) == 1) {
+		list_add_tail(&dev->dirty, &_devices->dirty);
+	}
+	pthread_mutex_unlock(&_devices->dirty_mutex);
+}
+
+static void device_unmark_dirty(obix_dev_t *dev)
+{
+	pthread_mutex_lock(&_devices->dirty_mutex);
+	list_del_init(&dev->dirty);
+	pthread_mutex_unlock(&_devices->dirty_mutex);
+}
+
+/*
+ * Take a snapshot of the given device contract within its "read region"
+ * and then save it onto the hard drive outside of it, so that threads
+ * changing the device won't be blocked by disk I/O
+ */
+static void device_persist(obix_dev_t *dev)
+{
+	char *buf;
+
+	if (tsync_reader_entry(&dev->sync) < 0) {
+		return;		/* being deleted */
+	}
+
+	buf = __device_dump_device(dev);
+
+	tsync_reader_exit(&dev->sync);
+
+	if (!buf) {
+		log_error("Failed to dump content from device of %s", dev->href);
+		device_mark_dirty(dev);		/* try again next time */
+		return;
+	}
+
+	pthread_mutex_lock(&_devices->persist_mutex);
+	if (dev->removed == 0 &&
+		xml_write_file_atomic(dev->file, buf, strlen(buf)) < 0) {
+		log_error("Failed to write device file at %s", dev->file);
+	}
+	pthread_mutex_unlock(&_devices->persist_mutex);
+
+	free(buf);
+}
+
+/* The devices to be saved into a snapshot */
+typedef struct dev_snapshot_list {
+	obix_dev_t **devs;
+	int count, size;
+} dev_snapshot_list_t;
+
+/*
+ * Collect every device but the Device Root with its reference
+ * count increased, so that they can be accessed outside of the
+ * "read region" of the prefix tree
+ *
+ * Return 0 on success, < 0 on error
+ */
+static int device_snapshot_collect(const void *item, void *arg)
+{
+	dev_snapshot_list_t *list = (dev_snapshot_list_t *)arg;
+	obix_dev_t *dev = (obix_dev_t *)item, **devs;
+	int size;
+
+	if (dev == _devices->device_root) {
+		return 0;
+	}
+
+	if (list->count == list->size) {
+		size = (list->size == 0) ? 64 : list->size * 2;
+		if (!(devs = (obix_dev_t **)realloc(list->devs,
+											sizeof(obix_dev_t *) * size))) {
+			return -1;
+		}
+
+		list->devs = devs;
+		list->size = size;
+	}
+
+	device_get(dev);
+	list->devs[list->count++] = dev;
+
+	return 0;
+}
+
+/*
+ * Append a record of the given device into the snapshot, with the help
+ * of the tree buffer to encode its contract
+ *
+ * NOTE: identities of persistent files are taken before the device
+ * contract is copied, so that any change of the device saved onto the
+ * hard drive in the meantime will invalidate the record
+ *
+ * Return 0 on success, 1 if the device is skipped, < 0 on error
+ */
+static int device_snapshot_put(xml_binary_t *buf, xml_binary_t *tree,
+							   obix_dev_t *dev)
+{
+	dev_stamp_t meta_stamp, file_stamp;
+	xmlNode *copy;
+	int ret;
+
+	if (device_get_stamp(dev->meta, &meta_stamp) < 0 ||
+		device_get_stamp(dev->file, &file_stamp) < 0) {
+		return 1;	/* persistent files not created or removed */
+	}
+
+	if (tsync_reader_entry(&dev->sync) < 0) {
+		return 1;	/* being deleted */
+	}
+
+	copy = __device_copy_no_child(dev, dev->node);
+
+	tsync_reader_exit(&dev->sync);
+
+	if (!copy) {
+		return -1;
+	}
+
+	xml_binary_reset(tree);
+
+	if (xml_binary_encode(tree, copy) < 0) {
+		xmlFreeNode(copy);
+		log_warning("Failed to encode device of %s into snapshot", dev->href);
+		return 1;
+	}
+
+	xmlFreeNode(copy);
+
+	ret = (xml_binary_put_str(buf, dev->file) < 0 ||
+		   xml_binary_put_str(buf, (const char *)dev->href) < 0 ||
+		   xml_binary_put_str(buf, dev->owner_id) < 0 ||
+		   xml_binary_put(buf, &meta_stamp, sizeof(dev_stamp_t)) < 0 ||
+		   xml_binary_put(buf, &file_stamp, sizeof(dev_stamp_t)) < 0 ||
+		   xml_binary_put_u32(buf, tree->len) < 0 ||
+		   xml_binary_put(buf, tree->data, tree->len) < 0) ? -1 : 0;
+
+	return ret;
+}
+
+/*
+ * Save a snapshot of the whole device database onto the hard drive,
+ * so that the server can restore all unchanged devices from it at
+ * next start-up much faster than parsing their persistent files
+ */
+static void device_snapshot_save(void)
+{
+	dev_snapshot_list_t list = { NULL, 0, 0 };
+	xml_binary_t buf, tree;
+	struct iovec iov[4];
+	uint32_t version = DEVICE_SNAPSHOT_VERSION, count = 0;
+	int i, ret = 0;
+
+	xml_binary_init(&buf);
+	xml_binary_init(&tree);
 
-	if (!(copy_src = xmlCopyNode((xmlNode *)src, 2))) {
-		return NULL;
+	/*
+	 * Devices are collected within the "read region" of the prefix tree
+	 * but copied outside of it, so as not to nest locks of devices in
+	 * that of the tree
+	 */
+	if (radix_for_each(_devices->tree, device_snapshot_collect, &list) < 0) {
+		log_error("Failed to collect devices for snapshot");
+		goto out;
 	}
 
-	for (node = src->children; node; node = node->next) {
-		if ((obix_dev_t *)node->_private != parent ||
-			!(copy_node = __device_copy_no_child(parent, node))) {
-			continue;
+	for (i = 0; i < list.count; i++) {
+		if ((ret = device_snapshot_put(&buf, &tree, list.devs[i])) < 0) {
+			log_error("Failed to save device of %s into snapshot",
+					  list.devs[i]->href);
+			goto out;
 		}
 
-		if (!xmlAddChild(copy_src, copy_node)) {
-			xmlFreeNode(copy_node);
-			xmlFreeNode(copy_src);
-			return NULL;
+		if (ret == 0) {
+			count++;
 		}
 	}
 
-	return copy_src;
-}
+	/* The header is followed by all records */
+	iov[0].iov_base = (char *)DEVICE_SNAPSHOT_MAGIC;
+	iov[0].iov_len = sizeof(DEVICE_SNAPSHOT_MAGIC);
+	iov[1].iov_base = &version;
+	iov[1].iov_len = sizeof(uint32_t);
+	iov[2].iov_base = &count;
+	iov[2].iov_len = sizeof(uint32_t);
+	iov[3].iov_base = buf.data;
+	iov[3].iov_len = buf.len;
 
-/*
- * Dump the content of a device into a buffer, EXCLUDING any of
- * its children devices
- *
- * NOTE: this is NOT a recursive function, since any child device
- * contracts should not be saved into parent's persistent file
- */
-static char *__device_dump_device(obix_dev_t *dev)
-{
-	xmlNode *copy;
-	char *buf = NULL;
+	if (file_writev_atomic(_devices->snapshot_file, iov, 4) < 0) {
+		log_error("Failed to write snapshot of device database at %s",
+				  _devices->snapshot_file);
+	} else {
+		log_debug("Saved %u devices into snapshot at %s", count,
+				  _devices->snapshot_file);
+	}
+
+	/* Fall through */
 
-	/* No children devices */
-	if (list_empty(&dev->children) == 1) {
-		return xml_dump_node(dev->node);
+out:
+	for (i = 0; i < list.count; i++) {
+		device_put(list.devs[i]);
 	}
 
-	/*
-	 * Otherwise excluding all its children devices
-	 * by making another copy of it
-	 */
-	if ((copy = __device_copy_no_child(dev, dev->node)) != NULL) {
-		buf = xml_dump_node(copy);
-		xmlFreeNode(copy);
+	if (list.devs) {
+		free(list.devs);
 	}
 
-	return buf;
+	xml_binary_dispose(&tree);
+	xml_binary_dispose(&buf);
+
+	_devices->snapshot_ts = time(NULL);
 }
 
 /*
- * Backup the device contract onto its persistent file on the
- * hard-drive and update its last modification timestamp
+ * Payload of the persister which saves all dirty devices, and then
+ * a snapshot of the device database once every snapshot period
  *
- * Return 0 on success, > 0 for error code
+ * NOTE: arg is NULL when the payload is invoked directly to save
+ * remaining dirty devices during shutdown
  */
-static int __device_write_file(obix_dev_t *dev, time_t now)
+static void device_persist_task(void *arg)
 {
-	char *buf;
-	int ret = 0;
+	obix_dev_t *dev;
 
-	if (!(buf = __device_dump_device(dev))) {
-		log_error("Failed to dump content from device of %s", dev->href);
-		return ERR_NO_MEM;
-	}
+	for (;;) {
+		pthread_mutex_lock(&_devices->dirty_mutex);
 
-	if (xml_write_file(dev->file, OPEN_FLAG_ASYNC, buf, strlen(buf)) < 0) {
-		log_error("Failed to write device file at %s", dev->file);
-		ret = ERR_DISK_IO;
+		if (list_empty(&_devices->dirty) == 1) {
+			pthread_mutex_unlock(&_devices->dirty_mutex);
+			break;
+		}
+
+		/*
+		 * Dequeue the device so that it can be queued again by
+		 * changes taking place during the saving. Its reference
+		 * count is increased before the dirty_mutex is released
+		 * so as to synchronise with deletion threads
+		 */
+		dev = list_first_entry(&_devices->dirty, obix_dev_t, dirty);
+		list_del_init(&dev->dirty);
+		device_get(dev);
+
+		pthread_mutex_unlock(&_devices->dirty_mutex);
+
+		device_persist(dev);
+		device_put(dev);
 	}
 
 	/*
-	 * Doesn't matter if now == 0 when the persistent file is initially
-	 * created and it will get updated by the first write into the device
+	 * Take the snapshot after all dirty devices are saved, otherwise
+	 * their records would be invalidated by the saving at once
 	 */
-	dev->mtime = now;
-
-	free(buf);
-	return ret;
+	if (arg && _devices->snapshot_period > 0 &&
+		time(NULL) - _devices->snapshot_ts >= _devices->snapshot_period) {
+		device_snapshot_save();
+	}
 }
 
 /*
- * Get the host device descriptor for the given href
- *
- * Search the hash table on a cache miss. If found, also have
- * the cache udpated
+ * Get the device descriptor registered at the given href
  *
  * NOTE: The reference count of the device descriptor is increased
  * before returned so as to synchronise with deletion threads
  */
 static obix_dev_t *device_search(const xmlChar *href)
 {
-	obix_dev_t *dev = NULL;
-
 	if (is_given_type(href, OBIX_DEVICE) == 0) {
 		return NULL;
 	}
 
-	if (is_device_root_href(href) == 1) {
-		dev = _devices->device_root;
-		/*
-		 * Need to manually increase the reference count for
-		 * the device root since it is not organised in hash table
-		 */
-		device_get(dev);
-		return dev;
-	}
-
-	if (!(dev = (obix_dev_t *)cache_search(_devices->cache, href,
-										   device_get_wrapper))) {
-		if ((dev = (obix_dev_t *)hash_search(_devices->tab, href)) != NULL) {
-			cache_update(_devices->cache, dev->href, dev);
-		}
-	}
-
-	return dev;
+	return (obix_dev_t *)radix_match(_devices->tree, href, RADIX_MATCH_EXACT);
 }
 
 /*
@@ -590,67 +2222,74 @@ static obix_dev_t *device_search(const xmlChar *href)
  */
 static obix_dev_t *device_search_parent(const xmlChar *href)
 {
-	obix_dev_t *dev = NULL;
-	xmlChar *parent = NULL;
-
 	if (is_given_type(href, OBIX_DEVICE) == 0 || is_device_root_href(href) == 1) {
 		return NULL;
 	}
 
-	if (!(parent = xmlStrdup(href)) ||
-		!(parent = (xmlChar *)dirname((char *)parent))) {
+	return (obix_dev_t *)radix_match(_devices->tree, href, RADIX_MATCH_PARENT);
+}
+
+/*
+ * Get the device registered at the given href, or otherwise its
+ * closest parent device, in one single walk on the prefix tree
+ *
+ * Search the prefix tree on a cache miss. If found, also have
+ * the cache updated
+ */
+static obix_dev_t *device_search_host(const xmlChar *href)
+{
+	obix_dev_t *dev;
+	unsigned long gen;
+
+	if (is_given_type(href, OBIX_DEVICE) == 0) {
 		return NULL;
 	}
 
-	while (!(dev = device_search(parent))) {
-		if (!(parent = (xmlChar *)dirname((char *)parent))) {
-			/* Won't have to nullify dev since it is assured to be NULL */
-			break;
-		}
+	if ((dev = (obix_dev_t *)cache_search(_devices->cache, href,
+										  device_get_wrapper)) != NULL) {
+		return dev;
 	}
 
-	if (parent) {
-		xmlFree(parent);
+	/*
+	 * The generation of the cache must be read before searching the
+	 * prefix tree so that the result won't get cached if any device
+	 * is registered or removed in the meantime
+	 */
+	gen = cache_get_gen(_devices->cache);
+
+	if ((dev = (obix_dev_t *)radix_match(_devices->tree, href,
+										 RADIX_MATCH_LONGEST)) != NULL) {
+		cache_update(_devices->cache, href, dev, gen);
 	}
 
 	return dev;
 }
 
 /*
- * Save the current snapshot of the device contract that host the given
- * href onto the hard drive
+ * Have the current snapshot of the device contract that host the given
+ * href saved onto the hard drive
  *
  * For sake of performance and efficiency, it's not desirable and not
  * necessary at all to save every single change of the device into its
  * persistent file on the hard drive, especially when it's being updated
- * very frequently. Instead, backup should be done when the entire
- * device contract may have been properly updated by client via one
- * batch object
+ * very frequently. Instead, the device is simply marked as dirty and
+ * the persister will save it within one backup period, coalescing all
+ * changes in the meantime
  *
  * Return 0 on success, > 0 for error code
  */
 int device_backup_uri(const xmlChar *href)
 {
 	obix_dev_t *dev;
-	time_t now;
-	int ret = ERR_INVALID_STATE;
 
-	if (!(dev = device_search_parent(href))) {
+	if (!(dev = device_search_host(href))) {
 		return ERR_DEVICE_NO_SUCH_URI;
 	}
 
-	if (tsync_writer_entry(&dev->sync) == 0) {
-		if ((now = time(NULL)) >= dev->mtime + _devices->backup_period) {
-			ret = __device_write_file(dev, now);
-		} else {
-			ret = 0;
-		}
-
-		tsync_writer_exit(&dev->sync);
-	}
+	device_mark_dirty(dev);
 
 	device_put(dev);
-	return ret;
+	return 0;
 }
 
 /*
@@ -658,8 +2297,14 @@ int device_backup_uri(const xmlChar *href)
  */
 static void __device_unlink(obix_dev_t *dev)
 {
-	hash_del(_devices->tab, dev->href);
-	cache_invalidate(_devices->cache, dev->href);
+	radix_del(_devices->tree, dev->href);
+	cache_flush(_devices->cache);
+
+	device_unmark_dirty(dev);
+
+	if (dev->parent) {
+		__device_index_touch_all(dev->parent);
+	}
 
 	list_del(&dev->siblings);
 	dev->parent = NULL;
@@ -682,7 +2327,7 @@ static void __device_purge(obix_dev_t *dev, int sign_off)
 	 * normal server shutdown
 	 */
 	if (sign_off == 1) {
-		__device_remove_files(dev);
+		device_remove_files(dev);
 	}
 
 	/* De-associate from its parent device's network */
@@ -733,6 +2378,9 @@ static void device_dispose(obix_dev_t *dev)
 		xmlFreeNode(dev->ref);
 	}
 
+	/* The device contract has been deleted from the global DOM tree */
+	__device_index_dispose(&dev->index, 0);
+
 	refcnt_cleanup(&dev->refcnt);
 	tsync_cleanup(&dev->sync);
 
@@ -756,6 +2404,7 @@ static obix_dev_t *device_init(xmlNode *node, const xmlChar *href,
 
 	INIT_LIST_HEAD(&dev->children);
 	INIT_LIST_HEAD(&dev->siblings);
+	INIT_LIST_HEAD(&dev->dirty);
 
 	refcnt_init(&dev->refcnt);
 	tsync_init(&dev->sync);
@@ -789,6 +2438,8 @@ static obix_dev_t *device_init(xmlNode *node, const xmlChar *href,
 	dev->node = node;
 	xml_setup_private(node, (void *)dev);
 
+	dev->version = device_version_next();
+
 	return dev;
 
 failed:
@@ -809,17 +2460,15 @@ static xmlNode *__device_get_node_core(obix_dev_t *dev, const xmlChar *href)
 
 	if (is_str_identical(dev->href, href, 1) == 1) {
 		node = dev->node;
-	} else {
+	} else if (__device_index_search(&dev->index, href + xmlStrlen(dev->href),
+									 &node) < 0) {
+		/*
+		 * Walk through the device contract only when the index is
+		 * not available, otherwise the index is authoritative
+		 */
 		node = xmldb_get_node_core(dev->node, href + xmlStrlen(dev->href));
 	}
 
-	/*
-	 * Cache up subnodes' mapping to parent device's descriptor would be
-	 * useful only when the server is not busy and the client is using
-	 * simple device contract (such as the example_adaptor). However, this
-	 * normally won't be the case since oBIX clients can fastly update
-	 * their device contracts, as a result, the cache is flushed quickly
-	 */
 	return node;
 }
 
@@ -827,9 +2476,13 @@ static xmlNode *__device_get_node_core(obix_dev_t *dev, const xmlChar *href)
  * Copy the node from the given device. Basically it's similar to
  * xml_copy_r() but takes extra care of coming across "read region"
  * of the parent and child devices
+ *
+ * The copy is allocated from the given arena if not NULL, see
+ * xml_arena.h
  */
 static xmlNode *__device_copy_node(obix_dev_t *parent, const xmlNode *src,
-								   xml_copy_flags_t flags, int depth)
+								   xml_copy_flags_t flags, int depth,
+								   arena_t *arena)
 {
 	obix_dev_t *child;
 	xmlNode *node, *copy_src = NULL, *copy_node = NULL;
@@ -868,13 +2521,17 @@ static xmlNode *__device_copy_node(obix_dev_t *parent, const xmlNode *src,
 		}
 	}
 
-	if (!(copy_src = xmlCopyNode((xmlNode *)src, 2))) {
+	copy_src = (arena) ? xml_arena_copy_node(arena, src) :
+						 xmlCopyNode((xmlNode *)src, 2);
+
+	if (!copy_src || __device_val_apply(src, copy_src, arena) < 0) {
 		log_error("Failed to copy a node");
 		goto out;
 	}
 
 	for (node = src->children; node; node = node->next) {
-		if (!(copy_node = __device_copy_node(child, node, flags, ++depth))) {
+		if (!(copy_node = __device_copy_node(child, node, flags, ++depth,
+											 arena))) {
 			/*
 			 * The current child may have been deliberatly excluded,
 			 * move on to the next one
@@ -882,7 +2539,9 @@ static xmlNode *__device_copy_node(obix_dev_t *parent, const xmlNode *src,
 			continue;
 		}
 
-		if (!xmlAddChild(copy_src, copy_node)) {
+		if (arena) {
+			xml_arena_add_child(copy_src, copy_node);
+		} else if (!xmlAddChild(copy_src, copy_node)) {
 			log_error("Failed to organise a node's copy from device %s",
 					  parent->href);
 			xmlFreeNode(copy_node);
@@ -907,7 +2566,9 @@ out:
 	}
 
 	if (ret > 0 && copy_src) {
-		xmlFreeNode(copy_src);
+		if (!arena) {
+			xmlFreeNode(copy_src);
+		}
 		copy_src = NULL;
 	}
 
@@ -915,24 +2576,87 @@ out:
 }
 
 /*
- * Copy a device node
+ * Get the version of the node with the given href in the device
+ * contract, or 0 if it is not available
+ *
+ * NOTE: Callers must have entered either "read region" or
+ * "write region" of the device
+ */
+static unsigned long __device_get_version(obix_dev_t *dev, const xmlChar *href)
+{
+	dev_index_item_t *item;
+
+	if (is_str_identical(dev->href, href, 1) == 1) {
+		return dev->version;
+	}
+
+	if (__device_index_search_item(&dev->index, href + xmlStrlen(dev->href),
+								   &item) < 0 || !item) {
+		return 0;
+	}
+
+	return item->version;
+}
+
+/*
+ * Return 1 if any child device is hosted in the subtree of the given
+ * node, 0 otherwise
+ *
+ * NOTE: Callers must have entered either "read region" or
+ * "write region" of the device
+ */
+static int __device_has_child_within(obix_dev_t *dev, const xmlNode *node)
+{
+	obix_dev_t *child;
+	const xmlNode *n;
+
+	list_for_each_entry(child, &dev->children, siblings) {
+		for (n = child->node->parent; n; n = n->parent) {
+			if (n == node) {
+				return 1;
+			}
+
+			if (n == dev->node) {
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Copy a device node, and return the version of the node if the
+ * copy doesn't contain any child device so that its serialised
+ * response can be cached by device_cache_response(), otherwise 0
+ *
+ * The copy is allocated from the given arena if not NULL, and must
+ * be handled by xml_arena_*() then
  *
  * NOTE: To avoid race conditions, the "get + copy" operations
  * must be done atomically
  */
-xmlNode *device_copy_uri(const xmlChar *href, xml_copy_flags_t flags)
+xmlNode *device_copy_uri_cacheable(const xmlChar *href, xml_copy_flags_t flags,
+								   unsigned long *version, arena_t *arena)
 {
 	obix_dev_t *dev;
 	xmlNode *node, *copy = NULL;
 
-	if (!(dev = device_search(href)) &&
-		!(dev = device_search_parent(href))) {
+	if (version) {
+		*version = 0;
+	}
+
+	if (!(dev = device_search_host(href))) {
 		return NULL;
 	}
 
 	if (tsync_reader_entry(&dev->sync) == 0) {
 		if ((node = __device_get_node_core(dev, href)) != NULL) {
-			copy = __device_copy_node(dev, node, flags, 0);
+			if (version && __device_has_child_within(dev, node) == 0) {
+				*version = __device_get_version(dev, href);
+			}
+
+			copy = __device_copy_node(dev, node, flags, 0, arena);
 		}
 
 		tsync_reader_exit(&dev->sync);
@@ -942,12 +2666,134 @@ xmlNode *device_copy_uri(const xmlChar *href, xml_copy_flags_t flags)
 	return copy;
 }
 
-static void __device_notify_watches(obix_dev_t *previous, xmlNode *node)
+xmlNode *device_copy_uri(const xmlChar *href, xml_copy_flags_t flags)
+{
+	return device_copy_uri_cacheable(href, flags, NULL, NULL);
+}
+
+/*
+ * Get an identity of the device hosting the given href, so that
+ * requests on the same device can be told apart from others
+ *
+ * NOTE: the returned pointer must never be dereferenced, since the
+ * device may be deleted at any time afterwards
+ *
+ * Return NULL if no device hosts the href
+ */
+const void *device_host_key(const xmlChar *href)
+{
+	obix_dev_t *dev;
+
+	if (!(dev = device_search_host(href))) {
+		return NULL;
+	}
+
+	device_put(dev);
+
+	return dev;
+}
+
+/*
+ * Get the current version of the node with the given href, without
+ * copying anything from it
+ *
+ * Return 0 if the node doesn't exist, or its version is not available
+ * or doesn't reflect changes in its subtree, that is, the subtree
+ * contains any child device
+ */
+unsigned long device_get_version(const xmlChar *href)
+{
+	obix_dev_t *dev;
+	xmlNode *node;
+	unsigned long version = 0;
+
+	if (!(dev = device_search_host(href))) {
+		return 0;
+	}
+
+	if (tsync_reader_entry(&dev->sync) == 0) {
+		if ((node = __device_get_node_core(dev, href)) != NULL &&
+			__device_has_child_within(dev, node) == 0) {
+			version = __device_get_version(dev, href);
+		}
+
+		tsync_reader_exit(&dev->sync);
+	}
+
+	device_put(dev);
+	return version;
+}
+
+/*
+ * Search for the serialised response of the given href which is
+ * generated from the current version of relevant node
+ *
+ * Return 0 on success with a copy of the response returned, which
+ * should be released by callers, along with the version of the node,
+ * < 0 otherwise
+ */
+int device_read_cached(const xmlChar *href, xml_copy_flags_t flags,
+					   char **data, int *size, unsigned long *current)
+{
+	obix_dev_t *dev;
+	unsigned long version = 0;
+
+	if (!(dev = device_search_host(href))) {
+		return -1;
+	}
+
+	if (tsync_reader_entry(&dev->sync) == 0) {
+		version = __device_get_version(dev, href);
+		tsync_reader_exit(&dev->sync);
+	}
+
+	device_put(dev);
+
+	if (resp_cache_search(_devices->resp_cache, href, flags, version,
+						  data, size) < 0) {
+		return -1;
+	}
+
+	*current = version;
+	return 0;
+}
+
+/*
+ * Cache the serialised response of the given href generated from the
+ * specified version of relevant node
+ */
+void device_cache_response(const xmlChar *href, xml_copy_flags_t flags,
+						   unsigned long version, const char *data, int size)
+{
+	resp_cache_update(_devices->resp_cache, href, flags, version, data, size);
+}
+
+/*
+ * Notify all watches that may have been monitoring the given node
+ *
+ * NOTE: callers must have entered the "read region" of the device
+ * the node belongs to
+ */
+static void __device_notify_node(xmlNode *node)
 {
-	obix_dev_t *current;
 	xmlNode *n;
 	long id;
 
+	for (n = node->children; n; n = n->next) {
+		if (n->type != XML_ELEMENT_NODE ||
+			xmlStrcmp(n->name, BAD_CAST OBIX_OBJ_META) != 0 ||
+			(id = xml_get_long(n, OBIX_META_ATTR_WATCH_ID)) < 0) {
+			continue;
+		}
+
+		watch_notify_watches(id, node, WATCH_EVT_NODE_CHANGED);
+	}
+}
+
+static void __device_notify_watches(obix_dev_t *previous, xmlNode *node)
+{
+	obix_dev_t *current;
+
 	if (!(current = (obix_dev_t *)node->_private)) {
 		return;		/* reached the parent of "/obix/deviceRoot/" */
 	}
@@ -957,27 +2803,16 @@ static void __device_notify_watches(obix_dev_t *previous, xmlNode *node)
 	 * that of the parent if needed
 	 */
 	if (current != previous) {
-		tsync_reader_exit(&previous->sync);
-		device_get(current);
-		if (tsync_reader_entry(&current->sync) < 0) {
-			device_put(current);
-			return;
-		}
-	}
-
-	/*
-	 * Notify all watches that may have been monitoring the current node
-	 */
-	for (n = node->children; n; n = n->next) {
-		if (n->type != XML_ELEMENT_NODE ||
-			xmlStrcmp(n->name, BAD_CAST OBIX_OBJ_META) != 0 ||
-			(id = xml_get_long(n, OBIX_META_ATTR_WATCH_ID)) < 0) {
-			continue;
+		tsync_reader_exit(&previous->sync);
+		device_get(current);
+		if (tsync_reader_entry(&current->sync) < 0) {
+			device_put(current);
+			return;
 		}
-
-		watch_notify_watches(id, node, WATCH_EVT_NODE_CHANGED);
 	}
 
+	__device_notify_node(node);
+
 	__device_notify_watches(current, node->parent);
 
 	if (current != previous) {
@@ -1036,6 +2871,58 @@ static void device_notify_watches(obix_dev_t *dev, xmlNode *node)
 	tsync_reader_exit(&dev->sync);
 }
 
+/*
+ * Notify watches of a number of changed nodes in the given device,
+ * along with their ancestors. Ancestors shared by changed nodes are
+ * notified only once, and so are ancestor devices
+ */
+static void device_notify_watches_bulk(obix_dev_t *dev, xmlNode **nodes,
+									   int count)
+{
+	xmlNode **visited = NULL, **p, *n;
+	int i, k, num = 0, size = 0;
+
+	if (tsync_reader_entry(&dev->sync) < 0) {
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		for (n = nodes[i]; n && (obix_dev_t *)n->_private == dev;
+			 n = n->parent) {
+			for (k = 0; k < num && visited[k] != n; k++);	/* do nothing */
+
+			if (k < num) {
+				break;		/* so have been all its ancestors */
+			}
+
+			if (num == size) {
+				size = (size == 0) ? 16 : size * 2;
+				if (!(p = (xmlNode **)realloc(visited,
+											  sizeof(xmlNode *) * size))) {
+					size = num;
+					__device_notify_node(n);
+					continue;	/* notify it anyway */
+				}
+				visited = p;
+			}
+
+			visited[num++] = n;
+			__device_notify_node(n);
+		}
+	}
+
+	/* Move on to ancestor devices */
+	if (dev->node->parent) {
+		__device_notify_watches(dev, dev->node->parent);
+	}
+
+	tsync_reader_exit(&dev->sync);
+
+	if (visited) {
+		free(visited);
+	}
+}
+
 /*
  * Update the val attribute on the given device node and
  * notify relevant watch objects if the val attribute is
@@ -1047,25 +2934,18 @@ int device_update_uri(const xmlChar *href, const xmlChar *new)
 {
 	obix_dev_t *dev;
 	xmlNode *node = NULL;
-	xmlChar *old = NULL;
 	int changed = 0, ret = ERR_INVALID_STATE;
 
-	if (!(dev = device_search(href)) &&
-		!(dev = device_search_parent(href))) {
+	if (!(dev = device_search_host(href))) {
 		return ERR_DEVICE_NO_SUCH_URI;
 	}
 
 	if (tsync_writer_entry(&dev->sync) == 0) {
 		if ((node = __device_get_node_core(dev, href)) != NULL) {
-			ret = 0;
-			if (!(old = xmlGetProp(node, BAD_CAST OBIX_ATTR_VAL)) ||
-				xmlStrcmp(old, new) != 0) {
-				if (!xmlSetProp(node, BAD_CAST OBIX_ATTR_VAL, new)) {
-					log_error("Failed to set the val attribute within %s", dev->href);
-					ret = ERR_NO_MEM;
-				} else {
-					changed = 1;
-				}
+			if ((ret = __device_val_update(node, new, &changed)) != 0) {
+				log_error("Failed to set the val attribute within %s", dev->href);
+			} else if (changed == 1) {
+				__device_index_touch(dev, href + xmlStrlen(dev->href));
 			}
 		} else {
 			ret = ERR_DEVICE_NO_SUCH_URI;
@@ -1076,15 +2956,117 @@ int device_update_uri(const xmlChar *href, const xmlChar *new)
 
 	if (changed == 1 && node) {
 		device_notify_watches(dev, node);
+		device_mark_dirty(dev);
 	}
 
 	device_put(dev);
+	return ret;
+}
 
-	if (old) {
-		xmlFree(old);
+/*
+ * Apply all writes to the given device within one "write region",
+ * then notify watches and queue the device to be saved only once
+ *
+ * The hosts array has the hosting device of each write, and those
+ * of the given device are released and cleared
+ */
+static void device_update_device(obix_dev_t *dev, device_write_t *writes,
+								 obix_dev_t **hosts, int count,
+								 xmlNode **changed)
+{
+	xmlNode *node;
+	int i, c, num = 0, locked;
+
+	locked = (tsync_writer_entry(&dev->sync) == 0) ? 1 : 0;
+
+	for (i = 0; i < count; i++) {
+		if (hosts[i] != dev) {
+			continue;
+		}
+
+		if (locked == 0) {
+			writes[i].ret = ERR_INVALID_STATE;
+		} else if (!(node = __device_get_node_core(dev, writes[i].href))) {
+			writes[i].ret = ERR_DEVICE_NO_SUCH_URI;
+		} else if ((writes[i].ret = __device_val_update(node, writes[i].val,
+														&c)) != 0) {
+			log_error("Failed to set the val attribute within %s", dev->href);
+		} else if (c == 1) {
+			__device_index_touch(dev, writes[i].href + xmlStrlen(dev->href));
+			changed[num++] = node;
+		}
 	}
 
-	return ret;
+	if (locked == 1) {
+		tsync_writer_exit(&dev->sync);
+	}
+
+	if (num > 0) {
+		device_notify_watches_bulk(dev, changed, num);
+		device_mark_dirty(dev);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (hosts[i] == dev) {
+			hosts[i] = NULL;
+			device_put(dev);
+		}
+	}
+}
+
+/*
+ * Apply a number of writes, which are grouped by their hosting devices
+ * so that each device is locked, notified and queued to be saved only
+ * once no matter how many of its nodes are written
+ *
+ * NOTE: writes to the same device are applied in the given order, but
+ * not necessarily in that order relative to writes to other devices
+ */
+void device_update_uris(device_write_t *writes, int count)
+{
+	obix_dev_t **hosts = NULL;
+	xmlNode **changed = NULL;
+	int i;
+
+	if (count <= 0) {
+		return;
+	}
+
+	if (!(hosts = (obix_dev_t **)calloc(count, sizeof(obix_dev_t *))) ||
+		!(changed = (xmlNode **)malloc(sizeof(xmlNode *) * count))) {
+		/* Apply them one by one then */
+		for (i = 0; i < count; i++) {
+			if (writes[i].ret == 0) {
+				writes[i].ret = device_update_uri(writes[i].href,
+												  writes[i].val);
+			}
+		}
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (writes[i].ret == 0 &&
+			!(hosts[i] = device_search_host(writes[i].href))) {
+			writes[i].ret = ERR_DEVICE_NO_SUCH_URI;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (hosts[i]) {
+			device_update_device(hosts[i], writes, hosts, count, changed);
+		}
+	}
+
+	/* Fall through */
+
+out:
+	if (hosts) {
+		free(hosts);
+	}
+
+	if (changed) {
+		free(changed);
+	}
 }
 
 /*
@@ -1094,14 +3076,22 @@ int device_update_uri(const xmlChar *href, const xmlChar *new)
  */
 static int __device_link(obix_dev_t *child, obix_dev_t *parent)
 {
-	if (hash_add(_devices->tab, child->href, child) != 0) {
+	if (radix_add(_devices->tree, child->href, child) != 0) {
 		return ERR_NO_MEM;
 	}
 
-	cache_update(_devices->cache, child->href, child);
+	cache_flush(_devices->cache);
 
 	list_add_tail(&child->siblings, &parent->children);
 	child->parent = parent;
+
+	__device_index_touch_all(parent);
+
+	/*
+	 * Index the child device only after it has been added into the
+	 * global DOM tree with all hrefs in its contract set relative
+	 */
+	__device_index_build(child);
 	return 0;
 }
 
@@ -1344,7 +3334,7 @@ int device_add(xmlNode *input, const xmlChar *href, const char *requester_id,
 	if (sign_up == 1) {
 		if ((ret = __device_create_files(child)) != 0 ||
 			(ret = __device_write_meta(child)) != 0 ||
-			(ret = __device_write_file(child, 0)) != 0) {
+			(ret = __device_write_file(child)) != 0) {
 			__device_remove_files(child);
 			__device_unlink(child);
 			xmlUnlinkNode(input);
@@ -1353,7 +3343,6 @@ int device_add(xmlNode *input, const xmlChar *href, const char *requester_id,
 			goto failed;
 		}
 	} else {
-		child->mtime = __device_get_file_ts(child);
 		ret = 0;
 	}
 
@@ -1399,41 +3388,6 @@ failed:
 	return ret;
 }
 
-/*
- * Load the device persistent file into the oBIX server, in particular,
- * add the device contract into the global DOM tree and have its descriptor
- * created and registered
- *
- * Return 0 on success, > 0 for error code
- */
-static int device_load_contract(const char *path, meta_info_t *info)
-{
-	struct stat statbuf;
-	xmlDoc *doc;
-	xmlNode *root;
-	int ret = 0;
-
-	errno = 0;
-	if (lstat(path, &statbuf) < 0) {
-		return (errno == ENOENT) ? 0 : ERR_DISK_IO;
-	}
-
-	if (!(doc = xmlReadFile(path, NULL,
-							XML_PARSE_OPTIONS_COMMON | XML_PARSE_NODICT)) ||
-		!(root = xmlDocGetRootElement(doc))) {
-		log_error("Unable to parse XML document %s", path);
-		ret = ERR_NO_MEM;
-	} else {
-		ret = device_add(root, BAD_CAST info->href, info->owner_id, 0);
-	}
-
-	if (doc) {
-		xmlFreeDoc(doc);
-	}
-
-	return ret;
-}
-
 /*
  * Link a new child node under the parent node with the given href
  * and backup its device contract onto the hard drive if needed
@@ -1455,8 +3409,7 @@ int device_link_single_node(const xmlChar *href, xmlNode *node,
 
 	*updated = NULL;
 
-	if (!(dev = device_search(href)) &&
-		!(dev = device_search_parent(href))) {
+	if (!(dev = device_search_host(href))) {
 		return ERR_DEVICE_NO_SUCH_URI;
 	}
 
@@ -1480,12 +3433,15 @@ int device_link_single_node(const xmlChar *href, xmlNode *node,
 	*updated = parent;
 	node->_private = dev;
 
-	if (backup == 1) {
-		__device_write_file(dev, 0);
-	}
+	__device_index_update(dev, node, 1);
+	__device_index_touch(dev, href + xmlStrlen(dev->href));
 
 	tsync_writer_exit(&dev->sync);
 
+	if (backup == 1) {
+		device_mark_dirty(dev);
+	}
+
 	/* Fall through */
 
 failed:
@@ -1507,8 +3463,7 @@ int device_unlink_single_node(const xmlChar *href, xmlNode *node, int backup)
 	obix_dev_t *dev;
 	int ret = 0;
 
-	if (!(dev = device_search(href)) &&
-		!(dev = device_search_parent(href))) {
+	if (!(dev = device_search_host(href))) {
 		return ERR_DEVICE_NO_SUCH_URI;
 	}
 
@@ -1517,14 +3472,16 @@ int device_unlink_single_node(const xmlChar *href, xmlNode *node, int backup)
 		goto failed;
 	}
 
+	__device_index_update(dev, node, 0);
 	xmlUnlinkNode(node);
+	__device_index_touch(dev, href + xmlStrlen(dev->href));
+
+	tsync_writer_exit(&dev->sync);
 
 	if (backup == 1) {
-		__device_write_file(dev, 0);
+		device_mark_dirty(dev);
 	}
 
-	tsync_writer_exit(&dev->sync);
-
 	/* Fall through */
 
 failed:
@@ -1544,8 +3501,7 @@ int device_get_op_id(const xmlChar *href, long *id)
 	xmlNode *node;
 	int ret = ERR_INVALID_STATE;
 
-	if (!(dev = device_search(href)) &&
-		!(dev = device_search_parent(href))) {
+	if (!(dev = device_search_host(href))) {
 		return ERR_DEVICE_NO_SUCH_URI;
 	}
 
@@ -1563,12 +3519,31 @@ int device_get_op_id(const xmlChar *href, long *id)
 	return ret;
 }
 
+static int device_dump_ref_helper(const void *item, void *arg)
+{
+	obix_dev_t *dev = (obix_dev_t *)item;
+	xmlNode *copy = (xmlNode *)arg, *ref_copy;
+
+	/* The Device Root itself is not listed */
+	if (dev == _devices->device_root) {
+		return 0;
+	}
+
+	if (!(ref_copy = xmlCopyNode(dev->ref, 1)) ||
+		!xmlAddChild(copy, ref_copy)) {
+		if (ref_copy) {
+			xmlFreeNode(ref_copy);
+		}
+
+		return -1;
+	}
+
+	return 0;
+}
+
 xmlNode *device_dump_ref(void)
 {
-	xmlNode *copy, *ref, *ref_copy;
-	hash_head_t *head;
-	hash_node_t *hn;
-	int i;
+	xmlNode *copy;
 
 	if (!(copy = xmldb_copy_uri(OBIX_DEVICES, 0))) {
 		log_error("Failed to copy from %s", OBIX_DEVICES);
@@ -1578,32 +3553,12 @@ xmlNode *device_dump_ref(void)
 	xmlUnsetProp(copy, BAD_CAST OBIX_ATTR_HIDDEN);
 	xmlSetProp(copy, BAD_CAST OBIX_ATTR_HREF, OBIX_DEVICES);
 
-	for (i = 0; i < _devices->tab->size; i++) {
-		head = &_devices->tab->table[i];
-
-		tsync_reader_entry(&head->sync);	/* Won't fail */
-
-		list_for_each_entry(hn, &head->head, list) {
-			ref = ((obix_dev_t *)(hn->item))->ref;
-			if (!(ref_copy = xmlCopyNode(ref, 1)) ||
-				!xmlAddChild(copy, ref_copy)) {
-				tsync_reader_exit(&head->sync);
-				goto failed;
-			}
-		}
-
-		tsync_reader_exit(&head->sync);
+	if (radix_for_each(_devices->tree, device_dump_ref_helper, copy) < 0) {
+		xmlFreeNode(copy);
+		return NULL;
 	}
 
 	return copy;
-
-failed:
-	if (ref_copy) {
-		xmlFreeNode(ref_copy);
-	}
-
-	xmlFreeNode(copy);
-	return NULL;
 }
 
 void obix_devices_dispose(void)
@@ -1612,6 +3567,16 @@ void obix_devices_dispose(void)
 		return;
 	}
 
+	/*
+	 * Stop the persister and save all remaining dirty devices before
+	 * their descriptors are released
+	 */
+	if (_devices->persister.initialised == 1) {
+		obix_destroy_task(&_devices->persister);
+		device_persist_task(NULL);
+		device_snapshot_save();
+	}
+
 	if (_devices->device_root) {
 		/*
 		 * Recursively deleting all remaining registered devices
@@ -1626,8 +3591,23 @@ void obix_devices_dispose(void)
 		cache_dispose(_devices->cache);
 	}
 
-	if (_devices->tab) {
-		hash_destroy_table(_devices->tab);
+	if (_devices->resp_cache) {
+		resp_cache_dispose(_devices->resp_cache);
+	}
+
+	if (_devices->tree) {
+		radix_dispose(_devices->tree);
+	}
+
+	pthread_mutex_destroy(&_devices->dirty_mutex);
+	pthread_mutex_destroy(&_devices->persist_mutex);
+
+	if (_devices->snapshot) {
+		device_snapshot_unload(_devices->snapshot);
+	}
+
+	if (_devices->snapshot_file) {
+		free(_devices->snapshot_file);
 	}
 
 	free(_devices);
@@ -1636,8 +3616,9 @@ void obix_devices_dispose(void)
 	log_debug("The Device subsystem disposed");
 }
 
-int obix_devices_init(const char *resdir, const int table_size,
-					  const int cache_size, const int backup_period)
+int obix_devices_init(const char *resdir, const int cache_size,
+					  const int resp_cache_size, const int backup_period,
+					  const int snapshot_period, const int load_threads)
 {
 	xmlNode *root;
 	char *dir;
@@ -1654,9 +3635,21 @@ int obix_devices_init(const char *resdir, const int table_size,
 	memset(_devices, 0, sizeof(obix_devices_t));
 
 	_devices->backup_period = backup_period;
+	_devices->snapshot_period = snapshot_period;
+	_devices->snapshot_ts = time(NULL);
+
+	if (link_pathname(&_devices->snapshot_file, resdir, NULL,
+					  SERVER_DB_DEVICE_SNAPSHOT, NULL) < 0) {
+		log_error("Failed to assemble pathname for device database snapshot");
+		goto failed;
+	}
+
+	INIT_LIST_HEAD(&_devices->dirty);
+	pthread_mutex_init(&_devices->dirty_mutex, NULL);
+	pthread_mutex_init(&_devices->persist_mutex, NULL);
 
-	if (!(_devices->tab = hash_init_table(table_size, &device_hash_ops))) {
-		log_error("Failed to allocate hash table for the Device subsystem");
+	if (!(_devices->tree = radix_init(device_get_wrapper))) {
+		log_error("Failed to allocate prefix tree for the Device subsystem");
 		goto failed;
 	}
 
@@ -1665,6 +3658,11 @@ int obix_devices_init(const char *resdir, const int table_size,
 		goto failed;
 	}
 
+	if (!(_devices->resp_cache = resp_cache_init(resp_cache_size))) {
+		log_error("Failed to allocate response cache for the Device subsystem");
+		goto failed;
+	}
+
 	if (!(root = xmldb_get_node(obix_roots[OBIX_DEVICE].root)) ||
 		!(_devices->device_root = device_init(root, obix_roots[OBIX_DEVICE].root,
 											  dir, OBIX_ID_DEVICE))) {
@@ -1672,11 +3670,39 @@ int obix_devices_init(const char *resdir, const int table_size,
 		goto failed;
 	}
 
-	if (device_load_files(dir) != 0) {
+	if (radix_add(_devices->tree, _devices->device_root->href,
+				  _devices->device_root) != 0) {
+		log_error("Failed to register the Device Root");
+		device_dispose(_devices->device_root);
+		_devices->device_root = NULL;
+		goto failed;
+	}
+
+	__device_index_build(_devices->device_root);
+
+	_devices->snapshot = device_snapshot_load(_devices->snapshot_file);
+
+	if (device_load_files(dir, load_threads) != 0) {
 		log_error("Failed to load device persistent files from %s", dir);
 		goto failed;
 	}
 
+	if (_devices->snapshot) {
+		log_debug("Restored %d out of %u devices from snapshot at %s",
+				  _devices->snapshot->restored, _devices->snapshot->count,
+				  _devices->snapshot_file);
+		device_snapshot_unload(_devices->snapshot);
+		_devices->snapshot = NULL;
+	}
+
+	if (obix_setup_task(&_devices->persister, NULL, device_persist_task,
+						_devices, _devices->backup_period * 1000,
+						EXECUTE_INDEFINITE) < 0 ||
+		obix_schedule_task(&_devices->persister) < 0) {
+		log_error("Failed to start the persister of the Device subsystem");
+		goto failed;
+	}
+
 	free(dir);
 
 	log_debug("The Device subsystem initialised");
@@ -1689,74 +3715,61 @@ failed:
 	return ERR_NO_MEM;
 }
 
-#ifdef DEBUG
-xmlNode *device_dump(void)
+/*
+ * Dump the statistics of the cache of the Device subsystem
+ */
+xmlNode *device_cache_dump(void)
 {
-	hash_table_t *tab = _devices->tab;
-	hash_head_t *head;
-	hash_node_t *node;
-	xmlNode *dump = NULL, *list = NULL, *item = NULL;
-	int i, ret = 0;
+	cache_t *cache = _devices->cache;
+	xmlNode *dump;
 	char buf[32];
+	int ret = 0;
 
-	if (!(dump = xmlNewNode(NULL, BAD_CAST OBIX_OBJ_LIST))) {
+	if (!(dump = xmlNewNode(NULL, BAD_CAST OBIX_OBJ)) ||
+		!xmlSetProp(dump, BAD_CAST OBIX_ATTR_NAME, BAD_CAST "Device Cache")) {
 		ret = ERR_NO_MEM;
 		goto failed;
 	}
 
-	/* Being lazy on checking return value for debug functions */
-	sprintf(buf, "%d", tab->size);
-	xmlSetProp(dump, BAD_CAST OBIX_ATTR_NAME, BAD_CAST "Device Hash Table");
-	xmlSetProp(dump, BAD_CAST "size", BAD_CAST buf);
-	xmlSetProp(dump, BAD_CAST OBIX_ATTR_OF, BAD_CAST "obix:list");
-
-	for (i = 0; i < tab->size; i++) {
-		head = &tab->table[i];
-
-		if (!(list = xmlNewNode(NULL, BAD_CAST OBIX_OBJ_LIST))) {
-			ret = ERR_NO_MEM;
-			break;
-		}
-
-		sprintf(buf, "Queue %d", i);
-		xmlSetProp(list, BAD_CAST OBIX_ATTR_NAME, BAD_CAST buf);
-		xmlSetProp(list, BAD_CAST OBIX_ATTR_OF, BAD_CAST "obix:uri");
+	sprintf(buf, "%d", cache_get_size(cache));
+	if (!xmlSetProp(dump, BAD_CAST "size", BAD_CAST buf)) {
+		ret = ERR_NO_MEM;
+		goto failed;
+	}
 
-		tsync_reader_entry(&head->sync);
+	sprintf(buf, "%ld", cache_get_hit(cache));
+	if (!xmlSetProp(dump, BAD_CAST "hit", BAD_CAST buf)) {
+		ret = ERR_NO_MEM;
+		goto failed;
+	}
 
-		sprintf(buf, "%d", head->count);
-		xmlSetProp(list, BAD_CAST "len", BAD_CAST buf);
+	sprintf(buf, "%ld", cache_get_miss(cache));
+	if (!xmlSetProp(dump, BAD_CAST "miss", BAD_CAST buf)) {
+		ret = ERR_NO_MEM;
+		goto failed;
+	}
 
-		list_for_each_entry(node, &head->head, list) {
-			if (!(item = xmlNewNode(NULL, BAD_CAST OBIX_OBJ_URI)) ||
-				!xmlSetProp(item, BAD_CAST OBIX_ATTR_VAL,
-							((obix_dev_t *)node->item)->href) ||
-				!xmlAddChild(list, item)) {
-				ret = ERR_NO_MEM;
-				break;
-			}
-		}
+	sprintf(buf, "%d", resp_cache_get_size(_devices->resp_cache));
+	if (!xmlSetProp(dump, BAD_CAST "resp_size", BAD_CAST buf)) {
+		ret = ERR_NO_MEM;
+		goto failed;
+	}
 
-		tsync_reader_exit(&head->sync);
+	sprintf(buf, "%ld", resp_cache_get_hit(_devices->resp_cache));
+	if (!xmlSetProp(dump, BAD_CAST "resp_hit", BAD_CAST buf)) {
+		ret = ERR_NO_MEM;
+		goto failed;
+	}
 
-		if (ret > 0 || !xmlAddChild(dump, list)) {
-			ret = ERR_NO_MEM;
-			break;
-		}
+	sprintf(buf, "%ld", resp_cache_get_miss(_devices->resp_cache));
+	if (!xmlSetProp(dump, BAD_CAST "resp_miss", BAD_CAST buf)) {
+		ret = ERR_NO_MEM;
 	}
 
 	/* Fall through */
 
 failed:
 	if (ret > 0) {
-		if (item) {
-			xmlFreeNode(item);
-		}
-
-		if (list) {
-			xmlFreeNode(list);
-		}
-
 		if (dump) {
 			xmlFreeNode(dump);
 		}
@@ -1767,57 +3780,43 @@ failed:
 	return dump;
 }
 
-xmlNode *device_cache_dump(void)
+#ifdef DEBUG
+static int device_dump_helper(const void *item, void *arg)
 {
-	cache_t *cache = _devices->cache;
-	xmlNode *dump = NULL, *list = NULL, *item = NULL;
-	const xmlChar *href;
-	char buf[32];
-	int ret = 0, i;
+	xmlNode *dump = (xmlNode *)arg, *node;
+
+	if (!(node = xmlNewNode(NULL, BAD_CAST OBIX_OBJ_URI)) ||
+		!xmlSetProp(node, BAD_CAST OBIX_ATTR_VAL,
+					((obix_dev_t *)item)->href) ||
+		!xmlAddChild(dump, node)) {
+		if (node) {
+			xmlFreeNode(node);
+		}
 
-	if (!(dump = xmlNewNode(NULL, BAD_CAST OBIX_OBJ)) ||
-		!(list = xmlNewNode(NULL, BAD_CAST OBIX_OBJ_LIST)) ||
-		!xmlAddChild(dump, list)) {
-		ret = ERR_NO_MEM;
-		goto failed;
+		return -1;
 	}
 
-	xmlSetProp(dump, BAD_CAST OBIX_ATTR_NAME, BAD_CAST "Device Cache");
-	xmlSetProp(list, BAD_CAST OBIX_ATTR_NAME, BAD_CAST "Cache slots");
-	xmlSetProp(list, BAD_CAST OBIX_ATTR_OF, BAD_CAST "obix:uri");
-
-	pthread_mutex_lock(&cache->mutex);
-
-	sprintf(buf, "%ld", cache->hit);
-	xmlSetProp(dump, BAD_CAST "hit", BAD_CAST buf);
+	return 0;
+}
 
-	sprintf(buf, "%ld", cache->miss);
-	xmlSetProp(dump, BAD_CAST "miss", BAD_CAST buf);
+xmlNode *device_dump(void)
+{
+	xmlNode *dump;
+	char buf[32];
 
-	for (i = 0; i < cache->len; i++) {
-		href = (cache->items[i].href) ? cache->items[i].href : BAD_CAST "NULL";
-		if (!(item = xmlNewNode(NULL, BAD_CAST OBIX_OBJ_URI)) ||
-			!xmlSetProp(item, BAD_CAST OBIX_ATTR_VAL, href) ||
-			!xmlAddChild(list, item)) {
-			ret = ERR_NO_MEM;
-			break;
-		}
+	if (!(dump = xmlNewNode(NULL, BAD_CAST OBIX_OBJ_LIST))) {
+		return xmldb_fatal_error();
 	}
 
-	pthread_mutex_unlock(&cache->mutex);
-
-failed:
-	if (ret > 0) {
-		if (list) {
-			xmlFreeNode(list);
-		}
-
-		if (dump) {
-			xmlFreeNode(dump);
-		}
+	/* Being lazy on checking return value for debug functions */
+	sprintf(buf, "%d", _devices->tree->count);
+	xmlSetProp(dump, BAD_CAST OBIX_ATTR_NAME, BAD_CAST "Device Registry");
+	xmlSetProp(dump, BAD_CAST "len", BAD_CAST buf);
+	xmlSetProp(dump, BAD_CAST OBIX_ATTR_OF, BAD_CAST "obix:uri");
 
+	if (radix_for_each(_devices->tree, device_dump_helper, dump) < 0) {
+		xmlFreeNode(dump);
 		dump = xmldb_fatal_error();
-
 	}
 
 	return dump;
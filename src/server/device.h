@@ -23,13 +23,40 @@
 
 #include <libxml/tree.h>
 #include "xml_utils.h"
+#include "arena.h"
 
 extern const xmlChar *OBIX_DEVICES;
 
+/*
+ * One of a number of writes applied by device_update_uris()
+ */
+typedef struct device_write {
+	/* The absolute href of the node to be written */
+	const xmlChar *href;
+
+	/* The new value of the node */
+	const xmlChar *val;
+
+	/*
+	 * The result of the write, 0 on success, > 0 for error code.
+	 * Entries with non-zero results on entry are skipped
+	 */
+	int ret;
+} device_write_t;
+
 int is_device_root_href(const xmlChar *href);
 
 xmlNode *device_copy_uri(const xmlChar *href, xml_copy_flags_t flags);
+xmlNode *device_copy_uri_cacheable(const xmlChar *href, xml_copy_flags_t flags,
+								   unsigned long *version, arena_t *arena);
+unsigned long device_get_version(const xmlChar *href);
+const void *device_host_key(const xmlChar *href);
+int device_read_cached(const xmlChar *href, xml_copy_flags_t flags,
+					   char **data, int *size, unsigned long *current);
+void device_cache_response(const xmlChar *href, xml_copy_flags_t flags,
+						   unsigned long version, const char *data, int size);
 int device_update_uri(const xmlChar *href, const xmlChar *new);
+void device_update_uris(device_write_t *writes, int count);
 int device_backup_uri(const xmlChar *href);
 int device_get_op_id(const xmlChar *href, long *id);
 int device_link_single_node(const xmlChar *href, xmlNode *node,
@@ -40,14 +67,15 @@ int device_del(const xmlChar *href, const char *requester_id, int sign_off);
 int device_add(xmlNode *input, const xmlChar *href, const char *requester_id, int sign_up);
 
 void obix_devices_dispose(void);
-int obix_devices_init(const char *resdir, const int table_size,
-					  const int cache_size, const int backup_period);
+int obix_devices_init(const char *resdir, const int cache_size,
+					  const int resp_cache_size, const int backup_period,
+					  const int snapshot_period, const int load_threads);
 
 xmlNode *device_dump_ref(void);
+xmlNode *device_cache_dump(void);
 
 #ifdef DEBUG
 xmlNode *device_dump(void);
-xmlNode *device_cache_dump(void);
 #endif
 
 #endif
@@ -31,6 +31,7 @@
 #include <limits.h>		/* LONG_MAX, LONG_MIN */
 #include <sys/uio.h>	/* writev */
 #include <libxml/tree.h>
+#include <libxml/parser.h>
 #include "list.h"
 #include "log_utils.h"
 #include "obix_utils.h"
@@ -119,6 +120,18 @@ typedef struct obix_hist_dev {
 	struct list_head list;
 } obix_hist_dev_t;
 
+/*
+ * Descriptor of one record to be appended to a history facility
+ */
+typedef struct hist_record {
+	/* value of its timestamp sub-node, or NULL if not available */
+	char *ts;
+
+	/* record content in the same format as saved in log files */
+	char *data;
+	int len;
+} hist_record_t;
+
 typedef int (*obix_hist_func_t) (obix_request_t *request,
 								 obix_hist_dev_t *dev, xmlNode *input);
 
@@ -177,6 +190,12 @@ static const int OBIX_HISTORY_LOBBY_LEN = 31;
  */
 static const char *HIST_RECORD_SEPARATOR = "\r\n";
 
+/*
+ * The maximal number of iovecs written to a log file by one writev(),
+ * each record taking two for its content and the separator
+ */
+#define HIST_IOV_MAX			512
+
 /*
  * The index file will be created upon the reception of
  * the get request with a unique device id that this history
@@ -284,54 +303,53 @@ static int add_abs_count(obix_hist_file_t *file, int added)
 }
 
 /*
- * Append one record into a log file
+ * Append a batch of records, as described by the given iovecs in pairs
+ * of record content and separator, into a log file
  *
- * Obviously the IO performance could be further promoted if ALL records
- * contained in one HistoryAppendIn contract could be written altogether
- * instead of separately. However, the adoption of Linux kernel IO cache
- * has greatly mitigated the potential performance loss. Furthermore, the
- * potential improvement will require creating iovecs array for arbitrary
- * number of records, making it not that appealing.
+ * All records are written by one writev() call, or a few if it returns
+ * early, so that a HistoryAppendIn contract with hundreds of records
+ * only takes one open and one synchronous write on the log file
  *
  * Return 0 on success, > 0 for error code
  */
-static int write_logfile(obix_hist_file_t *file, xmlNode *record)
+static int write_logfile(obix_hist_file_t *file, struct iovec *iov, int count)
 {
-	char *data;
-	struct iovec iov[2];
-	int fd, ret = ERR_HISTORY_IO;
-
-	if (!(data = xml_dump_node(record))) {
-		log_error("Failed to dump record content");
-		return ERR_NO_MEM;
-	}
-
-	iov[0].iov_base = data;
-	iov[0].iov_len = strlen(data);
-	iov[1].iov_base = (char *)HIST_RECORD_SEPARATOR;
-	iov[1].iov_len = strlen(HIST_RECORD_SEPARATOR);
+	ssize_t n;
+	int fd, ret = 0;
 
 	errno = 0;
 	if ((fd = open(file->filepath, O_APPEND | O_WRONLY | O_SYNC)) < 0) {
 		log_error("Failed to open %s because of %s", file->filepath,
 				  strerror(errno));
-		goto failed;
+		return ERR_HISTORY_IO;
 	}
 
-	errno = 0;
-	if (writev(fd, iov, 2) < 0) {
-		log_error("Failed to append %s because of %s", file->filepath,
-				  strerror(errno));
-	} else {
-		ret = 0;
-	}
+	while (count > 0) {
+		errno = 0;
+		if ((n = writev(fd, iov, count)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
 
-	close(fd);
+			log_error("Failed to append %s because of %s", file->filepath,
+					  strerror(errno));
+			ret = ERR_HISTORY_IO;
+			break;
+		}
 
-	/* Fall through */
+		while (count > 0 && n >= (ssize_t)iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
 
-failed:
-	free(data);
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	close(fd);
 	return ret;
 }
 
@@ -817,41 +835,68 @@ static void hist_flush_index(obix_hist_dev_t *dev)
 }
 
 /*
- * Append records from input contract to the given history facility,
- * return the number of records added through the last parameter
+ * Write a batch of records pending on the given log file, then update
+ * its abstract with the timestamp of the last one and the number of
+ * records added
+ *
+ * Return 0 on success, > 0 for error code
+ */
+static int hist_flush_records(obix_hist_file_t *file, struct iovec *iov,
+							  int count, const char *ts)
+{
+	int ret;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	if ((ret = write_logfile(file, iov, count)) > 0) {
+		return ret;
+	}
+
+	update_value(file->abstract, OBIX_OBJ_ABSTIME, HIST_ABS_END, ts);
+	add_abs_count(file, count / 2);
+
+	return 0;
+}
+
+/*
+ * Append the given records to the history facility, return the number
+ * of records added through the last parameter
+ *
+ * Records of the same date are gathered and written into their log
+ * file in batches, instead of one by one
  *
  * Return 0 on success, > 0 for error code
  *
  * NOTE: Caller has entered the "write region" of relevant history
  * facility
  */
-static int __hist_append_dev(obix_hist_dev_t *dev, xmlNode *input, int *added)
+static int __hist_append_records(obix_hist_dev_t *dev,
+								 const hist_record_t *records, int num,
+								 int *added)
 {
 	obix_hist_file_t *file;
-	xmlNode *list, *record;
-	char *ts = NULL, *latest_ts = NULL;
-	int count = 0, all_count = 0;
+	struct iovec iov[HIST_IOV_MAX];
+	const hist_record_t *record;
+	const char *latest_ts;
+	char *end_ts = NULL;
+	int i, n = 0, all_count = 0;
 	int res, new_day = 0, ret = 0;
 
 	*added = 0;
 
-	if(!(list = xml_find_child(input, OBIX_OBJ_LIST,
-							   OBIX_ATTR_NAME, HIST_AIN_DATA))) {
-		return ERR_INVALID_INPUT;
-	}
-
 	/* Get the timestamp of the latest history record */
 	if (list_empty(&dev->files) == 1) {
 		file = NULL;
-		latest_ts = strdup(HIST_TS_INIT);
+		latest_ts = HIST_TS_INIT;
 	} else {
 		file = list_last_entry(&dev->files, obix_hist_file_t, list);
-		latest_ts = xml_get_child_val(file->abstract, OBIX_OBJ_ABSTIME,
-									  HIST_ABS_END);
-	}
-
-	if (!latest_ts) {
-		return ERR_NO_MEM;
+		if (!(latest_ts = end_ts = xml_get_child_val(file->abstract,
+													 OBIX_OBJ_ABSTIME,
+													 HIST_ABS_END))) {
+			return ERR_NO_MEM;
+		}
 	}
 
 	/*
@@ -859,21 +904,11 @@ static int __hist_append_dev(obix_hist_dev_t *dev, xmlNode *input, int *added)
 	 * examine their timestamp's sanity, but more importantly, to
 	 * create new log file for a new date when needed
 	 */
-	for (record = list->children; record; record = record->next) {
-		if (record->type != XML_ELEMENT_NODE) {
-			continue;
-		}
-
-		/*
-		 * Free strings of previous record. Due to the use of continue,
-		 * they can't be released at the end of each loop
-		 */
-		if (ts) {
-			free(ts);
-		}
+	for (i = 0; i < num; i++) {
+		record = records + i;
 
-		if (!(ts = xml_get_child_val(record, OBIX_OBJ_ABSTIME, HIST_REC_TS)) ||
-			timestamp_compare(ts, latest_ts, &res, &new_day) < 0) {
+		if (!record->ts ||
+			timestamp_compare(record->ts, latest_ts, &res, &new_day) < 0) {
 			ret = ERR_TS_COMPARE;
 			continue;
 		}
@@ -883,85 +918,144 @@ static int __hist_append_dev(obix_hist_dev_t *dev, xmlNode *input, int *added)
 		 * older than or equal to the latest one
 		 */
 		if (res <= 0) {
-			log_debug("ts: %s VS latest_ts: %s", ts, latest_ts);
+			log_debug("ts: %s VS latest_ts: %s", record->ts, latest_ts);
 			ret = ERR_TS_OBSOLETE;
 			continue;
 		}
 
-		/* Create a new fragment file for the new date */
-		if (new_day == 1) {
-			if (count > 0) {
-				add_abs_count(file, count);
-				count = 0;		/* Reset counter for the new log file */
-			}
-
-			if (!(file = __hist_create_fragment(dev, ts))) {
-				ret = ERR_HISTORY_IO;
+		/* Write pending records before moving on to a new log file */
+		if (new_day == 1 || n == HIST_IOV_MAX) {
+			if ((res = hist_flush_records(file, iov, n, latest_ts)) > 0) {
+				ret = res;
 				goto failed;
 			}
+
+			all_count += n / 2;
+			n = 0;
 		}
 
-		if ((ret = write_logfile(file, record)) > 0) {
+		/* Create a new fragment file for the new date */
+		if (new_day == 1 && !(file = __hist_create_fragment(dev, record->ts))) {
+			ret = ERR_HISTORY_IO;
 			goto failed;
 		}
 
-		update_value(file->abstract, OBIX_OBJ_ABSTIME, HIST_ABS_END, ts);
+		iov[n].iov_base = record->data;
+		iov[n++].iov_len = record->len;
+		iov[n].iov_base = (char *)HIST_RECORD_SEPARATOR;
+		iov[n++].iov_len = strlen(HIST_RECORD_SEPARATOR);
 
-		/* Update latest_ts */
-		free(latest_ts);
-		if (!(latest_ts = strdup(ts))) {
-			ret = ERR_NO_MEM;
-			goto failed;
-		}
+		latest_ts = record->ts;
+	}
 
-		count++;
-		all_count++;
+	if ((res = hist_flush_records(file, iov, n, latest_ts)) > 0) {
+		ret = res;
+	} else {
+		all_count += n / 2;
 	}
 
+	/* Fall through */
+
+failed:
 	/*
-	 * Don't mix up count and all_count, the former is about the number of
-	 * records written to a single log file and gets reset to zero when it
-	 * comes to a new log file, while the latter is about the total number
-	 * of records successfully written into current device.
+	 * Records successfully written must be accounted for even if
+	 * the rest are failed due to errors such as ERR_HISTORY_IO
 	 */
-	if (count > 0) {
-		add_abs_count(file, count);
-	}
-
 	if (all_count > 0) {
 		dev->count += all_count;
 		hist_flush_index(dev);
 		*added = all_count;
 	}
 
-	/* TODO:
-	 * How to handle the case when only partial records are successfully
-	 * written and the rest are failed due to errors such as -4, -5 and -6?
-	 *
-	 * In this case, (all_count > 0 && ret < 0)
-	 */
+	if (end_ts) {
+		free(end_ts);
+	}
 
-	/* Fall through */
+	return ret;
+}
 
-failed:
-	if (latest_ts) {
-		free(latest_ts);
+static void hist_free_records(hist_record_t *records, int num)
+{
+	int i;
+
+	for (i = 0; i < num; i++) {
+		if (records[i].ts) {
+			free(records[i].ts);
+		}
+
+		if (records[i].data) {
+			free(records[i].data);
+		}
 	}
 
-	if (ts) {
-		free(ts);
+	free(records);
+}
+
+/*
+ * Collect records from the data list of the input contract, each
+ * dumped by xml_dump_node() the same way as saved in log files
+ *
+ * Return 0 on success, > 0 for error code
+ */
+static int hist_get_records(xmlNode *input, hist_record_t **records, int *num)
+{
+	xmlNode *list, *record;
+	hist_record_t *r;
+	int count = 0;
+
+	*records = NULL;
+	*num = 0;
+
+	if (!(list = xml_find_child(input, OBIX_OBJ_LIST,
+								OBIX_ATTR_NAME, HIST_AIN_DATA))) {
+		return ERR_INVALID_INPUT;
 	}
 
-	return ret;
+	for (record = list->children; record; record = record->next) {
+		if (record->type == XML_ELEMENT_NODE) {
+			count++;
+		}
+	}
+
+	if (count == 0) {
+		return 0;
+	}
+
+	if (!(*records = (hist_record_t *)calloc(count, sizeof(hist_record_t)))) {
+		return ERR_NO_MEM;
+	}
+
+	for (record = list->children, r = *records; record; record = record->next) {
+		if (record->type != XML_ELEMENT_NODE) {
+			continue;
+		}
+
+		/* Records without timestamp are rejected later */
+		r->ts = xml_get_child_val(record, OBIX_OBJ_ABSTIME, HIST_REC_TS);
+
+		if (!(r->data = xml_dump_node(record))) {
+			log_error("Failed to dump record content");
+			hist_free_records(*records, r - *records + 1);
+			*records = NULL;
+			return ERR_NO_MEM;
+		}
+
+		r->len = strlen(r->data);
+		r++;
+	}
+
+	*num = count;
+	return 0;
 }
 
 /**
- * Append records from input contract to history log files
+ * Append the given records to history log files and generate
+ * a HistoryAppendOut contract as the response
  *
  * Return 0 on success, > 0 for error code
  */
-static int hist_append_dev(obix_request_t *request,
-						   obix_hist_dev_t *dev, xmlNode *input)
+static int hist_append_records(obix_request_t *request, obix_hist_dev_t *dev,
+							   const hist_record_t *records, int num)
 {
 	char *start = NULL, *end = NULL;
 	obix_hist_file_t *first, *last;
@@ -976,7 +1070,7 @@ static int hist_append_dev(obix_request_t *request,
 		return ERR_INVALID_STATE;
 	}
 
-	if ((ret = __hist_append_dev(dev, input, &added)) > 0) {
+	if ((ret = __hist_append_records(dev, records, num, &added)) > 0) {
 		tsync_writer_exit(&dev->sync);
 		return ret;
 	}
@@ -1040,6 +1134,522 @@ failed:
 	return ret;
 }
 
+/**
+ * Append records from input contract to history log files
+ *
+ * Return 0 on success, > 0 for error code
+ */
+static int hist_append_dev(obix_request_t *request,
+						   obix_hist_dev_t *dev, xmlNode *input)
+{
+	hist_record_t *records;
+	int num, ret;
+
+	if ((ret = hist_get_records(input, &records, &num)) > 0) {
+		return ret;
+	}
+
+	ret = hist_append_records(request, dev, records, num);
+
+	if (records) {
+		hist_free_records(records, num);
+	}
+
+	return ret;
+}
+
+/*
+ * The SAX fast path of HistoryAppendIn contracts
+ *
+ * Instead of building a DOM tree of the input contract and dumping every
+ * record from it, records are serialised on the fly, exactly the same
+ * way as xml_dump_node() does, by SAX callbacks into one single buffer,
+ * along with their timestamps.
+ *
+ * Any input that may be serialised differently by xml_dump_node(), such
+ * as records with text content, comments, namespace prefixes or non-ASCII
+ * characters, is handed over to the DOM path instead
+ */
+
+/* The return value of hist_sax_parse() to resort to the DOM path */
+#define HIST_SAX_FALLBACK		-1
+
+/* The maximal level of elements nested in a record */
+#define HIST_SAX_LEVEL_MAX		16
+
+/* The initial size of the buffer of records */
+#define HIST_SAX_BUF_SIZE		4096
+
+/* The indentation of each level applied by xml_dump_node() */
+static const char *HIST_SAX_INDENT = "  ";
+
+typedef struct hist_sax_record {
+	/* offsets of the record and its timestamp in the buffer */
+	long data, ts;
+
+	int len;
+} hist_sax_record_t;
+
+typedef struct hist_sax {
+	/* the depth of the current element, the root being 1 */
+	int depth;
+
+	/* 0 before the data list, 1 inside it and 2 after it */
+	int list;
+
+	/* the level of the current element in a record, or -1 if not in one */
+	int level;
+
+	/* whether elements on each level have children or blank text */
+	char has_child[HIST_SAX_LEVEL_MAX];
+	char has_blank[HIST_SAX_LEVEL_MAX];
+
+	/* the timestamp of the current record and whether it is found */
+	char *ts;
+	int ts_found;
+
+	/* 0, HIST_SAX_FALLBACK or > 0 for error code */
+	int ret;
+
+	/* the buffer of all records and their timestamps */
+	char *buf;
+	long len, size;
+
+	hist_sax_record_t *recs;
+	int count, capacity;
+
+	/* descriptors of records pointing to the buffer */
+	hist_record_t *records;
+} hist_sax_t;
+
+static void hist_sax_put(hist_sax_t *sax, const char *str, int len)
+{
+	char *buf;
+	long size;
+
+	if (sax->ret != 0) {
+		return;
+	}
+
+	if (sax->len + len >= sax->size) {
+		for (size = (sax->size > 0) ? sax->size : HIST_SAX_BUF_SIZE;
+			 size <= sax->len + len; size *= 2);	/* do nothing */
+
+		if (!(buf = (char *)realloc(sax->buf, size))) {
+			sax->ret = ERR_NO_MEM;
+			return;
+		}
+
+		sax->buf = buf;
+		sax->size = size;
+	}
+
+	memcpy(sax->buf + sax->len, str, len);
+	sax->len += len;
+}
+
+static void hist_sax_puts(hist_sax_t *sax, const char *str)
+{
+	hist_sax_put(sax, str, strlen(str));
+}
+
+/*
+ * Escape an attribute value the same way as libxml2 serialises it
+ */
+static void hist_sax_put_attr_val(hist_sax_t *sax, const xmlChar *val)
+{
+	const xmlChar *p;
+	const char *esc;
+
+	for (p = val; *p != '\0'; p++) {
+		switch (*p) {
+		case '<':
+			esc = "&lt;";
+			break;
+		case '>':
+			esc = "&gt;";
+			break;
+		case '&':
+			/*
+			 * Without entities substituted, the SAX parser keeps
+			 * ampersands as character references in attributes
+			 */
+			if (xmlStrncmp(p + 1, BAD_CAST "#38;", 4) != 0) {
+				sax->ret = HIST_SAX_FALLBACK;
+				return;
+			}
+
+			hist_sax_put(sax, (const char *)val, p - val);
+			hist_sax_puts(sax, "&amp;");
+			p += 4;
+			val = p + 1;
+			continue;
+		case '"':
+			esc = "&quot;";
+			break;
+		case '\n':
+			esc = "&#10;";
+			break;
+		case '\r':
+			esc = "&#13;";
+			break;
+		case '\t':
+			esc = "&#9;";
+			break;
+		default:
+			if (*p >= 0x80) {
+				/* Character references depend on the encoding */
+				sax->ret = HIST_SAX_FALLBACK;
+				return;
+			}
+
+			continue;
+		}
+
+		hist_sax_put(sax, (const char *)val, p - val);
+		hist_sax_puts(sax, esc);
+		val = p + 1;
+	}
+
+	hist_sax_put(sax, (const char *)val, p - val);
+}
+
+static void hist_sax_indent(hist_sax_t *sax)
+{
+	int i;
+
+	for (i = 0; i < sax->level; i++) {
+		hist_sax_puts(sax, HIST_SAX_INDENT);
+	}
+}
+
+static const xmlChar *hist_sax_get_attr(const xmlChar **atts,
+										const char *name)
+{
+	int i;
+
+	for (i = 0; atts && atts[i]; i += 2) {
+		if (xmlStrcmp(atts[i], BAD_CAST name) == 0) {
+			return atts[i + 1];
+		}
+	}
+
+	return NULL;
+}
+
+static void hist_sax_start_record(hist_sax_t *sax)
+{
+	hist_sax_record_t *recs;
+	int capacity;
+
+	if (sax->count == sax->capacity) {
+		capacity = (sax->capacity > 0) ? sax->capacity * 2 : 64;
+
+		if (!(recs = (hist_sax_record_t *)realloc(sax->recs,
+									sizeof(hist_sax_record_t) * capacity))) {
+			sax->ret = ERR_NO_MEM;
+			return;
+		}
+
+		sax->recs = recs;
+		sax->capacity = capacity;
+	}
+
+	sax->recs[sax->count].data = sax->len;
+	sax->recs[sax->count].ts = -1;
+
+	if (sax->ts) {
+		free(sax->ts);
+		sax->ts = NULL;
+	}
+
+	sax->ts_found = 0;
+	sax->level = 0;
+}
+
+static void hist_sax_end_record(hist_sax_t *sax)
+{
+	hist_sax_record_t *rec = sax->recs + sax->count;
+
+	rec->len = sax->len - rec->data;
+
+	if (sax->ts) {
+		rec->ts = sax->len;
+		hist_sax_put(sax, sax->ts, strlen(sax->ts) + 1);
+	}
+
+	sax->count++;
+}
+
+static void hist_sax_start_element(void *ctx, const xmlChar *name,
+								   const xmlChar **atts)
+{
+	hist_sax_t *sax = (hist_sax_t *)ctx;
+	const xmlChar *val;
+	int i;
+
+	if (sax->ret != 0) {
+		return;
+	}
+
+	sax->depth++;
+
+	if (hist_sax_get_attr(atts, "xml:space") != NULL) {
+		sax->ret = HIST_SAX_FALLBACK;	/* blanks are preserved */
+		return;
+	}
+
+	if (sax->level >= 0) {
+		if (sax->level + 1 == HIST_SAX_LEVEL_MAX) {
+			sax->ret = HIST_SAX_FALLBACK;
+			return;
+		}
+
+		/* Close the start tag of the parent, blanks before are dropped */
+		if (sax->has_child[sax->level] == 0) {
+			hist_sax_puts(sax, ">\n");
+			sax->has_child[sax->level] = 1;
+		}
+
+		sax->has_blank[sax->level] = 0;
+		sax->level++;
+		hist_sax_indent(sax);
+	} else if (sax->list == 1 && sax->depth == 3) {
+		hist_sax_start_record(sax);
+	} else {
+		if (sax->list == 0 && sax->depth == 2 &&
+			xmlStrcmp(name, BAD_CAST OBIX_OBJ_LIST) == 0 &&
+			(val = hist_sax_get_attr(atts, OBIX_ATTR_NAME)) != NULL &&
+			xmlStrcmp(val, BAD_CAST HIST_AIN_DATA) == 0) {
+			sax->list = 1;
+		}
+
+		return;
+	}
+
+	sax->has_child[sax->level] = 0;
+	sax->has_blank[sax->level] = 0;
+
+	if (xmlStrchr(name, ':') != NULL) {
+		sax->ret = HIST_SAX_FALLBACK;
+		return;
+	}
+
+	hist_sax_puts(sax, "<");
+	hist_sax_puts(sax, (const char *)name);
+
+	for (i = 0; atts && atts[i]; i += 2) {
+		if (xmlStrchr(atts[i], ':') != NULL ||
+			xmlStrcmp(atts[i], BAD_CAST "xmlns") == 0) {
+			sax->ret = HIST_SAX_FALLBACK;
+			return;
+		}
+
+		hist_sax_puts(sax, " ");
+		hist_sax_puts(sax, (const char *)atts[i]);
+		hist_sax_puts(sax, "=\"");
+		hist_sax_put_attr_val(sax, atts[i + 1]);
+		hist_sax_puts(sax, "\"");
+	}
+
+	/* The same as xml_get_child_val() picks the first matching child */
+	if (sax->level == 1 && sax->ts_found == 0 &&
+		xmlStrcmp(name, BAD_CAST OBIX_OBJ_ABSTIME) == 0 &&
+		(val = hist_sax_get_attr(atts, OBIX_ATTR_NAME)) != NULL &&
+		xmlStrcmp(val, BAD_CAST HIST_REC_TS) == 0) {
+		sax->ts_found = 1;
+
+		if ((val = hist_sax_get_attr(atts, OBIX_ATTR_VAL)) != NULL &&
+			!(sax->ts = strdup((const char *)val))) {
+			sax->ret = ERR_NO_MEM;
+		}
+	}
+}
+
+static void hist_sax_end_element(void *ctx, const xmlChar *name)
+{
+	hist_sax_t *sax = (hist_sax_t *)ctx;
+
+	if (sax->ret != 0) {
+		return;
+	}
+
+	if (sax->level >= 0) {
+		if (sax->has_child[sax->level] == 0) {
+			if (sax->has_blank[sax->level] == 1) {
+				/* Blanks of an element without children are kept */
+				sax->ret = HIST_SAX_FALLBACK;
+				return;
+			}
+
+			hist_sax_puts(sax, "/>");
+		} else {
+			hist_sax_indent(sax);
+			hist_sax_puts(sax, "</");
+			hist_sax_puts(sax, (const char *)name);
+			hist_sax_puts(sax, ">");
+		}
+
+		if (sax->level > 0) {
+			hist_sax_puts(sax, "\n");
+		} else {
+			hist_sax_end_record(sax);
+		}
+
+		sax->level--;
+	} else if (sax->list == 1 && sax->depth == 2) {
+		sax->list = 2;
+	}
+
+	sax->depth--;
+}
+
+static void hist_sax_characters(void *ctx, const xmlChar *ch, int len)
+{
+	hist_sax_t *sax = (hist_sax_t *)ctx;
+	int i;
+
+	if (sax->ret != 0 || sax->level < 0) {
+		return;
+	}
+
+	for (i = 0; i < len; i++) {
+		if (ch[i] != ' ' && ch[i] != '\t' && ch[i] != '\n' &&
+			ch[i] != '\r') {
+			sax->ret = HIST_SAX_FALLBACK;	/* text content in a record */
+			return;
+		}
+	}
+
+	sax->has_blank[sax->level] = 1;
+}
+
+static void hist_sax_in_record_fallback(hist_sax_t *sax)
+{
+	if (sax->ret == 0 && sax->level >= 0) {
+		sax->ret = HIST_SAX_FALLBACK;
+	}
+}
+
+static void hist_sax_comment(void *ctx, const xmlChar *value)
+{
+	hist_sax_in_record_fallback((hist_sax_t *)ctx);
+}
+
+static void hist_sax_cdata(void *ctx, const xmlChar *value, int len)
+{
+	hist_sax_in_record_fallback((hist_sax_t *)ctx);
+}
+
+static void hist_sax_pi(void *ctx, const xmlChar *target, const xmlChar *data)
+{
+	hist_sax_in_record_fallback((hist_sax_t *)ctx);
+}
+
+static void hist_sax_unexpected(hist_sax_t *sax)
+{
+	if (sax->ret == 0) {
+		sax->ret = HIST_SAX_FALLBACK;
+	}
+}
+
+static void hist_sax_subset(void *ctx, const xmlChar *name,
+							const xmlChar *external_id,
+							const xmlChar *system_id)
+{
+	hist_sax_unexpected((hist_sax_t *)ctx);		/* entities may be declared */
+}
+
+static void hist_sax_reference(void *ctx, const xmlChar *name)
+{
+	hist_sax_unexpected((hist_sax_t *)ctx);
+}
+
+static void hist_sax_dispose(hist_sax_t *sax)
+{
+	if (sax->ts) {
+		free(sax->ts);
+	}
+
+	if (sax->buf) {
+		free(sax->buf);
+	}
+
+	if (sax->recs) {
+		free(sax->recs);
+	}
+
+	if (sax->records) {
+		free(sax->records);
+	}
+}
+
+/*
+ * Collect records from a HistoryAppendIn contract by one SAX pass
+ * without building its DOM tree
+ *
+ * Return 0 on success, > 0 for error code, or HIST_SAX_FALLBACK if
+ * the contract should be parsed into a DOM tree instead
+ *
+ * NOTE: callers should release the descriptor by hist_sax_dispose()
+ * in all cases
+ */
+static int hist_sax_parse(hist_sax_t *sax, const char *body, long len)
+{
+	xmlSAXHandler handler;
+	int i;
+
+	memset(sax, 0, sizeof(hist_sax_t));
+	sax->level = -1;
+
+	if (len > INT_MAX) {
+		return HIST_SAX_FALLBACK;
+	}
+
+	/* SAX1 callbacks, namespaces declarations treated as attributes */
+	memset(&handler, 0, sizeof(xmlSAXHandler));
+	handler.startElement = hist_sax_start_element;
+	handler.endElement = hist_sax_end_element;
+	handler.characters = hist_sax_characters;
+	handler.ignorableWhitespace = hist_sax_characters;
+	handler.comment = hist_sax_comment;
+	handler.cdataBlock = hist_sax_cdata;
+	handler.processingInstruction = hist_sax_pi;
+	handler.internalSubset = hist_sax_subset;
+	handler.reference = hist_sax_reference;
+
+	if (xmlSAXUserParseMemory(&handler, sax, body, len) != 0 &&
+		sax->ret == 0) {
+		sax->ret = HIST_SAX_FALLBACK;	/* let DOM path report errors */
+	}
+
+	if (sax->ret != 0) {
+		return sax->ret;
+	}
+
+	if (sax->list == 0) {
+		return ERR_INVALID_INPUT;
+	}
+
+	if (sax->count == 0) {
+		return 0;
+	}
+
+	if (!(sax->records = (hist_record_t *)malloc(sizeof(hist_record_t) *
+												 sax->count))) {
+		return ERR_NO_MEM;
+	}
+
+	for (i = 0; i < sax->count; i++) {
+		sax->records[i].data = sax->buf + sax->recs[i].data;
+		sax->records[i].len = sax->recs[i].len;
+		sax->records[i].ts = (sax->recs[i].ts >= 0) ?
+								sax->buf + sax->recs[i].ts : NULL;
+	}
+
+	return 0;
+}
+
 /*
  * We are going to parse the log file all by ourselves instead of employing
  * DOM tree for sake of efficiency. To this end the format of markups of a
@@ -1850,36 +2460,34 @@ static int hist_get_dev_id(const char *uri, const char *op_name, char **dev_id)
 	return (ret < 0) ? ERR_NO_MEM : 0;
 }
 
-static xmlNode *handlerHistoryHelper(obix_request_t *request,
-									 const xmlChar *uri,
-									 xmlNode *input,
-									 const char *op_name)
+/*
+ * Find the history facility of the device the given URI refers to
+ *
+ * Return 0 on success, > 0 for error code
+ */
+static int hist_get_dev(const xmlChar *uri, const char *op_name,
+						obix_hist_dev_t **dev)
 {
-	obix_hist_dev_t *dev;
 	char *dev_id;
-	int ret = ERR_NO_MEM;
+	int ret;
 
-	/* Find the device to operate on */
 	if ((ret = hist_get_dev_id((char *)uri, op_name, &dev_id)) != 0) {
-		goto failed;
+		return ret;
 	}
 
-	dev = hist_find_device(dev_id);
+	*dev = hist_find_device(dev_id);
 	free(dev_id);
-	if (!dev) {
-		ret = ERR_NO_SUCH_URI;
-		goto failed;
-	}
 
-	/* Invoke handler in response to request */
-	if (strcmp(op_name, HIST_OP_APPEND) == 0) {
-		ret = _history->op->append(request, dev, input);
-	} else if (strcmp(op_name, HIST_OP_QUERY) == 0) {
-		ret = _history->op->query(request, dev, input);
-	} else {
-		ret = ERR_NO_SUCH_URI;
-	}
+	return (*dev) ? 0 : ERR_NO_SUCH_URI;
+}
 
+/*
+ * Send out the response items of a history operation if it has
+ * succeeded, otherwise return an error contract
+ */
+static xmlNode *hist_reply(obix_request_t *request, const xmlChar *uri,
+						   const char *op_name, int ret)
+{
 	/* Add XML Header */
 	if (ret == 0 && obix_request_add_response_xml_header(request) == 0) {
 		request->is_history = 1;
@@ -1887,15 +2495,41 @@ static xmlNode *handlerHistoryHelper(obix_request_t *request,
 		return NULL;	/* Success */
 	}
 
-	/* Fall through */
+	if (ret == 0) {
+		ret = ERR_NO_MEM;
+	}
 
-failed:
 	log_error("%s : %s", uri, server_err_msg[ret].msgs);
 
 	return obix_server_generate_error(uri, server_err_msg[ret].type,
 									  op_name, server_err_msg[ret].msgs);
 }
 
+static xmlNode *handlerHistoryHelper(obix_request_t *request,
+									 const xmlChar *uri,
+									 xmlNode *input,
+									 const char *op_name)
+{
+	obix_hist_dev_t *dev;
+	int ret;
+
+	/* Find the device to operate on */
+	if ((ret = hist_get_dev(uri, op_name, &dev)) != 0) {
+		return hist_reply(request, uri, op_name, ret);
+	}
+
+	/* Invoke handler in response to request */
+	if (strcmp(op_name, HIST_OP_APPEND) == 0) {
+		ret = _history->op->append(request, dev, input);
+	} else if (strcmp(op_name, HIST_OP_QUERY) == 0) {
+		ret = _history->op->query(request, dev, input);
+	} else {
+		ret = ERR_NO_SUCH_URI;
+	}
+
+	return hist_reply(request, uri, op_name, ret);
+}
+
 xmlNode *handlerHistoryAppend(obix_request_t *request, const xmlChar *uri,
 							  xmlNode *input)
 {
@@ -1959,10 +2593,11 @@ xmlNode *handlerHistoryGet(obix_request_t *request, const xmlChar *uri,
 						   xmlNode *input)
 {
 	obix_hist_dev_t *dev;
-	char *href, *subhref, *dev_id, *requester_id, *devdir, *indexpath, *data;
+	char *href, *subhref, *dev_id, *devdir, *indexpath, *data;
+	const char *requester_id;
 	int len, ret = ERR_NO_MEM;
 
-	href = subhref = dev_id = requester_id = devdir = indexpath = data = NULL;
+	href = subhref = dev_id = devdir = indexpath = data = NULL;
 
 	if (!(requester_id = obix_fcgi_get_requester_id(request))) {
 		ret = ERR_NO_REQUESTER_ID;
@@ -2042,10 +2677,10 @@ existed:
 	if (obix_request_add_response_xml_header(request) == 0 &&
 		obix_request_create_append_response_item(request, data, len, 0) == 0) {
 		free(subhref);
-		free(requester_id);
 		free(devdir);
 
-		request->response_uri = xmlStrdup(dev->href);
+		request->response_uri = (unsigned char *)obix_request_strdup(request,
+													(const char *)dev->href);
 		request->is_history = 1;
 		obix_request_send_response(request);
 
@@ -2066,10 +2701,6 @@ failed:
 		free(subhref);
 	}
 
-	if (requester_id) {
-		free(requester_id);
-	}
-
 	if (devdir) {
 		free(devdir);
 	}
@@ -2268,3 +2899,42 @@ xmlNode *hist_copy_uri(const xmlChar *href, xml_copy_flags_t flag)
 	return copy;
 }
 
+/*
+ * Append records from the raw body of a HistoryAppendIn request,
+ * which is parsed by the SAX fast path and only parsed into a DOM
+ * tree when the fast path can't handle it
+ */
+xmlNode *handlerHistoryAppendRaw(obix_request_t *request, const xmlChar *uri,
+								 const char *body, long len)
+{
+	obix_hist_dev_t *dev;
+	hist_sax_t sax;
+	xmlDoc *doc = NULL;
+	xmlNode *node;
+	int ret;
+
+	if (!body || len <= 0) {
+		return handlerHistoryAppend(request, uri, NULL);
+	}
+
+	if ((ret = hist_sax_parse(&sax, body, len)) == HIST_SAX_FALLBACK) {
+		hist_sax_dispose(&sax);
+
+		doc = xmlReadMemory(body, len, NULL, NULL, XML_PARSE_OPTIONS_COMMON);
+		node = handlerHistoryAppend(request, uri,
+									(doc) ? xmlDocGetRootElement(doc) : NULL);
+		if (doc) {
+			xmlFreeDoc(doc);
+		}
+
+		return node;
+	}
+
+	if (ret == 0 && (ret = hist_get_dev(uri, HIST_OP_APPEND, &dev)) == 0) {
+		ret = hist_append_records(request, dev, sax.records, sax.count);
+	}
+
+	hist_sax_dispose(&sax);
+
+	return hist_reply(request, uri, HIST_OP_APPEND, ret);
+}
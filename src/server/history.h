@@ -29,6 +29,8 @@ void obix_hist_dispose(void);
 
 xmlNode *handlerHistoryGet(obix_request_t *request, const xmlChar *uri, xmlNode *input);
 xmlNode *handlerHistoryAppend(obix_request_t *request, const xmlChar *uri, xmlNode *input);
+xmlNode *handlerHistoryAppendRaw(obix_request_t *request, const xmlChar *uri,
+								 const char *body, long len);
 xmlNode *handlerHistoryQuery(obix_request_t *request, const xmlChar *uri, xmlNode *input);
 
 xmlNode *hist_copy_uri(const xmlChar *href, xml_copy_flags_t flag);
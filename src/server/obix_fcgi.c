@@ -20,12 +20,22 @@
  * *****************************************************************************/
 
 #include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <fastcgi.h>
 #include "obix_fcgi.h"
 #include "log_utils.h"
 #include "server.h"
 #include "xml_utils.h"
 #include "xml_config.h"
+#include "xml_storage.h"
 #include "obix_utils.h"
 #include "xml_utils.h"
 
@@ -40,6 +50,39 @@
 
 #undef SYNC_FCGX_ACCEPT
 
+/* The maximal number of events returned by one epoll_wait() */
+#define FCGI_EVENTS_MAX			64
+
+/* Timeout in seconds of reading FCGI records in worker threads */
+#define FCGI_RECV_TIMEOUT		5
+
+/*
+ * Timeout in milliseconds of reading FCGI records in the event loop,
+ * which only happens to reject requests when the fast pool is full
+ */
+#define FCGI_LOOP_RECV_TIMEOUT	100
+
+/* The maximal number of FCGI records sent by one writev() */
+#define FCGI_RECORDS_MAX		256
+
+/* The initial size of the buffer for request bodies, and the growth of it */
+#define FCGI_BODY_CHUNK			4096
+
+/* The buffer for request bodies is released once larger than this */
+#define FCGI_BODY_KEEP_MAX		(1024 * 1024)
+
+/* Returned by obix_fcgi_read_body() when the body exceeds body_max_size */
+#define FCGI_BODY_TOO_LARGE		(-2)
+
+/* The number of request bodies parsed before a parser context is renewed */
+#define FCGI_PARSER_REUSE_MAX	1024
+
+/* The size of the buffer holding compressed data before it is sent */
+#define FCGI_GZIP_CHUNK			16384
+
+/* The window bits of deflate plus 16 to produce a gzip wrapper */
+#define FCGI_GZIP_WBITS			(15 + 16)
+
 obix_fcgi_t *__fcgi;
 
 static char *fcgi_envp[] = {
@@ -47,7 +90,12 @@ static char *fcgi_envp[] = {
 	[FCGI_ENV_REQUEST_METHOD] = "REQUEST_METHOD",
 	[FCGI_ENV_REMOTE_PORT] = "REMOTE_PORT",
 	[FCGI_ENV_REMOTE_ADDR] = "REMOTE_ADDR",
-	[FCGI_ENV_REQUESTER_ID] = "REQUESTER_ID"
+	[FCGI_ENV_REQUESTER_ID] = "REQUESTER_ID",
+	[FCGI_ENV_IF_NONE_MATCH] = "HTTP_IF_NONE_MATCH",
+	[FCGI_ENV_CONTENT_LENGTH] = "CONTENT_LENGTH",
+	[FCGI_ENV_CONTENT_TYPE] = "CONTENT_TYPE",
+	[FCGI_ENV_ACCEPT] = "HTTP_ACCEPT",
+	[FCGI_ENV_ACCEPT_ENCODING] = "HTTP_ACCEPT_ENCODING"
 };
 
 static const char *FCGI_ENV_REQUEST_METHOD_GET = "GET";
@@ -59,14 +107,51 @@ static const char *FCGI_DEF_REQUESTER_ID = "UNDEFINED:UNDEFINED";
 static const char *SERVER_CONFIG_FILE = "server_config.xml";
 
 static const char *HTTP_STATUS_OK =
-"Status: 200 OK\r\n"
-"Content-Type: text/xml\r\n";
+"Status: 200 OK\r\n";
 
+static const char *HTTP_STATUS_NOT_MODIFIED =
+"Status: 304 Not Modified\r\n";
+
+static const char *HTTP_STATUS_UNAVAILABLE =
+"Status: 503 Service Unavailable\r\n";
+
+static const char *HTTP_RETRY_AFTER = "Retry-After: %d\r\n";
+
+static const char *HTTP_CONTENT_TYPE = "Content-Type: %s\r\n";
+static const char *HTTP_CONTENT_TYPE_XML = "text/xml";
 static const char *HTTP_CONTENT_LOCATION = "Content-Location: %s\r\n";
+static const char *HTTP_ETAG = "ETag: %s\r\n";
+
+/* The maximal length of an ETag, including the surrounding quotes */
+#define HTTP_ETAG_MAX		64
+
+/*
+ * Representations of the same version of an object differ in their
+ * encodings and content codings, so do their ETags, see
+ * obix_fcgi_get_etag()
+ */
+static const char *HTTP_ETAG_FORMATS[] = {
+	[OBIX_FORMAT_XML] = "xml",
+	[OBIX_FORMAT_BINARY] = "bin",
+	[OBIX_FORMAT_JSON] = "json"
+};
+
 static const char *HTTP_CONTENT_LENGTH = "Content-Length: %lu\r\n";
+static const char *HTTP_CONTENT_ENCODING_GZIP = "Content-Encoding: gzip\r\n";
+
+/*
+ * All responses are negotiated by the Accept and Accept-Encoding headers,
+ * so caches must not hand out a representation to clients asking for
+ * another one, whether it is compressed or not
+ */
+static const char *HTTP_VARY = "Vary: Accept, Accept-Encoding\r\n";
 static const char *HTTP_HEADER_SEPARATOR = "\r\n";
 
-char *obix_fcgi_get_requester_id(obix_request_t *request)
+/*
+ * Get the ID of the requester, allocated from the arena of the
+ * request and must not be freed by callers
+ */
+const char *obix_fcgi_get_requester_id(obix_request_t *request)
 {
 	const char *val;
 
@@ -75,7 +160,75 @@ char *obix_fcgi_get_requester_id(obix_request_t *request)
 		val = FCGI_DEF_REQUESTER_ID;
 	}
 
-	return strdup(val);
+	return obix_request_strdup(request, val);
+}
+
+/*
+ * Return 1 if the If-None-Match header is provided in the current
+ * request, 0 otherwise
+ */
+int obix_fcgi_has_if_none_match(obix_request_t *request)
+{
+	return (FCGX_GetParam(fcgi_envp[FCGI_ENV_IF_NONE_MATCH],
+						  request->request->envp) != NULL) ? 1 : 0;
+}
+
+/*
+ * Return 1 if the given environment parameter of the request, either
+ * the Content-Type or the Accept header, has the given content type,
+ * 0 otherwise
+ *
+ * NOTE: quality values in the Accept header are not honoured, oBIX
+ * clients asking for other encodings than XML are supposed to prefer
+ * them
+ */
+static int obix_fcgi_has_type(FCGX_Request *request, fcgi_env_t env,
+							  const char *type)
+{
+	const char *val;
+
+	return ((val = FCGX_GetParam(fcgi_envp[env], request->envp)) != NULL &&
+			strstr(val, type) != NULL) ? 1 : 0;
+}
+
+static int obix_fcgi_is_binary(FCGX_Request *request, fcgi_env_t env)
+{
+	return obix_fcgi_has_type(request, env, XML_BINARY_MIME);
+}
+
+/*
+ * Return 1 if the Accept-Encoding header of the given request accepts
+ * the gzip encoding, that is, "gzip" is listed without a zero quality
+ * value, 0 otherwise
+ */
+static int obix_fcgi_accepts_gzip(FCGX_Request *request)
+{
+	const char *val, *p;
+
+	if (!(val = FCGX_GetParam(fcgi_envp[FCGI_ENV_ACCEPT_ENCODING],
+							  request->envp)) ||
+		!(p = strstr(val, "gzip"))) {
+		return 0;
+	}
+
+	for (p += 4; *p == ' '; p++);		/* do nothing */
+
+	if (*p != ';') {
+		return 1;
+	}
+
+	for (p++; *p == ' '; p++);			/* do nothing */
+
+	/* "q=0", "q=0.0" and "q=0.000" reject the encoding */
+	if (strncmp(p, "q=0", 3) == 0) {
+		for (p += 3; *p == '.' || *p == '0'; p++);	/* do nothing */
+
+		if (*p < '1' || *p > '9') {
+			return 0;
+		}
+	}
+
+	return 1;
 }
 
 /*
@@ -120,6 +273,77 @@ static void obix_fcgi_url_decode(char *dst, const char *src)
 	*dst++ = '\0';
 }
 
+static void obix_fcgi_reader_free(void *arg)
+{
+	obix_fcgi_reader_t *reader = (obix_fcgi_reader_t *)arg;
+
+	if (!reader) {
+		return;
+	}
+
+	if (reader->ctxt) {
+		xmlFreeParserCtxt(reader->ctxt);
+	}
+
+	if (reader->buf) {
+		free(reader->buf);
+	}
+
+	xml_binary_dispose(&reader->bin);
+
+	if (reader->zs_ready == 1) {
+		deflateEnd(&reader->zs);
+	}
+
+	if (reader->zbuf) {
+		free(reader->zbuf);
+	}
+
+	free(reader);
+}
+
+/*
+ * Release the body reader of the current thread before it is accounted
+ * as exited, so that nothing is left to the destructor of the key, which
+ * would otherwise run after the thread waiting for it to exit could have
+ * deleted the key and torn down the server
+ */
+void obix_fcgi_reader_release(void)
+{
+	obix_fcgi_reader_t *reader;
+
+	if (!__fcgi ||
+		!(reader = (obix_fcgi_reader_t *)pthread_getspecific(__fcgi->reader_key))) {
+		return;
+	}
+
+	pthread_setspecific(__fcgi->reader_key, NULL);
+	obix_fcgi_reader_free(reader);
+}
+
+static void obix_fcgi_pool_init(obix_fcgi_pool_t *pool, const char *name,
+								const int min, const int max)
+{
+	pool->name = name;
+	pool->min = min;
+	pool->max = (max > min) ? max : min;
+	INIT_LIST_HEAD(&pool->queue);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->wq, NULL);
+	pthread_cond_init(&pool->exit_wq, NULL);
+}
+
+static void obix_fcgi_pool_dispose(obix_fcgi_pool_t *pool)
+{
+	if (!pool->name) {
+		return;		/* not initialised at all */
+	}
+
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->wq);
+	pthread_cond_destroy(&pool->exit_wq);
+}
+
 static void obix_fcgi_exit(void)
 {
 	obix_server_exit();
@@ -129,11 +353,16 @@ static void obix_fcgi_exit(void)
 
 	if (__fcgi) {
 		pthread_mutex_destroy(&__fcgi->mutex);
+		pthread_mutex_destroy(&__fcgi->admission);
+		pthread_key_delete(__fcgi->reader_key);
 
 		if (__fcgi->id) {
 			free(__fcgi->id);
 		}
 
+		obix_fcgi_pool_dispose(&__fcgi->fast);
+		obix_fcgi_pool_dispose(&__fcgi->slow);
+
 		free(__fcgi);
 		__fcgi = NULL;
 	}
@@ -141,21 +370,236 @@ static void obix_fcgi_exit(void)
 	log_debug("FCGI connection has been shutdown");
 }
 
-static void obix_fcgi_send_response(obix_request_t *request)
+/*
+ * Write all the given vectors to the given socket, resuming from
+ * where a partial write stops
+ *
+ * Return 0 on success, -1 on error
+ */
+static int obix_fcgi_writev(int fd, struct iovec *iov, int count)
 {
-	FCGX_Request *fcgiRequest = request->request;
-	response_item_t *item, *n;
-	long len = obix_request_get_response_len(request);
-	int items = obix_request_get_response_items(request);
-	int i = 0;
-	const char *response_uri;
+	ssize_t n;
+
+	while (count > 0) {
+		if ((n = writev(fd, iov, count)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return -1;
+		}
+
+		while (count > 0 && n >= (ssize_t)iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+static void obix_fcgi_stdout_header(FCGI_Header *header, int id, int len)
+{
+	header->version = FCGI_VERSION_1;
+	header->type = FCGI_STDOUT;
+	header->requestIdB1 = (id >> 8) & 0xff;
+	header->requestIdB0 = id & 0xff;
+	header->contentLengthB1 = (len >> 8) & 0xff;
+	header->contentLengthB0 = len & 0xff;
+	header->paddingLength = 0;
+	header->reserved = 0;
+}
+
+/*
+ * Send the given response items as FCGI STDOUT records straight to
+ * the connection by writev(), each item split into records of no
+ * more than FCGI_MAX_LENGTH bytes, so that their bodies are never
+ * copied into the buffer of the FCGX stream
+ *
+ * NOTE: the FCGX stream must have been flushed so that records sent
+ * by it and by this function are not interleaved
+ *
+ * Return the number of items sent completely
+ */
+static int obix_fcgi_send_items(FCGX_Request *fcgiRequest,
+								struct list_head *items)
+{
+	FCGI_Header headers[FCGI_RECORDS_MAX];
+	struct iovec iov[FCGI_RECORDS_MAX * 2];
+	response_item_t *item;
+	const char *body;
+	int len, n, count = 0, pending = 0, sent = 0;
+
+	list_for_each_entry(item, items, list) {
+		for (body = item->body, len = item->len; len > 0;
+			 body += n, len -= n) {
+			if (count == FCGI_RECORDS_MAX) {
+				if (obix_fcgi_writev(fcgiRequest->ipcFd, iov, count * 2) < 0) {
+					goto failed;
+				}
+
+				sent += pending;
+				count = pending = 0;
+			}
+
+			n = (len > FCGI_MAX_LENGTH) ? FCGI_MAX_LENGTH : len;
+
+			obix_fcgi_stdout_header(headers + count, fcgiRequest->requestId, n);
+
+			iov[count * 2].iov_base = headers + count;
+			iov[count * 2].iov_len = FCGI_HEADER_LEN;
+			iov[count * 2 + 1].iov_base = (void *)body;
+			iov[count * 2 + 1].iov_len = n;
+			count++;
+		}
+
+		pending++;
+	}
 
-	/* Header section: HTTP/1.1 200 OK */
-	if (FCGX_FPrintF(fcgiRequest->out, "%s", HTTP_STATUS_OK) == EOF) {
-		log_error("Failed to send HTTP_STATUS_OK header");
+	if (count > 0 &&
+		obix_fcgi_writev(fcgiRequest->ipcFd, iov, count * 2) < 0) {
 		goto failed;
 	}
 
+	return sent + pending;
+
+failed:
+	log_error("Failed to write FCGI STDOUT records: %s", strerror(errno));
+	return sent;
+}
+
+/*
+ * Print into the given buffer of HTTP_ETAG_MAX bytes the ETag of the
+ * given version of an object in the given encoding, compressed by gzip
+ * or not
+ */
+static void obix_fcgi_get_etag(char *etag, unsigned long version,
+							   obix_format_t format, int gzip)
+{
+	snprintf(etag, HTTP_ETAG_MAX, "\"%lx-%lx-%s%s\"",
+			 (unsigned long)__fcgi->epoch, version, HTTP_ETAG_FORMATS[format],
+			 (gzip == 1) ? "-gzip" : "");
+}
+
+/*
+ * Find in the If-None-Match header of the current request the ETag of
+ * the given version of the requested object in the negotiated encoding,
+ * either in identity or, if accepted, in the gzip content coding
+ *
+ * The header may contain a list of ETags, and weak ETags are
+ * compared in the same way as strong ones, as RFC 7232 specifies
+ * for GET requests
+ *
+ * Return 1 if the gzip one is matched, 0 if the identity one is matched
+ * or the header is a wildcard, -1 otherwise
+ */
+static int obix_fcgi_match_etag(obix_request_t *request, unsigned long version)
+{
+	const char *val;
+	char etag[HTTP_ETAG_MAX];
+	int gzip, max;
+
+	if (version == 0 ||
+		!(val = FCGX_GetParam(fcgi_envp[FCGI_ENV_IF_NONE_MATCH],
+							  request->request->envp))) {
+		return -1;
+	}
+
+	while (*val == ' ') {
+		val++;
+	}
+
+	if (strcmp(val, "*") == 0) {
+		return 0;
+	}
+
+	max = (__fcgi->gzip_level > 0) ? obix_fcgi_accepts_gzip(request->request) : 0;
+
+	for (gzip = 0; gzip <= max; gzip++) {
+		obix_fcgi_get_etag(etag, version, request->format, gzip);
+
+		if (strstr(val, etag) != NULL) {
+			return gzip;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Return 1 if the If-None-Match header of the current request has
+ * the ETag of the given version of the requested object, or is a
+ * wildcard, 0 otherwise
+ */
+int obix_fcgi_is_not_modified(obix_request_t *request, unsigned long version)
+{
+	return (obix_fcgi_match_etag(request, version) >= 0) ? 1 : 0;
+}
+
+/*
+ * Send the status and headers of the response in the given encoding
+ * for the given request, with the Content-Length header only if the
+ * length is known. The length of a response compressed by gzip is
+ * never known beforehand
+ *
+ * Return 0 on success, -1 on error
+ */
+static int obix_fcgi_send_headers(obix_request_t *request, long len,
+								  obix_format_t format, int gzip)
+{
+	FCGX_Request *fcgiRequest = request->request;
+	const char *response_uri, *status, *type;
+	char etag[HTTP_ETAG_MAX];
+
+	/*
+	 * Header section: HTTP/1.1 200 OK, 304 Not Modified, or 503 Service
+	 * Unavailable for requests rejected by the admission control
+	 */
+	if (request->not_modified == 1) {
+		status = HTTP_STATUS_NOT_MODIFIED;
+	} else if (request->retry_after > 0) {
+		status = HTTP_STATUS_UNAVAILABLE;
+	} else {
+		status = HTTP_STATUS_OK;
+	}
+
+	if (FCGX_FPrintF(fcgiRequest->out, "%s", status) == EOF) {
+		log_error("Failed to send HTTP status header");
+		return -1;
+	}
+
+	if (request->retry_after > 0 &&
+		FCGX_FPrintF(fcgiRequest->out, HTTP_RETRY_AFTER,
+					 request->retry_after) == EOF) {
+		log_error("Failed to write HTTP \"Retry-After\" header");
+		return -1;
+	}
+
+	switch (format) {
+	case OBIX_FORMAT_BINARY:
+		type = XML_BINARY_MIME;
+		break;
+	case OBIX_FORMAT_JSON:
+		type = XML_JSON_MIME;
+		break;
+	default:
+		type = HTTP_CONTENT_TYPE_XML;
+		break;
+	}
+
+	/* There is no body at all for the 304 status */
+	if (request->not_modified == 0 &&
+		FCGX_FPrintF(fcgiRequest->out, HTTP_CONTENT_TYPE, type) == EOF) {
+		log_error("Failed to write HTTP \"Content-Type\" header");
+		return -1;
+	}
+
 	/*
 	 * Header section: content-location
 	 *
@@ -175,333 +619,1707 @@ static void obix_fcgi_send_response(obix_request_t *request)
 		FCGX_FPrintF(fcgiRequest->out, HTTP_CONTENT_LOCATION,
 					 response_uri) == EOF) {
 		log_error("Failed to write HTTP \"Content-Location\" header");
-		goto failed;
+		return -1;
+	}
+
+	/*
+	 * The 304 status carries the ETag matched in the If-None-Match
+	 * header, of the representation oBIX client has in its cache
+	 */
+	if (request->response_version > 0) {
+		if (request->not_modified == 1) {
+			obix_fcgi_get_etag(etag, request->response_version,
+							   request->format,
+							   (obix_fcgi_match_etag(request,
+									request->response_version) == 1) ? 1 : 0);
+		} else {
+			obix_fcgi_get_etag(etag, request->response_version, format, gzip);
+		}
+
+		if (FCGX_FPrintF(fcgiRequest->out, HTTP_ETAG, etag) == EOF) {
+			log_error("Failed to write HTTP \"ETag\" header");
+			return -1;
+		}
 	}
 
-	if (len > 0) {
+	if (FCGX_FPrintF(fcgiRequest->out, "%s", HTTP_VARY) == EOF) {
+		log_error("Failed to write HTTP \"Vary\" header");
+		return -1;
+	}
+
+	if (gzip == 1) {
+		if (FCGX_FPrintF(fcgiRequest->out, "%s",
+						 HTTP_CONTENT_ENCODING_GZIP) == EOF) {
+			log_error("Failed to write HTTP \"Content-Encoding\" header");
+			return -1;
+		}
+	} else if (len > 0) {
 		if (FCGX_FPrintF(fcgiRequest->out, HTTP_CONTENT_LENGTH, len) == EOF) {
 			log_error("Failed to write HTTP \"Content-Length\" header");
-			goto failed;
+			return -1;
 		}
 	}
 
 	/* Separate headers from response body */
 	if (FCGX_FPrintF(fcgiRequest->out, "%s", HTTP_HEADER_SEPARATOR) == EOF) {
 		log_error("Failed to write delimiter after HTTP headers");
-		goto failed;
+		return -1;
 	}
 
-	pthread_mutex_lock(&request->mutex);
-	list_for_each_entry_safe(item, n, &request->response_items, list) {
-		list_del(&item->list);
-		pthread_mutex_unlock(&request->mutex);
+	return 0;
+}
 
-		/*
-		 * Now that the current item has been dequeued, mutex could be
-		 * safely dropped during lengthy operations
-		 */
-		if (FCGX_FPrintF(fcgiRequest->out, "%s", item->body) == EOF) {
-			goto failed;
-		}
+static int obix_fcgi_output_write(void *context, const char *buffer, int len)
+{
+	return (FCGX_PutStr(buffer, len, (FCGX_Stream *)context) == len) ? len : -1;
+}
 
-		i++;
+static int obix_fcgi_output_close(void *context)
+{
+	return 0;	/* the FCGX stream is closed along with the FCGX request */
+}
 
-		/*
-		 * Take advantage of this chance to have the response item
-		 * removed as well
-		 */
-		obix_request_destroy_response_item(item);
-		pthread_mutex_lock(&request->mutex);
+static obix_fcgi_reader_t *obix_fcgi_get_reader(void);
+
+/*
+ * Prepare the deflate state of the current thread to compress a new
+ * response into the given FCGX stream. The deflate state is created
+ * on its first use and then reset for each response, so that its
+ * internal buffers of hundreds of KB are not allocated over and over
+ *
+ * Return the reader of the current thread on success, NULL otherwise
+ */
+static obix_fcgi_reader_t *obix_fcgi_gzip_start(FCGX_Stream *out)
+{
+	obix_fcgi_reader_t *reader;
+
+	if (!(reader = obix_fcgi_get_reader()) ||
+		(!reader->zbuf &&
+		 !(reader->zbuf = (char *)malloc(FCGI_GZIP_CHUNK)))) {
+		log_error("Failed to allocate a buffer for gzip response");
+		return NULL;
 	}
-	pthread_mutex_unlock(&request->mutex);
 
-	/* Fall through */
+	if (reader->zs_ready == 0) {
+		if (deflateInit2(&reader->zs, __fcgi->gzip_level, Z_DEFLATED,
+						 FCGI_GZIP_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			log_error("Failed to initialise deflate state: %s",
+					  (reader->zs.msg) ? reader->zs.msg : "(null)");
+			return NULL;
+		}
 
-failed:
-	if (i < items) {
-		log_warning("%d out of %d response items(%ld bytes in total) have NOT "
-					"been sent due to FCGI error", items - i, items, len);
+		reader->zs_ready = 1;
+	} else if (deflateReset(&reader->zs) != Z_OK) {
+		log_error("Failed to reset deflate state");
+		return NULL;
 	}
+
+	reader->zout = out;
+
+	return reader;
 }
 
 /*
- * Initialise the FCGX channel
+ * Compress the given data and write whatever deflate has produced into
+ * the FCGX stream, or finish the gzip stream if flush is Z_FINISH
  *
- * Return the address of an obix_fcgi_t structure
+ * Return 0 on success, -1 on error
  */
-static obix_fcgi_t *obix_fcgi_init(xml_config_t *config)
+static int obix_fcgi_gzip_put(obix_fcgi_reader_t *reader, const char *data,
+							  int len, int flush)
 {
-	obix_fcgi_t *fcgi;
-	char *sock;
-	int backlog, ret, multi_threads;
+	z_stream *zs = &reader->zs;
+	int ret, n;
 
-	if (!(sock = xml_config_get_str(config, XP_LISTEN_SOCKET)) ||
-		(backlog = xml_config_get_int(config, XP_LISTEN_BACKLOG)) < 0 ||
-		(multi_threads = xml_config_get_int(config, XP_MULTI_THREADS)) < 0) {
-		log_error("Failed to get server's FCGX settings");
-		goto failed;
-	}
+	zs->next_in = (Bytef *)data;
+	zs->avail_in = len;
 
-	if (!(fcgi = (obix_fcgi_t *)malloc(sizeof(obix_fcgi_t))) ||
-		!(fcgi->id = (pthread_t *)malloc(sizeof(pthread_t) * multi_threads))) {
-		log_error("Failed to allocate an obix_fcgi_t structure");
-		goto mem_failed;
-	}
+	do {
+		zs->next_out = (Bytef *)reader->zbuf;
+		zs->avail_out = FCGI_GZIP_CHUNK;
 
-	fcgi->multi_threads = multi_threads;
-	fcgi->send_response = obix_fcgi_send_response;
-	pthread_mutex_init(&fcgi->mutex, NULL);
+		if ((ret = deflate(zs, flush)) == Z_STREAM_ERROR) {
+			log_error("Failed to compress response by gzip");
+			return -1;
+		}
 
-	if ((ret = FCGX_Init()) != 0) {
-		log_error("Failed to initialize FCGX channel: %d", ret);
-		goto init_failed;
-	}
+		n = FCGI_GZIP_CHUNK - zs->avail_out;
 
-	if ((fcgi->fd = FCGX_OpenSocket(sock, backlog)) < 0) {
-		log_error("Failed to create FCGX listen socket");
-		goto fcgi_failed;
-	}
+		if (n > 0 && FCGX_PutStr(reader->zbuf, n, reader->zout) != n) {
+			log_error("Failed to write gzip response into FCGX stream");
+			return -1;
+		}
+	} while (zs->avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
 
-	if ((ret = obix_server_init(config)) < 0) {
+	return 0;
+}
+
+static int obix_fcgi_gzip_write(void *context, const char *buffer, int len)
+{
+	return (obix_fcgi_gzip_put((obix_fcgi_reader_t *)context, buffer, len,
+							   Z_NO_FLUSH) == 0) ? len : -1;
+}
+
+static int obix_fcgi_gzip_close(void *context)
+{
+	return obix_fcgi_gzip_put((obix_fcgi_reader_t *)context, NULL, 0,
+							  Z_FINISH);
+}
+
+/*
+ * Create an output buffer of libxml2 writing straight into the FCGX
+ * stream of the given request, compressed by gzip if the reader with
+ * a deflate state prepared by obix_fcgi_gzip_start() is given, in
+ * which case the gzip stream is finished when the buffer is closed
+ */
+static xmlOutputBuffer *obix_fcgi_output_create(obix_request_t *request,
+												obix_fcgi_reader_t *reader)
+{
+	xmlOutputBuffer *out;
+
+	if (reader) {
+		out = xmlOutputBufferCreateIO(obix_fcgi_gzip_write,
+									  obix_fcgi_gzip_close, reader, NULL);
+	} else {
+		out = xmlOutputBufferCreateIO(obix_fcgi_output_write,
+									  obix_fcgi_output_close,
+									  request->request->out, NULL);
+	}
+
+	if (!out) {
+		log_error("Failed to create XML output buffer");
+	}
+
+	return out;
+}
+
+/*
+ * Convert the given response items, which are pieces of one XML
+ * document serialised by libxml2 such as history records, into JSON
+ * straight into the FCGX stream without building any DOM tree
+ *
+ * Return the number of items converted
+ */
+static int obix_fcgi_send_items_json(obix_request_t *request,
+									 struct list_head *items,
+									 obix_fcgi_reader_t *reader)
+{
+	xml_json_conv_t conv;
+	xmlOutputBuffer *out;
+	response_item_t *item;
+	int i = 0;
+
+	if (!(out = obix_fcgi_output_create(request, reader))) {
+		return 0;
+	}
+
+	xml_json_conv_init(&conv);
+
+	list_for_each_entry(item, items, list) {
+		if (xml_json_conv(&conv, out, item->body, item->len) < 0) {
+			log_error("Failed to convert response item of %d bytes into JSON",
+					  item->len);
+			break;
+		}
+
+		i++;
+	}
+
+	if (xmlOutputBufferClose(out) < 0 || xml_json_conv_end(&conv) < 0) {
+		log_error("Failed to stream JSON response of %s through FCGI channel",
+				  (request->request_decoded_uri) ?
+					request->request_decoded_uri : "(null)");
+	}
+
+	return i;
+}
+
+/*
+ * Compress the given response items by gzip into the FCGX stream, one
+ * after another with the deflate state prepared by obix_fcgi_gzip_start()
+ *
+ * Return the number of items compressed
+ */
+static int obix_fcgi_send_items_gzip(obix_fcgi_reader_t *reader,
+									 struct list_head *items)
+{
+	response_item_t *item;
+	int i = 0;
+
+	list_for_each_entry(item, items, list) {
+		if (obix_fcgi_gzip_put(reader, item->body, item->len,
+							   Z_NO_FLUSH) < 0) {
+			return i;
+		}
+
+		i++;
+	}
+
+	return (obix_fcgi_gzip_put(reader, NULL, 0, Z_FINISH) == 0) ? i : 0;
+}
+
+/*
+ * Return 1 if the response of the given length should be compressed
+ * by gzip, 0 otherwise
+ */
+static int obix_fcgi_use_gzip(obix_request_t *request, long len)
+{
+	return (__fcgi->gzip_level > 0 && request->not_modified == 0 &&
+			len > 0 && len >= __fcgi->gzip_min &&
+			obix_fcgi_accepts_gzip(request->request) == 1) ? 1 : 0;
+}
+
+static void obix_fcgi_send_response(obix_request_t *request)
+{
+	FCGX_Request *fcgiRequest = request->request;
+	obix_fcgi_reader_t *reader = NULL;
+	response_item_t *item, *n;
+	long len = obix_request_get_response_len(request);
+	int items = obix_request_get_response_items(request);
+	int json = (request->format == OBIX_FORMAT_JSON) ? 1 : 0;
+	int i = 0;
+	LIST_HEAD(queue);
+
+	/*
+	 * Prepare the deflate state before the gzip content coding is
+	 * promised by headers, and fall back on the identity one if the
+	 * deflate state is not available
+	 */
+	if (obix_fcgi_use_gzip(request, len) == 1 &&
+		!(reader = obix_fcgi_gzip_start(fcgiRequest->out))) {
+		log_warning("Failed to compress response of %s, sent as it is",
+					(request->request_decoded_uri) ?
+						request->request_decoded_uri : "(null)");
+	}
+
+	/* The length of the JSON conversion is not known beforehand */
+	if (obix_fcgi_send_headers(request, (json == 1) ? 0 : len,
+							   (json == 1) ? OBIX_FORMAT_JSON :
+											 OBIX_FORMAT_XML,
+							   (reader) ? 1 : 0) < 0) {
+		goto failed;
+	}
+
+	/*
+	 * Dequeue all response items at once, so that the mutex is
+	 * not held during lengthy operations
+	 */
+	pthread_mutex_lock(&request->mutex);
+	list_splice_init(&request->response_items, &queue);
+	pthread_mutex_unlock(&request->mutex);
+
+	if (json == 1) {
+		i = (list_empty(&queue) == 1) ? 0 :
+				obix_fcgi_send_items_json(request, &queue, reader);
+		goto failed;
+	}
+
+	/*
+	 * Compressed data is written into the FCGX stream, which sends
+	 * it in records of the size of its buffer
+	 */
+	if (reader) {
+		i = obix_fcgi_send_items_gzip(reader, &queue);
+		goto failed;
+	}
+
+	/*
+	 * Headers are buffered by the FCGX stream, flush them before
+	 * response items are sent straight to the connection
+	 */
+	if (FCGX_FFlush(fcgiRequest->out) == EOF) {
+		log_error("Failed to flush HTTP headers");
+		goto failed;
+	}
+
+	i = obix_fcgi_send_items(fcgiRequest, &queue);
+
+	/* Fall through */
+
+failed:
+	list_for_each_entry_safe(item, n, &queue, list) {
+		list_del(&item->list);
+		obix_request_destroy_response_item(item);
+	}
+
+	if (i < items) {
+		log_warning("%d out of %d response items(%ld bytes in total) have NOT "
+					"been sent due to FCGI error", items - i, items, len);
+	}
+}
+
+/*
+ * Encode the root of the given document in the compact binary encoding
+ * with the buffer of the current thread, then send it straight to the
+ * connection the same way as response items
+ *
+ * Return 0 if the response has been handled, or -1 if the object can't
+ * be encoded and should be sent in XML instead
+ */
+static int obix_fcgi_send_binary(obix_request_t *request, xmlDoc *doc)
+{
+	FCGX_Request *fcgiRequest = request->request;
+	obix_fcgi_reader_t *reader;
+	response_item_t item;
+	LIST_HEAD(queue);
+
+	if (!(reader = obix_fcgi_get_reader())) {
+		log_error("Failed to allocate a buffer for binary response");
+		return -1;
+	}
+
+	xml_binary_reset(&reader->bin);
+
+	if (xml_binary_encode(&reader->bin, xmlDocGetRootElement(doc)) < 0) {
+		log_warning("Failed to encode response of %s, sent in XML instead",
+					(request->request_decoded_uri) ?
+						request->request_decoded_uri : "(null)");
+		return -1;
+	}
+
+	if (obix_fcgi_send_headers(request, reader->bin.len, OBIX_FORMAT_BINARY,
+							   0) < 0 ||
+		FCGX_FFlush(fcgiRequest->out) == EOF) {
+		log_error("Failed to send HTTP headers");
+		goto out;
+	}
+
+	item.body = reader->bin.data;
+	item.len = reader->bin.len;
+	list_add_tail(&item.list, &queue);
+
+	if (obix_fcgi_send_items(fcgiRequest, &queue) < 1) {
+		log_error("Failed to send binary response of %u bytes",
+				  reader->bin.len);
+	}
+
+	/* Fall through */
+
+out:
+	if (reader->bin.size > FCGI_BODY_KEEP_MAX) {
+		xml_binary_dispose(&reader->bin);
+	}
+
+	return 0;
+}
+
+/*
+ * Emit the JSON encoding of the root of the given document straight
+ * into the FCGX stream, without serialising it in XML at all
+ */
+static void obix_fcgi_send_json(obix_request_t *request, xmlDoc *doc)
+{
+	xmlOutputBuffer *out;
+	int ret;
+
+	if (obix_fcgi_send_headers(request, 0, OBIX_FORMAT_JSON, 0) < 0 ||
+		!(out = obix_fcgi_output_create(request, NULL))) {
+		return;
+	}
+
+	ret = xml_json_dump(out, xmlDocGetRootElement(doc));
+
+	if (xmlOutputBufferClose(out) < 0 || ret < 0) {
+		log_error("Failed to stream JSON response of %s through FCGI channel",
+				  (request->request_decoded_uri) ?
+					request->request_decoded_uri : "(null)");
+	}
+}
+
+/*
+ * Serialise the given document straight into the FCGX stream through
+ * an output buffer of libxml2, so that the response never has to be
+ * held in memory as a whole. Since its length is not known until it
+ * has been sent, the Content-Length header is left out and the web
+ * server frames the response by chunked encoding instead
+ */
+static void obix_fcgi_send_object(obix_request_t *request, xmlDoc *doc)
+{
+	xmlOutputBuffer *out;
+
+	if (request->format == OBIX_FORMAT_BINARY &&
+		obix_fcgi_send_binary(request, doc) == 0) {
+		return;
+	}
+
+	if (request->format == OBIX_FORMAT_JSON) {
+		obix_fcgi_send_json(request, doc);
+		return;
+	}
+
+	if (obix_fcgi_send_headers(request, 0, OBIX_FORMAT_XML, 0) < 0 ||
+		!(out = obix_fcgi_output_create(request, NULL))) {
+		return;
+	}
+
+	/* The output buffer is closed regardless */
+#ifdef DEBUG
+	if (xmlSaveFormatFileTo(out, doc, NULL, 1) < 0) {
+#else
+	if (xmlSaveFormatFileTo(out, doc, NULL, 0) < 0) {
+#endif
+		log_error("Failed to stream response of %s through FCGI channel",
+				  (request->request_decoded_uri) ?
+					request->request_decoded_uri : "(null)");
+	}
+}
+
+/*
+ * Initialise the FCGX channel
+ *
+ * Return the address of an obix_fcgi_t structure
+ */
+static obix_fcgi_t *obix_fcgi_init(xml_config_t *config)
+{
+	obix_fcgi_t *fcgi;
+	char *sock;
+	int backlog, ret, multi_threads, fast_threads, slow_threads, i;
+	int fast_max, slow_max, idle_timeout, grow_latency;
+	int gzip_min, gzip_level, queue_max, retry_after, body_max;
+	int limits[OBIX_FCGI_CLASS_MAX];
+
+	if (!(sock = xml_config_get_str(config, XP_LISTEN_SOCKET)) ||
+		(backlog = xml_config_get_int(config, XP_LISTEN_BACKLOG)) < 0 ||
+		(multi_threads = xml_config_get_int(config, XP_MULTI_THREADS)) < 0 ||
+		(fast_threads = xml_config_get_int(config, XP_FAST_THREADS)) < 0 ||
+		(slow_threads = xml_config_get_int(config, XP_SLOW_THREADS)) < 0 ||
+		(fast_max = xml_config_get_int(config, XP_FAST_THREADS_MAX)) < 0 ||
+		(slow_max = xml_config_get_int(config, XP_SLOW_THREADS_MAX)) < 0 ||
+		(idle_timeout = xml_config_get_int(config, XP_THREAD_IDLE_TIMEOUT)) <= 0 ||
+		(grow_latency = xml_config_get_int(config, XP_THREAD_GROW_LATENCY)) < 0 ||
+		(gzip_min = xml_config_get_int(config, XP_GZIP_MIN_SIZE)) < 0 ||
+		(gzip_level = xml_config_get_int(config, XP_GZIP_LEVEL)) < 0 ||
+		gzip_level > Z_BEST_COMPRESSION ||
+		(body_max = xml_config_get_int(config, XP_BODY_MAX_SIZE)) <= 0 ||
+		(queue_max = xml_config_get_int(config, XP_QUEUE_MAX)) < 0 ||
+		(limits[OBIX_FCGI_CLASS_DEVICE] =
+				xml_config_get_int(config, XP_DEVICE_LIMIT)) < 0 ||
+		(limits[OBIX_FCGI_CLASS_HISTORY] =
+				xml_config_get_int(config, XP_HISTORY_LIMIT)) < 0 ||
+		(limits[OBIX_FCGI_CLASS_WATCH] =
+				xml_config_get_int(config, XP_WATCH_LIMIT)) < 0 ||
+		(retry_after = xml_config_get_int(config, XP_RETRY_AFTER)) <= 0) {
+		log_error("Failed to get server's FCGX settings");
+		goto failed;
+	}
+
+	if (!(fcgi = (obix_fcgi_t *)malloc(sizeof(obix_fcgi_t)))) {
+		log_error("Failed to allocate an obix_fcgi_t structure");
+		goto failed;
+	}
+	memset(fcgi, 0, sizeof(obix_fcgi_t));
+
+	obix_fcgi_pool_init(&fcgi->fast, "fast", fast_threads, fast_max);
+	obix_fcgi_pool_init(&fcgi->slow, "slow", slow_threads, slow_max);
+
+	if (!(fcgi->id = (pthread_t *)malloc(sizeof(pthread_t) * multi_threads))) {
+		log_error("Failed to allocate an obix_fcgi_t structure");
+		goto mem_failed;
+	}
+
+	fcgi->fast.queue_max = fcgi->slow.queue_max = queue_max;
+	fcgi->fast.idle_timeout = fcgi->slow.idle_timeout = idle_timeout;
+	fcgi->fast.grow_latency = fcgi->slow.grow_latency = grow_latency * 1000UL;
+
+	fcgi->multi_threads = multi_threads;
+	fcgi->gzip_min = gzip_min;
+	fcgi->gzip_level = gzip_level;
+	fcgi->body_max = body_max;
+	fcgi->retry_after = retry_after;
+
+	fcgi->class[OBIX_FCGI_CLASS_DEVICE].name = "device";
+	fcgi->class[OBIX_FCGI_CLASS_HISTORY].name = "history";
+	fcgi->class[OBIX_FCGI_CLASS_WATCH].name = "watch";
+
+	for (i = 0; i < OBIX_FCGI_CLASS_MAX; i++) {
+		fcgi->class[i].limit = limits[i];
+	}
+
+	pthread_mutex_init(&fcgi->admission, NULL);
+	fcgi->send_response = obix_fcgi_send_response;
+	fcgi->send_object = obix_fcgi_send_object;
+	fcgi->epoch = time(NULL);
+	fcgi->epfd = -1;
+	pthread_mutex_init(&fcgi->mutex, NULL);
+
+	if (pthread_key_create(&fcgi->reader_key, obix_fcgi_reader_free) != 0) {
+		log_error("Failed to create the key to body readers");
+		goto mem_failed;
+	}
+
+	if ((ret = FCGX_Init()) != 0) {
+		log_error("Failed to initialize FCGX channel: %d", ret);
+		goto init_failed;
+	}
+
+	if ((fcgi->fd = FCGX_OpenSocket(sock, backlog)) < 0) {
+		log_error("Failed to create FCGX listen socket");
+		goto fcgi_failed;
+	}
+
+	if ((ret = obix_server_init(config)) < 0) {
 		log_error("Failed to initialise oBIX server");
 		goto fcgi_failed;
 	}
 
-	log_debug("\"/proc/%u/fd\" and strace illustrate how server threads "
-			  "use FCGX listen socket and established connections", get_tid());
+	log_debug("\"/proc/%u/fd\" and strace illustrate how server threads "
+			  "use FCGX listen socket and established connections", get_tid());
+
+	free(sock);
+	return fcgi;
+
+fcgi_failed:
+	FCGX_ShutdownPending();
+	FCGX_Finish();
+
+init_failed:
+#ifdef SYNC_FCGX_ACCEPT
+	pthread_mutex_destroy(&fcgi->mutex);
+#endif
+
+	pthread_key_delete(fcgi->reader_key);
+
+mem_failed:
+	obix_fcgi_pool_dispose(&fcgi->fast);
+	obix_fcgi_pool_dispose(&fcgi->slow);
+
+	if (fcgi->id) {
+		free(fcgi->id);
+	}
+
+	free(fcgi);
+
+failed:
+	if (sock) {
+		free(sock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Get the body reader of the current thread, created on its first use
+ * and released when the thread exits
+ */
+static obix_fcgi_reader_t *obix_fcgi_get_reader(void)
+{
+	obix_fcgi_reader_t *reader;
+
+	if ((reader = (obix_fcgi_reader_t *)pthread_getspecific(__fcgi->reader_key)) != NULL) {
+		return reader;
+	}
+
+	if (!(reader = (obix_fcgi_reader_t *)malloc(sizeof(obix_fcgi_reader_t)))) {
+		return NULL;
+	}
+	memset(reader, 0, sizeof(obix_fcgi_reader_t));
+
+	if (pthread_setspecific(__fcgi->reader_key, reader) != 0) {
+		free(reader);
+		return NULL;
+	}
+
+	return reader;
+}
+
+/*
+ * Make sure the buffer of the reader can hold the given number of
+ * bytes plus a NUL terminator
+ *
+ * Return 0 on success, -1 on failure
+ */
+static int obix_fcgi_reader_reserve(obix_fcgi_reader_t *reader, long len)
+{
+	char *buf;
+	long size;
+
+	if (len < reader->size) {
+		return 0;
+	}
+
+	if (len >= LONG_MAX) {
+		return -1;
+	}
+
+	for (size = (reader->size > 0) ? reader->size : FCGI_BODY_CHUNK;
+		 size <= len; size *= 2) {
+		/* Stop doubling before it overflows */
+		if (size > LONG_MAX / 2) {
+			size = len + 1;
+			break;
+		}
+	}
+
+	if (!(buf = (char *)realloc(reader->buf, size))) {
+		return -1;
+	}
+
+	reader->buf = buf;
+	reader->size = size;
+
+	return 0;
+}
+
+/*
+ * Read the whole body of the given request into the buffer of the
+ * reader, in one go if its length is given by CONTENT_LENGTH, or
+ * until EOF otherwise
+ *
+ * Return the length of the body, FCGI_BODY_TOO_LARGE if it is longer
+ * than body_max_size, or -1 on other errors
+ */
+static long obix_fcgi_read_body(FCGX_Request *request,
+								obix_fcgi_reader_t *reader)
+{
+	const char *val;
+	long cl = -1, len = 0;
+	int n;
+
+	if ((val = FCGX_GetParam(fcgi_envp[FCGI_ENV_CONTENT_LENGTH],
+							 request->envp)) != NULL &&
+		(str_to_long(val, &cl) != 0 || cl < 0)) {
+		log_error("Invalid CONTENT_LENGTH env in current request: %s", val);
+		return -1;
+	}
+
+	if (cl > __fcgi->body_max) {
+		log_error("Request body of %ld bytes exceeds the limit of %ld bytes",
+				  cl, __fcgi->body_max);
+		return FCGI_BODY_TOO_LARGE;
+	}
+
+	if (cl >= 0) {
+		if (obix_fcgi_reader_reserve(reader, cl) < 0) {
+			log_error("Failed to allocate %ld bytes for request body", cl);
+			return -1;
+		}
+
+		while (len < cl) {
+			n = (cl - len > INT_MAX) ? INT_MAX : cl - len;
+
+			if ((n = FCGX_GetStr(reader->buf + len, n, request->in)) <= 0) {
+				log_error("Request body truncated at %ld out of %ld bytes",
+						  len, cl);
+				return -1;
+			}
+
+			len += n;
+		}
+	} else {
+		do {
+			if (obix_fcgi_reader_reserve(reader, len + FCGI_BODY_CHUNK) < 0) {
+				log_error("Failed to allocate memory for request body");
+				return -1;
+			}
+
+			len += (n = FCGX_GetStr(reader->buf + len, FCGI_BODY_CHUNK,
+									request->in));
+
+			if (len > __fcgi->body_max) {
+				log_error("Request body exceeds the limit of %ld bytes",
+						  __fcgi->body_max);
+				return FCGI_BODY_TOO_LARGE;
+			}
+		} while (n == FCGI_BODY_CHUNK);
+	}
+
+	reader->buf[len] = '\0';
+
+	return len;
+}
+
+/*
+ * Don't let occasional huge bodies pin down memory
+ */
+static void obix_fcgi_reader_trim(obix_fcgi_reader_t *reader)
+{
+	if (reader->size > FCGI_BODY_KEEP_MAX) {
+		free(reader->buf);
+		reader->buf = NULL;
+		reader->size = 0;
+	}
+}
+
+/*
+ * Turn the body in the compact binary encoding into a document
+ *
+ * Return the document, or NULL if the body is corrupted or on error
+ */
+static xmlDoc *obix_fcgi_decode(const char *body, long len)
+{
+	xmlDoc *doc;
+	xmlNode *node;
+
+	if (len > UINT32_MAX || !(node = xml_binary_decode(body, len))) {
+		log_error("Request body of %ld bytes is not a valid binary "
+				  "encoded object", len);
+		return NULL;
+	}
+
+	if (!(doc = xmlNewDoc(BAD_CAST XML_VERSION))) {
+		log_error("Failed to allocate a document for request body");
+		xmlFreeNode(node);
+		return NULL;
+	}
+
+	xmlDocSetRootElement(doc, node);
+
+	return doc;
+}
+
+/*
+ * Read and parse the body of the given request with the buffer and
+ * parser context of the current thread, which are reused by every
+ * request handled by the thread. Bodies in the compact binary encoding
+ * are decoded without the parser at all
+ *
+ * The length of the body, or the error returned by obix_fcgi_read_body(),
+ * is stored in the given address
+ *
+ * Return the parsed document, or NULL if the body is empty or not
+ * a well-formed XML document
+ */
+static xmlDoc *obix_fcgi_read(FCGX_Request *request, long *len)
+{
+	obix_fcgi_reader_t *reader;
+	xmlDoc *doc = NULL;
+
+	if (!(reader = obix_fcgi_get_reader())) {
+		log_error("Failed to allocate a request body reader");
+		*len = -1;
+		return NULL;
+	}
+
+	if ((*len = obix_fcgi_read_body(request, reader)) <= 0) {
+		goto out;
+	}
+
+	if (obix_fcgi_is_binary(request, FCGI_ENV_CONTENT_TYPE) == 1) {
+		doc = obix_fcgi_decode(reader->buf, *len);
+		goto out;
+	}
+
+	/*
+	 * Renew the parser context once in a while, so that its dictionary
+	 * shared by all documents parsed by it won't grow for ever
+	 */
+	if (reader->ctxt && reader->parsed >= FCGI_PARSER_REUSE_MAX) {
+		xmlFreeParserCtxt(reader->ctxt);
+		reader->ctxt = NULL;
+	}
+
+	if (!reader->ctxt) {
+		if (!(reader->ctxt = xmlNewParserCtxt())) {
+			log_error("Failed to allocate an XML parser context");
+			goto out;
+		}
+
+		reader->parsed = 0;
+	}
+
+	/* No XML_PARSE_NODICT applied, see comments above */
+	if (!(doc = xmlCtxtReadMemory(reader->ctxt, reader->buf, *len, NULL, NULL,
+								  XML_PARSE_OPTIONS_COMMON))) {
+		log_error("Request body of %ld bytes is not a well-formed XML "
+				  "document", *len);
+	}
+
+	reader->parsed++;
+
+	/* Fall through */
+
+out:
+	obix_fcgi_reader_trim(reader);
+	return doc;
+}
+
+/*
+ * Handle a POST request whose handler takes the raw body instead
+ * of a DOM tree, see obix_server_is_raw_post()
+ */
+static void obix_fcgi_handle_raw_post(obix_request_t *request)
+{
+	obix_fcgi_reader_t *reader;
+	long len;
+
+	if (!(reader = obix_fcgi_get_reader())) {
+		log_error("Failed to allocate a request body reader");
+		obix_server_handleRawPOST(request, NULL, 0);
+		return;
+	}
+
+	if ((len = obix_fcgi_read_body(request->request, reader)) ==
+													FCGI_BODY_TOO_LARGE) {
+		obix_server_handleError(request, "Request body too large");
+	} else {
+		obix_server_handleRawPOST(request, (len > 0) ? reader->buf : NULL, len);
+	}
+
+	obix_fcgi_reader_trim(reader);
+}
+
+static void obix_handle_request(obix_request_t *request)
+{
+	FCGX_Request *fcgiRequest = request->request;
+	xmlDoc *doc = NULL;
+	const char *requestType;
+	long len;
+
+	if (!(request->request_uri = FCGX_GetParam(fcgi_envp[FCGI_ENV_REQUEST_URI],
+											   fcgiRequest->envp)) ||
+		slash_preceded(request->request_uri) == 0 ||			/* not started with slash */
+		slash_preceded(request->request_uri + 1) == 1) {        /* double slashes */
+		log_error("Invalid URI env in current request: %s",
+				  (request->request_uri) ? request->request_uri : "(null)");
+		obix_server_handleError(request, "Invalid URI");
+		return;
+	}
+
+	if (!(request->request_decoded_uri =
+				(char *)arena_alloc(&request->arena,
+									strlen(request->request_uri) + 1))) {
+		log_error("Could not allocate enough memory to decode the input URI");
+		obix_server_handleError(request, "Failed to decode input URI");
+		return;
+	}
+
+	obix_fcgi_url_decode(request->request_decoded_uri, request->request_uri);
+
+	if (obix_fcgi_is_binary(fcgiRequest, FCGI_ENV_ACCEPT) == 1) {
+		request->format = OBIX_FORMAT_BINARY;
+	} else if (obix_fcgi_has_type(fcgiRequest, FCGI_ENV_ACCEPT,
+								  XML_JSON_MIME) == 1) {
+		request->format = OBIX_FORMAT_JSON;
+	}
+
+	if (!(requestType = FCGX_GetParam(fcgi_envp[FCGI_ENV_REQUEST_METHOD],
+									  fcgiRequest->envp))) {
+		log_error("Invalid METHOD env in current request: %s", requestType);
+		obix_server_handleError(request, "Missing HTTP verb");
+		return;
+	}
+
+	if (strcmp(requestType, FCGI_ENV_REQUEST_METHOD_GET) == 0) {
+		obix_server_handleGET(request);
+	} else if (strcmp(requestType, FCGI_ENV_REQUEST_METHOD_PUT) == 0) {
+		if (!(doc = obix_fcgi_read(fcgiRequest, &len)) &&
+			len == FCGI_BODY_TOO_LARGE) {
+			obix_server_handleError(request, "Request body too large");
+			return;
+		}
+
+		obix_server_handlePUT(request, doc);
+		if (doc) {
+			xmlFreeDoc(doc);
+		}
+	} else if (strcmp(requestType, FCGI_ENV_REQUEST_METHOD_POST) == 0 &&
+			   obix_fcgi_is_binary(fcgiRequest, FCGI_ENV_CONTENT_TYPE) == 0 &&
+			   obix_server_is_raw_post((xmlChar *)request->request_decoded_uri) == 1) {
+		obix_fcgi_handle_raw_post(request);
+	} else if (strcmp(requestType, FCGI_ENV_REQUEST_METHOD_POST) == 0) {
+		if (!(doc = obix_fcgi_read(fcgiRequest, &len)) &&
+			len == FCGI_BODY_TOO_LARGE) {
+			obix_server_handleError(request, "Request body too large");
+			return;
+		}
+
+		obix_server_handlePOST(request, doc);
+		if (doc) {
+			xmlFreeDoc(doc);
+		}
+	} else {
+		obix_server_handleError(request, "Illegal HTTP verb");
+	}
+}
+
+void obix_fcgi_request_destroy(FCGX_Request *request)
+{
+	if (!request) {
+		return;
+	}
+
+	FCGX_Finish_r(request);
+	FCGX_Free(request, 1);
+
+	free(request);
+}
+
+static FCGX_Request *obix_fcgi_request_create(obix_fcgi_t *fcgi)
+{
+	FCGX_Request *request;
+	int ret;
+
+	if (!(request = (FCGX_Request *)malloc(sizeof(FCGX_Request)))) {
+		log_error("Failed to create FCGX Request structure");
+		return NULL;
+	}
+
+	if ((FCGX_InitRequest(request, fcgi->fd, 0)) != 0) {
+		log_error("Failed to initialize the FCGX request");
+		goto failed;
+	}
+
+#ifdef SYNC_FCGX_ACCEPT
+	pthread_mutex_lock(&__fcgi->mutex);
+#endif
+	ret = FCGX_Accept_r(request);
+#ifdef SYNC_FCGX_ACCEPT
+	pthread_mutex_unlock(&__fcgi->mutex);
+#endif
+
+	if (ret == 0) {
+		return request;
+	}
+
+	log_error("Failed to accept FCGX request, returned %d", ret);
+
+	/* Fall through */
+
+failed:
+	obix_fcgi_request_destroy(request);
+	return NULL;
+}
+
+/*
+ * The payload for each oBIX server thread, which is basically
+ * accepting pending FCGI request and invoking a proper handle to
+ * take care of that repeatedly
+ *
+ * Note:
+ * 1. this function should never return unless on errors.
+ *
+ * 2. the FCGI website suggests that on some platform there is a
+ * need to serialize the accept(), if that is the case, we need
+ * to pass in a pointer to a common mutex that all threads need
+ * to compete to grab during the invocation of accept().
+ */
+static void *payload(void *arg)
+{
+	FCGX_Request *fcgiRequest = NULL;
+	obix_request_t *request = NULL;
+	obix_fcgi_t *fcgi = (obix_fcgi_t *)arg;
+
+#ifdef DEBUG_VALGRIND
+	int count = 0;
+#endif
+
+	while (1) {
+
+#ifdef DEBUG_VALGRIND
+		if ((MAX_REQUESTS_SERVED > 0) && (count++ == MAX_REQUESTS_SERVED)) {
+			log_debug("Threshold %d reached, [%u] exiting...",
+					  MAX_REQUESTS_SERVED, get_tid());
+			fcgiRequest = NULL;		/* avoid double-free */
+			break;
+		}
+#endif
+
+		if (!(fcgiRequest = obix_fcgi_request_create(fcgi))) {
+			log_error("Failed to create FCGI Request structure");
+			break;
+		}
+
+		if (!(request = obix_request_create(fcgiRequest))) {
+			log_error("Failed to create Response structure due to no memory");
+			break;
+		}
+
+		obix_handle_request(request);
+
+		/*
+		 * The [request, response] pair will be released regardless on error
+		 * conditions or after response is sent out, which may take place in an
+		 * asynchronous manner
+		 */
+	}
+
+	if (fcgiRequest) {
+		obix_fcgi_request_destroy(fcgiRequest);
+	}
+
+	return NULL;
+}
+
+static void *obix_fcgi_worker(void *arg);
+
+/*
+ * Create one more detached worker thread for the given pool, unless
+ * it has reached its maximal size or is shutting down
+ *
+ * Return 0 on success, -1 otherwise
+ *
+ * NOTE: callers must hold pool->mutex
+ */
+static int __obix_fcgi_pool_grow(obix_fcgi_pool_t *pool)
+{
+	pthread_attr_t attr;
+	pthread_t id;
+	int ret;
+
+	if (pool->shutdown == 1 || pool->threads >= pool->max) {
+		return -1;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&id, &attr, obix_fcgi_worker, (void *)pool);
+	pthread_attr_destroy(&attr);
+
+	if (ret != 0) {
+		log_warning("Failed to create %s thread%d", pool->name, pool->threads);
+		return -1;
+	}
+
+	if (++pool->threads > pool->peak) {
+		pool->peak = pool->threads;
+	}
+
+	return 0;
+}
+
+/*
+ * Queue the given request to the given pool, unless its queue is full,
+ * and have one more thread created if no idle thread could pick it up
+ *
+ * Return 0 on success, -1 if the request should be rejected
+ */
+static int obix_fcgi_pool_add(obix_fcgi_pool_t *pool, obix_request_t *request)
+{
+	pthread_mutex_lock(&pool->mutex);
+
+	if (pool->queue_max > 0 && pool->queued >= pool->queue_max) {
+		pthread_mutex_unlock(&pool->mutex);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &request->queued);
+	list_add_tail(&request->list, &pool->queue);
+	pool->queued++;
+
+	if (pool->queued > pool->idle) {
+		if (__obix_fcgi_pool_grow(pool) == 0) {
+			pool->grown++;
+		} else if (pool->threads == 0) {
+			/* Nobody would ever pick up the request in a pool grown from 0 */
+			list_del_init(&request->list);
+			pool->queued--;
+			pthread_mutex_unlock(&pool->mutex);
+			return -1;
+		}
+	}
+
+	pthread_cond_signal(&pool->wq);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return 0;
+}
+
+/*
+ * Return the class of the request on the given URI
+ */
+static obix_fcgi_class_id_t obix_fcgi_classify(const char *uri)
+{
+	if (!uri) {
+		return OBIX_FCGI_CLASS_DEVICE;
+	}
+
+	if (is_given_type((const xmlChar *)uri, OBIX_HISTORY) == 1) {
+		return OBIX_FCGI_CLASS_HISTORY;
+	}
+
+	if (is_given_type((const xmlChar *)uri, OBIX_WATCH) == 1) {
+		return OBIX_FCGI_CLASS_WATCH;
+	}
+
+	return OBIX_FCGI_CLASS_DEVICE;
+}
+
+/*
+ * Admit one more request of the given class unless its limit has
+ * been reached
+ *
+ * Return 0 on success, -1 if the request should be rejected
+ */
+static int obix_fcgi_admit(obix_fcgi_t *fcgi, obix_fcgi_class_id_t id)
+{
+	obix_fcgi_class_t *class = fcgi->class + id;
+	int ret = 0;
+
+	pthread_mutex_lock(&fcgi->admission);
+
+	if (class->limit > 0 && class->admitted >= class->limit) {
+		class->rejected++;
+		ret = -1;
+	} else {
+		class->admitted++;
+	}
+
+	pthread_mutex_unlock(&fcgi->admission);
+
+	return ret;
+}
+
+/*
+ * Release a request of the given class that has been admitted, either
+ * after it has been handled or when it can't be queued after all, in
+ * which case it is accounted as rejected
+ */
+static void obix_fcgi_release(obix_fcgi_t *fcgi, obix_fcgi_class_id_t id,
+							  unsigned long wait, int handled)
+{
+	obix_fcgi_class_t *class = fcgi->class + id;
+
+	pthread_mutex_lock(&fcgi->admission);
+
+	class->admitted--;
+
+	if (handled == 1) {
+		class->handled++;
+		class->wait_total += wait;
+
+		if (wait > class->wait_max) {
+			class->wait_max = wait;
+		}
+	} else {
+		class->rejected++;
+	}
+
+	pthread_mutex_unlock(&fcgi->admission);
+}
+
+/*
+ * Reject the given request right away with an error contract telling
+ * oBIX clients when to retry, without reading its body at all
+ */
+static void obix_fcgi_reject(obix_fcgi_t *fcgi, obix_request_t *request,
+							 obix_fcgi_class_id_t id)
+{
+	xmlNode *node;
+	char desc[128];
+
+	snprintf(desc, sizeof(desc), "Too many %s requests, retry after %d "
+			 "seconds", fcgi->class[id].name, fcgi->retry_after);
+
+	request->retry_after = fcgi->retry_after;
+
+	node = obix_server_generate_error(NULL, OBIX_CONTRACT_ERR_SERVER,
+									  "oBIX Server", desc);
+
+	obix_server_reply_object(request, ((node != NULL) ? node :
+													   xmldb_fatal_error()));
+}
+
+/*
+ * Return the time in microseconds elapsed since the given moment
+ */
+static unsigned long obix_fcgi_elapsed(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - since->tv_sec) * 1000000UL +
+		   (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+/*
+ * Read in the BEGIN_REQUEST and PARAMS records of the given request,
+ * with each read waiting no longer than the given timeout
+ *
+ * Return 0 on success, -1 on failure in which case the request has
+ * been destroyed
+ */
+static int obix_fcgi_read_params(obix_request_t *request,
+								 const struct timeval *tv)
+{
+	FCGX_Request *fcgiRequest = request->request;
+	int ret;
+
+	setsockopt(fcgiRequest->ipcFd, SOL_SOCKET, SO_RCVTIMEO, tv, sizeof(*tv));
+
+	if ((ret = FCGX_Accept_r(fcgiRequest)) != 0) {
+		log_error("Failed to read FCGX request, returned %d", ret);
+		obix_request_destroy(request);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Read in the FCGI request on the connection dispatched by the event
+ * loop and classify it. Requests on history facilities which involve
+ * disk I/O are passed on to the slow pool, others are to be handled
+ * by the current thread, unless rejected by the admission control
+ *
+ * Return 0 if the current thread should handle the request, -1 if it
+ * has been passed on, rejected or destroyed
+ */
+static int obix_fcgi_accept(obix_fcgi_t *fcgi, obix_request_t *request)
+{
+	struct timeval tv = {
+		.tv_sec = FCGI_RECV_TIMEOUT,
+		.tv_usec = 0
+	};
+	obix_fcgi_class_id_t id;
+
+	if (obix_fcgi_read_params(request, &tv) < 0) {
+		return -1;
+	}
+
+	id = obix_fcgi_classify(FCGX_GetParam(fcgi_envp[FCGI_ENV_REQUEST_URI],
+										  request->request->envp));
+
+	request->fcgi_class = id;
+
+	if (obix_fcgi_admit(fcgi, id) < 0) {
+		obix_fcgi_reject(fcgi, request, id);
+		return -1;
+	}
+
+	/* The slow pool may have no threads at all until history requests come */
+	if (id == OBIX_FCGI_CLASS_HISTORY && fcgi->slow.max > 0) {
+		if (obix_fcgi_pool_add(&fcgi->slow, request) < 0) {
+			obix_fcgi_release(fcgi, id, 0, 0);
+			obix_fcgi_reject(fcgi, request, id);
+		}
+
+		return -1;
+	}
+
+	return 0;
+}
 
-	free(sock);
-	return fcgi;
+/*
+ * Wait for requests to be queued to the given pool. Threads beyond
+ * the minimal size of the pool wait for idle_timeout seconds at most
+ *
+ * Return 0 if there are queued requests or the pool is shutting down,
+ * -1 if the current thread should retire
+ *
+ * NOTE: callers must hold pool->mutex
+ */
+static int __obix_fcgi_pool_wait(obix_fcgi_pool_t *pool)
+{
+	struct timespec deadline;
+	int ret = 0;
 
-fcgi_failed:
-	FCGX_ShutdownPending();
-	FCGX_Finish();
+	pool->idle++;
 
-init_failed:
-#ifdef SYNC_FCGX_ACCEPT
-	pthread_mutex_destroy(&fcgi->mutex);
-#endif
+	while (pool->shutdown == 0 && list_empty(&pool->queue) == 1) {
+		if (pool->threads <= pool->min) {
+			pthread_cond_wait(&pool->wq, &pool->mutex);
+			continue;
+		}
 
-	free(fcgi->id);
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += pool->idle_timeout;
 
-mem_failed:
-	if (fcgi) {
-		free(fcgi);
+		if (pthread_cond_timedwait(&pool->wq, &pool->mutex,
+								   &deadline) == ETIMEDOUT &&
+			list_empty(&pool->queue) == 1 && pool->threads > pool->min) {
+			ret = -1;
+			break;
+		}
 	}
 
-failed:
-	if (sock) {
-		free(sock);
+	pool->idle--;
+
+	return ret;
+}
+
+/*
+ * The payload for each worker thread of the event-driven front end,
+ * which reads in and handles requests dispatched by the event loop
+ * one by one until the pool is shutting down, or the thread has been
+ * idle for long enough and is not needed to keep the minimal size of
+ * the pool
+ */
+static void *obix_fcgi_worker(void *arg)
+{
+	obix_fcgi_pool_t *pool = (obix_fcgi_pool_t *)arg;
+	obix_request_t *request;
+	obix_fcgi_class_id_t id;
+	unsigned long wait;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while (1) {
+		if (__obix_fcgi_pool_wait(pool) < 0) {
+			pool->retired++;
+			break;
+		}
+
+		if (list_empty(&pool->queue) == 1) {
+			break;		/* shutting down */
+		}
+
+		request = list_first_entry(&pool->queue, obix_request_t, list);
+		list_del_init(&request->list);
+		pool->queued--;
+
+		wait = obix_fcgi_elapsed(&request->queued);
+
+		/* Requests still queued have waited too long for a thread */
+		if (pool->queued > 0 && wait > pool->grow_latency &&
+			__obix_fcgi_pool_grow(pool) == 0) {
+			pool->grown++;
+		}
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		/* Connections from the event loop have not been read in yet */
+		if (request->fcgi_class == OBIX_FCGI_CLASS_MAX &&
+			obix_fcgi_accept(__fcgi, request) < 0) {
+			pthread_mutex_lock(&pool->mutex);
+			continue;
+		}
+
+		/* The request may have been released once handled */
+		id = request->fcgi_class;
+
+		obix_handle_request(request);
+
+		obix_fcgi_release(__fcgi, id, wait, 1);
+
+		pthread_mutex_lock(&pool->mutex);
+	}
+
+	obix_fcgi_reader_release();
+
+	if (--pool->threads == 0) {
+		pthread_cond_broadcast(&pool->exit_wq);
 	}
 
+	pthread_mutex_unlock(&pool->mutex);
+
 	return NULL;
 }
 
-static xmlDoc *obix_fcgi_read(FCGX_Request *request)
+/*
+ * Have the given pool shut down once all queued requests have been
+ * handled, and wait for all its threads to exit
+ */
+static void obix_fcgi_pool_stop(obix_fcgi_pool_t *pool)
 {
-	static const int chunkSize = 2048; /** read 2KiB chunks */
-	xmlParserCtxt *parserContext = NULL;
-	xmlDoc *document = NULL;
-	char chunk[chunkSize];
-	int bytesRead = 0;
-
-	memset(chunk, 0, chunkSize);
+	pthread_mutex_lock(&pool->mutex);
 
-	bytesRead = FCGX_GetStr(chunk, chunkSize, request->in);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->wq);
 
-	parserContext = xmlCreatePushParserCtxt(NULL, NULL, chunk, chunkSize, NULL);
-	if (parserContext == NULL) {
-		log_error("Failed to allocate an XML Push parser context");
-		return NULL;
+	while (pool->threads > 0) {
+		pthread_cond_wait(&pool->exit_wq, &pool->mutex);
 	}
 
-	/* No XML_PARSE_NODICT applied, see comments above */
-	xmlCtxtUseOptions(parserContext, XML_PARSE_OPTIONS_COMMON);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/*
+ * Start the minimal number of threads of the given pool, more threads
+ * are created on demand
+ */
+static int obix_fcgi_pool_start(obix_fcgi_pool_t *pool)
+{
+	int i;
 
-	while ((bytesRead = FCGX_GetStr(chunk, chunkSize, request->in)) > 0) {
-		xmlParseChunk(parserContext, chunk, bytesRead, 0); /* Non-terminating */
+	pthread_mutex_lock(&pool->mutex);
 
-		if (bytesRead < chunkSize) {
-			break;		/** eof has been reached */
+	for (i = 0; i < pool->min; i++) {
+		if (__obix_fcgi_pool_grow(pool) < 0) {
+			pthread_mutex_unlock(&pool->mutex);
+			log_error("Failed to start %s thread%d", pool->name, i);
+			obix_fcgi_pool_stop(pool);
+			return -1;
 		}
 	}
 
-	xmlParseChunk(parserContext, chunk, 0, 1); /** terminate the stream */
-	document = parserContext->myDoc;
+	pthread_mutex_unlock(&pool->mutex);
+
+	return 0;
+}
+
+/*
+ * Accept all pending connections from the web server and have them
+ * watched by the event loop until FCGI records arrive on them
+ */
+static void obix_fcgi_accept_all(obix_fcgi_t *fcgi)
+{
+	struct epoll_event ev;
+	int fd;
 
-#if 0
-	/* TODO:
-	 * So far all input XML doc generated are NOT well formed, regardless of
-	 * whether XML header is available or not. Worse still, if it is there,
-	 * the parsed myDoc would be somehow nullified!
+	/*
+	 * Established connections are blocking as expected by the FCGX
+	 * library, however, they are only watched by the event loop and
+	 * read by worker threads after becoming readable
 	 */
-	if (parserContext->wellFormed == 0) {
-		log_warning("Parsed XML doc NOT well formed!: %d", parserContext->errNo);
+	while ((fd = accept(fcgi->fd, NULL, NULL)) >= 0) {
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+
+		if (epoll_ctl(fcgi->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			log_error("Failed to watch FCGI connection %d: %s",
+					  fd, strerror(errno));
+			close(fd);
+		}
 	}
-#endif
-
-	xmlFreeParserCtxt(parserContext); /** does not free myDoc ptr */
 
-	return document;
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		log_error("Failed to accept FCGI connection: %s", strerror(errno));
+	}
 }
 
-static void obix_handle_request(obix_request_t *request)
+/*
+ * Dispatch the given readable connection to the fast pool, whose
+ * worker threads read in the FCGI request and pass it on to the slow
+ * pool if needed, so that a web server slow in sending FCGI records
+ * never holds up the event loop
+ */
+static void obix_fcgi_dispatch(obix_fcgi_t *fcgi, int fd)
 {
-	FCGX_Request *fcgiRequest = request->request;
-	xmlDoc *doc = NULL;
-	const char *requestType;
+	FCGX_Request *fcgiRequest;
+	obix_request_t *request;
+	obix_fcgi_class_id_t id;
+	struct timeval tv = {
+		.tv_sec = 0,
+		.tv_usec = FCGI_LOOP_RECV_TIMEOUT * 1000
+	};
 
-	if (!(request->request_uri = FCGX_GetParam(fcgi_envp[FCGI_ENV_REQUEST_URI],
-											   fcgiRequest->envp)) ||
-		slash_preceded(request->request_uri) == 0 ||			/* not started with slash */
-		slash_preceded(request->request_uri + 1) == 1) {        /* double slashes */
-		log_error("Invalid URI env in current request: %s",
-				  (request->request_uri) ? request->request_uri : "(null)");
-		obix_server_handleError(request, "Invalid URI");
+	epoll_ctl(fcgi->epfd, EPOLL_CTL_DEL, fd, NULL);
+
+	if (!(fcgiRequest = (FCGX_Request *)malloc(sizeof(FCGX_Request)))) {
+		log_error("Failed to create FCGX Request structure");
+		close(fd);
 		return;
 	}
 
-	if (!(request->request_decoded_uri =
-				(char *)malloc(strlen(request->request_uri) + 1))) {
-		log_error("Could not allocate enough memory to decode the input URI");
-		obix_server_handleError(request, "Failed to decode input URI");
+	/*
+	 * Have FCGX_Accept_r() adopt the established connection instead of
+	 * accepting one by itself, which is prevented by an invalid listen
+	 * socket as well
+	 */
+	if (FCGX_InitRequest(fcgiRequest, -1, 0) != 0) {
+		log_error("Failed to initialize the FCGX request");
+		free(fcgiRequest);
+		close(fd);
 		return;
 	}
 
-	obix_fcgi_url_decode(request->request_decoded_uri, request->request_uri);
+	fcgiRequest->ipcFd = fd;
+	fcgiRequest->keepConnection = 1;
 
-	if (!(requestType = FCGX_GetParam(fcgi_envp[FCGI_ENV_REQUEST_METHOD],
-									  fcgiRequest->envp))) {
-		log_error("Invalid METHOD env in current request: %s", requestType);
-		obix_server_handleError(request, "Missing HTTP verb");
+	if (!(request = obix_request_create(fcgiRequest))) {
+		log_error("Failed to create Response structure due to no memory");
+		obix_fcgi_request_destroy(fcgiRequest);
 		return;
 	}
 
-	if (strcmp(requestType, FCGI_ENV_REQUEST_METHOD_GET) == 0) {
-		obix_server_handleGET(request);
-	} else if (strcmp(requestType, FCGI_ENV_REQUEST_METHOD_PUT) == 0) {
-		doc = obix_fcgi_read(fcgiRequest);
-		obix_server_handlePUT(request, doc);
-		if (doc) {
-			xmlFreeDoc(doc);
-		}
-	} else if (strcmp(requestType, FCGI_ENV_REQUEST_METHOD_POST) == 0) {
-		doc = obix_fcgi_read(fcgiRequest);
-		obix_server_handlePOST(request, doc);
-		if (doc) {
-			xmlFreeDoc(doc);
-		}
-	} else {
-		obix_server_handleError(request, "Illegal HTTP verb");
+	/* Not read in nor classified yet */
+	request->fcgi_class = OBIX_FCGI_CLASS_MAX;
+
+	if (obix_fcgi_pool_add(&fcgi->fast, request) == 0) {
+		return;
 	}
-}
 
-void obix_fcgi_request_destroy(FCGX_Request *request)
-{
-	if (!request) {
+	/*
+	 * The request has to be read in before it could be rejected, but
+	 * only for a short while since the event loop is held up meanwhile
+	 */
+	if (obix_fcgi_read_params(request, &tv) < 0) {
 		return;
 	}
 
-	FCGX_Finish_r(request);
-	FCGX_Free(request, 1);
+	id = obix_fcgi_classify(FCGX_GetParam(fcgi_envp[FCGI_ENV_REQUEST_URI],
+										  fcgiRequest->envp));
 
-	free(request);
+	request->fcgi_class = id;
+
+	obix_fcgi_reject(fcgi, request, id);
 }
 
-static FCGX_Request *obix_fcgi_request_create(obix_fcgi_t *fcgi)
+/*
+ * The event loop of the oBIX server, which accepts connections and
+ * dispatches them to worker pools as they become readable
+ *
+ * Note: this function should never return unless on errors
+ */
+static void obix_fcgi_event_loop(obix_fcgi_t *fcgi)
 {
-	FCGX_Request *request;
-	int ret;
+	struct epoll_event ev, events[FCGI_EVENTS_MAX];
+	int i, n;
 
-	if (!(request = (FCGX_Request *)malloc(sizeof(FCGX_Request)))) {
-		log_error("Failed to create FCGX Request structure");
-		return NULL;
+	if ((fcgi->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		log_error("Failed to create epoll instance: %s", strerror(errno));
+		return;
 	}
 
-	if ((FCGX_InitRequest(request, fcgi->fd, 0)) != 0) {
-		log_error("Failed to initialize the FCGX request");
+	ev.events = EPOLLIN;
+	ev.data.fd = fcgi->fd;
+
+	if (fcntl(fcgi->fd, F_SETFL, fcntl(fcgi->fd, F_GETFL) | O_NONBLOCK) < 0 ||
+		epoll_ctl(fcgi->epfd, EPOLL_CTL_ADD, fcgi->fd, &ev) < 0) {
+		log_error("Failed to watch FCGX listen socket: %s", strerror(errno));
 		goto failed;
 	}
 
-#ifdef SYNC_FCGX_ACCEPT
-	pthread_mutex_lock(&__fcgi->mutex);
-#endif
-	ret = FCGX_Accept_r(request);
-#ifdef SYNC_FCGX_ACCEPT
-	pthread_mutex_unlock(&__fcgi->mutex);
-#endif
+	while (1) {
+		if ((n = epoll_wait(fcgi->epfd, events, FCGI_EVENTS_MAX, -1)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
 
-	if (ret == 0) {
-		return request;
-	}
+			log_error("Failed to wait for FCGI events: %s", strerror(errno));
+			break;
+		}
 
-	log_error("Failed to accept FCGX request, returned %d", ret);
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == fcgi->fd) {
+				obix_fcgi_accept_all(fcgi);
+			} else {
+				obix_fcgi_dispatch(fcgi, events[i].data.fd);
+			}
+		}
+	}
 
 	/* Fall through */
 
 failed:
-	obix_fcgi_request_destroy(request);
-	return NULL;
+	close(fcgi->epfd);
+	fcgi->epfd = -1;
 }
 
 /*
- * The payload for each oBIX server thread, which is basically
- * accepting pending FCGI request and invoking a proper handle to
- * take care of that repeatedly
- *
- * Note:
- * 1. this function should never return unless on errors.
- *
- * 2. the FCGI website suggests that on some platform there is a
- * need to serialize the accept(), if that is the case, we need
- * to pass in a pointer to a common mutex that all threads need
- * to compete to grab during the invocation of accept().
+ * Start worker pools and run the event loop in the current thread
  */
-static void *payload(void *arg)
+static void obix_fcgi_event_run(obix_fcgi_t *fcgi)
 {
-	FCGX_Request *fcgiRequest = NULL;
-	obix_request_t *request = NULL;
-	obix_fcgi_t *fcgi = (obix_fcgi_t *)arg;
+	if (obix_fcgi_pool_start(&fcgi->fast) < 0) {
+		return;
+	}
 
-#ifdef DEBUG_VALGRIND
-	int count = 0;
-#endif
+	if (obix_fcgi_pool_start(&fcgi->slow) < 0) {
+		goto failed;
+	}
 
-	while (1) {
+	log_debug("Event loop started with %d to %d fast and %d to %d slow "
+			  "threads", fcgi->fast.min, fcgi->fast.max,
+			  fcgi->slow.min, fcgi->slow.max);
 
-#ifdef DEBUG_VALGRIND
-		if ((MAX_REQUESTS_SERVED > 0) && (count++ == MAX_REQUESTS_SERVED)) {
-			log_debug("Threshold %d reached, [%u] exiting...",
-					  MAX_REQUESTS_SERVED, get_tid());
-			fcgiRequest = NULL;		/* avoid double-free */
-			break;
-		}
-#endif
+	obix_fcgi_event_loop(fcgi);
 
-		if (!(fcgiRequest = obix_fcgi_request_create(fcgi))) {
-			log_error("Failed to create FCGI Request structure");
-			break;
-		}
+	/* Fast threads may still pass history requests on to the slow pool */
+	obix_fcgi_pool_stop(&fcgi->fast);
+	obix_fcgi_pool_stop(&fcgi->slow);
+	return;
 
-		if (!(request = obix_request_create(fcgiRequest))) {
-			log_error("Failed to create Response structure due to no memory");
-			break;
-		}
+failed:
+	obix_fcgi_pool_stop(&fcgi->fast);
+}
 
-		obix_handle_request(request);
+static int obix_fcgi_dump_prop(xmlNode *node, const char *name,
+							   unsigned long long val)
+{
+	char buf[32];
 
-		/*
-		 * The [request, response] pair will be released regardless on error
-		 * conditions or after response is sent out, which may take place in an
-		 * asynchronous manner
-		 */
+	sprintf(buf, "%llu", val);
+
+	return (xmlSetProp(node, BAD_CAST name, BAD_CAST buf) != NULL) ? 0 : -1;
+}
+
+static int obix_fcgi_dump_class(xmlNode *dump, const obix_fcgi_class_t *class)
+{
+	xmlNode *node;
+
+	if (!(node = xmlNewNode(NULL, BAD_CAST OBIX_OBJ))) {
+		return -1;
 	}
 
-	if (fcgiRequest) {
-		obix_fcgi_request_destroy(fcgiRequest);
+	if (!xmlSetProp(node, BAD_CAST OBIX_ATTR_NAME, BAD_CAST class->name) ||
+		obix_fcgi_dump_prop(node, "limit", class->limit) < 0 ||
+		obix_fcgi_dump_prop(node, "admitted", class->admitted) < 0 ||
+		obix_fcgi_dump_prop(node, "handled", class->handled) < 0 ||
+		obix_fcgi_dump_prop(node, "rejected", class->rejected) < 0 ||
+		obix_fcgi_dump_prop(node, "wait_avg_us", (class->handled > 0) ?
+							class->wait_total / class->handled : 0) < 0 ||
+		obix_fcgi_dump_prop(node, "wait_max_us", class->wait_max) < 0 ||
+		!xmlAddChild(dump, node)) {
+		xmlFreeNode(node);
+		return -1;
 	}
 
-	return NULL;
+	return 0;
+}
+
+static int obix_fcgi_dump_pool(xmlNode *dump, obix_fcgi_pool_t *pool)
+{
+	obix_fcgi_pool_t snapshot;
+	xmlNode *node;
+
+	pthread_mutex_lock(&pool->mutex);
+	memcpy(&snapshot, pool, sizeof(obix_fcgi_pool_t));
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (!(node = xmlNewNode(NULL, BAD_CAST OBIX_OBJ))) {
+		return -1;
+	}
+
+	if (!xmlSetProp(node, BAD_CAST OBIX_ATTR_NAME, BAD_CAST pool->name) ||
+		obix_fcgi_dump_prop(node, "threads", snapshot.threads) < 0 ||
+		obix_fcgi_dump_prop(node, "min", snapshot.min) < 0 ||
+		obix_fcgi_dump_prop(node, "max", snapshot.max) < 0 ||
+		obix_fcgi_dump_prop(node, "idle", snapshot.idle) < 0 ||
+		obix_fcgi_dump_prop(node, "peak", snapshot.peak) < 0 ||
+		obix_fcgi_dump_prop(node, "grown", snapshot.grown) < 0 ||
+		obix_fcgi_dump_prop(node, "retired", snapshot.retired) < 0 ||
+		obix_fcgi_dump_prop(node, "queued", snapshot.queued) < 0 ||
+		obix_fcgi_dump_prop(node, "queue_max", snapshot.queue_max) < 0 ||
+		!xmlAddChild(dump, node)) {
+		xmlFreeNode(node);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Dump the counters of the admission control of the event loop and
+ * the status of its worker pools
+ */
+xmlNode *obix_fcgi_dump(void)
+{
+	obix_fcgi_class_t class[OBIX_FCGI_CLASS_MAX];
+	xmlNode *dump;
+	int i;
+
+	/* Take a consistent snapshot of all classes */
+	pthread_mutex_lock(&__fcgi->admission);
+	memcpy(class, __fcgi->class, sizeof(class));
+	pthread_mutex_unlock(&__fcgi->admission);
+
+	if (!(dump = xmlNewNode(NULL, BAD_CAST OBIX_OBJ)) ||
+		!xmlSetProp(dump, BAD_CAST OBIX_ATTR_NAME, BAD_CAST "FCGI") ||
+		obix_fcgi_dump_prop(dump, "retry_after", __fcgi->retry_after) < 0) {
+		goto failed;
+	}
+
+	for (i = 0; i < OBIX_FCGI_CLASS_MAX; i++) {
+		if (obix_fcgi_dump_class(dump, class + i) < 0) {
+			goto failed;
+		}
+	}
+
+	if (obix_fcgi_dump_pool(dump, &__fcgi->fast) < 0 ||
+		obix_fcgi_dump_pool(dump, &__fcgi->slow) < 0) {
+		goto failed;
+	}
+
+	return dump;
+
+failed:
+	if (dump) {
+		xmlFreeNode(dump);
+	}
+
+	return xmldb_fatal_error();
 }
 
 /**
@@ -539,6 +2357,11 @@ int main(int argc, char **argv)
 		goto log_failed;
 	}
 
+	if (__fcgi->fast.min > 0) {
+		obix_fcgi_event_run(__fcgi);
+		goto exit;
+	}
+
 	for (i = 0; i < __fcgi->multi_threads; i++) {
 		if (pthread_create(__fcgi->id + i, NULL, payload, (void *)__fcgi) != 0) {
 			log_warning("Failed to start thread%d", i);
@@ -551,6 +2374,10 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Fall through */
+
+exit:
+
 	obix_fcgi_exit();
 
 	/* Fall through */
@@ -21,7 +21,133 @@
 #ifndef _OBIX_FCGI_H
 #define _OBIX_FCGI_H
 
+#include <time.h>
+#include <zlib.h>
+#include <libxml/tree.h>
+#include <libxml/parser.h>
 #include "obix_request.h"
+#include "xml_binary.h"
+#include "xml_json.h"
+
+/*
+ * The buffer and XML parser context of one thread to read and parse
+ * request bodies, reused by every request handled by the thread
+ */
+typedef struct obix_fcgi_reader {
+	xmlParserCtxt *ctxt;
+
+	/* The number of bodies parsed by the current parser context */
+	int parsed;
+
+	char *buf;
+	long size;
+
+	/* The buffer to encode responses in the compact binary encoding */
+	xml_binary_t bin;
+
+	/*
+	 * The deflate state to compress responses by gzip, initialised on
+	 * its first use and reset for each response, the buffer for the
+	 * compressed data and the FCGX stream it is written to
+	 */
+	z_stream zs;
+	int zs_ready;
+	char *zbuf;
+	FCGX_Stream *zout;
+} obix_fcgi_reader_t;
+
+/*
+ * The classes of requests subject to the admission control of the
+ * event loop, so that one kind of requests can never occupy all
+ * worker threads and queue slots at the cost of others
+ */
+typedef enum obix_fcgi_class_id {
+	OBIX_FCGI_CLASS_DEVICE = 0,		/* all requests of other classes */
+	OBIX_FCGI_CLASS_HISTORY,
+	OBIX_FCGI_CLASS_WATCH,
+	OBIX_FCGI_CLASS_MAX
+} obix_fcgi_class_id_t;
+
+typedef struct obix_fcgi_class {
+	const char *name;
+
+	/*
+	 * The maximal number of requests of the class admitted at once,
+	 * either queued or being handled, 0 for no limit
+	 */
+	int limit;
+
+	/* The number of requests of the class admitted at the moment */
+	int admitted;
+
+	/* The number of requests handled and rejected since start-up */
+	unsigned long handled;
+	unsigned long rejected;
+
+	/*
+	 * The total and the maximal time in microseconds requests of the
+	 * class have waited in the queue of a worker pool
+	 */
+	unsigned long long wait_total;
+	unsigned long wait_max;
+} obix_fcgi_class_t;
+
+/*
+ * A pool of worker threads handling requests dispatched by the
+ * event loop, which grows when requests have to wait in its queue
+ * and shrinks when its threads stay idle, between min and max
+ *
+ * Worker threads are detached, the pool keeps track of their number
+ * only so that they can be waited for on shutdown
+ */
+typedef struct obix_fcgi_pool {
+	/* The name of the pool, for debug purpose */
+	const char *name;
+
+	/*
+	 * The current, minimal and maximal number of worker threads, and
+	 * the number of those waiting for requests
+	 */
+	int threads;
+	int min;
+	int max;
+	int idle;
+
+	/*
+	 * The highest number of worker threads ever reached, and the
+	 * number of threads created and retired on demand
+	 */
+	int peak;
+	unsigned long grown;
+	unsigned long retired;
+
+	/*
+	 * Surplus threads retire after being idle for idle_timeout seconds,
+	 * while a new thread is created whenever the queue holds more
+	 * requests than idle threads, or requests are still queued after
+	 * one of them has waited for grow_latency microseconds
+	 */
+	int idle_timeout;
+	unsigned long grow_latency;
+
+	/*
+	 * The queue of requests waiting to be handled, its length and
+	 * the maximal length beyond which requests are rejected
+	 */
+	struct list_head queue;
+	int queued;
+	int queue_max;
+
+	pthread_mutex_t mutex;
+
+	/* Signalled when requests are queued or the pool is shutting down */
+	pthread_cond_t wq;
+
+	/* Signalled when the last worker thread exits on shutdown */
+	pthread_cond_t exit_wq;
+
+	int shutdown;
+} obix_fcgi_pool_t;
 
 /*
  * Descriptor for the FCGX channel
@@ -43,6 +169,49 @@ typedef struct obix_fcgi {
 	/* The array of pthread_t for above sync threads */
 	pthread_t *id;
 
+	/*
+	 * The worker pools of the event-driven front end, where one
+	 * event loop accepts connections and reads in FCGI requests,
+	 * then dispatches them to the fast pool for normal requests
+	 * or the slow pool for those on the history facilities that
+	 * involve disk I/O, so that lengthy history queries never
+	 * starve normal reads and writes
+	 *
+	 * If there is no fast thread at all the oBIX server falls back
+	 * on multi_threads threads accepting requests by themselves
+	 */
+	obix_fcgi_pool_t fast;
+	obix_fcgi_pool_t slow;
+
+	/*
+	 * The admission control of the event loop, requests beyond the
+	 * limit of their class or the queue of their pool are rejected
+	 * right away with an error contract and a Retry-After header of
+	 * retry_after seconds, instead of piling up until the web server
+	 * gives up on them
+	 */
+	obix_fcgi_class_t class[OBIX_FCGI_CLASS_MAX];
+	int retry_after;
+
+	/* The mutex to protect the admission counters of all classes */
+	pthread_mutex_t admission;
+
+	/* The epoll instance of the event loop */
+	int epfd;
+
+	/* The key to the body reader of each thread */
+	pthread_key_t reader_key;
+
+	/*
+	 * The minimal length of responses compressed by gzip and the
+	 * compression level, 0 if compression is disabled
+	 */
+	long gzip_min;
+	int gzip_level;
+
+	/* The maximal length of request bodies */
+	long body_max;
+
 	/*
 	 * Method used by a server thread to send response back for
 	 * the given request
@@ -53,8 +222,21 @@ typedef struct obix_fcgi {
 	 */
 	void (*send_response)(obix_request_t *);
 
+	/*
+	 * Method used by a server thread to serialise the given document
+	 * straight into the FCGI channel as response to the given request,
+	 * without any response item
+	 */
+	void (*send_object)(obix_request_t *, xmlDoc *);
+
 	/* The mutex to prevent races on accept(), needed on some platform */
 	pthread_mutex_t mutex;
+
+	/*
+	 * The start-up time of the oBIX server, part of every ETag so that
+	 * versions of objects before the last restart are never matched
+	 */
+	time_t epoch;
 } obix_fcgi_t;
 
 extern obix_fcgi_t *__fcgi;
@@ -64,11 +246,21 @@ typedef enum fcgi_env {
 	FCGI_ENV_REQUEST_METHOD,
 	FCGI_ENV_REMOTE_PORT,
 	FCGI_ENV_REMOTE_ADDR,
-	FCGI_ENV_REQUESTER_ID
+	FCGI_ENV_REQUESTER_ID,
+	FCGI_ENV_IF_NONE_MATCH,
+	FCGI_ENV_CONTENT_LENGTH,
+	FCGI_ENV_CONTENT_TYPE,
+	FCGI_ENV_ACCEPT,
+	FCGI_ENV_ACCEPT_ENCODING
 } fcgi_env_t;
 
-char *obix_fcgi_get_requester_id(obix_request_t *request);
+const char *obix_fcgi_get_requester_id(obix_request_t *request);
+int obix_fcgi_has_if_none_match(obix_request_t *request);
+int obix_fcgi_is_not_modified(obix_request_t *request, unsigned long version);
 
 void obix_fcgi_request_destroy(FCGX_Request *request);
+void obix_fcgi_reader_release(void);
+
+xmlNode *obix_fcgi_dump(void);
 
 #endif
@@ -34,6 +34,13 @@ void obix_request_send_response(obix_request_t *request)
 	}
 }
 
+void obix_request_send_object(obix_request_t *request, xmlDoc *doc)
+{
+	if (__fcgi && __fcgi->send_object) {
+		__fcgi->send_object(request, doc);
+	}
+}
+
 /**
  * Create a request descriptor and pair it up with relevant
  * FCGI request, which is the vehicle to send response back
@@ -56,6 +63,9 @@ obix_request_t *obix_request_create(FCGX_Request *request)
 
 	obixRequest->request = request;
 	INIT_LIST_HEAD(&obixRequest->response_items);
+	INIT_LIST_HEAD(&obixRequest->list);
+	arena_init(&obixRequest->arena, obixRequest->arena_buf,
+			   OBIX_REQUEST_ARENA_SIZE, OBIX_REQUEST_CHUNK_SIZE);
 	pthread_mutex_init(&obixRequest->mutex, NULL);
 
 	return obixRequest;
@@ -111,14 +121,11 @@ void obix_request_destroy(obix_request_t *request)
 
 	pthread_mutex_destroy(&request->mutex);
 
-	/* response_uri may have not been used at all */
-	if (request->response_uri) {
-		free(request->response_uri);
-	}
-
-	if (request->request_decoded_uri) {
-		free(request->request_decoded_uri);
-	}
+	/*
+	 * Release response_uri, request_decoded_uri, DOM copies read from
+	 * the arena and the like at once
+	 */
+	arena_reset(&request->arena);
 
 	free(request);
 }
@@ -244,3 +251,12 @@ int obix_request_add_response_xml_header(obix_request_t *request)
 
 	return 0;
 }
+
+/**
+ * Duplicate the given string in the arena of the request, which is
+ * released along with the request and must not be freed by callers
+ */
+char *obix_request_strdup(obix_request_t *request, const char *str)
+{
+	return arena_strdup(&request->arena, str);
+}
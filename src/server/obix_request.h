@@ -22,8 +22,29 @@
 #ifndef _OBIX_REQUEST_H
 #define _OBIX_REQUEST_H
 
+#include <time.h>
 #include <fcgiapp.h>
+#include <libxml/tree.h>
 #include "list.h"
+#include "arena.h"
+
+/*
+ * The size of the buffer embedded in a request for its arena, enough
+ * for strings of most requests without any malloc(), and the size of
+ * chunks allocated once it is used up, such as by DOM copies read
+ */
+#define OBIX_REQUEST_ARENA_SIZE		512
+#define OBIX_REQUEST_CHUNK_SIZE		16384
+
+/*
+ * The encodings of oBIX objects sent back to oBIX clients, as
+ * negotiated by the Accept header of requests
+ */
+typedef enum obix_format {
+	OBIX_FORMAT_XML = 0,
+	OBIX_FORMAT_BINARY,		/* see xml_binary.h */
+	OBIX_FORMAT_JSON		/* see xml_json.h */
+} obix_format_t;
 
 typedef struct response_item {
 	/* Full or a part of response from oBIX server */
@@ -39,7 +60,8 @@ typedef struct response_item {
 typedef struct obix_request {
 	/*
 	 * Which href on the oBIX server has generated this response,
-	 * used to setup the HTTP Content-Location header
+	 * used to setup the HTTP Content-Location header, allocated
+	 * from the arena of the request
 	 *
 	 * In most cases handlers won't bother to set it up and the
 	 * decoded request_uri will be used.
@@ -62,7 +84,8 @@ typedef struct obix_request {
 	const char *request_uri;
 
 	/*
-	 * The decoded version of the requested URI.
+	 * The decoded version of the requested URI, allocated from the
+	 * arena of the request
 	 */
 	char *request_decoded_uri;
 
@@ -78,6 +101,34 @@ typedef struct obix_request {
 	 */
 	int is_history;
 
+	/*
+	 * The version of the object carried by the response, used to
+	 * setup the HTTP ETag header, or 0 if not available
+	 */
+	unsigned long response_version;
+
+	/*
+	 * Raised when the requested object has not changed since the
+	 * version cached by oBIX client, in which case only the status
+	 * and headers are sent back without any response body
+	 */
+	int not_modified;
+
+	/*
+	 * Set for requests rejected by the admission control of the event
+	 * loop to the number of seconds oBIX clients are advised to wait
+	 * before retrying, sent in the HTTP Retry-After header
+	 */
+	int retry_after;
+
+	/*
+	 * The encoding of the oBIX object carried by the response. Objects
+	 * sent by obix_server_reply_object() can be in any encoding, while
+	 * serialised responses such as history query results are either
+	 * sent in XML as they are or converted into JSON on the fly
+	 */
+	obix_format_t format;
+
 	/*
 	 * The overall body length of current response
 	 *
@@ -111,6 +162,34 @@ typedef struct obix_request {
 
 	/* Mutex to protect the whole data structure */
 	pthread_mutex_t mutex;
+
+	/*
+	 * Joining the queue of a worker pool, when dispatched by the
+	 * event loop of the oBIX server
+	 */
+	struct list_head list;
+
+	/*
+	 * The class of the request for the admission control, which is
+	 * OBIX_FCGI_CLASS_MAX until a worker thread has read it in, and
+	 * when it joined the queue of the worker pool
+	 */
+	int fcgi_class;
+	struct timespec queued;
+
+	/*
+	 * The arena for memory needed until the request is destroyed,
+	 * such as the decoded URI, the requester ID, and copies of device
+	 * contracts or the global DOM tree read by GET requests along with
+	 * the documents wrapping them, which are all released in one go
+	 * along with the request instead of one by one. Only the thread
+	 * handling the request may allocate from it
+	 *
+	 * NOTE: serialised responses are not allocated from the arena
+	 * since they may be cached beyond the request
+	 */
+	arena_t arena;
+	char arena_buf[OBIX_REQUEST_ARENA_SIZE] __attribute__((aligned(ARENA_ALIGN)));
 } obix_request_t;
 
 typedef void (*obix_request_listener)(obix_request_t *);
@@ -135,8 +214,12 @@ int obix_request_add_response_xml_header(obix_request_t *resp);
 
 void obix_request_send_response(obix_request_t *);
 
+void obix_request_send_object(obix_request_t *, xmlDoc *);
+
 long obix_request_get_response_len(obix_request_t *);
 
 int obix_request_get_response_items(obix_request_t *);
 
+char *obix_request_strdup(obix_request_t *, const char *);
+
 #endif
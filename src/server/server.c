@@ -29,6 +29,7 @@
 #include "watch.h"
 #include "server.h"
 #include "xml_utils.h"
+#include "xml_arena.h"
 #include "obix_fcgi.h"
 #include "history.h"
 #include "batch.h"
@@ -42,9 +43,25 @@
  */
 static const xmlChar *OBIX_SRV_DUMP_URI = (xmlChar *)"/obix-dump/";
 static const xmlChar *OBIX_DEV_DUMP_URI = (xmlChar *)"/obix-dev-dump/";
-static const xmlChar *OBIX_DEV_CACHE_DUMP_URI = (xmlChar *)"/obix-dev-cache-dump/";
 #endif
 
+/*
+ * The special URI to expose the statistics of the device cache
+ */
+static const xmlChar *OBIX_DEV_CACHE_DUMP_URI = (xmlChar *)"/obix-dev-cache-dump/";
+
+/*
+ * The special URI to expose the admission control counters and the
+ * worker pools of the FCGI front end
+ */
+static const xmlChar *OBIX_FCGI_DUMP_URI = (xmlChar *)"/obix-fcgi-dump/";
+
+/*
+ * The nodes excluded from the result of a read request
+ */
+static const xml_copy_flags_t OBIX_READ_FLAGS =
+					EXCLUDE_META | EXCLUDE_HIDDEN | EXCLUDE_COMMENTS;
+
 /*
  * Prototype of a POST Handler function.
  *
@@ -57,6 +74,7 @@ typedef xmlNode *(*obix_server_handler)(obix_request_t *, const xmlChar *,
 
 void obix_server_exit(void)
 {
+	obix_batch_dispose();
 	obix_devices_dispose();
 	obix_hist_dispose();
 	obix_watch_dispose();
@@ -67,12 +85,19 @@ void obix_server_exit(void)
 
 int obix_server_init(const xml_config_t *config)
 {
-	int poll_threads, table_size, cache_size, backup_period;
+	int poll_threads, poll_threads_max, idle_timeout;
+	int cache_size, resp_cache_size, backup_period;
+	int snapshot_period, load_threads, batch_threads;
 
 	if ((poll_threads = xml_config_get_int(config, XP_POLL_THREADS)) < 0 ||
-		(table_size = xml_config_get_int(config, XP_DEV_TABLE_SIZE)) < 0 ||
+		(poll_threads_max = xml_config_get_int(config, XP_POLL_THREADS_MAX)) < 0 ||
+		(idle_timeout = xml_config_get_int(config, XP_THREAD_IDLE_TIMEOUT)) <= 0 ||
 		(cache_size = xml_config_get_int(config, XP_DEV_CACHE_SIZE)) < 0 ||
-		(backup_period = xml_config_get_int(config, XP_DEV_BACKUP_PERIOD)) < 0) {
+		(resp_cache_size = xml_config_get_int(config, XP_DEV_RESP_CACHE_SIZE)) < 0 ||
+		(backup_period = xml_config_get_int(config, XP_DEV_BACKUP_PERIOD)) < 0 ||
+		(snapshot_period = xml_config_get_int(config, XP_DEV_SNAPSHOT_PERIOD)) < 0 ||
+		(load_threads = xml_config_get_int(config, XP_DEV_LOAD_THREADS)) < 0 ||
+		(batch_threads = xml_config_get_int(config, XP_BATCH_THREADS)) < 0) {
 		log_error("Failed to get server settings");
 		return -1;
 	}
@@ -83,7 +108,7 @@ int obix_server_init(const xml_config_t *config)
 		return -1;
 	}
 
-	if (obix_watch_init(poll_threads) != 0) {
+	if (obix_watch_init(poll_threads, poll_threads_max, idle_timeout) != 0) {
 		log_error("Failed to initialise the watch subsystem");
 		goto failed;
 	}
@@ -93,14 +118,25 @@ int obix_server_init(const xml_config_t *config)
 		goto hist_failed;
 	}
 
-	if (obix_devices_init(config->resdir, table_size,
-						  cache_size, backup_period) != 0) {
+	if (obix_devices_init(config->resdir, cache_size, resp_cache_size,
+						  backup_period, snapshot_period, load_threads) != 0) {
 		log_error("Failed to initialise the Device subsystem");
 		goto device_failed;
 	}
 
+	/* No more strings inserted into the dictionary of the global DOM tree */
+	xmldb_dict_freeze();
+
+	if (obix_batch_init(batch_threads) != 0) {
+		log_error("Failed to initialise the batch worker pool");
+		goto batch_failed;
+	}
+
 	return 0;
 
+batch_failed:
+	obix_devices_dispose();
+
 device_failed:
 	obix_hist_dispose();
 
@@ -133,21 +169,152 @@ xmlNode *obix_server_generate_error(const xmlChar *href, const char *contract,
 	return node;
 }
 
-xmlNode *obix_server_read(obix_request_t *request, const xmlChar *overrideUri)
+/*
+ * Make the given oBIX object the root of a new document so as to
+ * serialise it. The object is released along with the document by
+ * obix_server_free_object(), or right away on failure
+ *
+ * Copies allocated from the arena of the request are wrapped by a
+ * document from the arena as well
+ *
+ * Return the document on success, NULL on failure
+ */
+static xmlDoc *obix_server_wrap_object(obix_request_t *request, xmlNode *node)
+{
+	xmlDoc *doc;
+
+	if (arena_owns(&request->arena, node) == 1) {
+		if (!(doc = xml_arena_wrap(&request->arena, node))) {
+			log_error("Could not generate obix document for reply.");
+		}
+
+		return doc;
+	}
+
+	if (!(doc = xmlNewDoc(BAD_CAST XML_VERSION))) {
+		log_error("Could not generate obix document for reply.");
+		xmlFreeNode(node);
+		return NULL;
+	}
+
+	/*
+	 * Reparent the answer node to the newly created temp document to generate
+	 * response. If it comes from the original input document that may have
+	 * used a XML parser dictionary (e.g., returned by the signUp handler),
+	 * the dictionary should be referenced so that the release of the temp
+	 * document won't interfere with it
+	 *
+	 * However, such logic will be bypassed if the node using dictionary is not
+	 * added as the root node of the temp document, e.g., as the child of the
+	 * batchOut contract (which is created from a template and have no relation
+	 * to any document), an extra copy is a must-have to de-associate with the
+	 * dictionary. See comments in obix_batch_add_item
+	 */
+	if (node->doc) {
+		doc->dict = node->doc->dict;
+		if (doc->dict) {
+			xmlDictReference(doc->dict);
+		}
+	}
+
+	xmlDocSetRootElement(doc, node);
+
+	return doc;
+}
+
+/*
+ * Release the document created by obix_server_wrap_object(), unless
+ * it is left to the arena of the request
+ */
+static void obix_server_free_object(obix_request_t *request, xmlDoc *doc)
+{
+	if (arena_owns(&request->arena, doc) == 0) {
+		xmlFreeDoc(doc);
+	}
+}
+
+/*
+ * Serialise the given oBIX object, which is released regardless of
+ * whether it is serialised successfully or not
+ *
+ * Return the serialised object with its size, or NULL on failure
+ */
+static xmlChar *obix_server_dump_object(obix_request_t *request,
+										xmlNode *node, int *size)
+{
+	xmlDoc *doc;
+	xmlChar *mem = NULL;
+
+	*size = 0;
+
+	if (!(doc = obix_server_wrap_object(request, node))) {
+		return NULL;
+	}
+
+#ifdef DEBUG
+	xmlDocDumpFormatMemory(doc, &mem, size, 1);
+#else
+	xmlDocDumpFormatMemory(doc, &mem, size, 0);
+#endif
+
+	obix_server_free_object(request, doc);
+	return mem;
+}
+
+/*
+ * Send back the serialised response to oBIX client, then the response
+ * and relevant FCGI request would be released in the end.
+ *
+ * If failed to create an item, destroy them right away
+ */
+static void obix_server_reply_data(obix_request_t *request, char *mem, int size)
+{
+	if (obix_request_create_append_response_item(request, mem, size, 0) < 0) {
+		log_error("Failed to create a response item");
+		if (mem) {
+			free(mem);
+		}
+	} else {
+		obix_request_send_response(request);
+	}
+
+	obix_request_destroy(request);
+}
+
+/*
+ * Read the object at the given href, and return the version of it if
+ * it comes from a device contract and its serialised response can be
+ * cached, otherwise 0
+ *
+ * If the given arena is not NULL, copies of device contracts and the
+ * global DOM tree are allocated from it, see xml_arena.h
+ */
+static xmlNode *obix_server_read_version(obix_request_t *request,
+										 const xmlChar *overrideUri,
+										 unsigned long *version,
+										 arena_t *arena)
 {
 	xmlNode *copy;
-	xml_copy_flags_t flags = EXCLUDE_META | EXCLUDE_HIDDEN | EXCLUDE_COMMENTS;
+	xml_copy_flags_t flags = OBIX_READ_FLAGS;
 	const xmlChar *uri;
-	int ret = 0;
+	int ret = 0, in_arena = 0;
 
 	uri = (overrideUri) ? overrideUri : (const xmlChar *)request->request_decoded_uri;
 
+	if (version) {
+		*version = 0;
+	}
+
 	if (is_given_type(uri, OBIX_DEVICE) == 1) {
-		copy = device_copy_uri(uri, flags);
+		copy = device_copy_uri_cacheable(uri, flags, version, arena);
+		in_arena = (arena) ? 1 : 0;
 	} else if (is_given_type(uri, OBIX_WATCH) == 1) {
 		copy = watch_copy_uri(uri, flags);
 	} else if (is_given_type(uri, OBIX_HISTORY) == 1) {
 		copy = hist_copy_uri(uri, flags);
+	} else if (arena) {
+		copy = xmldb_copy_uri_arena(arena, uri, flags);
+		in_arena = 1;
 	} else {
 		copy = xmldb_copy_uri(uri, flags);
 	}
@@ -157,6 +324,16 @@ xmlNode *obix_server_read(obix_request_t *request, const xmlChar *overrideUri)
 		goto failed;
 	}
 
+	if (in_arena == 1) {
+		if (xml_arena_set_prop(arena, copy, BAD_CAST OBIX_ATTR_HREF, uri) < 0) {
+			ret = ERR_NO_MEM;
+			goto failed;
+		}
+
+		xml_arena_unset_prop(copy, BAD_CAST OBIX_ATTR_HIDDEN);
+		return copy;
+	}
+
 	if (!xmlSetProp(copy, BAD_CAST OBIX_ATTR_HREF, uri)) {
 		ret = ERR_NO_MEM;
 		goto failed;
@@ -169,17 +346,92 @@ failed:
 	if (ret > 0) {
 		log_error("%s : %s", uri, server_err_msg[ret].msgs);
 
-		if (copy) {
+		/* Copies from the arena are released along with the request */
+		if (copy && in_arena == 0) {
 			xml_delete_node(copy);
 		}
 
 		copy = obix_server_generate_error(uri, server_err_msg[ret].type,
 										  "Read", server_err_msg[ret].msgs);
+
+		if (version) {
+			*version = 0;
+		}
 	}
 
 	return copy;
 }
 
+xmlNode *obix_server_read(obix_request_t *request, const xmlChar *overrideUri)
+{
+	return obix_server_read_version(request, overrideUri, NULL, NULL);
+}
+
+/*
+ * Read from a device contract, reusing the serialised response of
+ * the same href if relevant node has not changed since then, so as
+ * to skip both the copy and the serialisation of the node
+ *
+ * If oBIX client already has the current version of the node, as
+ * indicated by the If-None-Match header, simply reply with the 304
+ * status without generating any response body at all
+ */
+static void obix_server_read_device(obix_request_t *request)
+{
+	const xmlChar *uri = (const xmlChar *)request->request_decoded_uri;
+	xmlNode *node;
+	xmlChar *mem;
+	char *data;
+	unsigned long version;
+	int size;
+
+	if (obix_fcgi_has_if_none_match(request) == 1 &&
+		obix_fcgi_is_not_modified(request,
+								  (version = device_get_version(uri))) == 1) {
+		request->response_version = version;
+		request->not_modified = 1;
+		obix_request_send_response(request);
+		obix_request_destroy(request);
+		return;
+	}
+
+	/*
+	 * Cached responses are in XML, which can be converted into JSON
+	 * on the fly but not into the binary encoding
+	 */
+	if (request->format == OBIX_FORMAT_BINARY) {
+		node = obix_server_read_version(request, NULL, &version,
+										&request->arena);
+		request->response_version = version;
+		obix_server_reply_object(request, ((node != NULL) ? node : xmldb_fatal_error()));
+		return;
+	}
+
+	if (device_read_cached(uri, OBIX_READ_FLAGS, &data, &size, &version) == 0) {
+		request->response_version = version;
+		obix_server_reply_data(request, data, size);
+		return;
+	}
+
+	node = obix_server_read_version(request, NULL, &version, &request->arena);
+
+	if (!node || version == 0) {
+		obix_server_reply_object(request, ((node != NULL) ? node : xmldb_fatal_error()));
+		return;
+	}
+
+	/* The object has been released, try the fatal error contract */
+	if (!(mem = obix_server_dump_object(request, node, &size))) {
+		obix_server_reply_object(request, xmldb_fatal_error());
+		return;
+	}
+
+	device_cache_response(uri, OBIX_READ_FLAGS, version, (char *)mem, size);
+
+	request->response_version = version;
+	obix_server_reply_data(request, (char *)mem, size);
+}
+
 void obix_server_handleError(obix_request_t *request, const char *msg)
 {
 	xmlNode *node;
@@ -210,18 +462,35 @@ void obix_server_handleGET(obix_request_t *request)
 	} else if (is_str_identical((xmlChar *)request->request_decoded_uri,
 								OBIX_DEV_CACHE_DUMP_URI, 1) == 1) {
 		node = device_cache_dump();
+	} else if (is_str_identical((xmlChar *)request->request_decoded_uri,
+								OBIX_FCGI_DUMP_URI, 1) == 1) {
+		node = obix_fcgi_dump();
 	} else if (is_str_identical((xmlChar *)request->request_decoded_uri,
 								OBIX_DEVICES, 1) == 1) {
 		node = device_dump_ref();
+	} else if (is_given_type((xmlChar *)request->request_decoded_uri,
+							 OBIX_DEVICE) == 1) {
+		obix_server_read_device(request);
+		return;
 	} else {
-		node = obix_server_read(request, NULL);
+		node = obix_server_read_version(request, NULL, NULL, &request->arena);
 	}
 #else
 	if (is_str_identical((xmlChar *)request->request_decoded_uri,
-						 OBIX_DEVICES, 1) == 1) {
+						 OBIX_DEV_CACHE_DUMP_URI, 1) == 1) {
+		node = device_cache_dump();
+	} else if (is_str_identical((xmlChar *)request->request_decoded_uri,
+								OBIX_FCGI_DUMP_URI, 1) == 1) {
+		node = obix_fcgi_dump();
+	} else if (is_str_identical((xmlChar *)request->request_decoded_uri,
+								OBIX_DEVICES, 1) == 1) {
 		node = device_dump_ref();
+	} else if (is_given_type((xmlChar *)request->request_decoded_uri,
+							 OBIX_DEVICE) == 1) {
+		obix_server_read_device(request);
+		return;
 	} else {
-		node = obix_server_read(request, NULL);
+		node = obix_server_read_version(request, NULL, NULL, &request->arena);
 	}
 #endif
 
@@ -229,28 +498,24 @@ void obix_server_handleGET(obix_request_t *request)
 }
 
 /*
- * Update the val attribute of the destination node according to
- * the input contract
+ * Check the input contract of a write request on the given uri and
+ * get the new value from it
+ *
+ * Return 0 on success, > 0 for error code
  */
-xmlNode *obix_server_write(obix_request_t *request, const xmlChar *overrideUri,
-						   xmlNode *input)
+int obix_server_write_check(const xmlChar *uri, xmlNode *input, xmlChar **val)
 {
-	xmlNode *copy = NULL;
-	xmlChar *val = NULL;
-	const xmlChar *uri;
 	char *href_src, *href_dst, *href_copy;
-	int ret = 0;
+	int ret;
 
-	uri = (overrideUri) ? overrideUri : (const xmlChar *)request->request_decoded_uri;
+	*val = NULL;
 
 	if (!input) {
-		ret = ERR_NO_INPUT;
-		goto failed;
+		return ERR_NO_INPUT;
 	}
 
 	if (is_given_type(uri, OBIX_HISTORY) == 1) {
-		ret = ERR_READONLY_HREF;
-		goto failed;
+		return ERR_READONLY_HREF;
 	}
 
 	/*
@@ -261,8 +526,7 @@ xmlNode *obix_server_write(obix_request_t *request, const xmlChar *overrideUri,
 	if (href_src) {
 		if (!(href_copy = strdup((char *)uri))) {
 			free(href_src);
-			ret = ERR_NO_MEM;
-			goto failed;
+			return ERR_NO_MEM;
 		}
 
 		href_dst = (slash_preceded(href_src) == 1) ? href_copy : basename(href_copy);
@@ -272,22 +536,42 @@ xmlNode *obix_server_write(obix_request_t *request, const xmlChar *overrideUri,
 		free(href_copy);
 
 		if (ret != 0) {
-			ret = ERR_INVALID_HREF;
-			goto failed;
+			return ERR_INVALID_HREF;
 		}
 	}
 
 	/*
 	 * TODO: Enforcement of oBIX Data Modeling should be done here
 	 */
-	if (!(val = xmlGetProp(input, BAD_CAST OBIX_ATTR_VAL)) ||
+	if (!(*val = xmlGetProp(input, BAD_CAST OBIX_ATTR_VAL)) ||
 		(xmlStrcmp(input->name, BAD_CAST OBIX_OBJ_BOOL) == 0 &&
-		 xmlStrcmp(val, BAD_CAST XML_TRUE) != 0 &&
-		 xmlStrcmp(val, BAD_CAST XML_FALSE) != 0) ||
+		 xmlStrcmp(*val, BAD_CAST XML_TRUE) != 0 &&
+		 xmlStrcmp(*val, BAD_CAST XML_FALSE) != 0) ||
 		(xmlStrcmp(input->name, BAD_CAST OBIX_OBJ_ABSTIME) == 0 &&
-		 timestamp_is_valid((char *)val) == 0)) {
-		ret = ERR_INVALID_INPUT;
-		goto failed;
+		 timestamp_is_valid((char *)*val) == 0)) {
+		if (*val) {
+			xmlFree(*val);
+			*val = NULL;
+		}
+		return ERR_INVALID_INPUT;
+	}
+
+	return 0;
+}
+
+/*
+ * Update the val attribute of the destination node according to
+ * the input contract, without reading it back
+ *
+ * Return 0 on success, > 0 for error code
+ */
+int obix_server_update(const xmlChar *uri, xmlNode *input)
+{
+	xmlChar *val = NULL;
+	int ret;
+
+	if ((ret = obix_server_write_check(uri, input, &val)) != 0) {
+		return ret;
 	}
 
 	if (is_given_type(uri, OBIX_DEVICE) == 1) {
@@ -298,30 +582,36 @@ xmlNode *obix_server_write(obix_request_t *request, const xmlChar *overrideUri,
 		ret = xmldb_update_uri(uri, val);
 	}
 
+	xmlFree(val);
+
+	return ret;
+}
+
+/*
+ * Update the val attribute of the destination node according to
+ * the input contract
+ */
+xmlNode *obix_server_write(obix_request_t *request, const xmlChar *overrideUri,
+						   xmlNode *input)
+{
+	xmlNode *copy = NULL;
+	const xmlChar *uri;
+	int ret = 0;
+
+	uri = (overrideUri) ? overrideUri : (const xmlChar *)request->request_decoded_uri;
+
 	/*
 	 * The gap between update & copy a node won't invite
 	 * race condition if it is deleted since no pointer
 	 * of it was passed through
 	 */
-
-	if (ret == 0) {
+	if ((ret = obix_server_update(uri, input)) == 0) {
 		copy = obix_server_read(request, uri);
 	}
 
-	/* Fall through */
-
-failed:
-	if (val) {
-		xmlFree(val);
-	}
-
 	if (ret > 0) {
 		log_error("%s : %s", uri, server_err_msg[ret].msgs);
 
-		if (copy) {
-			xml_delete_node(copy);
-		}
-
 		copy = obix_server_generate_error(uri, server_err_msg[ret].type,
 										  "Write", server_err_msg[ret].msgs);
 	}
@@ -357,9 +647,7 @@ void obix_server_handlePUT(obix_request_t *request, const xmlDoc *input)
  */
 void obix_server_reply_object(obix_request_t *request, xmlNode *node)
 {
-	xmlDoc *doc = NULL;
-	xmlChar *mem;
-	int size = 0;
+	xmlDoc *doc;
 
 	/*
 	 * Due to the fact that glibc free() won't nullify the released memory
@@ -386,65 +674,23 @@ void obix_server_reply_object(obix_request_t *request, xmlNode *node)
 		return;
 	}
 
-	if (!(doc = xmlNewDoc(BAD_CAST XML_VERSION))) {
-		log_error("Could not generate obix document for reply.");
-		goto failed;
-	}
-
 	/*
-	 * Reparent the answer node to the newly created temp document to generate
-	 * response. If it comes from the original input document that may have
-	 * used a XML parser dictionary (e.g., returned by the signUp handler),
-	 * the dictionary should be referenced so that the release of the temp
-	 * document won't interfere with it
-	 *
-	 * However, such logic will be bypassed if the node using dictionary is not
-	 * added as the root node of the temp document, e.g., as the child of the
-	 * batchOut contract (which is created from a template and have no relation
-	 * to any document), an extra copy is a must-have to de-associate with the
-	 * dictionary. See comments in obix_batch_add_item
+	 * Stream the object straight into the FCGI channel instead of
+	 * serialising it into memory first, so that large objects such
+	 * as the lobby, the device references or watchOut contracts
+	 * never occupy memory twice
 	 */
-	if (node->doc) {
-		doc->dict = node->doc->dict;
-		if (doc->dict) {
-			xmlDictReference(doc->dict);
-		}
+	if (!(doc = obix_server_wrap_object(request, node)) &&
+		(node = xmldb_fatal_error()) != NULL) {
+		/* The object has been released, try the fatal error contract */
+		doc = obix_server_wrap_object(request, node);
 	}
 
-	xmlDocSetRootElement(doc, node);
-
-#ifdef DEBUG
-	xmlDocDumpFormatMemory(doc, &mem, &size, 1);
-#else
-	xmlDocDumpFormatMemory(doc, &mem, &size, 0);
-#endif
-
-	/*
-	 * Create a response item to carry the result and send it back
-	 * to oBIX client. Then the response and relevant FCGI request
-	 * would be released in the end.
-	 *
-	 * If failed to create an item, destroy them right away
-	 */
-	if (obix_request_create_append_response_item(request, (char *)mem, size, 0) < 0) {
-		log_error("Failed to create a response item");
-		free(mem);
-		obix_request_destroy(request);
-	} else {
-		obix_request_send_response(request);
-		obix_request_destroy(request);
+	if (doc) {
+		obix_request_send_object(request, doc);
+		obix_server_free_object(request, doc);
 	}
 
-	xmlFreeDoc(doc);
-	return;
-
-failed:
-	/*
-	 * The provided oBIX contract needs to be released before
-	 * this function exits, even if it fails.
-	 */
-	xmlFreeNode(node);
-
 	obix_request_destroy(request);
 }
 
@@ -465,7 +711,7 @@ xmlNode *handlerSignOff(obix_request_t *request, const xmlChar *uri,
 						xmlNode *input)
 {
 	xmlChar *href = NULL;
-	char *requester_id = NULL;
+	const char *requester_id;
 	xmlNode *node = NULL;
 	int ret = 0;
 
@@ -514,10 +760,6 @@ failed:
 		xmlFree(href);
 	}
 
-	if (requester_id) {
-		free(requester_id);
-	}
-
 	return node;
 }
 
@@ -527,7 +769,7 @@ xmlNode *handlerSignUp(obix_request_t *request, const xmlChar *uri,
 	xmlNode *inputCopy, *pos, *node = NULL;
 	xmlChar *href = NULL;
 	int ret = 0;
-	char *requester_id = NULL;
+	const char *requester_id;
 
 	if (!(requester_id = obix_fcgi_get_requester_id(request))) {
 		ret = ERR_NO_REQUESTER_ID;
@@ -610,10 +852,6 @@ failed:
 		xmlFree(href);
 	}
 
-	if (requester_id) {
-		free(requester_id);
-	}
-
 	return node;
 }
 
@@ -684,6 +922,39 @@ xmlNode *obix_server_invoke(obix_request_t *request, const xmlChar *overrideUri,
 									  "Invoke", server_err_msg[ret].msgs);
 }
 
+/*
+ * Check whether the body of a POST request to the given URI can be
+ * handled as is without being parsed into a DOM tree in advance,
+ * which is true for the HistoryAppendIn contracts
+ */
+int obix_server_is_raw_post(const xmlChar *uri)
+{
+	long id;
+
+	return (is_given_type(uri, OBIX_HISTORY) == 1 &&
+			xmldb_get_op_id(uri, &id) == 0 &&
+			id > 0 && id < POST_HANDLERS_COUNT &&
+			post_handlers[id] == handlerHistoryAppend) ? 1 : 0;
+}
+
+void obix_server_handleRawPOST(obix_request_t *request, const char *body,
+							   long len)
+{
+	xmlNode *node;
+
+	node = handlerHistoryAppendRaw(request,
+							(const xmlChar *)request->request_decoded_uri,
+							body, len);
+
+	/* The same as obix_server_handlePOST() */
+	if (request->is_history == 1) {
+		obix_request_destroy(request);
+		return;
+	}
+
+	obix_server_reply_object(request, ((node) ? node : xmldb_fatal_error()));
+}
+
 void obix_server_handlePOST(obix_request_t *request, const xmlDoc *input)
 {
 	xmlNode *node;
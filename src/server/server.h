@@ -37,8 +37,13 @@ void obix_server_handleError(obix_request_t *request, const char *msg);
 void obix_server_handleGET(obix_request_t *request);
 void obix_server_handlePUT(obix_request_t *request, const xmlDoc *input);
 void obix_server_handlePOST(obix_request_t *request, const xmlDoc *input);
+int obix_server_is_raw_post(const xmlChar *uri);
+void obix_server_handleRawPOST(obix_request_t *request, const char *body,
+							   long len);
 
 xmlNode *obix_server_read(obix_request_t *request, const xmlChar *overrideUri);
+int obix_server_write_check(const xmlChar *uri, xmlNode *input, xmlChar **val);
+int obix_server_update(const xmlChar *uri, xmlNode *input);
 xmlNode *obix_server_write(obix_request_t *request, const xmlChar *overrideUri,
 						   xmlNode *input);
 xmlNode *obix_server_invoke(obix_request_t *request, const xmlChar *overrideUri,
@@ -52,6 +52,7 @@
 #include "errmsg.h"
 #include "refcnt.h"
 #include "tsync.h"
+#include "obix_fcgi.h"
 
 /*
  * Descriptor of all watch objects on the oBIX server
@@ -162,19 +163,71 @@ typedef struct obix_watch_item {
 	struct list_head list;
 } obix_watch_item_t;
 
+/*
+ * The upper bounds, in milliseconds, of the buckets of the histogram
+ * of the latency from the notification of a change to the reply of
+ * relevant poll task. The last bucket collects anything beyond them
+ */
+static const long WATCH_LATENCY_BOUNDS[] = {
+	1, 5, 10, 50, 100, 500, 1000, 5000
+};
+
+#define WATCH_LATENCY_BUCKETS	(sizeof(WATCH_LATENCY_BOUNDS) / sizeof(long) + 1)
+
+/*
+ * Statistics of the poll backlog, which help administrators
+ * decide on the number of polling threads
+ *
+ * NOTE: all fields are protected by backlog->mutex
+ */
+typedef struct poll_stats {
+	/* The number of poll tasks in list_all and list_active queues */
+	long all, active;
+
+	/* The number of poll tasks replied so far */
+	long replied;
+
+	/* The number of poll tasks expired without any change */
+	long expired;
+
+	/* Histogram of the latency from change notification to reply */
+	long latency[WATCH_LATENCY_BUCKETS];
+
+	/* The number of times backlog->mutex has been acquired */
+	long locked;
+
+	/* The overall and maximal wait time on backlog->mutex, in nanoseconds */
+	long long lock_wait, lock_wait_max;
+
+	/*
+	 * The highest number of polling threads ever reached, and the number
+	 * of threads created and retired on demand
+	 */
+	long peak_threads, grown, retired;
+} poll_stats_t;
+
 /**
  * Descriptor of the backlog of all pending poll tasks
  */
 typedef struct poll_backlog {
-	/* The number of polling threads */
+	/*
+	 * The current, minimal and maximal number of polling threads, and
+	 * the number of those waiting for poll tasks to be attended
+	 *
+	 * Polling threads are detached and more of them are created when
+	 * poll tasks become active while no thread is idle, whereas those
+	 * beyond the minimal number retire after being idle for idle_timeout
+	 * seconds
+	 */
 	int num_threads;
+	int min_threads;
+	int max_threads;
+	int idle_threads;
+	int idle_timeout;
 
 	/* The shutting down flag */
 	int is_shutdown;
 
-	/* The fleet of polling threads as consumer of this backlog */
-	pthread_t *poll_threads;
-
 	/*
 	 * Queue of all pending poll tasks, organized in expiry ascending order
 	 * Producer: Watch.PollChanges handler
@@ -205,6 +258,12 @@ typedef struct poll_backlog {
 	 * need to be attended
 	 */
 	pthread_cond_t wq;
+
+	/* Signalled when the last polling thread exits on shutdown */
+	pthread_cond_t exit_wq;
+
+	/* Statistics exposed via WATCH_SERVICE_STATS */
+	poll_stats_t stats;
 } poll_backlog_t;
 
 /*
@@ -224,6 +283,12 @@ typedef struct poll_task {
 	 */
 	struct timespec expiry;
 
+	/*
+	 * When this task was moved onto the active tasks queue, used to
+	 * measure the latency from change notification to reply
+	 */
+	struct timespec notified;
+
 	/* Relevant response object */
 	obix_request_t *request;
 
@@ -258,6 +323,9 @@ static const xmlChar *WATCH_ID_PREFIX = (xmlChar *)"watch";
 static const int WATCH_ID_PREFIX_LEN = 5;
 
 static const xmlChar *WATCH_SERVICE_MAKE = (xmlChar *)"/obix/watchService/make/";
+static const xmlChar *WATCH_SERVICE_STATS = (xmlChar *)"/obix/watchService/stats/";
+
+static const char *WATCH_STATS_CONTRACT = "nextdc:WatchStats";
 
 /* The value of the name attribute of the root node of the watchIn contract */
 static const char *WATCH_IN_HREFS = "hrefs";
@@ -307,6 +375,152 @@ static void watch_put(obix_watch_t *watch)
 	refcnt_put(&watch->refcnt);
 }
 
+/*
+ * Return the interval between the given two timestamps in nanoseconds
+ */
+static long long timespec_diff_ns(const struct timespec *start,
+								  const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000LL +
+		   (end->tv_nsec - start->tv_nsec);
+}
+
+/*
+ * Grab the mutex of the poll backlog and account for the time
+ * spent waiting for it
+ */
+static void backlog_lock(poll_backlog_t *bl)
+{
+	struct timespec start, end;
+	long long wait;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_mutex_lock(&bl->mutex);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	wait = timespec_diff_ns(&start, &end);
+
+	bl->stats.locked++;
+	bl->stats.lock_wait += wait;
+	if (wait > bl->stats.lock_wait_max) {
+		bl->stats.lock_wait_max = wait;
+	}
+}
+
+/*
+ * Account for a poll task that has just been replied
+ *
+ * NOTE: callers must hold backlog->mutex
+ */
+static void __backlog_stats_replied(poll_backlog_t *bl,
+									const struct timespec *notified)
+{
+	struct timespec now;
+	long ms;
+	int i;
+
+	bl->stats.replied++;
+
+	if (notified->tv_sec == 0 && notified->tv_nsec == 0) {
+		bl->stats.expired++;
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = timespec_diff_ns(notified, &now) / 1000000;
+
+	for (i = 0; i < WATCH_LATENCY_BUCKETS - 1; i++) {
+		if (ms < WATCH_LATENCY_BOUNDS[i]) {
+			break;
+		}
+	}
+
+	bl->stats.latency[i]++;
+}
+
+/*
+ * Create one more detached polling thread, unless the maximal number
+ * has been reached or the backlog is shutting down
+ *
+ * Return 0 on success, -1 otherwise
+ *
+ * NOTE: callers must hold backlog->mutex
+ */
+static int __backlog_grow(poll_backlog_t *bl)
+{
+	pthread_attr_t attr;
+	pthread_t id;
+	int ret;
+
+	if (bl->is_shutdown == 1 || bl->num_threads >= bl->max_threads) {
+		return -1;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&id, &attr, poll_thread_task, bl);
+	pthread_attr_destroy(&attr);
+
+	if (ret != 0) {
+		log_warning("Failed to create a polling thread");
+		return -1;
+	}
+
+	if (++bl->num_threads > bl->stats.peak_threads) {
+		bl->stats.peak_threads = bl->num_threads;
+	}
+
+	return 0;
+}
+
+/*
+ * Return 1 if the current polling thread, idle since the given moment,
+ * should retire, 0 otherwise
+ *
+ * NOTE: callers must hold backlog->mutex
+ */
+static int __backlog_should_retire(poll_backlog_t *bl,
+								   const struct timespec *idle_since)
+{
+	struct timespec now;
+
+	if (bl->num_threads <= bl->min_threads) {
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - idle_since->tv_sec >= bl->idle_timeout) ? 1 : 0;
+}
+
+/*
+ * Get the deadline of the wait of a polling thread, that is the given
+ * expiry of the first poll task if any, or otherwise no later than
+ * idle_timeout seconds from now for threads beyond the minimal number
+ *
+ * Return 1 if the deadline is set, 0 if the thread could wait for ever
+ *
+ * NOTE: callers must hold backlog->mutex
+ */
+static int __backlog_deadline(poll_backlog_t *bl,
+							  const struct timespec *expiry,
+							  struct timespec *deadline)
+{
+	int surplus = (bl->num_threads > bl->min_threads) ? 1 : 0;
+
+	if (surplus == 1) {
+		clock_gettime(CLOCK_REALTIME, deadline);
+		deadline->tv_sec += bl->idle_timeout;
+	}
+
+	if (expiry && (surplus == 0 || timespec_compare(expiry, deadline) < 0)) {
+		*deadline = *expiry;
+		return 1;
+	}
+
+	return surplus;
+}
+
 /*
  * Return 1 if the given href points to the common operation to create
  * a watch object, 0 otherwise
@@ -316,6 +530,15 @@ int is_watch_service_make_href(const xmlChar *href)
 	return is_str_identical(href, WATCH_SERVICE_MAKE, 1);
 }
 
+/*
+ * Return 1 if the given href points to the statistics of the
+ * watch subsystem, 0 otherwise
+ */
+static int is_watch_service_stats_href(const xmlChar *href)
+{
+	return is_str_identical(href, WATCH_SERVICE_STATS, 1);
+}
+
 /*
  * Search for a subnode with the given href in the specified
  * watch object
@@ -426,12 +649,20 @@ static void __watch_notify_tasks(obix_watch_t *watch)
 		return;
 	}
 
-	pthread_mutex_lock(&backlog->mutex);
+	backlog_lock(backlog);
 	list_for_each_entry(task, &watch->tasks, list_watch) {
 		if (task->list_active.prev == &task->list_active) {
 			list_add_tail(&task->list_active, &backlog->list_active);
+			clock_gettime(CLOCK_MONOTONIC, &task->notified);
+			backlog->stats.active++;
 		}
 	}
+
+	/* Have the change collected at once even if all threads are busy */
+	if (backlog->idle_threads == 0 && __backlog_grow(backlog) == 0) {
+		backlog->stats.grown++;
+	}
+
 	pthread_cond_signal(&backlog->wq);
 	pthread_mutex_unlock(&backlog->mutex);
 }
@@ -944,37 +1175,27 @@ static void do_and_free_task(poll_task_t *task)
 static void poll_backlog_dispose(poll_backlog_t *bl)
 {
 	poll_task_t *task, *n;
-	int i;
 
 	/*
 	 * Raise the shutting down flag and wake up poll threads that
-	 * are being blocked for any outstanding poll tasks.
+	 * are being blocked for any outstanding poll tasks, then wait
+	 * for all of them to exit.
 	 *
 	 * Although only one thread can grab the backlog->mutex at any
-	 * one time, it will release the mutex before calling pthread_exit()
-	 * so that other threads will have a chance to obtain the mutex
-	 * and exit eventually.
+	 * one time, it will release the mutex before it exits so that
+	 * other threads will have a chance to obtain the mutex and exit
+	 * eventually, the last one of which signals backlog->exit_wq.
 	 */
-	if (bl->poll_threads) {
-		pthread_mutex_lock(&bl->mutex);
-		bl->is_shutdown = 1;
-		pthread_cond_broadcast(&bl->wq);
-		pthread_mutex_unlock(&bl->mutex);
-
-		for (i = 0; i < bl->num_threads; i++) {
-			if (bl->poll_threads[i] == 0) {
-				continue;
-			}
-
-			if (pthread_join(bl->poll_threads[i], NULL) != 0) {
-				log_warning("Failed to join thread%d and it could be "
-							"left zombie", i);
-			}
-		}
+	backlog_lock(bl);
+	bl->is_shutdown = 1;
+	pthread_cond_broadcast(&bl->wq);
 
-		free(bl->poll_threads);
+	while (bl->num_threads > 0) {
+		pthread_cond_wait(&bl->exit_wq, &bl->mutex);
 	}
 
+	pthread_mutex_unlock(&bl->mutex);
+
 	/*
 	 * No dangling poll tasks should ever exist after all
 	 * watches have been removed already. Delete them if
@@ -991,6 +1212,7 @@ static void poll_backlog_dispose(poll_backlog_t *bl)
 
 	pthread_mutex_destroy(&bl->mutex);
 	pthread_cond_destroy(&bl->wq);
+	pthread_cond_destroy(&bl->exit_wq);
 
 	free(bl);
 }
@@ -1000,7 +1222,7 @@ static void poll_backlog_dispose(poll_backlog_t *bl)
  *
  * Return its address on success, NULL otherwise
  */
-static poll_backlog_t *poll_backlog_init(int num)
+static poll_backlog_t *poll_backlog_init(int num, int max, int idle_timeout)
 {
 	poll_backlog_t *bl;
 	int i;
@@ -1009,36 +1231,41 @@ static poll_backlog_t *poll_backlog_init(int num)
 		num = DEF_THREAD_COUNT;
 	}
 
+	if (max < num) {
+		max = num;
+	}
+
 	if (!(bl = (poll_backlog_t *)malloc(sizeof(poll_backlog_t)))) {
 		log_error("Failed to allocate poll_backlog_t");
 		return NULL;
 	}
 	memset(bl, 0, sizeof(poll_backlog_t));
 
-	bl->num_threads = num;
+	bl->min_threads = num;
+	bl->max_threads = max;
+	bl->idle_timeout = (idle_timeout > 0) ? idle_timeout : 1;
 	INIT_LIST_HEAD(&bl->list_all);
 	INIT_LIST_HEAD(&bl->list_active);
 	pthread_mutex_init(&bl->mutex, NULL);
 	pthread_cond_init(&bl->wq, NULL);
-
-	bl->poll_threads = (pthread_t *)malloc(sizeof(pthread_t) * num);
-	if (!bl->poll_threads) {
-		log_error("Failed to allocate polling threads pointer array");
-		goto failed;
-	}
+	pthread_cond_init(&bl->exit_wq, NULL);
 
 	/*
-	 * Fork a fleet of poll threads at starts-up, which will sleep
-	 * on backlog->wq until any poll tasks need to be attended
+	 * Fork the minimal fleet of poll threads at starts-up, which will
+	 * sleep on backlog->wq until any poll tasks need to be attended
 	 */
+	backlog_lock(bl);
+
 	for (i = 0; i < num; i++) {
-		if (pthread_create(&bl->poll_threads[i], NULL,
-						   poll_thread_task, bl) != 0) {
+		if (__backlog_grow(bl) < 0) {
+			pthread_mutex_unlock(&bl->mutex);
 			log_error("Failed to create a polling thread");
 			goto failed;
 		}
 	}
 
+	pthread_mutex_unlock(&bl->mutex);
+
 	return bl;
 
 failed:
@@ -1213,14 +1440,16 @@ void obix_watch_dispose(void)
  *
  * Return 0 on success, > 0 for error code
  */
-int obix_watch_init(const int poll_threads)
+int obix_watch_init(const int poll_threads, const int poll_threads_max,
+					const int idle_timeout)
 {
 	if (watchset || backlog) {
 		return 0;
 	}
 
 	if (!(watchset = watch_set_init()) ||
-		!(backlog = poll_backlog_init(poll_threads))) {
+		!(backlog = poll_backlog_init(poll_threads, poll_threads_max,
+									  idle_timeout))) {
 		log_error("Failed to initialized watch subsystem");
 		obix_watch_dispose();
 		return ERR_NO_MEM;
@@ -1366,7 +1595,8 @@ xmlNode *handlerWatchServiceMake(obix_request_t *request, const xmlChar *href,
 
 	tsync_reader_exit(&watch->sync);
 
-	request->response_uri = xmlStrdup(watch->href);
+	request->response_uri = (unsigned char *)obix_request_strdup(request,
+												(const char *)watch->href);
 
 	watch_put(watch);
 	return node;
@@ -1531,7 +1761,8 @@ static int watch_create_poll_task(obix_watch_t *watch, long expiry,	/* milliseco
 	 * Insert the poll task into the global poll task queue which is
 	 * organized in strict expiry ascending order of each task
 	 */
-	pthread_mutex_lock(&backlog->mutex);
+	backlog_lock(backlog);
+	backlog->stats.all++;
 	if (list_empty(&backlog->list_all) == 1) {
 		list_add(&task->list_all, &backlog->list_all);
 	} else {
@@ -1794,32 +2025,44 @@ static void poll_thread_task_helper(poll_task_t *task)
 }
 
 /**
- * Payload of polling threads
+ * Payload of polling threads, which exit when the shutting down flag
+ * is raised, or retire after being idle for long enough if they are
+ * not needed to keep the minimal number of polling threads
  */
 static void *poll_thread_task(void *arg)
 {
 	poll_backlog_t *bl = (poll_backlog_t *)arg;
 	poll_task_t *task;
-	struct timespec closest_expiry;
+	struct timespec closest_expiry, notified, idle_since, deadline;
 
 	for (;;) {
-		pthread_mutex_lock(&bl->mutex);
+		backlog_lock(bl);
+		clock_gettime(CLOCK_MONOTONIC, &idle_since);
 
 retry:
 		if (bl->is_shutdown == 1) {
-			pthread_mutex_unlock(&bl->mutex);
 			log_debug("[%u] Exiting as the shutting down flag is raised",
 					  get_tid());
-			pthread_exit(NULL);
+			goto exit;
 		}
 
+		bl->idle_threads++;
+
 		/*
 		 * Wait until the global poll tasks queue is not empty
 		 * while the shutting down flag is not raised
 		 */
 		while (list_empty(&bl->list_all) == 1 &&
 			   bl->is_shutdown == 0) {
-			pthread_cond_wait(&bl->wq, &bl->mutex);
+			if (__backlog_should_retire(bl, &idle_since) == 1) {
+				goto retire;
+			}
+
+			if (__backlog_deadline(bl, NULL, &deadline) == 1) {
+				pthread_cond_timedwait(&bl->wq, &bl->mutex, &deadline);
+			} else {
+				pthread_cond_wait(&bl->wq, &bl->mutex);
+			}
 		}
 
 		/*
@@ -1829,7 +2072,12 @@ retry:
 		while (list_empty(&bl->list_active) == 1 &&
 			   get_expired_task(bl, &closest_expiry) == NULL &&
 			   bl->is_shutdown == 0) {
-			pthread_cond_timedwait(&bl->wq, &bl->mutex, &closest_expiry);
+			if (__backlog_should_retire(bl, &idle_since) == 1) {
+				goto retire;
+			}
+
+			__backlog_deadline(bl, &closest_expiry, &deadline);
+			pthread_cond_timedwait(&bl->wq, &bl->mutex, &deadline);
 
 			/*
 			 * Other threads may have consumed all poll tasks during the
@@ -1837,10 +2085,13 @@ retry:
 			 * if this is the case
 			 */
 			if (list_empty(&bl->list_all) == 1) {
+				bl->idle_threads--;
 				goto retry;
 			}
 		}
 
+		bl->idle_threads--;
+
 		/*
 		 * Now there are outstanding, positive poll tasks that should be
 		 * attended, handle active tasks before those expired ones.
@@ -1863,10 +2114,30 @@ retry:
 			/*
 			 * Dequeue current task so that other poll threads
 			 * won't have a chance to work on it at all.
+			 *
+			 * Tasks never notified of any changes have their
+			 * notified timestamp left zero and are accounted
+			 * as expired ones.
 			 */
+			if (task->list_active.prev != &task->list_active) {
+				bl->stats.active--;
+			}
+			bl->stats.all--;
+			notified = task->notified;
+
 			list_del(&task->list_active);
 			list_del(&task->list_all);
 
+			/*
+			 * Have more polling threads attend remaining active tasks
+			 * if all others are busy as well
+			 */
+			if (bl->idle_threads == 0 &&
+				list_empty(&bl->list_active) == 0 &&
+				__backlog_grow(bl) == 0) {
+				bl->stats.grown++;
+			}
+
 			/*
 			 * Release the mutex while engaging time-consuming
 			 * jobs but re-grab it before working on remaining
@@ -1874,13 +2145,32 @@ retry:
 			 */
 			pthread_mutex_unlock(&bl->mutex);
 			poll_thread_task_helper(task);
-			pthread_mutex_lock(&bl->mutex);
+			backlog_lock(bl);
+
+			__backlog_stats_replied(bl, &notified);
 		}
 
 		pthread_mutex_unlock(&bl->mutex);
 	} /* for */
 
-	return NULL;	/* Should never reach here */
+retire:
+	bl->idle_threads--;
+	bl->stats.retired++;
+	log_debug("[%u] Retiring after being idle for %d seconds",
+			  get_tid(), bl->idle_timeout);
+
+	/* Fall through */
+
+exit:
+	obix_fcgi_reader_release();
+
+	if (--bl->num_threads == 0) {
+		pthread_cond_broadcast(&bl->exit_wq);
+	}
+
+	pthread_mutex_unlock(&bl->mutex);
+
+	return NULL;
 }
 
 int watch_update_uri(const xmlChar *href, const xmlChar *new)
@@ -2092,10 +2382,168 @@ static xmlNode *watch_obj_copy_uri(obix_watch_t *watch, const xmlChar *href,
 	return copy;
 }
 
+/*
+ * Append an integer child with the given name and value to
+ * the parent node
+ *
+ * Return 0 on success, > 0 for error code
+ */
+static int watch_stats_add_int(xmlNode *parent, const char *name, long long val)
+{
+	xmlNode *node;
+	char buf[32];
+
+	sprintf(buf, "%lld", val);
+
+	if (!(node = xmlNewNode(NULL, BAD_CAST OBIX_OBJ_INT)) ||
+		!xmlSetProp(node, BAD_CAST OBIX_ATTR_NAME, BAD_CAST name) ||
+		!xmlSetProp(node, BAD_CAST OBIX_ATTR_VAL, BAD_CAST buf) ||
+		!xmlAddChild(parent, node)) {
+		if (node) {
+			xmlFreeNode(node);
+		}
+
+		return ERR_NO_MEM;
+	}
+
+	return 0;
+}
+
+/*
+ * Create an object reflecting the statistics of the watch subsystem
+ * and the poll backlog, so that administrators could learn whether
+ * the polling threads are able to keep up with the load
+ */
+static xmlNode *watch_stats_dump(void)
+{
+	obix_watch_t *watch;
+	obix_watch_item_t *item;
+	xmlNode *dump = NULL, *list = NULL;
+	poll_stats_t stats;
+	long watches = 0, items = 0, max_items = 0, count;
+	char buf[32];
+	int i, threads, idle, ret = 0;
+
+	/*
+	 * Take a snapshot of the statistics of the poll backlog so as
+	 * to not hold its mutex while walking through the watch set
+	 */
+	backlog_lock(backlog);
+	memcpy(&stats, &backlog->stats, sizeof(poll_stats_t));
+	threads = backlog->num_threads;
+	idle = backlog->idle_threads;
+	pthread_mutex_unlock(&backlog->mutex);
+
+	if (tsync_reader_entry(&watchset->sync) < 0) {
+		return xmldb_fatal_error();
+	}
+
+	list_for_each_entry(watch, &watchset->watches, list) {
+		if (tsync_reader_entry(&watch->sync) < 0) {
+			continue;	/* being deleted */
+		}
+
+		count = 0;
+		list_for_each_entry(item, &watch->items, list) {
+			count++;
+		}
+
+		tsync_reader_exit(&watch->sync);
+
+		watches++;
+		items += count;
+		if (count > max_items) {
+			max_items = count;
+		}
+	}
+
+	tsync_reader_exit(&watchset->sync);
+
+	if (!(dump = xmlNewNode(NULL, BAD_CAST OBIX_OBJ)) ||
+		!xmlSetProp(dump, BAD_CAST OBIX_ATTR_IS,
+					BAD_CAST WATCH_STATS_CONTRACT) ||
+		!xmlSetProp(dump, BAD_CAST OBIX_ATTR_DISPLAY_NAME,
+					BAD_CAST "Watch Statistics")) {
+		ret = ERR_NO_MEM;
+		goto failed;
+	}
+
+	if ((ret = watch_stats_add_int(dump, "pollThreads", threads)) > 0 ||
+		(ret = watch_stats_add_int(dump, "pollThreadsMin",
+								   backlog->min_threads)) > 0 ||
+		(ret = watch_stats_add_int(dump, "pollThreadsMax",
+								   backlog->max_threads)) > 0 ||
+		(ret = watch_stats_add_int(dump, "pollThreadsIdle", idle)) > 0 ||
+		(ret = watch_stats_add_int(dump, "pollThreadsPeak",
+								   stats.peak_threads)) > 0 ||
+		(ret = watch_stats_add_int(dump, "pollThreadsGrown",
+								   stats.grown)) > 0 ||
+		(ret = watch_stats_add_int(dump, "pollThreadsRetired",
+								   stats.retired)) > 0 ||
+		(ret = watch_stats_add_int(dump, "watches", watches)) > 0 ||
+		(ret = watch_stats_add_int(dump, "watchItems", items)) > 0 ||
+		(ret = watch_stats_add_int(dump, "maxItemsPerWatch",
+								   max_items)) > 0 ||
+		(ret = watch_stats_add_int(dump, "pendingTasks", stats.all)) > 0 ||
+		(ret = watch_stats_add_int(dump, "activeTasks", stats.active)) > 0 ||
+		(ret = watch_stats_add_int(dump, "repliedTasks", stats.replied)) > 0 ||
+		(ret = watch_stats_add_int(dump, "expiredTasks", stats.expired)) > 0 ||
+		(ret = watch_stats_add_int(dump, "backlogLocked", stats.locked)) > 0 ||
+		(ret = watch_stats_add_int(dump, "backlogLockWaitUs",
+								   stats.lock_wait / 1000)) > 0 ||
+		(ret = watch_stats_add_int(dump, "backlogLockWaitMaxUs",
+								   stats.lock_wait_max / 1000)) > 0) {
+		goto failed;
+	}
+
+	if (!(list = xmlNewNode(NULL, BAD_CAST OBIX_OBJ_LIST)) ||
+		!xmlSetProp(list, BAD_CAST OBIX_ATTR_NAME, BAD_CAST "latency") ||
+		!xmlSetProp(list, BAD_CAST OBIX_ATTR_OF, BAD_CAST "obix:int")) {
+		ret = ERR_NO_MEM;
+		goto failed;
+	}
+
+	for (i = 0; i < WATCH_LATENCY_BUCKETS; i++) {
+		if (i < WATCH_LATENCY_BUCKETS - 1) {
+			sprintf(buf, "lt%ldms", WATCH_LATENCY_BOUNDS[i]);
+		} else {
+			sprintf(buf, "ge%ldms", WATCH_LATENCY_BOUNDS[i - 1]);
+		}
+
+		if ((ret = watch_stats_add_int(list, buf, stats.latency[i])) > 0) {
+			goto failed;
+		}
+	}
+
+	if (!xmlAddChild(dump, list)) {
+		ret = ERR_NO_MEM;
+		goto failed;
+	}
+
+	return dump;
+
+failed:
+	if (list) {
+		xmlFreeNode(list);
+	}
+
+	if (dump) {
+		xmlFreeNode(dump);
+	}
+
+	log_error("Failed to dump watch statistics because of %s",
+			  server_err_msg[ret].msgs);
+	return xmldb_fatal_error();
+}
+
 xmlNode *watch_copy_uri(const xmlChar *href, xml_copy_flags_t flags)
 {
 	obix_watch_t *watch;
 
+	if (is_watch_service_stats_href(href) == 1) {
+		return watch_stats_dump();
+	}
+
 	return ((watch = watch_search(href)) != NULL) ?
 			watch_obj_copy_uri(watch, href, flags) : watch_set_copy_uri(href, flags);
 }
@@ -54,7 +54,7 @@ xmlNode *handlerWatchRemove(obix_request_t *request, const xmlChar *href, xmlNod
 xmlNode *handlerWatchPollChanges(obix_request_t *request, const xmlChar *href, xmlNode *input);
 xmlNode *handlerWatchPollRefresh(obix_request_t *request, const xmlChar *href, xmlNode *input);
 
-int obix_watch_init(const int);
+int obix_watch_init(const int, const int, const int);
 void obix_watch_dispose(void);
 
 void watch_notify_watches(long id, xmlNode *monitored, WATCH_EVT event);
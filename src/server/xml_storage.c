@@ -29,6 +29,7 @@
 #include <libxml/parser.h>
 #include "xml_config.h"
 #include "xml_utils.h"
+#include "xml_arena.h"
 #include "obix_utils.h"
 #include "log_utils.h"
 #include "xml_storage.h"
@@ -77,6 +78,42 @@ typedef enum xmldb_stub_type {
 /* The place where all data is stored. */
 xmlDoc *_storage = NULL;
 
+/*
+ * The dictionary of the global DOM tree, shared by all nodes in it
+ *
+ * Names of elements and attributes, along with values of attributes
+ * other than val, are interned into the dictionary when nodes are added
+ * into the global DOM tree, so that strings repeated by numerous device
+ * contracts, such as "real", "href", "name" and "obix:Point", are only
+ * stored once. libxml2 leaves interned strings alone when releasing
+ * nodes whose document has the dictionary.
+ *
+ * Since libxml2 dictionaries are not thread-safe for insertion, new
+ * strings are only inserted while the oBIX server is initialised by
+ * one single thread, after which the dictionary is frozen and strings
+ * are only looked up by all threads.
+ *
+ * NOTE: all attribute names that may be set by xmlSetProp() on nodes
+ * in the global DOM tree at run time are interned beforehand, otherwise
+ * libxml2 would insert them into the frozen dictionary
+ */
+static int __xmldb_dict_frozen;
+
+static const char *xmldb_dict_tags[] = {
+	OBIX_OBJ, OBIX_OBJ_REF, OBIX_OBJ_OP, OBIX_OBJ_LIST, OBIX_OBJ_ERR,
+	OBIX_OBJ_BOOL, OBIX_OBJ_INT, OBIX_OBJ_REAL, OBIX_OBJ_STR, OBIX_OBJ_ENUM,
+	OBIX_OBJ_ABSTIME, OBIX_OBJ_RELTIME, OBIX_OBJ_URI, OBIX_OBJ_FEED,
+	OBIX_OBJ_META, OBIX_OBJ_DATE, OBIX_OBJ_HTML
+};
+
+static const char **xmldb_dict_strs[] = {
+	&OBIX_ATTR_IS, &OBIX_ATTR_OF, &OBIX_ATTR_NAME, &OBIX_ATTR_HREF,
+	&OBIX_ATTR_VAL, &OBIX_ATTR_NULL, &OBIX_ATTR_DISPLAY,
+	&OBIX_ATTR_DISPLAY_NAME, &OBIX_ATTR_HIDDEN, &OBIX_ATTR_STATUS,
+	&OBIX_META_ATTR_OP, &OBIX_META_ATTR_WATCH_ID,
+	&XML_TRUE, &XML_FALSE, &OBIX_STATUS_OK, &OBIX_RELTIME_ZERO
+};
+
 /*
  * The error contract allocated at the initialization of the XML
  * database, so as to be returned to clients when oBIX server would
@@ -174,6 +211,77 @@ xmlNode *xmldb_set_relative_href(xmlNode *node)
 	return node;
 }
 
+/*
+ * Replace the given string with the same one in the dictionary of
+ * the global DOM tree, which is inserted into the dictionary first
+ * unless it has been frozen
+ */
+static void xmldb_dict_intern_str(const xmlChar **str)
+{
+	const xmlChar *interned;
+
+	if (!*str) {
+		return;
+	}
+
+	interned = (__xmldb_dict_frozen == 1) ?
+					xmlDictExists(_storage->dict, *str, -1) :
+					xmlDictLookup(_storage->dict, *str, -1);
+
+	if (interned && interned != *str) {
+		xmlFree((xmlChar *)*str);
+		*str = interned;
+	}
+}
+
+/*
+ * Intern strings of the given subtree into the dictionary of the
+ * global DOM tree
+ *
+ * NOTE: the subtree must belong to the document of the global DOM
+ * tree already, so that interned strings won't be freed along with
+ * the subtree
+ */
+static void xmldb_dict_intern(xmlNode *node)
+{
+	xmlAttr *attr;
+	xmlNode *child;
+
+	if (node->type != XML_ELEMENT_NODE) {
+		return;
+	}
+
+	xmldb_dict_intern_str(&node->name);
+
+	for (attr = node->properties; attr; attr = attr->next) {
+		xmldb_dict_intern_str(&attr->name);
+
+		/* Values of val attributes are replaced on every write anyway */
+		if (xmlStrcmp(attr->name, BAD_CAST OBIX_ATTR_VAL) == 0 ||
+			!(child = attr->children) || child->next ||
+			child->type != XML_TEXT_NODE ||
+			child->content == (xmlChar *)&child->properties) {
+			continue;
+		}
+
+		xmldb_dict_intern_str((const xmlChar **)&child->content);
+	}
+
+	for (child = node->children; child; child = child->next) {
+		xmldb_dict_intern(child);
+	}
+}
+
+/*
+ * Freeze the dictionary of the global DOM tree once the oBIX server
+ * has been initialised, after which it is safe to be accessed by
+ * multiple threads
+ */
+void xmldb_dict_freeze(void)
+{
+	__xmldb_dict_frozen = 1;
+}
+
 /*
  * Add the given node as a child of the specified parent node
  *
@@ -211,6 +319,19 @@ int xmldb_add_child(xmlNode *parent, xmlNode *node,
 		xmldb_set_relative_href(node);
 	}
 
+	/*
+	 * Strings of the node are interned before it is visible to other
+	 * threads, and its document pointer is set in advance so that they
+	 * are still recognised if callers release the node on failure
+	 */
+	if (node->doc != parent->doc && (!node->doc || !node->doc->dict)) {
+		xmlSetTreeDoc(node, parent->doc);
+	}
+
+	if (node->doc == _storage) {
+		xmldb_dict_intern(node);
+	}
+
 	/*
 	 * xmlAddChild will take care of setting up required context of the
 	 * newly added child, e.g., relationships in parent sub tree and
@@ -519,6 +640,21 @@ xmlNode *xmldb_copy_uri(const xmlChar *href, xml_copy_flags_t flags)
 	return copy;
 }
 
+/*
+ * The same as xmldb_copy_uri() except that the copy is allocated from
+ * the given arena, see xml_arena.h
+ */
+xmlNode *xmldb_copy_uri_arena(arena_t *arena, const xmlChar *href,
+							  xml_copy_flags_t flags)
+{
+	xmlNode *root, *node;
+
+	root = xmlDocGetRootElement(_storage);
+
+	return ((node = xmldb_get_node_core(root, href)) != NULL) ?
+				xml_arena_copy(arena, node, flags) : NULL;
+}
+
 /*
  * Update the val attribute of the node with given href in the
  * global DOM tree
@@ -878,6 +1014,7 @@ int obix_xmldb_init(const char *resdir)
 {
 	xmlNode *newRootNode = NULL;
 	int ret = ERR_NO_MEM;
+	unsigned int i;
 
 	if (_storage) {
 		return 0;
@@ -888,6 +1025,26 @@ int obix_xmldb_init(const char *resdir)
 		return ERR_NO_MEM;
 	}
 
+	/* Released along with the document */
+	if (!(_storage->dict = xmlDictCreate())) {
+		log_error("Failed to allocate a dictionary for the XML database");
+		goto failed;
+	}
+
+	__xmldb_dict_frozen = 0;
+
+	for (i = 0; i < sizeof(xmldb_dict_tags) / sizeof(xmldb_dict_tags[0]); i++) {
+		if (!xmlDictLookup(_storage->dict, BAD_CAST xmldb_dict_tags[i], -1)) {
+			goto failed;
+		}
+	}
+
+	for (i = 0; i < sizeof(xmldb_dict_strs) / sizeof(xmldb_dict_strs[0]); i++) {
+		if (!xmlDictLookup(_storage->dict, BAD_CAST *xmldb_dict_strs[i], -1)) {
+			goto failed;
+		}
+	}
+
 	if (!(newRootNode = xmlNewNode(NULL, BAD_CAST OBIX_OBJ))) {
 		log_error("Failed to allocate a new root node for the XML database");
 		goto failed;
@@ -990,7 +1147,12 @@ static xmlNode *xmldb_fcgi_var_list(obix_request_t *request)
 	xmlNode *envList = NULL;
 	xmlNode *curEnvNode = NULL;
 
-	if (!(envList = xmlNewDocNode(_storage, NULL, BAD_CAST OBIX_OBJ_LIST, NULL))) {
+	/*
+	 * Not created in the document of the global DOM tree, whose
+	 * dictionary would be left behind when the nodes are re-parented
+	 * to the response
+	 */
+	if (!(envList = xmlNewNode(NULL, BAD_CAST OBIX_OBJ_LIST))) {
 		log_error("Failed to allocate the oBIX:List contract");
 		return NULL;
 	}
@@ -1004,7 +1166,7 @@ static xmlNode *xmldb_fcgi_var_list(obix_request_t *request)
 	}
 
 	for (envp = request->request->envp; *envp != NULL; ++envp) {
-		if (!(curEnvNode = xmlNewDocNode(_storage, NULL, BAD_CAST OBIX_OBJ_STR, NULL))) {
+		if (!(curEnvNode = xmlNewNode(NULL, BAD_CAST OBIX_OBJ_STR))) {
 			log_error("Failed to allocate the oBIX:str value for FCGI variable");
 			break;
 		}
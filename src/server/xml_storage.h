@@ -80,6 +80,8 @@ void xmldb_delete_comment(xmlNode *node);
 void xmldb_delete_hidden(xmlNode *node);
 
 xmlNode *xmldb_copy_uri(const xmlChar *href, xml_copy_flags_t flag);
+xmlNode *xmldb_copy_uri_arena(arena_t *arena, const xmlChar *href,
+							  xml_copy_flags_t flags);
 
 int xmldb_update_uri(const xmlChar *href, const xmlChar *val);
 
@@ -87,6 +89,8 @@ xmlNode *xmldb_copy_sys(sys_stubs_t which);
 
 int xmldb_add_child(xmlNode *parent, xmlNode *node, int unlink, int relative);
 
+void xmldb_dict_freeze(void);
+
 xmlNode *xmldb_set_relative_href(xmlNode *node);
 
 int xmldb_get_op_id(const xmlChar *uri, long *id);
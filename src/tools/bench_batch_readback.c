@@ -0,0 +1,244 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+/*
+ * An instrument to compare the cost of generating and serialising the
+ * batchOut contract for a batch of writes on one device, when written
+ * nodes are read back in full, in compact objects with only href and
+ * val attributes, or replaced by bare status objects, as specified by
+ * the readback attribute of the batchIn contract
+ *
+ * Build below command:
+ *
+ *	$ gcc -O2 -Wall -Werror bench_batch_readback.c
+ *		  -I/usr/include/libxml2/ -lxml2 -o bench_batch_readback
+ *
+ * Run with following arguments:
+ *
+ *	$ ./bench_batch_readback <writes> <batches>
+ *
+ * Where
+ *	<writes>: the number of writes in each batch, each on a different
+ *			  point of the same device
+ *	<batches>: the number of batches handled for each readback option
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libxml/tree.h>
+
+#define DEVICE_HREF		"/obix/deviceRoot/M1/DH1/BCM01/"
+
+typedef enum {
+	READBACK_FULL = 0,
+	READBACK_COMPACT = 1,
+	READBACK_NONE = 2
+} readback_t;
+
+static const char *readback_names[] = {
+	[READBACK_FULL] = "full",
+	[READBACK_COMPACT] = "compact",
+	[READBACK_NONE] = "none"
+};
+
+/*
+ * Setup a device contract with the given number of points, which
+ * resemble those of a BCM with a few attributes and a child each
+ */
+static xmlNode *setup_device(int points)
+{
+	xmlNode *dev, *point, *child;
+	char name[32];
+	int i;
+
+	if (!(dev = xmlNewNode(NULL, BAD_CAST "obj"))) {
+		return NULL;
+	}
+
+	xmlSetProp(dev, BAD_CAST "name", BAD_CAST "BCM01");
+	xmlSetProp(dev, BAD_CAST "href", BAD_CAST DEVICE_HREF);
+
+	for (i = 0; i < points; i++) {
+		sprintf(name, "Meter%02d", i);
+
+		if (!(point = xmlNewChild(dev, NULL, BAD_CAST "real", NULL)) ||
+			!(child = xmlNewChild(point, NULL, BAD_CAST "str", NULL))) {
+			xmlFreeNode(dev);
+			return NULL;
+		}
+
+		xmlSetProp(point, BAD_CAST "name", BAD_CAST name);
+		xmlSetProp(point, BAD_CAST "href", BAD_CAST name);
+		xmlSetProp(point, BAD_CAST "val", BAD_CAST "0.000000");
+		xmlSetProp(point, BAD_CAST "unit", BAD_CAST "obix:units/kilowatt_hour");
+		xmlSetProp(point, BAD_CAST "displayName", BAD_CAST "Energy of meter");
+		xmlSetProp(point, BAD_CAST "writable", BAD_CAST "true");
+
+		xmlSetProp(child, BAD_CAST "name", BAD_CAST "desc");
+		xmlSetProp(child, BAD_CAST "val", BAD_CAST "Accumulated energy");
+	}
+
+	return dev;
+}
+
+/*
+ * Generate the response to a successful write on the given point
+ * as the server does for the specified readback option
+ */
+static xmlNode *write_response(xmlNode *point, const xmlChar *href,
+							   const xmlChar *val, readback_t readback)
+{
+	xmlNode *node = NULL;
+
+	switch (readback) {
+	case READBACK_FULL:
+		if ((node = xmlCopyNode(point, 1)) != NULL) {
+			xmlSetProp(node, BAD_CAST "href", href);
+		}
+		break;
+	case READBACK_COMPACT:
+		if ((node = xmlNewNode(NULL, point->name)) != NULL) {
+			xmlSetProp(node, BAD_CAST "href", href);
+			xmlSetProp(node, BAD_CAST "val", val);
+		}
+		break;
+	case READBACK_NONE:
+		if ((node = xmlNewNode(NULL, BAD_CAST "obj")) != NULL) {
+			xmlSetProp(node, BAD_CAST "href", href);
+			xmlSetProp(node, BAD_CAST "status", BAD_CAST "ok");
+		}
+		break;
+	}
+
+	return node;
+}
+
+/*
+ * Handle one batch of writes and serialise its batchOut contract
+ *
+ * Return the size of the serialised batchOut contract, or < 0 on error
+ */
+static int handle_batch(xmlNode *dev, int writes, int seq, readback_t readback)
+{
+	xmlNode *out, *point, *node;
+	xmlBuffer *buf;
+	xmlChar *name;
+	char href[128], val[32];
+	int i, size;
+
+	if (!(out = xmlNewNode(NULL, BAD_CAST "list"))) {
+		return -1;
+	}
+
+	xmlSetProp(out, BAD_CAST "is", BAD_CAST "obix:BatchOut");
+
+	for (i = 0, point = dev->children; i < writes && point;
+		 i++, point = point->next) {
+		if (!(name = xmlGetProp(point, BAD_CAST "name"))) {
+			xmlFreeNode(out);
+			return -1;
+		}
+
+		sprintf(href, DEVICE_HREF "%s", (char *)name);
+		xmlFree(name);
+
+		sprintf(val, "%f", (double)seq + i / 100.0);
+
+		/* The write itself, which is the same for all options */
+		xmlSetProp(point, BAD_CAST "val", BAD_CAST val);
+
+		if (!(node = write_response(point, BAD_CAST href, BAD_CAST val,
+									readback)) ||
+			!xmlAddChild(out, node)) {
+			xmlFreeNode(out);
+			return -1;
+		}
+	}
+
+	if (!(buf = xmlBufferCreate())) {
+		xmlFreeNode(out);
+		return -1;
+	}
+
+	size = (xmlNodeDump(buf, NULL, out, 0, 0) < 0) ? -1 : xmlBufferLength(buf);
+
+	xmlBufferFree(buf);
+	xmlFreeNode(out);
+
+	return size;
+}
+
+int main(int argc, char *argv[])
+{
+	xmlNode *dev;
+	struct timespec start, end;
+	double ns, base = 0;
+	long bytes;
+	int writes, batches, i, size;
+	readback_t readback;
+
+	if (argc != 3 || (writes = atoi(argv[1])) <= 0 ||
+		(batches = atoi(argv[2])) <= 0) {
+		printf("Usage: %s <writes> <batches>\n", argv[0]);
+		return -1;
+	}
+
+	xmlInitParser();
+
+	if (!(dev = setup_device(writes))) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+
+	printf("%d writes per batch, %d batches\n", writes, batches);
+
+	for (readback = READBACK_FULL; readback <= READBACK_NONE; readback++) {
+		bytes = 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		for (i = 0; i < batches; i++) {
+			if ((size = handle_batch(dev, writes, i, readback)) < 0) {
+				printf("Failed to handle batch %d\n", i);
+				return -1;
+			}
+			bytes += size;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+		if (readback == READBACK_FULL) {
+			base = ns;
+		}
+
+		printf("%-8s %10.1f us/batch %10.0f batches/s %8ld bytes/batch  x%.2f\n",
+			   readback_names[readback], ns / batches / 1e3,
+			   batches * 1e9 / ns, bytes / batches, base / ns);
+	}
+
+	xmlFreeNode(dev);
+	xmlCleanupParser();
+
+	return 0;
+}
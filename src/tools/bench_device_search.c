@@ -0,0 +1,295 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+/*
+ * An instrument to compare the cost of finding the device that hosts
+ * a point href, by the hash table + cache + dirname() approach used
+ * by the Device subsystem before against the prefix tree, with and
+ * without the cache of hosting devices in front of it
+ *
+ * Build below command:
+ *
+ *	$ gcc -O2 -Wall -Werror bench_device_search.c ../libs/hash.c
+ *		  ../libs/cache.c ../libs/radix.c ../libs/tsync.c
+ *		  ../libs/log_utils.c ../libs/obix_utils.c ../libs/xml_utils.c
+ *		  -I../libs/ -I/usr/include/libxml2/
+ *		  -lxml2 -lpthread -o bench_device_search
+ *
+ * Run with following arguments:
+ *
+ *	$ ./bench_device_search <devices> <lookups> <threads>
+ *
+ * Where
+ *	<devices>: the number of BCM devices registered under each of
+ *			   the 8 data halls
+ *	<lookups>: the number of point hrefs looked up by each thread, out
+ *			   of 32 points in each device
+ *	<threads>: the number of threads looking up in parallel
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <time.h>
+#include "xml_utils.h"
+#include "hash.h"
+#include "cache.h"
+#include "radix.h"
+
+#define DEVICE_ROOT		"/obix/deviceRoot/"
+#define HALLS			8
+#define TABLE_SIZE		1024
+#define CACHE_SIZE		4
+#define HOST_CACHE_SIZE	2048
+
+typedef struct device {
+	unsigned char href[64];
+} device_t;
+
+static device_t *devices;
+static int num_devices;
+
+static hash_table_t *tab;
+static cache_t *cache;
+static cache_t *host_cache;
+static radix_tree_t *tree;
+
+static unsigned int device_compute_hash(const unsigned char *href,
+										const unsigned int size)
+{
+	int len = strlen((const char *)href), root_len = strlen(DEVICE_ROOT);
+
+	if (strncmp((const char *)href, DEVICE_ROOT, root_len) == 0 &&
+		len > root_len) {
+		href += root_len;
+		len -= root_len;
+	}
+
+	return hash_bkdr(href, len, size);
+}
+
+static int device_compare_str(const unsigned char *href, hash_node_t *node)
+{
+	return is_str_identical(href, ((device_t *)node->item)->href, 1);
+}
+
+static void device_get(void *dev)
+{
+	/* No reference count to maintain */
+}
+
+static hash_table_ops_t device_hash_ops = {
+	.compute = device_compute_hash,
+	.compare = device_compare_str,
+	.get = device_get
+};
+
+/*
+ * The same as device_search() and device_search_parent() of
+ * the Device subsystem before the prefix tree is adopted
+ */
+static device_t *hash_device_search(const unsigned char *href)
+{
+	device_t *dev;
+	unsigned long gen;
+
+	if (!(dev = (device_t *)cache_search(cache, href, device_get))) {
+		gen = cache_get_gen(cache);
+		if ((dev = (device_t *)hash_search(tab, href)) != NULL) {
+			cache_update(cache, dev->href, dev, gen);
+		}
+	}
+
+	return dev;
+}
+
+static device_t *hash_device_search_host(const unsigned char *href)
+{
+	device_t *dev;
+	char *parent;
+
+	if ((dev = hash_device_search(href)) != NULL) {
+		return dev;
+	}
+
+	if (!(parent = strdup((const char *)href)) ||
+		!(parent = dirname(parent))) {
+		return NULL;
+	}
+
+	while (!(dev = hash_device_search((unsigned char *)parent))) {
+		if (strcmp(parent, "/") == 0 || !(parent = dirname(parent))) {
+			break;
+		}
+	}
+
+	free(parent);
+	return dev;
+}
+
+static device_t *radix_device_search_host(const unsigned char *href)
+{
+	return (device_t *)radix_match(tree, href, RADIX_MATCH_LONGEST);
+}
+
+/*
+ * The same as device_search_host() of the Device subsystem, where
+ * point hrefs are cached along with their hosting devices
+ */
+static device_t *radix_cache_device_search_host(const unsigned char *href)
+{
+	device_t *dev;
+	unsigned long gen;
+
+	if (!(dev = (device_t *)cache_search(host_cache, href, device_get))) {
+		gen = cache_get_gen(host_cache);
+		if ((dev = radix_device_search_host(href)) != NULL) {
+			cache_update(host_cache, href, dev, gen);
+		}
+	}
+
+	return dev;
+}
+
+typedef device_t *(*search_t)(const unsigned char *);
+
+typedef struct worker {
+	pthread_t id;
+	search_t search;
+	int lookups;
+	unsigned int seed;
+	int errors;
+} worker_t;
+
+static void *worker_task(void *arg)
+{
+	worker_t *w = (worker_t *)arg;
+	unsigned char href[128];
+	device_t *dev, *expected;
+	int i;
+
+	for (i = 0; i < w->lookups; i++) {
+		expected = &devices[rand_r(&w->seed) % num_devices];
+
+		sprintf((char *)href, "%s4BEMS/Meter%02d/kWh", expected->href,
+				rand_r(&w->seed) % 32);
+
+		if ((dev = w->search(href)) != expected) {
+			w->errors++;
+		}
+	}
+
+	return NULL;
+}
+
+static double run(const char *name, search_t search, int threads, int lookups)
+{
+	worker_t *workers;
+	struct timespec start, end;
+	double ns;
+	int i, errors = 0;
+
+	if (!(workers = (worker_t *)calloc(threads, sizeof(worker_t)))) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < threads; i++) {
+		workers[i].search = search;
+		workers[i].lookups = lookups;
+		workers[i].seed = i + 1;
+		pthread_create(&workers[i].id, NULL, worker_task, &workers[i]);
+	}
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].id, NULL);
+		errors += workers[i].errors;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	printf("%-12s %10.1f ns/lookup %12.0f lookups/s  %d mismatches\n",
+		   name, ns / lookups,
+		   (double)lookups * threads * 1e9 / ns, errors);
+
+	free(workers);
+	return ns;
+}
+
+int main(int argc, char *argv[])
+{
+	int per_hall, lookups, threads, i;
+
+	if (argc != 4 || (per_hall = atoi(argv[1])) <= 0 ||
+		(lookups = atoi(argv[2])) <= 0 || (threads = atoi(argv[3])) <= 0) {
+		printf("Usage: %s <devices> <lookups> <threads>\n", argv[0]);
+		return -1;
+	}
+
+	/* Data halls are devices as well, followed by BCMs in them */
+	num_devices = HALLS + HALLS * per_hall;
+
+	if (!(devices = (device_t *)calloc(num_devices, sizeof(device_t))) ||
+		!(tab = hash_init_table(TABLE_SIZE, &device_hash_ops)) ||
+		!(cache = cache_init(CACHE_SIZE)) ||
+		!(host_cache = cache_init(HOST_CACHE_SIZE)) ||
+		!(tree = radix_init(device_get))) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		if (i < HALLS) {
+			sprintf((char *)devices[i].href, DEVICE_ROOT "M1/DH%d/", i);
+		} else {
+			sprintf((char *)devices[i].href, DEVICE_ROOT "M1/DH%d/BCM%03d/",
+					(i - HALLS) % HALLS, (i - HALLS) / HALLS);
+		}
+
+		if (hash_add(tab, devices[i].href, &devices[i]) != 0 ||
+			radix_add(tree, devices[i].href, &devices[i]) != 0) {
+			printf("Failed to register %s\n", devices[i].href);
+			return -1;
+		}
+	}
+
+	printf("%d devices, %d threads, %d lookups per thread\n",
+		   num_devices, threads, lookups);
+
+	run("hash+cache", hash_device_search_host, threads, lookups);
+	run("radix", radix_device_search_host, threads, lookups);
+	run("radix+cache", radix_cache_device_search_host, threads, lookups);
+
+	printf("host cache: %ld hit, %ld miss\n",
+		   cache_get_hit(host_cache), cache_get_miss(host_cache));
+
+	radix_dispose(tree);
+	cache_dispose(host_cache);
+	cache_dispose(cache);
+	hash_destroy_table(tab);
+	free(devices);
+
+	return 0;
+}
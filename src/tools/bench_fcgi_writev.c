@@ -0,0 +1,282 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+/*
+ * An instrument to compare the throughput of sending a large response,
+ * such as the result of a history query that consists of hundreds of
+ * response items, through the FCGX stream as done by the oBIX server
+ * before against building FCGI STDOUT records and sending them along
+ * with response items by writev()
+ *
+ * The FCGX stream is emulated the same way as FCGX_FPrintF(out, "%s")
+ * works: the length of each item is counted by strlen() and its body
+ * is copied into an 8KB buffer, which is written as one FCGI record
+ * once full. The other end of the connection is a thread reading and
+ * discarding everything
+ *
+ * Build below command:
+ *
+ *	$ gcc -O2 -Wall -Werror bench_fcgi_writev.c -lpthread
+ *		  -o bench_fcgi_writev
+ *
+ * Run with following arguments:
+ *
+ *	$ ./bench_fcgi_writev <items> <size> <rounds>
+ *
+ * Where
+ *	<items>: the number of response items in each response
+ *	<size>: the size in bytes of each response item
+ *	<rounds>: the number of responses sent by each method
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define FCGI_HEADER_LEN		8
+#define FCGI_MAX_LENGTH		0xffff
+#define FCGI_STDOUT			6
+
+/* The same as the buffer of the FCGX STDOUT stream */
+#define STREAM_BUF_SIZE		8192
+
+/* The same as FCGI_RECORDS_MAX of the oBIX server */
+#define RECORDS_MAX			256
+
+#define READ_BUF_SIZE		(256 * 1024)
+
+typedef struct item {
+	char *body;
+	int len;
+} item_t;
+
+static item_t *items;
+static int num_items;
+
+static void stdout_header(unsigned char *header, int len)
+{
+	header[0] = 1;
+	header[1] = FCGI_STDOUT;
+	header[2] = 0;
+	header[3] = 1;
+	header[4] = (len >> 8) & 0xff;
+	header[5] = len & 0xff;
+	header[6] = 0;
+	header[7] = 0;
+}
+
+static int write_all(int fd, struct iovec *iov, int count)
+{
+	ssize_t n;
+
+	while (count > 0) {
+		if ((n = writev(fd, iov, count)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return -1;
+		}
+
+		while (count > 0 && n >= (ssize_t)iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+static int stream_flush(int fd, unsigned char *buf, int len)
+{
+	struct iovec iov;
+
+	stdout_header(buf, len);
+
+	iov.iov_base = buf;
+	iov.iov_len = FCGI_HEADER_LEN + len;
+
+	return write_all(fd, &iov, 1);
+}
+
+static int send_stream(int fd)
+{
+	unsigned char buf[STREAM_BUF_SIZE];
+	int room = STREAM_BUF_SIZE - FCGI_HEADER_LEN;
+	int i, len, n, used = 0;
+	const char *body;
+
+	for (i = 0; i < num_items; i++) {
+		body = items[i].body;
+		len = strlen(body);
+
+		while (len > 0) {
+			n = (len > room - used) ? room - used : len;
+			memcpy(buf + FCGI_HEADER_LEN + used, body, n);
+			used += n;
+			body += n;
+			len -= n;
+
+			if (used == room) {
+				if (stream_flush(fd, buf, used) < 0) {
+					return -1;
+				}
+				used = 0;
+			}
+		}
+	}
+
+	return (used > 0) ? stream_flush(fd, buf, used) : 0;
+}
+
+static int send_writev(int fd)
+{
+	unsigned char headers[RECORDS_MAX][FCGI_HEADER_LEN];
+	struct iovec iov[RECORDS_MAX * 2];
+	const char *body;
+	int i, len, n, count = 0;
+
+	for (i = 0; i < num_items; i++) {
+		for (body = items[i].body, len = items[i].len; len > 0;
+			 body += n, len -= n) {
+			if (count == RECORDS_MAX) {
+				if (write_all(fd, iov, count * 2) < 0) {
+					return -1;
+				}
+				count = 0;
+			}
+
+			n = (len > FCGI_MAX_LENGTH) ? FCGI_MAX_LENGTH : len;
+
+			stdout_header(headers[count], n);
+
+			iov[count * 2].iov_base = headers[count];
+			iov[count * 2].iov_len = FCGI_HEADER_LEN;
+			iov[count * 2 + 1].iov_base = (void *)body;
+			iov[count * 2 + 1].iov_len = n;
+			count++;
+		}
+	}
+
+	return (count > 0) ? write_all(fd, iov, count * 2) : 0;
+}
+
+static void *reader_task(void *arg)
+{
+	int fd = *(int *)arg;
+	char *buf;
+
+	if (!(buf = (char *)malloc(READ_BUF_SIZE))) {
+		return NULL;
+	}
+
+	while (read(fd, buf, READ_BUF_SIZE) > 0);	/* do nothing */
+
+	free(buf);
+	return NULL;
+}
+
+static void run(const char *name, int (*send)(int), int rounds)
+{
+	struct timespec start, end;
+	pthread_t reader;
+	int fds[2], i;
+	double sec, bytes;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		printf("Failed to create socket pair\n");
+		return;
+	}
+
+	pthread_create(&reader, NULL, reader_task, &fds[1]);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < rounds; i++) {
+		if (send(fds[0]) < 0) {
+			printf("Failed to send response\n");
+			break;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	close(fds[0]);
+	pthread_join(reader, NULL);
+	close(fds[1]);
+
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	bytes = (double)items[0].len * num_items * i;
+
+	printf("%-8s %10.1f MB/s %10.1f responses/s\n",
+		   name, bytes / sec / (1024 * 1024), i / sec);
+}
+
+int main(int argc, char *argv[])
+{
+	int size, rounds, i;
+
+	if (argc != 4 || (num_items = atoi(argv[1])) <= 0 ||
+		(size = atoi(argv[2])) <= 0 || (rounds = atoi(argv[3])) <= 0) {
+		printf("Usage: %s <items> <size> <rounds>\n", argv[0]);
+		return -1;
+	}
+
+	if (!(items = (item_t *)calloc(num_items, sizeof(item_t)))) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+
+	/* Printable characters only, as history records are */
+	for (i = 0; i < num_items; i++) {
+		if (!(items[i].body = (char *)malloc(size + 1))) {
+			printf("Failed to allocate memory\n");
+			return -1;
+		}
+
+		memset(items[i].body, 'x', size);
+		items[i].body[size] = '\0';
+		items[i].len = size;
+	}
+
+	printf("%d items of %d bytes, %d responses\n", num_items, size, rounds);
+
+	run("stream", send_stream, rounds);
+	run("writev", send_writev, rounds);
+
+	for (i = 0; i < num_items; i++) {
+		free(items[i].body);
+	}
+	free(items);
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+
+/*
+ * An instrument to measure the contention on malloc() among a number
+ * of server threads handling requests, when strings needed until a
+ * request is answered are allocated one by one and released piecemeal
+ * as done by the oBIX server before, against being allocated from the
+ * arena of the request and released in one go
+ *
+ * Every request allocates a number of strings of 16 to 128 bytes, along
+ * with the request descriptor itself that embeds a 512 bytes buffer for
+ * the arena. An oBIX request allocates about 3 of them, that is, the
+ * decoded URI, the requester ID and sometimes the Content-Location href,
+ * which is the default. DOM copies read by GET requests take many more
+ * blocks, but they are not measured here
+ *
+ * Build below command:
+ *
+ *	$ gcc -O2 -Wall -Werror bench_request_arena.c ../libs/arena.c
+ *		  -I../libs/ -lpthread -o bench_request_arena
+ *
+ * Run with following arguments:
+ *
+ *	$ ./bench_request_arena <threads> <requests> [strings]
+ *
+ * Where
+ *	<threads>: the number of server threads, e.g. 24
+ *	<requests>: the number of requests handled by each thread
+ *	[strings]: the number of strings allocated by each request, 3 by
+ *			   default
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "arena.h"
+
+#define ARENA_SIZE			512
+#define CHUNK_SIZE			4096
+#define STRINGS_MAX			1024
+
+/* The number of strings allocated by an oBIX request */
+#define STRINGS_DEF			3
+
+typedef struct request {
+	arena_t arena;
+	char arena_buf[ARENA_SIZE] __attribute__((aligned(ARENA_ALIGN)));
+	char *strs[STRINGS_MAX];
+} request_t;
+
+typedef struct worker {
+	pthread_t id;
+	int use_arena;
+	int requests;
+	int strings;
+	unsigned int seed;
+	int errors;
+} worker_t;
+
+static const char *TEMPLATE =
+"/obix/deviceRoot/M1/DH1/BCM01/CB01/kWh/obix/deviceRoot/M1/DH1/BCM01/CB02/kWh"
+"/obix/deviceRoot/M1/DH1/BCM01/CB03/kWh";
+
+static char *dup_len(request_t *req, int use_arena, int len)
+{
+	char *s;
+
+	s = (use_arena == 1) ? (char *)arena_alloc(&req->arena, len + 1) :
+						   (char *)malloc(len + 1);
+	if (s) {
+		memcpy(s, TEMPLATE, len);
+		s[len] = '\0';
+	}
+
+	return s;
+}
+
+static void *worker_task(void *arg)
+{
+	worker_t *w = (worker_t *)arg;
+	request_t *req;
+	int i, j;
+
+	for (i = 0; i < w->requests; i++) {
+		if (!(req = (request_t *)malloc(sizeof(request_t)))) {
+			w->errors++;
+			continue;
+		}
+
+		arena_init(&req->arena, req->arena_buf, ARENA_SIZE, CHUNK_SIZE);
+
+		for (j = 0; j < w->strings; j++) {
+			if (!(req->strs[j] = dup_len(req, w->use_arena,
+										 16 + rand_r(&w->seed) % 113))) {
+				w->errors++;
+			}
+		}
+
+		if (w->use_arena == 1) {
+			arena_reset(&req->arena);
+		} else {
+			for (j = 0; j < w->strings; j++) {
+				free(req->strs[j]);
+			}
+		}
+
+		free(req);
+	}
+
+	return NULL;
+}
+
+static void run(const char *name, int use_arena, int threads, int requests,
+				int strings)
+{
+	worker_t *workers;
+	struct timespec start, end;
+	double ns;
+	int i, errors = 0;
+
+	if (!(workers = (worker_t *)calloc(threads, sizeof(worker_t)))) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < threads; i++) {
+		workers[i].use_arena = use_arena;
+		workers[i].requests = requests;
+		workers[i].strings = strings;
+		workers[i].seed = i + 1;
+		pthread_create(&workers[i].id, NULL, worker_task, &workers[i]);
+	}
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].id, NULL);
+		errors += workers[i].errors;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	printf("%-8s %10.1f ns/request %12.0f requests/s  %d errors\n",
+		   name, ns / requests,
+		   (double)requests * threads * 1e9 / ns, errors);
+
+	free(workers);
+}
+
+int main(int argc, char *argv[])
+{
+	int threads, requests, strings = STRINGS_DEF;
+
+	if (argc < 3 || argc > 4 || (threads = atoi(argv[1])) <= 0 ||
+		(requests = atoi(argv[2])) <= 0 ||
+		(argc == 4 && ((strings = atoi(argv[3])) <= 0 ||
+					   strings > STRINGS_MAX))) {
+		printf("Usage: %s <threads> <requests> [strings]\n", argv[0]);
+		return -1;
+	}
+
+	printf("%d threads, %d requests per thread, %d strings per request\n",
+		   threads, requests, strings);
+
+	run("malloc", 0, threads, requests, strings);
+	run("arena", 1, threads, requests, strings);
+
+	return 0;
+}
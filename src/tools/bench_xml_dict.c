@@ -0,0 +1,259 @@
+/* *****************************************************************************
+ * Copyright (c) 2013-2015 Qingtao Cao
+ *
+ * This file is part of oBIX.
+ *
+ * oBIX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * oBIX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with oBIX. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * *****************************************************************************/
+
+/*
+ * An instrument to compare the memory footprint of a large device
+ * database, where device contracts are parsed without dictionary and
+ * inserted into the global DOM tree as done by the oBIX server before,
+ * against having their strings interned into the dictionary of the
+ * global DOM tree the same way as xmldb_add_child() does
+ *
+ * The time to copy device contracts out of the global DOM tree, as done
+ * for every read request, is measured as well. Each method is run in a
+ * child process of its own so that their RSS won't interfere
+ *
+ * Build below command:
+ *
+ *	$ gcc -O2 -Wall -Werror bench_xml_dict.c -I/usr/include/libxml2/
+ *		  -lxml2 -o bench_xml_dict
+ *
+ * Run with following arguments:
+ *
+ *	$ ./bench_xml_dict <devices> <points> <copies>
+ *
+ * Where
+ *	<devices>: the number of device contracts in the global DOM tree
+ *	<points>: the number of points in each device contract
+ *	<copies>: the number of device contracts copied for timing
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <libxml/tree.h>
+#include <libxml/parser.h>
+
+#define PARSE_OPTIONS	(XML_PARSE_NONET | XML_PARSE_NOBLANKS | XML_PARSE_NODICT)
+
+static const char *POINT =
+"<real name=\"Point%02d\" href=\"Point%02d\" val=\"%d.5\" "
+"unit=\"obix:units/kilowatt_hour\" displayName=\"Energy meter reading\" "
+"is=\"obix:Point\" writable=\"true\"/>\n";
+
+static char *contract;
+static int num_devices;
+static int num_copies;
+
+static long get_rss(void)
+{
+	FILE *fp;
+	long size, rss = 0;
+
+	if ((fp = fopen("/proc/self/statm", "r")) != NULL) {
+		if (fscanf(fp, "%ld %ld", &size, &rss) != 2) {
+			rss = 0;
+		}
+		fclose(fp);
+	}
+
+	return rss * sysconf(_SC_PAGESIZE);
+}
+
+static char *build_contract(int points)
+{
+	char *buf, *p;
+	int i;
+
+	if (!(buf = (char *)malloc(512 + points * 256))) {
+		return NULL;
+	}
+
+	p = buf + sprintf(buf, "<obj is=\"obix:BCM\" href=\"/obix/deviceRoot/BCM/\">\n"
+					  "<str name=\"Model\" href=\"Model\" val=\"BCM\"/>\n");
+
+	for (i = 0; i < points; i++) {
+		p += sprintf(p, POINT, i, i, i);
+	}
+
+	strcpy(p, "</obj>\n");
+
+	return buf;
+}
+
+/*
+ * The same as xmldb_dict_intern_str() and xmldb_dict_intern()
+ */
+static void intern_str(xmlDict *dict, const xmlChar **str)
+{
+	const xmlChar *interned;
+
+	if (*str && (interned = xmlDictLookup(dict, *str, -1)) != NULL &&
+		interned != *str) {
+		xmlFree((xmlChar *)*str);
+		*str = interned;
+	}
+}
+
+static void intern(xmlDict *dict, xmlNode *node)
+{
+	xmlAttr *attr;
+	xmlNode *child;
+
+	if (node->type != XML_ELEMENT_NODE) {
+		return;
+	}
+
+	intern_str(dict, &node->name);
+
+	for (attr = node->properties; attr; attr = attr->next) {
+		intern_str(dict, &attr->name);
+
+		if (xmlStrcmp(attr->name, BAD_CAST "val") == 0 ||
+			!(child = attr->children) || child->next ||
+			child->type != XML_TEXT_NODE) {
+			continue;
+		}
+
+		intern_str(dict, (const xmlChar **)&child->content);
+	}
+
+	for (child = node->children; child; child = child->next) {
+		intern(dict, child);
+	}
+}
+
+static void run(const char *name, int use_dict)
+{
+	struct timespec start, end;
+	xmlDoc *storage, *doc;
+	xmlNode *root, *node, *copy;
+	long rss;
+	double ns;
+	int i;
+
+	rss = get_rss();
+
+	if (!(storage = xmlNewDoc(BAD_CAST "1.0")) ||
+		!(root = xmlNewNode(NULL, BAD_CAST "obj"))) {
+		printf("Failed to allocate memory\n");
+		return;
+	}
+
+	xmlDocSetRootElement(storage, root);
+
+	if (use_dict == 1 && !(storage->dict = xmlDictCreate())) {
+		printf("Failed to allocate memory\n");
+		return;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		if (!(doc = xmlReadMemory(contract, strlen(contract), NULL, NULL,
+								  PARSE_OPTIONS))) {
+			printf("Failed to parse device contract\n");
+			return;
+		}
+
+		node = xmlDocGetRootElement(doc);
+		xmlUnlinkNode(node);
+		xmlFreeDoc(doc);
+
+		if (use_dict == 1) {
+			xmlSetTreeDoc(node, storage);
+			intern(storage->dict, node);
+		}
+
+		xmlAddChild(root, node);
+	}
+
+	rss = get_rss() - rss;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0, node = root->children; i < num_copies; i++) {
+		if (!(copy = xmlCopyNode(node, 1))) {
+			printf("Failed to copy device contract\n");
+			return;
+		}
+
+		xmlFreeNode(copy);
+
+		if (!(node = node->next)) {
+			node = root->children;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	printf("%-8s %10.1f MB RSS %10.1f bytes/device %10.0f ns/copy\n",
+		   name, rss / (1024.0 * 1024), (double)rss / num_devices,
+		   ns / num_copies);
+
+	xmlFreeDoc(storage);
+}
+
+static void run_child(const char *name, int use_dict)
+{
+	pid_t pid;
+
+	fflush(stdout);
+
+	if ((pid = fork()) == 0) {
+		run(name, use_dict);
+		exit(0);
+	}
+
+	if (pid > 0) {
+		waitpid(pid, NULL, 0);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int points;
+
+	if (argc != 4 || (num_devices = atoi(argv[1])) <= 0 ||
+		(points = atoi(argv[2])) <= 0 || (num_copies = atoi(argv[3])) <= 0) {
+		printf("Usage: %s <devices> <points> <copies>\n", argv[0]);
+		return -1;
+	}
+
+	xmlInitParser();
+
+	if (!(contract = build_contract(points))) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+
+	printf("%d devices of %d points, %d copies\n",
+		   num_devices, points, num_copies);
+
+	run_child("nodict", 0);
+	run_child("dict", 1);
+
+	free(contract);
+	xmlCleanupParser();
+
+	return 0;
+}